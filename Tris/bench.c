@@ -0,0 +1,675 @@
+// Microbenchmark del motore di gioco (tris_game.c) e dei gestori dei comandi del server.
+// Il server viene incluso come unità di traduzione: i gestori e le funzioni statiche (init_shard, ...) sono
+// raggiungibili senza esporli nel server, e il suo main diventa server_main. I socket dei client sono
+// descrittori di /dev/null: gli handler accodano le risposte e la writev() di fine giro non tocca la rete.
+#define main server_main
+#include "server.c"
+#undef main
+
+#include <stdarg.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_GAMES 20000       // Partite casuali del corpus classico (-g); quello 15x15 ne ha 1/40
+#define DEFAULT_REPEATS 5         // Ripetizioni di ogni misura (-r): si riporta la più veloce
+#define DEFAULT_STREAM_PAIRS 256  // Coppie di client del flusso di comandi predefinito (-p)
+#define BENCH_MAX_CLIENTS 4096    // Client distinti di un flusso di comandi
+#define BENCH_LINE_MAX 256        // Lunghezza massima di una riga del flusso (come MAX_LINE_LENGTH)
+#define BENCH_RATINGS 1024        // Giocatori registrati disponibili per i comandi "login" del flusso
+
+// --- Conteggio delle allocazioni ---
+// Il target si linka con -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc: ogni chiamata
+// del server e dei moduli passa da qui. Le allocazioni di libc al proprio interno non sono contate.
+
+static uint64_t bench_allocations; // malloc, calloc e realloc eseguite
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    bench_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    bench_allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    bench_allocations++;
+    return __real_realloc(ptr, size);
+}
+
+// --- Contatori hardware (perf_event) ---
+
+// Gruppo di contatori del processo: cache miss (leader) e istruzioni, solo in spazio utente.
+// Se il kernel li nega (perf_event_paranoid, container, macchina virtuale) il report scrive "n/d".
+static int perf_group_fd = -1;
+static int perf_instr_fd = -1;
+
+static int perf_open(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd < 0; // Il gruppo parte e si ferma insieme al leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void perf_init(void) {
+    perf_group_fd = perf_open(PERF_COUNT_HW_CACHE_MISSES, -1);
+    if (perf_group_fd >= 0) {
+        perf_instr_fd = perf_open(PERF_COUNT_HW_INSTRUCTIONS, perf_group_fd);
+    }
+}
+
+// Risultato di una misura
+typedef struct {
+    uint64_t ops;           // Operazioni misurate
+    uint64_t ns;            // Tempo totale
+    uint64_t allocations;   // Allocazioni durante la misura
+    uint64_t cache_misses;  // Cache miss (se perf è disponibile)
+    uint64_t instructions;  // Istruzioni (se perf è disponibile e il gruppo ha accettato il contatore)
+    bool perf;              // Contatori hardware validi
+} Measure;
+
+static uint64_t measure_started_ns;
+static uint64_t measure_started_allocations;
+
+static void measure_begin(void) {
+    if (perf_group_fd >= 0) {
+        ioctl(perf_group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    measure_started_allocations = bench_allocations;
+    measure_started_ns = metrics_clock_ns();
+}
+
+static void measure_end(Measure *m, uint64_t ops) {
+    uint64_t now_ns = metrics_clock_ns();
+    m->ops = ops;
+    m->ns = now_ns - measure_started_ns;
+    m->allocations = bench_allocations - measure_started_allocations;
+    m->cache_misses = 0;
+    m->instructions = 0;
+    m->perf = false;
+    if (perf_group_fd >= 0) {
+        ioctl(perf_group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t values[3] = { 0, 0, 0 }; // Numero di contatori, poi i valori nell'ordine del gruppo
+        if (read(perf_group_fd, values, sizeof(values)) >= (ssize_t)(2 * sizeof(uint64_t))) {
+            m->perf = true;
+            m->cache_misses = values[1];
+            m->instructions = values[0] > 1 ? values[2] : 0;
+        }
+    }
+}
+
+// --- Report ---
+
+static FILE *report; // Copia di stdout: lo stdout vero va in /dev/null per nascondere i messaggi del server
+
+static void report_header(const char *title) {
+    fprintf(report, "\n%s\n", title);
+    fprintf(report, "  %-22s %10s %10s %10s %10s %10s\n", "misura", "op", "ns/op", "alloc/op", "miss/op", "istr/op");
+}
+
+static void report_row(const char *name, const Measure *m) {
+    double ops = m->ops > 0 ? (double)m->ops : 1.0;
+    char misses[16], instructions[16];
+    if (m->perf) {
+        snprintf(misses, sizeof(misses), "%.3f", (double)m->cache_misses / ops);
+    } else {
+        snprintf(misses, sizeof(misses), "n/d");
+    }
+    if (m->perf && m->instructions > 0) {
+        snprintf(instructions, sizeof(instructions), "%.1f", (double)m->instructions / ops);
+    } else {
+        snprintf(instructions, sizeof(instructions), "n/d");
+    }
+    fprintf(report, "  %-22s %10llu %10.1f %10.3f %10s %10s\n", name, (unsigned long long)m->ops,
+            (double)m->ns / ops, (double)m->allocations / ops, misses, instructions);
+}
+
+// --- Corpus di partite casuali ---
+
+static uint32_t bench_rng = 2463534242u; // Seme fisso (-s): corpus identici tra un'esecuzione e l'altra
+
+static uint32_t next_random(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 17;
+    bench_rng ^= bench_rng << 5;
+    return bench_rng;
+}
+
+// Partite giocate a caso fino alla fine, e tutte le posizioni intermedie
+typedef struct {
+    const char *name;
+    int rows, cols, k;
+    int games;
+    uint32_t *offsets;      // Prima mossa di ogni partita in moves (games + 1 voci)
+    uint16_t *moves;        // Celle giocate, partita dopo partita
+    TrisGame *positions;    // Posizione dopo ogni mossa
+    size_t num_positions;   // Uguale al numero totale di mosse
+} Corpus;
+
+static void init_corpus_game(const Corpus *corpus, TrisGame *game) {
+    if (corpus->rows == SIZE && corpus->cols == SIZE && corpus->k == SIZE) {
+        init_game(game);
+    } else {
+        init_game_variant(game, corpus->rows, corpus->cols, corpus->k);
+    }
+}
+
+static bool build_corpus(Corpus *corpus) {
+    int cells = corpus->rows * corpus->cols;
+    size_t capacity = (size_t)corpus->games * (size_t)cells;
+    corpus->offsets = malloc(((size_t)corpus->games + 1) * sizeof(uint32_t));
+    corpus->moves = malloc(capacity * sizeof(uint16_t));
+    corpus->positions = malloc(capacity * sizeof(TrisGame));
+    if (!corpus->offsets || !corpus->moves || !corpus->positions) {
+        return false;
+    }
+
+    uint16_t order[MAX_CELLS];
+    size_t count = 0;
+    for (int g = 0; g < corpus->games; g++) {
+        corpus->offsets[g] = (uint32_t)count;
+        for (int c = 0; c < cells; c++) {
+            order[c] = (uint16_t)c;
+        }
+        // Fisher-Yates: ogni partita gioca le celle in un ordine casuale finché qualcuno vince o il tabellone è pieno
+        for (int c = cells - 1; c > 0; c--) {
+            int j = (int)(next_random() % (uint32_t)(c + 1));
+            uint16_t swap = order[c];
+            order[c] = order[j];
+            order[j] = swap;
+        }
+        TrisGame game;
+        init_corpus_game(corpus, &game);
+        for (int c = 0; c < cells; c++) {
+            make_move_index(&game, order[c]);
+            corpus->moves[count] = order[c];
+            corpus->positions[count] = game;
+            count++;
+            if (check_winner(&game) != IN_PROGRESS) {
+                break;
+            }
+        }
+    }
+    corpus->offsets[corpus->games] = (uint32_t)count;
+    corpus->num_positions = count;
+    return true;
+}
+
+static void free_corpus(Corpus *corpus) {
+    free(corpus->offsets);
+    free(corpus->moves);
+    free(corpus->positions);
+}
+
+static volatile uint64_t bench_sink; // Impedisce al compilatore di scartare i risultati
+
+static void bench_init_game(const Corpus *corpus, TrisGame *scratch, Measure *m) {
+    uint64_t sum = 0;
+    measure_begin();
+    for (int g = 0; g < corpus->games; g++) {
+        init_corpus_game(corpus, &scratch[g]);
+        sum += scratch[g].rows;
+    }
+    measure_end(m, (uint64_t)corpus->games);
+    bench_sink += sum;
+}
+
+static void bench_make_move(const Corpus *corpus, TrisGame *scratch, Measure *m) {
+    uint64_t sum = 0;
+    for (int g = 0; g < corpus->games; g++) {
+        init_corpus_game(corpus, &scratch[g]); // Fuori dalla misura: conta solo il costo delle mosse
+    }
+    measure_begin();
+    for (int g = 0; g < corpus->games; g++) {
+        TrisGame *game = &scratch[g];
+        for (uint32_t i = corpus->offsets[g]; i < corpus->offsets[g + 1]; i++) {
+            int cell = corpus->moves[i];
+            sum += (uint64_t)make_move(game, cell / corpus->cols, cell % corpus->cols);
+        }
+    }
+    measure_end(m, corpus->num_positions);
+    bench_sink += sum;
+}
+
+static void bench_check_winner(const Corpus *corpus, Measure *m) {
+    uint64_t sum = 0;
+    measure_begin();
+    for (size_t i = 0; i < corpus->num_positions; i++) {
+        sum += (uint64_t)check_winner(&corpus->positions[i]);
+    }
+    measure_end(m, corpus->num_positions);
+    bench_sink += sum;
+}
+
+static void bench_print_board(const Corpus *corpus, Measure *m) {
+    static char board[BOARD_TEXT_SIZE];
+    uint64_t sum = 0;
+    measure_begin();
+    for (size_t i = 0; i < corpus->num_positions; i++) {
+        print_board(&corpus->positions[i], board);
+        sum += (uint8_t)board[0];
+    }
+    measure_end(m, corpus->num_positions);
+    bench_sink += sum;
+}
+
+// Ripete una misura e tiene la più veloce: le altre contengono rumore (interruzioni, frequenza della CPU)
+#define BEST_OF(repeats, best, call) do { \
+        for (int rep_ = 0; rep_ < (repeats); rep_++) { \
+            Measure run_; \
+            Measure *m = &run_; \
+            call; \
+            if (rep_ == 0 || run_.ns < (best).ns) { \
+                (best) = run_; \
+            } \
+        } \
+    } while (0)
+
+static void run_engine_benchmarks(Corpus *corpus, int repeats) {
+    TrisGame *scratch = malloc((size_t)corpus->games * sizeof(TrisGame));
+    if (!scratch) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    char title[128];
+    snprintf(title, sizeof(title), "Motore di gioco, %s: %d partite casuali, %zu posizioni", corpus->name, corpus->games, corpus->num_positions);
+    report_header(title);
+
+    Measure best;
+    BEST_OF(repeats, best, bench_init_game(corpus, scratch, m));
+    report_row("init_game", &best);
+    BEST_OF(repeats, best, bench_make_move(corpus, scratch, m));
+    report_row("make_move", &best);
+    BEST_OF(repeats, best, bench_check_winner(corpus, m));
+    report_row("check_winner", &best);
+    BEST_OF(repeats, best, bench_print_board(corpus, m));
+    report_row("print_board", &best);
+    free(scratch);
+}
+
+// --- Flussi di comandi ---
+
+// Un comando del flusso: il client che lo invia e il testo, in cui "@n" sta per la partita del client n
+typedef struct {
+    int client;
+    char text[BENCH_LINE_MAX];
+} StreamCommand;
+
+typedef struct {
+    StreamCommand *commands;
+    size_t count;
+    size_t capacity;
+    int num_clients;        // Indice massimo dei client usati + 1
+} CommandStream;
+
+static void stream_add(CommandStream *stream, int client, const char *format, ...) {
+    if (stream->count == stream->capacity) {
+        size_t new_capacity = stream->capacity > 0 ? stream->capacity * 2 : 1024;
+        StreamCommand *grown = realloc(stream->commands, new_capacity * sizeof(StreamCommand));
+        if (!grown) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        stream->commands = grown;
+        stream->capacity = new_capacity;
+    }
+    StreamCommand *cmd = &stream->commands[stream->count++];
+    cmd->client = client;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(cmd->text, sizeof(cmd->text), format, args);
+    va_end(args);
+    if (client >= stream->num_clients) {
+        stream->num_clients = client + 1;
+    }
+}
+
+// Mosse di un round scritto: celle (riga * 3 + colonna) a turno, a partire da chi muove per primo
+static const uint8_t win_script[] = { 0, 4, 1, 8, 2 };            // Il primo vince sulla riga in alto
+static const uint8_t draw_script[] = { 0, 4, 8, 1, 7, 6, 2, 5, 3 }; // Tabellone pieno senza tris
+
+static void add_round(CommandStream *stream, int first, int second, const uint8_t *script, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        stream_add(stream, i % 2 == 0 ? first : second, "move %d %d", script[i] / 3, script[i] % 3);
+    }
+}
+
+/**
+ * @brief Costruisce il flusso predefinito: coppie di client che giocano in parallelo, un passo per coppia alla volta,
+ * così che gli handler lavorino su molte partite come in un giro di eventi carico.
+ * Ogni coppia: create, join, accept, vittoria di A; join, accept, pareggio; rematch (inizia B), pareggio;
+ * rematch (inizia di nuovo B, il turno riparte da X), vittoria di B che resta proprietario; list e leave.
+ * @param stream Il flusso da riempire.
+ * @param pairs Numero di coppie.
+ */
+static void build_default_stream(CommandStream *stream, int pairs) {
+    CommandStream script = { 0 };
+    int a = 0, b = 1; // Copione di una coppia con i client 0 e 1, poi replicato con gli indici di ogni coppia
+    stream_add(&script, a, "create");
+    stream_add(&script, b, "join @%d", a);
+    stream_add(&script, a, "accept");
+    add_round(&script, a, b, win_script, sizeof(win_script));
+    stream_add(&script, b, "list");
+    stream_add(&script, b, "join @%d", a);
+    stream_add(&script, a, "accept");
+    add_round(&script, a, b, draw_script, sizeof(draw_script));
+    stream_add(&script, a, "rematch");
+    stream_add(&script, b, "rematch");
+    add_round(&script, b, a, draw_script, sizeof(draw_script));
+    stream_add(&script, b, "rematch");
+    stream_add(&script, a, "rematch");
+    add_round(&script, b, a, win_script, sizeof(win_script));
+    stream_add(&script, a, "list waiting");
+    stream_add(&script, b, "leave");
+
+    for (size_t step = 0; step < script.count; step++) {
+        for (int p = 0; p < pairs; p++) {
+            const StreamCommand *cmd = &script.commands[step];
+            char text[BENCH_LINE_MAX];
+            const char *at = strchr(cmd->text, '@');
+            if (at) {
+                // Il riferimento alla partita punta al client corrispondente della stessa coppia
+                snprintf(text, sizeof(text), "%.*s@%d", (int)(at - cmd->text), cmd->text, 2 * p + atoi(at + 1));
+            } else {
+                snprintf(text, sizeof(text), "%s", cmd->text);
+            }
+            stream_add(stream, 2 * p + cmd->client, "%s", text);
+        }
+    }
+    free(script.commands);
+}
+
+/**
+ * @brief Legge un flusso registrato: una riga per comando, "<client> <comando>", con "@n" al posto dell'ID della
+ * partita in cui si trova il client n al momento del comando. Righe vuote e che iniziano con '#' sono ignorate.
+ * @return true se riuscito.
+ */
+static bool load_stream(CommandStream *stream, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    char line[BENCH_LINE_MAX + 16];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *text = line + strspn(line, " \t");
+        if (*text == '\0' || *text == '#') {
+            continue;
+        }
+        char *end;
+        long client = strtol(text, &end, 10);
+        if (end == text || client < 0 || client >= BENCH_MAX_CLIENTS || (*end != ' ' && *end != '\t')) {
+            fprintf(stderr, "%s:%d: atteso \"<client> <comando>\" con client tra 0 e %d\n", path, line_number, BENCH_MAX_CLIENTS - 1);
+            fclose(file);
+            return false;
+        }
+        stream_add(stream, (int)client, "%s", end + strspn(end, " \t"));
+    }
+    fclose(file);
+    return true;
+}
+
+// Sostituisce "@n" con l'ID della partita del client n (-1 se il client non è in partita o non esiste)
+static void expand_command(const StreamCommand *cmd, const int *fds, int num_clients, char *out, size_t size) {
+    size_t len = 0;
+    for (const char *p = cmd->text; *p && len + 1 < size; p++) {
+        if (*p == '@' && p[1] >= '0' && p[1] <= '9') {
+            char *end;
+            long index = strtol(p + 1, &end, 10);
+            Client *client = index < num_clients ? find_client_by_fd(fds[index]) : NULL;
+            int written = snprintf(out + len, size - len, "%d", client ? client->game_id : -1);
+            len += written > 0 ? (size_t)written : 0;
+            p = end - 1;
+        } else {
+            out[len++] = *p;
+        }
+    }
+    out[len < size ? len : size - 1] = '\0';
+}
+
+// Collega i client del flusso: un descrittore di /dev/null per client, registrato come una connessione accettata
+static void connect_stream_clients(int *fds, int count) {
+    for (int i = 0; i < count; i++) {
+        fds[i] = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (fds[i] < 0 || !initialize_client(fds[i])) {
+            perror("open /dev/null");
+            exit(EXIT_FAILURE);
+        }
+    }
+    flush_dirty_clients(); // Messaggio di benvenuto
+}
+
+static void disconnect_stream_clients(const int *fds, int count) {
+    for (int i = 0; i < count; i++) {
+        if (find_client_by_fd(fds[i])) {
+            remove_client_from_game(fds[i]);
+            remove_client(fds[i]);
+        }
+    }
+    flush_dirty_clients();
+}
+
+// Tempi di un'esecuzione del flusso: gli handler e lo svuotamento di fine giro separati
+typedef struct {
+    Measure handlers;       // handle_client_data
+    Measure flush;          // flush_dirty_clients (writev su /dev/null)
+    uint64_t skipped;       // Comandi di client già disconnessi
+} StreamRun;
+
+static void run_stream_once(const CommandStream *stream, int *fds, StreamRun *run) {
+    char line[BENCH_LINE_MAX + 1];
+    uint64_t handler_ns = 0, handler_allocations = 0, handler_misses = 0, handler_instructions = 0;
+    uint64_t flush_ns = 0, flush_allocations = 0, flush_misses = 0, flush_instructions = 0;
+    uint64_t executed = 0, flushes = 0;
+    bool perf = perf_group_fd >= 0;
+    run->skipped = 0;
+
+    connect_stream_clients(fds, stream->num_clients);
+    for (size_t i = 0; i < stream->count; i++) {
+        const StreamCommand *cmd = &stream->commands[i];
+        if (!find_client_by_fd(fds[cmd->client])) {
+            run->skipped++; // Il client ha chiuso con "quit" o è stato disconnesso
+            continue;
+        }
+        expand_command(cmd, fds, stream->num_clients, line, sizeof(line));
+        current_shard->now_ms = monotonic_ms();
+
+        // Ogni comando è un giro di eventi: handler, commit del journal e dei replay, svuotamento delle code
+        Measure m;
+        measure_begin();
+        handle_client_data(fds[cmd->client], line, (int)strlen(line));
+        measure_end(&m, 1);
+        handler_ns += m.ns;
+        handler_allocations += m.allocations;
+        handler_misses += m.cache_misses;
+        handler_instructions += m.instructions;
+        perf = perf && m.perf;
+        executed++;
+
+        commit_journal();
+        replay_store_commit(&current_shard->replays);
+        measure_begin();
+        flush_dirty_clients();
+        measure_end(&m, 1);
+        flush_ns += m.ns;
+        flush_allocations += m.allocations;
+        flush_misses += m.cache_misses;
+        flush_instructions += m.instructions;
+        flushes++;
+    }
+    disconnect_stream_clients(fds, stream->num_clients);
+
+    run->handlers = (Measure){ executed, handler_ns, handler_allocations, handler_misses, handler_instructions, perf };
+    run->flush = (Measure){ flushes, flush_ns, flush_allocations, flush_misses, flush_instructions, perf };
+}
+
+// Prepara uno shard come quello di un worker a processo singolo, senza listener né journal
+static void init_bench_server(void) {
+    load_config();
+    config.workers = 1;
+    config.threads = 1;
+    config.journal_dir = NULL;
+    config.replay_dir = NULL;
+    config.ratings_file = NULL;
+    config.stats_port = 0;
+    config.io_uring = false; // Gli svuotamenti misurati sono le writev() sincrone del reactor epoll
+    num_shards = 1;
+    max_clients_per_shard = config.max_clients;
+    max_games_per_shard = config.max_games;
+    if (directory_create(&directory, num_shards, max_games_per_shard) < 0 ||
+        ratings_create(&ratings, NULL, BENCH_RATINGS) < 0 ||
+        metrics_create(&metrics, num_shards, monotonic_ms()) < 0 ||
+        search_init(SEARCH_TT_BITS) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    ai_set_search_limits(config.search_ms * 1000, config.search_threads);
+
+    // Socket UNIX dello shard (mai usato con un solo shard) e un eventfd al posto del listener
+    static int ipc_pair[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, ipc_pair) < 0) {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+    ipc_recv_fds = &ipc_pair[0];
+    ipc_send_fds = &ipc_pair[1];
+    listen_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shards = calloc(1, sizeof(Shard));
+    if (listen_fd < 0 || !shards) {
+        perror("eventfd/calloc");
+        exit(EXIT_FAILURE);
+    }
+    init_shard(&shards[0], 0);
+    current_shard = &shards[0];
+}
+
+static void run_stream_benchmark(const CommandStream *stream, const char *name, int repeats) {
+    int *fds = malloc((size_t)stream->num_clients * sizeof(int));
+    if (!fds) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    char title[256];
+    snprintf(title, sizeof(title), "Comandi, %s: %zu comandi di %d client", name, stream->count, stream->num_clients);
+    report_header(title);
+
+    StreamRun best, run;
+    ShardMetrics before = *current_shard->metrics;
+    for (int rep = 0; rep < repeats; rep++) {
+        run_stream_once(stream, fds, &run);
+        if (rep == 0 || run.handlers.ns < best.handlers.ns) {
+            best = run;
+        }
+    }
+    report_row("handle_client_data", &best.handlers);
+    report_row("flush_dirty_clients", &best.flush);
+    if (best.skipped > 0) {
+        fprintf(report, "  (%llu comandi di client già disconnessi non eseguiti)\n", (unsigned long long)best.skipped);
+    }
+
+    // Dettaglio per comando dagli istogrammi dello shard: media su tutte le ripetizioni, orologio compreso
+    const ShardMetrics *after = current_shard->metrics;
+    fprintf(report, "  %-22s %10s %10s\n", "per comando", "op", "ns/op");
+    for (int c = 0; c < METRIC_CMD_COUNT; c++) {
+        uint64_t count = after->commands[c].count - before.commands[c].count;
+        uint64_t sum_ns = after->commands[c].sum_ns - before.commands[c].sum_ns;
+        if (count > 0) {
+            fprintf(report, "    %-20s %10llu %10.1f\n", metrics_command_name((MetricCommand)c),
+                    (unsigned long long)count, (double)sum_ns / (double)count);
+        }
+    }
+    free(fds);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-g partite] [-r ripetizioni] [-p coppie] [-s seme] [-f flusso] [-v]\n", program);
+    fprintf(stderr, "  -f: flusso registrato, una riga \"<client> <comando>\" per comando (\"@n\" = partita del client n)\n");
+    fprintf(stderr, "  -v: lascia sullo stdout i messaggi del server\n");
+}
+
+int main(int argc, char *argv[]) {
+    int games = DEFAULT_GAMES;
+    int repeats = DEFAULT_REPEATS;
+    int pairs = DEFAULT_STREAM_PAIRS;
+    const char *stream_path = NULL;
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:r:p:s:f:vh")) != -1) {
+        switch (opt) {
+            case 'g': games = atoi(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            case 'p': pairs = atoi(optarg); break;
+            case 's': bench_rng = (uint32_t)strtoul(optarg, NULL, 10) | 1; break; // Mai 0 (xorshift)
+            case 'f': stream_path = optarg; break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (games < 40 || repeats < 1 || pairs < 1 || pairs > BENCH_MAX_CLIENTS / 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Il report va sullo stdout originale; i messaggi del server (printf degli handler) in /dev/null
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (!report || null_fd < 0) {
+        perror("dup/open");
+        return EXIT_FAILURE;
+    }
+    if (!verbose) {
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+    }
+    close(null_fd);
+    signal(SIGPIPE, SIG_IGN);
+
+    perf_init();
+    fprintf(report, "Ripetizioni: %d (riportata la più veloce). Contatori hardware: %s\n", repeats,
+            perf_group_fd >= 0 ? (perf_instr_fd >= 0 ? "cache miss e istruzioni" : "cache miss") : "non disponibili (perf_event_open)");
+
+    Corpus corpora[] = {
+        { "tris classico", SIZE, SIZE, SIZE, games, NULL, NULL, NULL, 0 },
+        { "15x15 k=5", 15, 15, 5, games / 40, NULL, NULL, NULL, 0 },
+    };
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        if (!build_corpus(&corpora[i])) {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+        run_engine_benchmarks(&corpora[i], repeats);
+        free_corpus(&corpora[i]);
+    }
+
+    init_bench_server();
+    CommandStream stream = { 0 };
+    char name[64];
+    if (stream_path) {
+        if (!load_stream(&stream, stream_path)) {
+            return EXIT_FAILURE;
+        }
+        run_stream_benchmark(&stream, stream_path, repeats);
+    } else {
+        build_default_stream(&stream, pairs);
+        snprintf(name, sizeof(name), "%d coppie (vittorie, pareggi, rivincite)", pairs);
+        run_stream_benchmark(&stream, name, repeats);
+    }
+    free(stream.commands);
+    fclose(report);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS non è definito in modalità C99 stretta
+#include "game_directory.h"
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Restituisce la voce (shard, slot)
+static DirectoryEntry *entry_at(const GameDirectory *dir, int shard, int slot) {
+    return &dir->entries[(size_t)shard * (size_t)dir->slots_per_shard + (size_t)slot];
+}
+
+// Millisecondi di CLOCK_MONOTONIC troncati a 32 bit: bastano per confrontare istanti vicini
+static uint32_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+// Alloca voci, log e contatori in un'unica mappatura condivisa, ereditata dai processi figli dopo la fork.
+int directory_create(GameDirectory *dir, int num_shards, int slots_per_shard) {
+    size_t entries_size = (size_t)num_shards * (size_t)slots_per_shard * sizeof(DirectoryEntry);
+    size_t log_size = DIRECTORY_LOG_SIZE * sizeof(DirectoryChange);
+    size_t marks_size = (size_t)(num_shards + 1) * sizeof(uint32_t);
+    void *mem = mmap(NULL, entries_size + log_size + marks_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    // La memoria anonima è già azzerata: tutte le voci risultano libere e il log vuoto (versione 0)
+    dir->num_shards = num_shards;
+    dir->slots_per_shard = slots_per_shard;
+    dir->entries = mem;
+    dir->log = (DirectoryChange *)((char *)mem + entries_size);
+    dir->high_water = (uint32_t *)((char *)mem + entries_size + log_size);
+    dir->version = dir->high_water + num_shards;
+    return 0;
+}
+
+// Riserva la versione successiva e registra la modifica nella sua posizione del log.
+// La voce della directory è già aggiornata: chi legge la nuova versione vede anche la voce.
+static void log_change(GameDirectory *dir, int32_t game_id, int32_t state, int32_t owner_fd, int32_t variant) {
+    uint32_t version = __atomic_add_fetch(dir->version, 1, __ATOMIC_ACQ_REL);
+    DirectoryChange *c = &dir->log[version & (DIRECTORY_LOG_SIZE - 1)];
+    __atomic_store_n(&c->version, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->claimed_ms, monotonic_ms(), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&c->game_id, game_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->state, state, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->owner_fd, owner_fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->variant, variant, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->version, version, __ATOMIC_RELEASE);
+}
+
+// Scrittura sotto seqlock: il contatore diventa dispari, si aggiornano i campi, torna pari.
+static void write_entry(GameDirectory *dir, int shard, int slot, int32_t game_id, int32_t state, int32_t owner_fd, int32_t variant) {
+    DirectoryEntry *e = entry_at(dir, shard, slot);
+    uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&e->game_id, game_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->state, state, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->owner_fd, owner_fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->variant, variant, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+
+    // Solo lo shard proprietario scrive il proprio contatore: basta una store
+    if ((uint32_t)slot >= __atomic_load_n(&dir->high_water[shard], __ATOMIC_RELAXED)) {
+        __atomic_store_n(&dir->high_water[shard], (uint32_t)slot + 1, __ATOMIC_RELEASE);
+    }
+}
+
+void directory_publish(GameDirectory *dir, int shard, int slot, int32_t game_id, int32_t state, int32_t owner_fd, int32_t variant) {
+    write_entry(dir, shard, slot, game_id, state, owner_fd, variant);
+    log_change(dir, game_id, state, owner_fd, variant);
+}
+
+// Una voce libera ha game_id 0; il log conserva l'ID rimosso, che la voce non ha più
+void directory_clear(GameDirectory *dir, int shard, int slot) {
+    DirectoryEntry *e = entry_at(dir, shard, slot);
+    int32_t game_id = __atomic_load_n(&e->game_id, __ATOMIC_RELAXED);
+    int32_t variant = __atomic_load_n(&e->variant, __ATOMIC_RELAXED);
+    write_entry(dir, shard, slot, 0, 0, -1, 0);
+    if (game_id != 0) {
+        log_change(dir, game_id, DIRECTORY_REMOVED, -1, variant);
+    }
+}
+
+// Chiamata dal processo supervisore quando il worker proprietario non esiste più.
+// Un worker terminato durante write_entry lascia il contatore dispari (e magari game_id ancora 0, se stava
+// pubblicando in uno slot libero): lo si riporta al pari successivo prima di liberare la voce, altrimenti la
+// scrittura successiva lo lascerebbe dispari per sempre e ogni lettura della voce girerebbe all'infinito.
+// high_water viene aggiornato dopo la scrittura, quindi la voce interrotta può stare oltre: si esaminano tutti gli slot.
+void directory_clear_shard(GameDirectory *dir, int shard) {
+    for (int slot = 0; slot < dir->slots_per_shard; ++slot) {
+        DirectoryEntry *e = entry_at(dir, shard, slot);
+        uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+        if (seq & 1) {
+            __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE); // Nessun altro scrittore: il proprietario non c'è più
+        } else if (__atomic_load_n(&e->game_id, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+        directory_clear(dir, shard, slot);
+    }
+}
+
+// Lettura senza lock: ripete finché il seqlock non è pari e invariato attorno alla copia.
+int directory_read(const GameDirectory *dir, int shard, int slot, DirectoryEntry *out) {
+    const DirectoryEntry *e = entry_at(dir, shard, slot);
+    uint32_t before, after;
+    do {
+        before = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        out->game_id = __atomic_load_n(&e->game_id, __ATOMIC_RELAXED);
+        out->state = __atomic_load_n(&e->state, __ATOMIC_RELAXED);
+        out->owner_fd = __atomic_load_n(&e->owner_fd, __ATOMIC_RELAXED);
+        out->variant = __atomic_load_n(&e->variant, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    out->seq = after;
+    return out->game_id != 0 ? 0 : -1;
+}
+
+uint32_t directory_version(const GameDirectory *dir) {
+    return __atomic_load_n(dir->version, __ATOMIC_ACQUIRE);
+}
+
+// Ogni posizione del log si legge come un seqlock: la versione deve essere quella attesa prima e dopo la copia.
+// Una versione più vecchia (o 0) indica una scrittura non ancora completata: ci si ferma lì e il resto
+// arriverà con la richiesta successiva. Una versione più recente indica che la posizione è già stata riusata.
+// Un worker terminato tra la prenotazione e il completamento lascerebbe la posizione incompleta finché il log
+// non fa il giro, fermando tutti i lettori: se la prenotazione è più vecchia di DIRECTORY_STALL_MS (o la sua ora
+// non è ancora scritta, e quella rimasta è di un giro precedente) si restituisce -1. Il chiamante rilegge le voci,
+// che lo scrittore aggiorna prima di prenotare, e riparte dalla versione corrente, oltre la posizione abbandonata;
+// con uno scrittore solo lento il costo è una rilettura in più.
+int directory_changes(const GameDirectory *dir, uint32_t since, DirectoryChange *out, int max, uint32_t *reached) {
+    uint32_t current = directory_version(dir);
+    if ((int32_t)(current - since) < 0 || current - since > DIRECTORY_LOG_SIZE) {
+        return -1;
+    }
+    int count = 0;
+    uint32_t version = since;
+    while (version != current && count < max) {
+        uint32_t wanted = version + 1;
+        const DirectoryChange *c = &dir->log[wanted & (DIRECTORY_LOG_SIZE - 1)];
+        uint32_t before = __atomic_load_n(&c->version, __ATOMIC_ACQUIRE);
+        out[count].game_id = __atomic_load_n(&c->game_id, __ATOMIC_RELAXED);
+        out[count].state = __atomic_load_n(&c->state, __ATOMIC_RELAXED);
+        out[count].owner_fd = __atomic_load_n(&c->owner_fd, __ATOMIC_RELAXED);
+        out[count].variant = __atomic_load_n(&c->variant, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t after = __atomic_load_n(&c->version, __ATOMIC_RELAXED);
+        if (before != wanted || after != wanted) {
+            if (before != 0 && (int32_t)(before - wanted) > 0) {
+                return -1; // Sovrascritta da una modifica più recente: il log non copre più since
+            }
+            if (after != 0 && (int32_t)(after - wanted) > 0) {
+                return -1;
+            }
+            uint32_t age = monotonic_ms() - __atomic_load_n(&c->claimed_ms, __ATOMIC_RELAXED);
+            if (age > DIRECTORY_STALL_MS) {
+                return -1; // Scrittura abbandonata
+            }
+            break; // Scrittura in corso
+        }
+        out[count++].version = wanted;
+        version = wanted;
+    }
+    *reached = version;
+    return count;
+}
@@ -0,0 +1,69 @@
+#ifndef GAME_DIRECTORY_H
+#define GAME_DIRECTORY_H
+
+#include <stdint.h>
+
+#define DIRECTORY_LOG_SIZE 4096 // Modifiche recenti conservate per gli aggiornamenti incrementali della lista (potenza di 2)
+#define DIRECTORY_REMOVED (-1)  // Stato di una modifica che rimuove la partita dalla lista
+#define DIRECTORY_OWNER_DETACHED (-3) // owner_fd di un proprietario non connesso, il cui posto è tenuto per il rientro
+#define DIRECTORY_STALL_MS 1000 // Oltre questo tempo una modifica prenotata e non completata si considera abbandonata
+
+// Voce della directory: descrive una partita vista da tutti i worker.
+// Ogni voce ha un solo scrittore (lo shard proprietario) ed è protetta da un seqlock:
+// i lettori non bloccano mai e ritentano se leggono durante una scrittura.
+typedef struct {
+    uint32_t seq;           // Seqlock: dispari durante una scrittura
+    int32_t game_id;        // ID della partita (0 se la voce è libera)
+    int32_t state;          // Stato della partita (GameState del server)
+    int32_t owner_fd;       // File descriptor del proprietario nel worker che ospita la partita
+    int32_t variant;        // Variante m,n,k impacchettata (PROTO_VARIANT, 0 = tris classico)
+} DirectoryEntry;
+
+// Modifica registrata nel log circolare della directory.
+// La scrivono più shard in concorrenza, ognuno nella posizione della versione che ha riservato:
+// version vale 0 durante la scrittura e la versione della modifica quando è completa.
+// claimed_ms permette ai lettori di riconoscere la posizione di un worker terminato a metà scrittura.
+typedef struct {
+    uint32_t version;       // Versione della directory prodotta da questa modifica
+    uint32_t claimed_ms;    // Istante della prenotazione (CLOCK_MONOTONIC in ms, modulo 2^32)
+    int32_t game_id;        // Partita modificata
+    int32_t state;          // Nuovo stato (GameState del server) o DIRECTORY_REMOVED
+    int32_t owner_fd;       // Proprietario dopo la modifica
+    int32_t variant;        // Variante della partita (PROTO_VARIANT, 0 = tris classico)
+} DirectoryChange;
+
+// Directory delle partite in memoria condivisa: una riga di voci per ogni shard di ogni worker
+typedef struct {
+    int num_shards;          // Numero totale di shard (worker * thread)
+    int slots_per_shard;     // Voci disponibili per ogni shard
+    uint32_t *high_water;    // Per ogni shard, numero di slot mai usati (limite superiore della scansione)
+    uint32_t *version;       // Versione della directory: cresce di uno a ogni pubblicazione o rimozione
+    DirectoryChange *log;    // Ultime DIRECTORY_LOG_SIZE modifiche, indicizzate per versione
+    DirectoryEntry *entries; // num_shards * slots_per_shard voci
+} GameDirectory;
+
+// Alloca la directory in memoria condivisa anonima: va creata prima della fork dei worker
+int directory_create(GameDirectory *dir, int num_shards, int slots_per_shard);
+
+// Pubblica lo stato di una partita nella voce (shard, slot); chiamabile solo dallo shard proprietario
+void directory_publish(GameDirectory *dir, int shard, int slot, int32_t game_id, int32_t state, int32_t owner_fd, int32_t variant);
+
+// Libera la voce (shard, slot)
+void directory_clear(GameDirectory *dir, int shard, int slot);
+
+// Libera tutte le voci di uno shard (usato quando il worker che lo ospitava termina)
+void directory_clear_shard(GameDirectory *dir, int shard);
+
+// Legge una copia coerente della voce (shard, slot); restituisce 0 se la voce è occupata, -1 se libera
+int directory_read(const GameDirectory *dir, int shard, int slot, DirectoryEntry *out);
+
+// Versione corrente della directory. Va letta prima di scandire le voci: le modifiche successive
+// alla lettura compaiono in directory_changes anche se la scansione le ha già viste.
+uint32_t directory_version(const GameDirectory *dir);
+
+// Copia in out, in ordine, al più max modifiche successive alla versione since e scrive in *reached l'ultima versione copiata.
+// Restituisce il numero di modifiche copiate, -1 se since è troppo vecchia (non più nel log) o successiva alla versione corrente,
+// oppure se il log è fermo da più di DIRECTORY_STALL_MS su una modifica mai completata: in tutti i casi si rilegge la directory.
+int directory_changes(const GameDirectory *dir, uint32_t since, DirectoryChange *out, int max, uint32_t *reached);
+
+#endif // GAME_DIRECTORY_H
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE // fdatasync e O_CLOEXEC non sono definiti in modalità C99 stretta
+#include "journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "TRJ1"
+#define SNAPSHOT_MAGIC "TRS1"
+#define JOURNAL_INITIAL_BUFFER 4096
+
+// Intestazione dei file del journal e dell'istantanea
+typedef struct {
+    char magic[4];          // JOURNAL_MAGIC o SNAPSHOT_MAGIC
+    uint32_t layout;        // Journal.layout di chi ha scritto il file
+    uint32_t epoch;         // Istantanea a cui il file appartiene
+    uint32_t reserved;
+} JournalHeader;
+
+static void fill_header(JournalHeader *header, const char *magic, uint32_t layout, uint32_t epoch) {
+    memcpy(header->magic, magic, sizeof(header->magic));
+    header->layout = layout;
+    header->epoch = epoch;
+    header->reserved = 0;
+}
+
+// Scrive tutto il buffer, riprendendo dopo le scritture parziali
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Legge un file per intero; un file assente vale come vuoto. Restituisce 0 se riuscito, -1 altrimenti.
+static int read_file(const char *path, uint8_t **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size > 0 && !(*data = malloc((size_t)st.st_size)))) {
+        close(fd);
+        return -1;
+    }
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t n = read(fd, *data + done, (size_t)st.st_size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break; // Il file si è accorciato: si usa quanto letto
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+    *size = done;
+    return 0;
+}
+
+// Vero se il file inizia con un'intestazione del tipo e del layout attesi
+static bool valid_header(const uint8_t *data, size_t size, const char *magic, uint32_t layout, uint32_t *epoch) {
+    JournalHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.layout != layout) {
+        return false;
+    }
+    *epoch = header.epoch;
+    return true;
+}
+
+// Applica i record dopo l'intestazione: ognuno è preceduto da un byte di lunghezza
+static int apply_records(const uint8_t *data, size_t size, const char *path, JournalApply apply, void *ctx) {
+    int count = 0;
+    size_t pos = sizeof(JournalHeader);
+    while (pos < size) {
+        size_t len = data[pos];
+        if (len == 0 || pos + 1 + len > size) {
+            fprintf(stderr, "%s: record incompleto all'offset %zu (scrittura interrotta), ignorati gli ultimi %zu byte\n",
+                    path, pos, size - pos);
+            break;
+        }
+        apply(data + pos + 1, len, ctx);
+        pos += 1 + len;
+        count++;
+    }
+    return count;
+}
+
+// Rende persistente la rinomina di un file sincronizzando la directory che lo contiene
+static void sync_parent_directory(const char *path) {
+    char dir[JOURNAL_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    }
+    int fd = open(slash ? dir : ".", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int journal_open(Journal *journal, const char *dir, int shard, uint32_t layout, bool sync) {
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    journal->layout = layout;
+    journal->sync = sync;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        return -1;
+    }
+    if (snprintf(journal->path, sizeof(journal->path), "%s/journal-%d.log", dir, shard) >= (int)sizeof(journal->path) ||
+        snprintf(journal->snapshot_path, sizeof(journal->snapshot_path), "%s/snapshot-%d.bin", dir, shard) >= (int)sizeof(journal->snapshot_path)) {
+        fprintf(stderr, "Percorso del journal troppo lungo: %s\n", dir);
+        return -1;
+    }
+    journal->fd = open(journal->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (journal->fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    journal->size = fstat(journal->fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    return 0;
+}
+
+int journal_replay(Journal *journal, JournalApply apply, void *ctx) {
+    if (journal->fd < 0) {
+        return 0;
+    }
+    int count = 0;
+    uint8_t *data;
+    size_t size;
+    uint32_t epoch = 0;
+    journal->epoch = 0;
+    if (read_file(journal->snapshot_path, &data, &size) < 0) {
+        perror(journal->snapshot_path);
+    } else if (size > 0 && !valid_header(data, size, SNAPSHOT_MAGIC, journal->layout, &epoch)) {
+        fprintf(stderr, "%s: istantanea non valida o scritta con un'altra configurazione, ignorata\n", journal->snapshot_path);
+    } else if (size > 0) {
+        journal->epoch = epoch;
+        count += apply_records(data, size, journal->snapshot_path, apply, ctx);
+    }
+    free(data);
+
+    // Il journal vale solo se riparte dall'istantanea appena letta: uno più vecchio è già contenuto in essa
+    if (read_file(journal->path, &data, &size) < 0) {
+        perror(journal->path);
+    } else if (size > 0 && !valid_header(data, size, JOURNAL_MAGIC, journal->layout, &epoch)) {
+        fprintf(stderr, "%s: journal non valido o scritto con un'altra configurazione, ignorato\n", journal->path);
+    } else if (size > 0 && epoch == journal->epoch) {
+        count += apply_records(data, size, journal->path, apply, ctx);
+    }
+    free(data);
+    return count;
+}
+
+void journal_append(Journal *journal, const void *record, size_t len) {
+    if (journal->fd < 0 || len == 0 || len > JOURNAL_RECORD_MAX) {
+        return;
+    }
+    if (journal->len + 1 + len > journal->cap) {
+        size_t cap = journal->cap > 0 ? journal->cap : JOURNAL_INITIAL_BUFFER;
+        while (journal->len + 1 + len > cap) {
+            cap *= 2;
+        }
+        uint8_t *buf = realloc(journal->buf, cap);
+        if (!buf) {
+            perror("realloc");
+            return;
+        }
+        journal->buf = buf;
+        journal->cap = cap;
+    }
+    journal->buf[journal->len] = (uint8_t)len;
+    memcpy(journal->buf + journal->len + 1, record, len);
+    journal->len += 1 + len;
+}
+
+// Una scrittura fallita a metà viene tagliata: i record successivi non devono seguire un record incompleto.
+// I record non scritti vanno persi, ma il server non blocca le partite in attesa del disco.
+int journal_commit(Journal *journal) {
+    if (journal->fd < 0 || journal->len == 0) {
+        return 0;
+    }
+    int rc = write_all(journal->fd, journal->buf, journal->len);
+    if (rc == 0 && journal->sync) {
+        rc = fdatasync(journal->fd);
+    }
+    if (rc == 0) {
+        journal->size += journal->len;
+    } else {
+        perror(journal->path);
+        if (ftruncate(journal->fd, (off_t)journal->size) < 0) {
+            perror("ftruncate");
+        }
+    }
+    journal->len = 0;
+    return rc;
+}
+
+// L'istantanea viene scritta in un file temporaneo e poi rinominata: un crash lascia sempre l'istantanea
+// precedente o quella nuova. Dopo la rinomina il journal riparte vuoto con l'epoca della nuova istantanea;
+// se il crash avviene prima, il vecchio journal ha l'epoca precedente e al ripristino viene ignorato.
+int journal_snapshot(Journal *journal, JournalEmit emit, void *ctx) {
+    if (journal->fd < 0) {
+        return 0;
+    }
+    journal_commit(journal); // Se fallisce, l'istantanea contiene comunque lo stato che quei record descrivono
+    uint32_t epoch = journal->epoch + 1;
+    JournalHeader header;
+    fill_header(&header, SNAPSHOT_MAGIC, journal->layout, epoch);
+    emit(journal, ctx);
+
+    char tmp_path[JOURNAL_PATH_MAX + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal->snapshot_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && write_all(fd, &header, sizeof(header)) == 0 &&
+                   write_all(fd, journal->buf, journal->len) == 0 && fdatasync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    journal->len = 0;
+    if (!written || rename(tmp_path, journal->snapshot_path) < 0) {
+        perror(journal->snapshot_path);
+        unlink(tmp_path);
+        return -1;
+    }
+    sync_parent_directory(journal->snapshot_path);
+    journal->epoch = epoch;
+
+    fill_header(&header, JOURNAL_MAGIC, journal->layout, epoch);
+    if (ftruncate(journal->fd, 0) < 0 || write_all(journal->fd, &header, sizeof(header)) < 0 || fdatasync(journal->fd) < 0) {
+        // Senza intestazione i record successivi non sarebbero riconosciuti: meglio fermare il journal
+        perror(journal->path);
+        fprintf(stderr, "%s: journal disattivato, resta valida l'istantanea\n", journal->path);
+        close(journal->fd);
+        journal->fd = -1;
+        return -1;
+    }
+    journal->size = sizeof(header);
+    return 0;
+}
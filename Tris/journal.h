@@ -0,0 +1,52 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOURNAL_RECORD_MAX 255 // Lunghezza massima di un record (la lunghezza è scritta in un byte davanti al record)
+#define JOURNAL_PATH_MAX 256
+
+// Journal append-only di uno shard, con l'istantanea da cui riparte.
+// I record di un giro di eventi vengono raccolti in memoria e scritti con una sola write() a fine giro
+// (group commit); il contenuto dei record è deciso dal chiamante. Ogni file inizia con un'intestazione
+// che lo lega alla configurazione (layout) e all'istantanea (epoch): un journal di un'epoca precedente
+// all'istantanea è già contenuto nell'istantanea e non viene riapplicato.
+typedef struct {
+    int fd;                 // File del journal, aperto in append (-1 se il journal è disattivato)
+    char path[JOURNAL_PATH_MAX];          // <dir>/journal-<shard>.log
+    char snapshot_path[JOURNAL_PATH_MAX]; // <dir>/snapshot-<shard>.bin
+    uint32_t layout;        // Valore che deve coincidere tra una esecuzione e la successiva (es. il numero di shard)
+    uint32_t epoch;         // Numero dell'ultima istantanea (0 = nessuna)
+    bool sync;              // fdatasync() a ogni commit: i record sopravvivono anche a un crash della macchina
+    uint8_t *buf;           // Record in attesa del prossimo commit (o dell'istantanea in costruzione)
+    size_t len;
+    size_t cap;
+    uint64_t size;          // Byte del journal su disco
+} Journal;
+
+// Chiamata per ogni record letto durante il ripristino (prima quelli dell'istantanea, poi quelli del journal)
+typedef void (*JournalApply)(const uint8_t *record, size_t len, void *ctx);
+
+// Chiamata da journal_snapshot per scrivere con journal_append lo stato completo
+typedef void (*JournalEmit)(Journal *journal, void *ctx);
+
+// Apre (o crea) il journal dello shard nella directory dir; restituisce 0 se riuscito, -1 altrimenti (journal disattivato)
+int journal_open(Journal *journal, const char *dir, int shard, uint32_t layout, bool sync);
+
+// Rilegge istantanea e journal chiamando apply per ogni record completo; un record troncato da un crash chiude la lettura.
+// File di un layout diverso vengono ignorati. Restituisce il numero di record applicati.
+// Va seguita da journal_snapshot, che riscrive lo stato ripristinato e riparte con un journal vuoto.
+int journal_replay(Journal *journal, JournalApply apply, void *ctx);
+
+// Accoda un record (al più JOURNAL_RECORD_MAX byte) per il prossimo commit: solo una copia in memoria
+void journal_append(Journal *journal, const void *record, size_t len);
+
+// Scrive su disco i record accodati con una sola write(); restituisce 0 se riuscito, -1 altrimenti
+int journal_commit(Journal *journal);
+
+// Scrive una nuova istantanea con i record prodotti da emit e svuota il journal; restituisce 0 se riuscito, -1 altrimenti
+int journal_snapshot(Journal *journal, JournalEmit emit, void *ctx);
+
+#endif // JOURNAL_H
@@ -0,0 +1,575 @@
+#define _GNU_SOURCE // memmem è un'estensione GNU
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "tris_protocol.h" // Frame del protocollo binario, lo stesso del server
+
+// Generatore di carico: apre molte connessioni da un solo processo con epoll e fa giocare a ogni coppia
+// di connessioni dei round scritti in anticipo (create, join, accept, mosse, rematch) con il protocollo binario.
+// Misura la latenza di ogni comando, dall'invio alla risposta che lo conclude, e classifica i fallimenti.
+
+#define PORT_DEFAULT 8080
+#define DEFAULT_CONNECTIONS 1000 // Connessioni aperte (-c), a coppie
+#define DEFAULT_ROUNDS 10        // Round giocati da ogni coppia (-r)
+#define DEFAULT_DRAW_PERCENT 50  // Percentuale di round che finiscono in pareggio e ripartono con "rematch" (-p)
+#define DEFAULT_TIMEOUT 10       // Secondi senza progressi dopo cui una coppia viene abbandonata (-t)
+#define INPUT_BUFFER_SIZE 4096   // Byte ricevuti e non ancora consumati di una connessione
+#define MAX_EVENTS 256
+#define MAX_ERROR_CODES 64       // Codici di ProtoError contati separatamente
+
+// Comandi misurati
+typedef enum {
+    CMD_BINARY,
+    CMD_CREATE,
+    CMD_JOIN,
+    CMD_ACCEPT,
+    CMD_MOVE,
+    CMD_REMATCH,
+    CMD_COUNT,
+    CMD_NONE = -1
+} LoadCommand;
+
+static const char *const command_names[CMD_COUNT] = { "binary", "create", "join", "accept", "move", "rematch" };
+
+// Tipi di fallimento
+typedef enum {
+    FAIL_CONNECT,      // connect() fallita (il dettaglio è in connect_errors)
+    FAIL_DISCONNECT,   // Il server ha chiuso la connessione o la ha resettata
+    FAIL_TIMEOUT,      // Nessun progresso della coppia entro il timeout
+    FAIL_SEND,         // send() fallita o socket pieno
+    FAIL_SERVER,       // Frame di errore del server (il dettaglio è in server_errors)
+    FAIL_PROTOCOL,     // Risposta che il copione non prevede
+    FAIL_COUNT
+} FailureType;
+
+static const char *const failure_names[FAIL_COUNT] = {
+    "connessione fallita", "connessione chiusa dal server", "timeout", "invio fallito", "errore del server", "risposta inattesa"
+};
+
+// Nomi dei codici di errore del server, nell'ordine di ProtoError
+static const char *const error_names[] = {
+    "", "INTERNAL", "UNKNOWN_COMMAND", "ALREADY_IN_GAME", "MAX_GAMES", "GAME_NOT_FOUND", "GAME_UNAVAILABLE",
+    "OWN_GAME", "NOT_OWNER", "NO_PENDING_PLAYER", "NOT_IN_GAME", "GAME_NOT_RUNNING", "GAME_ENDED",
+    "NOT_YOUR_TURN", "INVALID_MOVE", "NO_REMATCH", "INVALID_VARIANT", "QUEUED", "NOT_WATCHING",
+    "RESUME_DENIED", "REPLAY_NOT_FOUND", "NOT_LOGGED_IN", "INPUT_OVERFLOW"
+};
+
+// Round scritti: celle (riga * 3 + colonna) giocate a turno a partire da chi muove per primo
+static const uint8_t win_script[] = { 0, 4, 1, 8, 2 };            // Il primo vince sulla riga in alto
+static const uint8_t draw_script[] = { 0, 4, 8, 1, 7, 6, 2, 5, 3 }; // Tabellone pieno senza tris
+
+typedef struct Pair Pair;
+
+// Una connessione del generatore
+typedef struct {
+    int fd;                 // -1 se chiusa
+    Pair *pair;             // Coppia di cui fa parte
+    bool connected;         // connect() completata
+    bool binary;            // HELLO ricevuto: da qui in poi solo frame
+    LoadCommand awaiting;   // Comando in attesa di risposta (CMD_NONE se nessuno)
+    uint64_t sent_ns;       // Istante di invio del comando in attesa
+    uint8_t in[INPUT_BUFFER_SIZE];
+    size_t in_len;
+} Conn;
+
+// Due connessioni che giocano tra loro: la prima crea la partita, la seconda vi entra
+struct Pair {
+    Conn conns[2];
+    uint32_t game_id;       // Partita della coppia (0 finché non è creata)
+    bool joined;            // La seconda connessione ha già chiesto di entrare
+    int rounds;             // Round conclusi
+    int ply;                // Mosse giocate nel round in corso
+    bool draw_round;        // Il round in corso segue draw_script
+    bool active;            // Falso quando la coppia ha finito o è stata abbandonata
+    uint64_t last_progress_ns; // Ultimo frame ricevuto da una delle due connessioni
+};
+
+// Latenze di un comando, in nanosecondi
+typedef struct {
+    uint64_t *samples;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+// Opzioni della corsa
+static int opt_connections = DEFAULT_CONNECTIONS;
+static int opt_rounds = DEFAULT_ROUNDS;
+static int opt_draw_percent = DEFAULT_DRAW_PERCENT;
+static int opt_timeout = DEFAULT_TIMEOUT;
+
+// Risultati
+static Samples latencies[CMD_COUNT];
+static uint64_t failures[FAIL_COUNT];
+static uint64_t connect_errors[256];       // Per errno
+static uint64_t server_errors[MAX_ERROR_CODES]; // Per ProtoError
+static uint64_t total_rounds;
+static uint64_t total_moves;
+static int pairs_completed;
+static int active_pairs;
+static uint32_t rng = 2463534242u;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Generatore xorshift: sceglie quali round finiscono in pareggio
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void add_sample(LoadCommand command, uint64_t ns) {
+    Samples *s = &latencies[command];
+    if (s->count == s->capacity) {
+        size_t capacity = s->capacity ? s->capacity * 2 : 4096;
+        uint64_t *grown = realloc(s->samples, capacity * sizeof(uint64_t));
+        if (!grown) {
+            return; // Il campione va perso, la corsa continua
+        }
+        s->samples = grown;
+        s->capacity = capacity;
+    }
+    s->samples[s->count++] = ns;
+}
+
+static void close_conn(Conn *c) {
+    if (c->fd >= 0) {
+        close(c->fd); // Chiudere il socket lo toglie anche dall'epoll
+        c->fd = -1;
+    }
+    c->awaiting = CMD_NONE;
+}
+
+// Chiude entrambe le connessioni della coppia; failed indica se è stata abbandonata per un errore
+static void finish_pair(Pair *pair, bool failed) {
+    if (!pair->active) {
+        return;
+    }
+    pair->active = false;
+    active_pairs--;
+    if (!failed) {
+        pairs_completed++;
+    }
+    close_conn(&pair->conns[0]);
+    close_conn(&pair->conns[1]);
+}
+
+static void fail_pair(Pair *pair, FailureType type) {
+    if (pair->active) {
+        failures[type]++;
+    }
+    finish_pair(pair, true);
+}
+
+// Invia un frame e, se command non è CMD_NONE, lo registra come comando in attesa di risposta
+static bool send_command(Conn *c, LoadCommand command, uint8_t op, uint8_t code, uint16_t aux, uint32_t arg) {
+    ProtoFrame frame = { op, code, aux, arg };
+    uint8_t wire[PROTO_FRAME_SIZE];
+    proto_encode(&frame, wire);
+    c->awaiting = command;
+    c->sent_ns = now_ns();
+    if (send(c->fd, wire, sizeof(wire), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(wire)) {
+        fail_pair(c->pair, FAIL_SEND);
+        return false;
+    }
+    return true;
+}
+
+// Gioca la prossima mossa del round scritto della coppia
+static void play_next_move(Conn *c) {
+    Pair *pair = c->pair;
+    const uint8_t *script = pair->draw_round ? draw_script : win_script;
+    int length = pair->draw_round ? (int)sizeof(draw_script) : (int)sizeof(win_script);
+    if (pair->ply >= length) {
+        fail_pair(pair, FAIL_PROTOCOL); // Il server chiede un'altra mossa a tabellone già deciso
+        return;
+    }
+    int cell = script[pair->ply++];
+    total_moves++;
+    send_command(c, CMD_MOVE, PROTO_OP_MOVE, (uint8_t)(cell / 3), (uint16_t)(cell % 3), 0);
+}
+
+// Vero se il frame è la risposta che conclude il comando in attesa
+static bool completes(LoadCommand command, const ProtoFrame *frame) {
+    switch (command) {
+        case CMD_BINARY: return frame->op == PROTO_OP_HELLO;
+        case CMD_CREATE: return frame->op == PROTO_OP_EVENT && frame->code == PROTO_EV_GAME_CREATED;
+        case CMD_JOIN: return frame->op == PROTO_OP_EVENT && frame->code == PROTO_EV_JOIN_SENT;
+        case CMD_ACCEPT: return frame->op == PROTO_OP_EVENT && frame->code == PROTO_EV_GAME_STARTED;
+        case CMD_MOVE: return frame->op == PROTO_OP_STATE;
+        case CMD_REMATCH:
+            return frame->op == PROTO_OP_EVENT &&
+                   (frame->code == PROTO_EV_REMATCH_SENT || frame->code == PROTO_EV_REMATCH_STARTED);
+        default: return false;
+    }
+}
+
+// Fa avanzare il copione della coppia in base a un frame ricevuto da c
+static void handle_frame(Conn *c, const ProtoFrame *frame) {
+    Pair *pair = c->pair;
+    Conn *partner = &pair->conns[c == &pair->conns[0] ? 1 : 0];
+    LoadCommand answered = CMD_NONE;
+
+    if (c->awaiting != CMD_NONE && completes(c->awaiting, frame)) {
+        answered = c->awaiting;
+        add_sample(answered, now_ns() - c->sent_ns);
+        c->awaiting = CMD_NONE;
+    }
+
+    switch (frame->op) {
+        case PROTO_OP_ERROR:
+            server_errors[frame->code < MAX_ERROR_CODES ? frame->code : 0]++;
+            fail_pair(pair, FAIL_SERVER);
+            return;
+        case PROTO_OP_HELLO:
+            if (c == &pair->conns[0]) {
+                send_command(c, CMD_CREATE, PROTO_OP_CREATE, 0, 0, 0);
+            } else if (pair->game_id != 0 && !pair->joined) {
+                pair->joined = true;
+                send_command(c, CMD_JOIN, PROTO_OP_JOIN, 0, 0, pair->game_id);
+            }
+            return;
+        case PROTO_OP_STATE:
+            if (answered == CMD_MOVE && (frame->code & (PROTO_STATE_WIN | PROTO_STATE_DRAW))) {
+                // Round concluso dalla mossa di c: il successivo riparte da join (vittoria) o da rematch (pareggio)
+                pair->rounds++;
+                total_rounds++;
+                pair->ply = 0;
+                pair->draw_round = (int)(next_random() % 100) < opt_draw_percent;
+                if (pair->rounds >= opt_rounds) {
+                    finish_pair(pair, false);
+                }
+            } else if (frame->code & PROTO_STATE_YOUR_TURN) {
+                play_next_move(c);
+            }
+            return;
+        case PROTO_OP_EVENT:
+            break;
+        default:
+            return; // Codici di rientro e altri frame non servono al copione
+    }
+
+    switch (frame->code) {
+        case PROTO_EV_GAME_CREATED:
+            pair->game_id = frame->arg;
+            if (partner->binary && !pair->joined) {
+                pair->joined = true;
+                send_command(partner, CMD_JOIN, PROTO_OP_JOIN, 0, 0, pair->game_id);
+            }
+            break;
+        case PROTO_EV_JOIN_REQUEST:
+            send_command(c, CMD_ACCEPT, PROTO_OP_ACCEPT, 0, 0, 0);
+            break;
+        case PROTO_EV_REMOVED: // Ha perso il round: il vincitore è il nuovo proprietario, si rientra con join
+            send_command(c, CMD_JOIN, PROTO_OP_JOIN, 0, 0, pair->game_id);
+            break;
+        case PROTO_EV_DRAW:
+            send_command(c, CMD_REMATCH, PROTO_OP_REMATCH, 0, 0, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+// Legge tutto quello che è arrivato sulla connessione ed elabora i frame completi
+static void handle_readable(Conn *c) {
+    while (c->fd >= 0) {
+        ssize_t received = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            fail_pair(c->pair, FAIL_DISCONNECT);
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        c->in_len += (size_t)received;
+        c->pair->last_progress_ns = now_ns();
+
+        size_t offset = 0;
+        if (!c->binary) {
+            // Prima del passaggio al protocollo binario arriva il benvenuto testuale: si cerca il frame HELLO
+            static const uint8_t hello[PROTO_FRAME_SIZE] = { PROTO_OP_HELLO, PROTO_VERSION, 0, 0, 0, 0, 0, 0 };
+            uint8_t *found = memmem(c->in, c->in_len, hello, sizeof(hello));
+            if (!found) {
+                if (c->in_len == sizeof(c->in)) {
+                    // Testo più lungo del buffer senza HELLO: se ne tiene solo la coda, dove il frame può iniziare
+                    memmove(c->in, c->in + c->in_len - (PROTO_FRAME_SIZE - 1), PROTO_FRAME_SIZE - 1);
+                    c->in_len = PROTO_FRAME_SIZE - 1;
+                }
+                continue;
+            }
+            c->binary = true;
+            offset = (size_t)(found - c->in);
+        }
+        while (c->fd >= 0 && c->in_len - offset >= PROTO_FRAME_SIZE) {
+            ProtoFrame frame;
+            proto_decode(c->in + offset, &frame);
+            offset += PROTO_FRAME_SIZE;
+            handle_frame(c, &frame);
+        }
+        if (c->fd < 0) {
+            return;
+        }
+        memmove(c->in, c->in + offset, c->in_len - offset);
+        c->in_len -= offset;
+    }
+}
+
+// Avvia una connessione non bloccante verso il server
+static bool start_conn(Conn *c, int epoll_fd, const struct addrinfo *server) {
+    c->fd = socket(server->ai_family, server->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, server->ai_protocol);
+    if (c->fd < 0) {
+        connect_errors[errno & 0xFF]++;
+        return false;
+    }
+    // I comandi sono frame di 8 byte inviati uno alla volta: senza TCP_NODELAY l'algoritmo di Nagle li tratterrebbe
+    // fino all'ACK (ritardato) del precedente e la latenza misurata sarebbe quella del kernel, non del server
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, server->ai_addr, server->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        connect_errors[errno & 0xFF]++;
+        close_conn(c);
+        return false;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        connect_errors[errno & 0xFF]++;
+        close_conn(c);
+        return false;
+    }
+    return true;
+}
+
+// Gestisce un evento di epoll su una connessione
+static void handle_event(Conn *c, uint32_t events) {
+    if (c->fd < 0) {
+        return; // Chiusa da un evento precedente dello stesso giro (es. il partner ha fallito)
+    }
+    if (!c->connected) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0) {
+            connect_errors[error & 0xFF]++;
+            fail_pair(c->pair, FAIL_CONNECT);
+            return;
+        }
+        c->connected = true;
+        c->awaiting = CMD_BINARY;
+        c->sent_ns = now_ns();
+        if (send(c->fd, "binary\n", 7, MSG_NOSIGNAL | MSG_DONTWAIT) != 7) {
+            fail_pair(c->pair, FAIL_SEND);
+            return;
+        }
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        handle_readable(c);
+    }
+}
+
+// Abbandona le coppie ferme da più di opt_timeout secondi
+static void check_timeouts(Pair *pairs, int num_pairs, uint64_t now) {
+    uint64_t limit = (uint64_t)opt_timeout * 1000000000u;
+    for (int i = 0; i < num_pairs; i++) {
+        if (pairs[i].active && now - pairs[i].last_progress_ns > limit) {
+            fail_pair(&pairs[i], FAIL_TIMEOUT);
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Percentile q (0-1) di campioni già ordinati, in microsecondi
+static double percentile_us(const Samples *s, double q) {
+    if (s->count == 0) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(q * (double)s->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    if (rank > s->count) {
+        rank = s->count;
+    }
+    return (double)s->samples[rank - 1] / 1000.0;
+}
+
+static void print_report(double seconds, int num_pairs) {
+    uint64_t commands = 0;
+    for (int c = 0; c < CMD_COUNT; c++) {
+        commands += latencies[c].count;
+    }
+    printf("\nCoppie completate: %d su %d, durata %.2f s\n", pairs_completed, num_pairs, seconds);
+    printf("Round: %llu (%.0f/s), mosse: %llu (%.0f/s), comandi con risposta: %llu (%.0f/s)\n",
+           (unsigned long long)total_rounds, total_rounds / seconds, (unsigned long long)total_moves, total_moves / seconds,
+           (unsigned long long)commands, commands / seconds);
+
+    if (commands > 0) {
+        printf("\n%-8s %10s %10s %10s %10s %10s  (microsecondi)\n", "comando", "risposte", "p50", "p99", "p999", "max");
+    }
+    for (int c = 0; c < CMD_COUNT; c++) {
+        Samples *s = &latencies[c];
+        if (s->count == 0) {
+            continue;
+        }
+        qsort(s->samples, s->count, sizeof(uint64_t), compare_u64);
+        printf("%-8s %10zu %10.1f %10.1f %10.1f %10.1f\n", command_names[c], s->count,
+               percentile_us(s, 0.50), percentile_us(s, 0.99), percentile_us(s, 0.999), percentile_us(s, 1.0));
+    }
+
+    uint64_t failed = 0;
+    for (int f = 0; f < FAIL_COUNT; f++) {
+        failed += failures[f];
+    }
+    if (failed == 0) {
+        printf("\nNessun fallimento.\n");
+        return;
+    }
+    printf("\nFallimenti: %llu\n", (unsigned long long)failed);
+    for (int f = 0; f < FAIL_COUNT; f++) {
+        if (failures[f] > 0) {
+            printf("  %-32s %llu\n", failure_names[f], (unsigned long long)failures[f]);
+        }
+    }
+    for (int e = 0; e < 256; e++) {
+        if (connect_errors[e] > 0) {
+            printf("    connect: %-24s %llu\n", strerror(e), (unsigned long long)connect_errors[e]);
+        }
+    }
+    int known = (int)(sizeof(error_names) / sizeof(error_names[0]));
+    for (int e = 0; e < MAX_ERROR_CODES; e++) {
+        if (server_errors[e] > 0) {
+            printf("    server: %-25s %llu\n", e > 0 && e < known ? error_names[e] : "sconosciuto", (unsigned long long)server_errors[e]);
+        }
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-c connessioni] [-r round] [-p percentuale_pareggi] [-t timeout_s]\n"
+                    "Server da SERVER_HOST e SERVER_PORT, come il client.\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:p:t:h")) != -1) {
+        switch (opt) {
+            case 'c': opt_connections = atoi(optarg); break;
+            case 'r': opt_rounds = atoi(optarg); break;
+            case 'p': opt_draw_percent = atoi(optarg); break;
+            case 't': opt_timeout = atoi(optarg); break;
+            default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (opt_connections < 2 || opt_rounds < 1 || opt_draw_percent < 0 || opt_draw_percent > 100 || opt_timeout < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    int num_pairs = opt_connections / 2;
+
+    // Host e porta come nel client interattivo
+    const char *server_host = getenv("SERVER_HOST") ? getenv("SERVER_HOST") : "127.0.0.1";
+    char server_port_str[6];
+    if (getenv("SERVER_PORT")) {
+        snprintf(server_port_str, sizeof(server_port_str), "%s", getenv("SERVER_PORT"));
+    } else {
+        snprintf(server_port_str, sizeof(server_port_str), "%d", PORT_DEFAULT);
+    }
+    struct addrinfo hints, *servinfo;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(server_host, server_port_str, &hints, &servinfo);
+    if (status != 0) {
+        fprintf(stderr, "Errore getaddrinfo: %s\n", gai_strerror(status));
+        return EXIT_FAILURE;
+    }
+
+    // Migliaia di connessioni richiedono più descrittori del limite predefinito
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)opt_connections + 64) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < (rlim_t)opt_connections + 64) {
+            fprintf(stderr, "Attenzione: limite di descrittori (%llu) insufficiente per %d connessioni\n",
+                    (unsigned long long)limit.rlim_cur, opt_connections);
+        }
+    }
+
+    Pair *pairs = calloc((size_t)num_pairs, sizeof(Pair));
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!pairs || epoll_fd < 0) {
+        perror("calloc/epoll_create1");
+        return EXIT_FAILURE;
+    }
+    rng ^= (uint32_t)getpid() * 2654435761u;
+
+    printf("Generatore di carico: %d connessioni (%d coppie) verso %s:%s, %d round per coppia, %d%% pareggi\n",
+           num_pairs * 2, num_pairs, server_host, server_port_str, opt_rounds, opt_draw_percent);
+    fflush(stdout);
+
+    uint64_t started = now_ns();
+    for (int i = 0; i < num_pairs; i++) {
+        Pair *pair = &pairs[i];
+        pair->active = true;
+        pair->last_progress_ns = started;
+        pair->draw_round = (int)(next_random() % 100) < opt_draw_percent;
+        active_pairs++;
+        for (int k = 0; k < 2; k++) {
+            pair->conns[k].fd = -1;
+            pair->conns[k].pair = pair;
+            pair->conns[k].awaiting = CMD_NONE;
+        }
+        if (!start_conn(&pair->conns[0], epoll_fd, servinfo) ||
+            !start_conn(&pair->conns[1], epoll_fd, servinfo)) {
+            fail_pair(pair, FAIL_CONNECT);
+        }
+    }
+    freeaddrinfo(servinfo);
+
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t last_check = started;
+    while (active_pairs > 0) {
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+        if (nfds < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nfds; i++) {
+            handle_event(events[i].data.ptr, events[i].events);
+        }
+        uint64_t now = now_ns();
+        if (now - last_check >= 100000000u) {
+            check_timeouts(pairs, num_pairs, now);
+            last_check = now;
+        }
+    }
+
+    print_report((double)(now_ns() - started) / 1e9, num_pairs);
+    return pairs_completed == num_pairs ? EXIT_SUCCESS : EXIT_FAILURE;
+}
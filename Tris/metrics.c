@@ -0,0 +1,342 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS non è definito in modalità C99 stretta
+#include "metrics.h"
+#include "tris_protocol.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Nomi dei comandi nelle etichette, nell'ordine di MetricCommand
+static const char *const command_names[METRIC_CMD_COUNT] = {
+    "list", "create", "join", "queue", "watch", "unwatch", "resume", "login", "rating", "top",
+    "replay", "accept", "reject", "leave", "move", "rematch", "hint", "quit", "other"
+};
+
+// Nomi degli stati delle partite, nell'ordine di GameState
+static const char *const state_names[METRICS_GAME_STATES] = { "new", "waiting", "in_progress", "ended" };
+
+// Nomi dei pool di oggetti, nell'ordine di MetricPool
+static const char *const pool_names[METRIC_POOL_COUNT] = { "client", "game", "buffer_small", "buffer" };
+
+int metrics_create(Metrics *metrics, int num_shards, uint64_t now_ms) {
+    void *mem = mmap(NULL, (size_t)num_shards * sizeof(ShardMetrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    // La memoria anonima è già azzerata e allineata alla pagina: ogni shard parte dalla propria linea di cache
+    metrics->num_shards = num_shards;
+    metrics->started_ms = now_ms;
+    metrics->shards = mem;
+    return 0;
+}
+
+void metrics_reset_gauges(Metrics *metrics, int shard) {
+    ShardMetrics *m = &metrics->shards[shard];
+    METRICS_SET(m->clients, 0);
+    METRICS_SET(m->games, 0);
+    for (int p = 0; p < METRIC_POOL_COUNT; p++) {
+        METRICS_SET(m->pool_live[p], 0);
+        METRICS_SET(m->pool_capacity[p], 0);
+    }
+    METRICS_SET(m->moves_per_sec, 0);
+    METRICS_SET(m->accepts_per_sec, 0);
+}
+
+uint64_t metrics_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Confronta la prima parola di line con word
+static int first_word_is(const char *line, const char *word) {
+    size_t len = strlen(word);
+    return strncmp(line, word, len) == 0 && (line[len] == '\0' || line[len] == ' ');
+}
+
+MetricCommand metrics_text_command(const char *line) {
+    for (int c = 0; c < METRIC_CMD_OTHER; c++) {
+        if (first_word_is(line, command_names[c])) {
+            return (MetricCommand)c;
+        }
+    }
+    return first_word_is(line, "replays") ? METRIC_CMD_REPLAY : METRIC_CMD_OTHER;
+}
+
+MetricCommand metrics_frame_command(uint8_t op) {
+    switch (op) {
+        case PROTO_OP_LIST: return METRIC_CMD_LIST;
+        case PROTO_OP_CREATE: return METRIC_CMD_CREATE;
+        case PROTO_OP_JOIN: return METRIC_CMD_JOIN;
+        case PROTO_OP_QUEUE: return METRIC_CMD_QUEUE;
+        case PROTO_OP_WATCH: return METRIC_CMD_WATCH;
+        case PROTO_OP_UNWATCH: return METRIC_CMD_UNWATCH;
+        case PROTO_OP_RESUME: return METRIC_CMD_RESUME;
+        case PROTO_OP_RATING: return METRIC_CMD_RATING;
+        case PROTO_OP_REPLAY:
+        case PROTO_OP_REPLAYS: return METRIC_CMD_REPLAY;
+        case PROTO_OP_ACCEPT: return METRIC_CMD_ACCEPT;
+        case PROTO_OP_REJECT: return METRIC_CMD_REJECT;
+        case PROTO_OP_LEAVE: return METRIC_CMD_LEAVE;
+        case PROTO_OP_MOVE: return METRIC_CMD_MOVE;
+        case PROTO_OP_REMATCH: return METRIC_CMD_REMATCH;
+        case PROTO_OP_HINT: return METRIC_CMD_HINT;
+        case PROTO_OP_QUIT: return METRIC_CMD_QUIT;
+        default: return METRIC_CMD_OTHER;
+    }
+}
+
+const char *metrics_command_name(MetricCommand command) {
+    return command >= 0 && command < METRIC_CMD_COUNT ? command_names[command] : command_names[METRIC_CMD_OTHER];
+}
+
+// Indice del bucket a potenze di 2 che contiene value: il più piccolo i con value <= 2^i, al più last
+static int log2_bucket(uint64_t value, int last) {
+    if (value <= 1) {
+        return 0;
+    }
+    int bucket = 64 - __builtin_clzll(value - 1);
+    return bucket < last ? bucket : last;
+}
+
+void metrics_observe_command(ShardMetrics *m, MetricCommand command, uint64_t elapsed_ns) {
+    MetricHistogram *h = &m->commands[command];
+    METRICS_ADD(h->count, 1);
+    METRICS_ADD(h->sum_ns, elapsed_ns);
+    METRICS_ADD(h->buckets[log2_bucket(elapsed_ns / 1000, METRICS_LATENCY_BUCKETS - 1)], 1);
+}
+
+void metrics_observe_output(ShardMetrics *m, size_t queued_bytes) {
+    // Il bucket 0 arriva a 64 byte: si sposta la scala di 6 bit
+    int bucket = queued_bytes <= 64 ? 0 : log2_bucket((queued_bytes + 63) >> 6, METRICS_DEPTH_BUCKETS - 1);
+    METRICS_ADD(m->output_depth[bucket], 1);
+    METRICS_ADD(m->output_depth_sum, queued_bytes);
+}
+
+void metrics_tick(ShardMetrics *m, uint64_t now_ms) {
+    uint64_t elapsed = now_ms - m->rate_since_ms;
+    if (elapsed < 1000) {
+        return;
+    }
+    uint64_t moves = m->moves, accepted = m->accepted; // Scritti solo da questo thread
+    if (m->rate_since_ms != 0) {
+        METRICS_SET(m->moves_per_sec, (moves - m->rate_moves) * 1000 / elapsed);
+        METRICS_SET(m->accepts_per_sec, (accepted - m->rate_accepted) * 1000 / elapsed);
+    }
+    m->rate_moves = moves;
+    m->rate_accepted = accepted;
+    METRICS_SET(m->rate_since_ms, now_ms);
+}
+
+void metrics_snapshot(const Metrics *metrics, const GameDirectory *dir, uint64_t now_ms, MetricsSnapshot *out) {
+    memset(out, 0, sizeof(*out));
+    uint64_t *total = (uint64_t *)&out->total;
+    size_t words = offsetof(ShardMetrics, rate_since_ms) / sizeof(uint64_t);
+    for (int s = 0; s < metrics->num_shards; s++) {
+        const ShardMetrics *m = &metrics->shards[s];
+        const uint64_t *src = (const uint64_t *)m;
+        for (size_t i = 0; i < words; i++) {
+            total[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+        // Uno shard fermo in epoll_wait da più di un secondo non ha chiuso la finestra: nel frattempo non ha giocato mosse
+        uint64_t since = __atomic_load_n(&m->rate_since_ms, __ATOMIC_RELAXED);
+        if (since != 0 && now_ms - since < 2000) {
+            out->total.moves_per_sec += __atomic_load_n(&m->moves_per_sec, __ATOMIC_RELAXED);
+            out->total.accepts_per_sec += __atomic_load_n(&m->accepts_per_sec, __ATOMIC_RELAXED);
+        }
+    }
+    out->uptime_ms = now_ms - metrics->started_ms;
+
+    if (!dir) {
+        return;
+    }
+    for (int s = 0; s < dir->num_shards; s++) {
+        uint32_t used = __atomic_load_n(&dir->high_water[s], __ATOMIC_ACQUIRE);
+        for (uint32_t slot = 0; slot < used; slot++) {
+            DirectoryEntry entry;
+            if (directory_read(dir, s, (int)slot, &entry) == 0 && entry.state >= 0 && entry.state < METRICS_GAME_STATES) {
+                out->games_by_state[entry.state]++;
+            }
+        }
+    }
+}
+
+// Scrittura formattata in coda a un buffer che non trabocca mai: l'eccedenza viene troncata
+typedef struct {
+    char *data;
+    size_t cap;
+    size_t len;
+} TextOut;
+
+static void text_printf(TextOut *out, const char *format, ...) {
+    if (out->len + 1 >= out->cap) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->data + out->len, out->cap - out->len, format, args);
+    va_end(args);
+    if (n > 0) {
+        out->len += (size_t)n < out->cap - out->len ? (size_t)n : out->cap - out->len - 1;
+    }
+}
+
+// Limite superiore in secondi del bucket di latenza i (2^i microsecondi)
+static double latency_bound_seconds(int bucket) {
+    return (double)(1ull << bucket) / 1e6;
+}
+
+static void prometheus_counter(TextOut *out, const char *name, const char *help, uint64_t value) {
+    text_printf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+static void prometheus_gauge(TextOut *out, const char *name, const char *help, uint64_t value) {
+    text_printf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+size_t metrics_format_prometheus(const MetricsSnapshot *snap, char *out, size_t cap) {
+    TextOut text = { out, cap, 0 };
+    const ShardMetrics *t = &snap->total;
+    if (cap > 0) {
+        out[0] = '\0';
+    }
+
+    text_printf(&text, "# HELP tris_command_duration_seconds Latenza degli handler dei comandi.\n"
+                       "# TYPE tris_command_duration_seconds histogram\n");
+    for (int c = 0; c < METRIC_CMD_COUNT; c++) {
+        const MetricHistogram *h = &t->commands[c];
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRICS_LATENCY_BUCKETS - 1; b++) {
+            cumulative += h->buckets[b];
+            text_printf(&text, "tris_command_duration_seconds_bucket{command=\"%s\",le=\"%g\"} %llu\n",
+                        command_names[c], latency_bound_seconds(b), (unsigned long long)cumulative);
+        }
+        text_printf(&text, "tris_command_duration_seconds_bucket{command=\"%s\",le=\"+Inf\"} %llu\n"
+                           "tris_command_duration_seconds_sum{command=\"%s\"} %.9f\n"
+                           "tris_command_duration_seconds_count{command=\"%s\"} %llu\n",
+                    command_names[c], (unsigned long long)h->count,
+                    command_names[c], (double)h->sum_ns / 1e9,
+                    command_names[c], (unsigned long long)h->count);
+    }
+
+    text_printf(&text, "# HELP tris_output_queue_bytes Byte nella coda di output di un client a ogni svuotamento.\n"
+                       "# TYPE tris_output_queue_bytes histogram\n");
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_DEPTH_BUCKETS - 1; b++) {
+        cumulative += t->output_depth[b];
+        text_printf(&text, "tris_output_queue_bytes_bucket{le=\"%llu\"} %llu\n", 64ull << b, (unsigned long long)cumulative);
+    }
+    cumulative += t->output_depth[METRICS_DEPTH_BUCKETS - 1];
+    text_printf(&text, "tris_output_queue_bytes_bucket{le=\"+Inf\"} %llu\n"
+                       "tris_output_queue_bytes_sum %llu\n"
+                       "tris_output_queue_bytes_count %llu\n",
+                (unsigned long long)cumulative, (unsigned long long)t->output_depth_sum, (unsigned long long)cumulative);
+
+    prometheus_counter(&text, "tris_output_backlogged_total", "Svuotamenti interrotti dal socket pieno.", t->output_backlogged);
+    prometheus_counter(&text, "tris_output_overflow_disconnects_total", "Client disconnessi perche' non leggevano il proprio output.", t->output_overflows);
+    prometheus_counter(&text, "tris_moves_total", "Mosse giocate, comprese quelle del bot.", t->moves);
+    prometheus_counter(&text, "tris_connections_accepted_total", "Connessioni accettate.", t->accepted);
+    prometheus_counter(&text, "tris_received_bytes_total", "Byte ricevuti dai client.", t->bytes_in);
+    prometheus_counter(&text, "tris_sent_bytes_total", "Byte inviati ai client.", t->bytes_out);
+    prometheus_counter(&text, "tris_handoffs_total", "Client trasferiti a un altro shard.", t->handoffs);
+    prometheus_counter(&text, "tris_handoffs_queued_total", "Trasferimenti verso altri worker accodati in attesa del socket UNIX.", t->handoffs_queued);
+    prometheus_gauge(&text, "tris_moves_per_second", "Mosse nell'ultimo secondo.", t->moves_per_sec);
+    prometheus_gauge(&text, "tris_accepts_per_second", "Connessioni accettate nell'ultimo secondo.", t->accepts_per_sec);
+    prometheus_gauge(&text, "tris_clients", "Client connessi.", t->clients);
+
+    text_printf(&text, "# HELP tris_games Partite per stato.\n# TYPE tris_games gauge\n");
+    for (int s = 0; s < METRICS_GAME_STATES; s++) {
+        text_printf(&text, "tris_games{state=\"%s\"} %llu\n", state_names[s], (unsigned long long)snap->games_by_state[s]);
+    }
+    text_printf(&text, "# HELP tris_pool_objects Oggetti in uso nei pool degli shard.\n# TYPE tris_pool_objects gauge\n");
+    for (int p = 0; p < METRIC_POOL_COUNT; p++) {
+        text_printf(&text, "tris_pool_objects{pool=\"%s\"} %llu\n", pool_names[p], (unsigned long long)t->pool_live[p]);
+    }
+    text_printf(&text, "# HELP tris_pool_capacity_objects Oggetti contenuti nelle slab mappate dei pool.\n# TYPE tris_pool_capacity_objects gauge\n");
+    for (int p = 0; p < METRIC_POOL_COUNT; p++) {
+        text_printf(&text, "tris_pool_capacity_objects{pool=\"%s\"} %llu\n", pool_names[p], (unsigned long long)t->pool_capacity[p]);
+    }
+    prometheus_counter(&text, "tris_pool_resets_total", "Pool svuotati con restituzione delle slab in eccesso.", t->pool_resets);
+    text_printf(&text, "# HELP tris_uptime_seconds Secondi dall'avvio del server.\n# TYPE tris_uptime_seconds gauge\n"
+                       "tris_uptime_seconds %llu\n", (unsigned long long)(snap->uptime_ms / 1000));
+    return text.len;
+}
+
+// Limite superiore del bucket che contiene il quantile q di un istogramma (indice del bucket, -1 se vuoto)
+static int quantile_bucket(const uint64_t *buckets, int count, uint64_t total, double q) {
+    if (total == 0) {
+        return -1;
+    }
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < count; b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return b;
+        }
+    }
+    return count - 1;
+}
+
+// Scrive "<=N us" per il bucket di latenza b ("oltre" per l'ultimo)
+static void latency_label(char *out, size_t cap, int bucket) {
+    if (bucket >= METRICS_LATENCY_BUCKETS - 1) {
+        snprintf(out, cap, ">%llu us", 1ull << (METRICS_LATENCY_BUCKETS - 2));
+    } else {
+        snprintf(out, cap, "<=%llu us", 1ull << bucket);
+    }
+}
+
+size_t metrics_format_summary(const MetricsSnapshot *snap, char *out, size_t cap) {
+    TextOut text = { out, cap, 0 };
+    const ShardMetrics *t = &snap->total;
+    if (cap > 0) {
+        out[0] = '\0';
+    }
+
+    text_printf(&text, "Statistiche del server (attivo da %llu s):\n", (unsigned long long)(snap->uptime_ms / 1000));
+    text_printf(&text, "Client connessi: %llu. Partite: %llu in attesa, %llu in corso, %llu terminate.\n",
+                (unsigned long long)t->clients, (unsigned long long)snap->games_by_state[1],
+                (unsigned long long)snap->games_by_state[2], (unsigned long long)snap->games_by_state[3]);
+    text_printf(&text, "Mosse: %llu (%llu/s). Connessioni accettate: %llu (%llu/s). Trasferimenti tra shard: %llu (%llu accodati).\n",
+                (unsigned long long)t->moves, (unsigned long long)t->moves_per_sec,
+                (unsigned long long)t->accepted, (unsigned long long)t->accepts_per_sec, (unsigned long long)t->handoffs,
+                (unsigned long long)t->handoffs_queued);
+    text_printf(&text, "Byte ricevuti: %llu, inviati: %llu.\n", (unsigned long long)t->bytes_in, (unsigned long long)t->bytes_out);
+
+    uint64_t flushes = 0;
+    for (int b = 0; b < METRICS_DEPTH_BUCKETS; b++) {
+        flushes += t->output_depth[b];
+    }
+    int p50 = quantile_bucket(t->output_depth, METRICS_DEPTH_BUCKETS, flushes, 0.50);
+    int p99 = quantile_bucket(t->output_depth, METRICS_DEPTH_BUCKETS, flushes, 0.99);
+    text_printf(&text, "Code di output: %llu svuotamenti, p50 <=%llu B, p99 <=%llu B, %llu interrotti dal socket pieno, %llu client disconnessi.\n",
+                (unsigned long long)flushes, p50 < 0 ? 0ull : 64ull << p50, p99 < 0 ? 0ull : 64ull << p99,
+                (unsigned long long)t->output_backlogged, (unsigned long long)t->output_overflows);
+
+    text_printf(&text, "Pool (in uso/capacità):");
+    for (int p = 0; p < METRIC_POOL_COUNT; p++) {
+        text_printf(&text, " %s %llu/%llu%s", pool_names[p], (unsigned long long)t->pool_live[p],
+                    (unsigned long long)t->pool_capacity[p], p < METRIC_POOL_COUNT - 1 ? "," : ".");
+    }
+    text_printf(&text, " Svuotamenti: %llu.\n", (unsigned long long)t->pool_resets);
+
+    text_printf(&text, "%-8s %10s %12s %12s %10s\n", "comando", "chiamate", "p50", "p99", "media");
+    for (int c = 0; c < METRIC_CMD_COUNT; c++) {
+        const MetricHistogram *h = &t->commands[c];
+        if (h->count == 0) {
+            continue;
+        }
+        char p50_text[24], p99_text[24];
+        latency_label(p50_text, sizeof(p50_text), quantile_bucket(h->buckets, METRICS_LATENCY_BUCKETS, h->count, 0.50));
+        latency_label(p99_text, sizeof(p99_text), quantile_bucket(h->buckets, METRICS_LATENCY_BUCKETS, h->count, 0.99));
+        text_printf(&text, "%-8s %10llu %12s %12s %7.1f us\n", command_names[c], (unsigned long long)h->count,
+                    p50_text, p99_text, (double)h->sum_ns / (double)h->count / 1000.0);
+    }
+    return text.len;
+}
@@ -0,0 +1,141 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "game_directory.h"
+
+#define METRICS_LATENCY_BUCKETS 22 // Bucket i: latenza fino a 2^i microsecondi; l'ultimo raccoglie tutto il resto
+#define METRICS_DEPTH_BUCKETS 16   // Bucket i: coda di output fino a 2^(i + 6) byte; l'ultimo raccoglie tutto il resto
+#define METRICS_GAME_STATES 4      // Stati di una partita (GameState del server)
+#define METRICS_TEXT_MAX (64 * 1024) // Spazio sufficiente per l'esposizione completa in formato Prometheus
+
+// Incrementa un contatore di cui il thread chiamante è l'unico scrittore: load e store atomiche rilassate,
+// senza istruzioni con prefisso lock. I lettori di altri processi vedono sempre un valore intero.
+#define METRICS_ADD(counter, n) \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (uint64_t)(n), __ATOMIC_RELAXED)
+
+// Imposta un indicatore (valore istantaneo) di cui il thread chiamante è l'unico scrittore
+#define METRICS_SET(gauge, v) __atomic_store_n(&(gauge), (uint64_t)(v), __ATOMIC_RELAXED)
+
+// Comandi misurati separatamente: testuali e binari finiscono nello stesso contatore
+typedef enum {
+    METRIC_CMD_LIST = 0,
+    METRIC_CMD_CREATE,
+    METRIC_CMD_JOIN,
+    METRIC_CMD_QUEUE,
+    METRIC_CMD_WATCH,
+    METRIC_CMD_UNWATCH,
+    METRIC_CMD_RESUME,
+    METRIC_CMD_LOGIN,
+    METRIC_CMD_RATING,
+    METRIC_CMD_TOP,
+    METRIC_CMD_REPLAY,
+    METRIC_CMD_ACCEPT,
+    METRIC_CMD_REJECT,
+    METRIC_CMD_LEAVE,
+    METRIC_CMD_MOVE,
+    METRIC_CMD_REMATCH,
+    METRIC_CMD_HINT,
+    METRIC_CMD_QUIT,
+    METRIC_CMD_OTHER,       // binary, stats, comandi sconosciuti
+    METRIC_CMD_COUNT
+} MetricCommand;
+
+// Pool di oggetti di uno shard di cui si espone l'occupazione
+typedef enum {
+    METRIC_POOL_CLIENT = 0,
+    METRIC_POOL_GAME,
+    METRIC_POOL_BUFFER_SMALL, // Buffer brevi della coda di output (testi e tabelloni condivisi), slot di 256 byte
+    METRIC_POOL_BUFFER,       // Buffer della coda di output fino a OUTPUT_CHUNK_SIZE byte
+    METRIC_POOL_COUNT
+} MetricPool;
+
+// Istogramma delle latenze di un comando, con bucket a potenze di 2
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;        // Somma delle latenze in nanosecondi
+    uint64_t buckets[METRICS_LATENCY_BUCKETS]; // Non cumulativi
+} MetricHistogram;
+
+// Metriche di uno shard. Ogni shard scrive solo le proprie, in linee di cache separate da quelle degli altri:
+// il percorso dei comandi non usa lock né operazioni atomiche read-modify-write.
+typedef struct {
+    MetricHistogram commands[METRIC_CMD_COUNT]; // Latenza degli handler per comando
+    uint64_t moves;         // Mosse giocate (anche dal bot)
+    uint64_t accepted;      // Connessioni accettate
+    uint64_t bytes_in;      // Byte letti dai socket dei client
+    uint64_t bytes_out;     // Byte scritti sui socket dei client
+    uint64_t handoffs;      // Client trasferiti ad altri shard
+    uint64_t handoffs_queued; // Trasferimenti verso altri worker accodati in attesa del socket UNIX
+    uint64_t output_depth[METRICS_DEPTH_BUCKETS]; // Byte in coda al momento di ogni svuotamento (non cumulativi)
+    uint64_t output_depth_sum; // Somma dei byte in coda su tutti gli svuotamenti
+    uint64_t output_backlogged; // Svuotamenti interrotti dal socket pieno: il resto parte con EPOLLOUT
+    uint64_t output_overflows;  // Client disconnessi perché non leggevano il proprio output
+    uint64_t clients;       // Indicatore: client connessi allo shard
+    uint64_t games;         // Indicatore: partite ospitate dallo shard
+    uint64_t pool_live[METRIC_POOL_COUNT];     // Indicatore: oggetti in uso di ogni pool dello shard
+    uint64_t pool_capacity[METRIC_POOL_COUNT]; // Indicatore: oggetti contenuti nelle slab mappate di ogni pool
+    uint64_t pool_resets;   // Svuotamenti dei pool con restituzione delle slab in eccesso al sistema
+    // Campi precedenti: tutti uint64_t, sommati parola per parola da metrics_snapshot
+    uint64_t rate_since_ms; // Inizio della finestra di un secondo su cui si misurano mosse e connessioni al secondo
+    uint64_t rate_moves;    // Mosse all'inizio della finestra
+    uint64_t rate_accepted; // Connessioni all'inizio della finestra
+    uint64_t moves_per_sec; // Indicatore: mosse nell'ultima finestra completa
+    uint64_t accepts_per_sec; // Indicatore: connessioni nell'ultima finestra completa
+} __attribute__((aligned(64))) ShardMetrics;
+
+// Metriche di tutti gli shard in memoria condivisa anonima: va creata prima della fork, come la directory
+typedef struct {
+    int num_shards;
+    uint64_t started_ms;    // Avvio del server (orologio monotono)
+    ShardMetrics *shards;   // num_shards voci
+} Metrics;
+
+// Somma delle metriche di tutti gli shard più lo stato delle partite letto dalla directory
+typedef struct {
+    ShardMetrics total;
+    uint64_t games_by_state[METRICS_GAME_STATES]; // Partite in ogni GameState
+    uint64_t uptime_ms;
+} MetricsSnapshot;
+
+// Alloca le metriche di num_shards shard in memoria condivisa. Restituisce 0 se riuscito, -1 altrimenti.
+int metrics_create(Metrics *metrics, int num_shards, uint64_t now_ms);
+
+// Azzera gli indicatori di uno shard (il worker che lo ospitava è terminato); i contatori restano
+void metrics_reset_gauges(Metrics *metrics, int shard);
+
+// Lettura dell'orologio monotono in nanosecondi per misurare la latenza di un handler
+uint64_t metrics_clock_ns(void);
+
+// Classifica un comando testuale dalla prima parola
+MetricCommand metrics_text_command(const char *line);
+
+// Classifica un frame binario dal suo codice operativo
+MetricCommand metrics_frame_command(uint8_t op);
+
+// Nome di un comando misurato (la prima parola del comando testuale, "other" per il resto)
+const char *metrics_command_name(MetricCommand command);
+
+// Registra la latenza di un comando eseguito dallo shard
+void metrics_observe_command(ShardMetrics *m, MetricCommand command, uint64_t elapsed_ns);
+
+// Registra la dimensione della coda di output di un client prima di uno svuotamento
+void metrics_observe_output(ShardMetrics *m, size_t queued_bytes);
+
+// Chiude la finestra di un secondo delle frequenze se è trascorsa; chiamata dallo shard a ogni giro di eventi
+void metrics_tick(ShardMetrics *m, uint64_t now_ms);
+
+// Raccoglie le metriche di tutti gli shard e conta le partite della directory per stato (dir può essere NULL)
+void metrics_snapshot(const Metrics *metrics, const GameDirectory *dir, uint64_t now_ms, MetricsSnapshot *out);
+
+// Scrive in out (al più cap byte, terminatore compreso) le metriche nel formato di esposizione di Prometheus.
+// Restituisce i byte scritti.
+size_t metrics_format_prometheus(const MetricsSnapshot *snap, char *out, size_t cap);
+
+// Scrive in out un riepilogo leggibile, con i percentili 50 e 99 della latenza di ogni comando usato.
+// Restituisce i byte scritti.
+size_t metrics_format_summary(const MetricsSnapshot *snap, char *out, size_t cap);
+
+#endif // METRICS_H
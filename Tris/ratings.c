@@ -0,0 +1,351 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS e i mutex robusti non sono definiti in modalità C99 stretta
+#include "ratings.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RATINGS_MAGIC "TRP1"
+#define RATING_K 16             // Fattore K di un giocatore con almeno RATING_PROVISIONAL_GAMES partite
+
+// Intestazione del file dei giocatori, seguita da capacity voci RatingAccount
+typedef struct {
+    char magic[4];          // RATINGS_MAGIC
+    uint32_t capacity;      // Voci nel file
+    uint32_t reserved[2];
+} RatingFileHeader;
+
+// Bucket di un punteggio: il bucket 0 è quello del punteggio più alto, così un prefisso conta chi sta davanti
+static int bucket_of(int32_t rating) {
+    return RATING_MAX - 1 - rating;
+}
+
+static int32_t clamp_rating(int32_t rating) {
+    return rating < 0 ? 0 : rating >= RATING_MAX ? RATING_MAX - 1 : rating;
+}
+
+// Aggiunge delta al conteggio del bucket (albero di Fenwick con indici da 1)
+static void fenwick_add(RatingIndex *index, int bucket, int32_t delta) {
+    for (int i = bucket + 1; i <= RATING_MAX; i += i & -i) {
+        index->fenwick[i] += (uint32_t)delta;
+    }
+}
+
+// Giocatori nei bucket [0, bucket)
+static uint32_t fenwick_prefix(const RatingIndex *index, int bucket) {
+    uint32_t sum = 0;
+    for (int i = bucket; i > 0; i -= i & -i) {
+        sum += index->fenwick[i];
+    }
+    return sum;
+}
+
+// Bucket che contiene il giocatore in posizione rank (da 1): discesa binaria sull'albero
+static int fenwick_find(const RatingIndex *index, uint32_t rank) {
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= RATING_MAX) {
+        step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+        if (pos + step <= RATING_MAX && index->fenwick[pos + step] < rank) {
+            pos += step;
+            rank -= index->fenwick[pos];
+        }
+    }
+    return pos; // Bucket pos (indice da 1: pos + 1)
+}
+
+static void bucket_link(RatingTable *table, int32_t account) {
+    RatingIndex *index = table->index;
+    int bucket = bucket_of(table->accounts[account].rating);
+    table->prev[account] = -1;
+    table->next[account] = index->bucket_head[bucket];
+    if (table->next[account] >= 0) {
+        table->prev[table->next[account]] = account;
+    }
+    index->bucket_head[bucket] = account;
+    fenwick_add(index, bucket, 1);
+}
+
+static void bucket_unlink(RatingTable *table, int32_t account) {
+    RatingIndex *index = table->index;
+    int bucket = bucket_of(table->accounts[account].rating);
+    if (table->prev[account] >= 0) {
+        table->next[table->prev[account]] = table->next[account];
+    } else {
+        index->bucket_head[bucket] = table->next[account];
+    }
+    if (table->next[account] >= 0) {
+        table->prev[table->next[account]] = table->prev[account];
+    }
+    fenwick_add(index, bucket, -1);
+}
+
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (; *name; ++name) {
+        h = (h ^ (uint8_t)*name) * 16777619u;
+    }
+    return h;
+}
+
+// Posizione del nome nella tabella hash: la sua voce o la prima libera incontrata
+static uint32_t name_slot(const RatingTable *table, const char *name) {
+    uint32_t i = hash_name(name) & table->names_mask;
+    while (table->names[i] != 0 && strcmp(table->accounts[table->names[i] - 1].name, name) != 0) {
+        i = (i + 1) & table->names_mask;
+    }
+    return i;
+}
+
+// Ricostruisce indice per nome e classifica dalle voci: all'apertura e dopo la morte di un processo che teneva il lock
+static void rebuild_index(RatingTable *table) {
+    RatingIndex *index = table->index;
+    memset(index->fenwick, 0, sizeof(index->fenwick));
+    memset(index->bucket_head, 0xFF, sizeof(index->bucket_head));
+    memset(table->names, 0, ((size_t)table->names_mask + 1) * sizeof(int32_t));
+    index->count = 0;
+    while (index->count < table->capacity && table->accounts[index->count].name[0] != '\0') {
+        int32_t account = (int32_t)index->count++;
+        RatingAccount *a = &table->accounts[account];
+        a->name[RATING_NAME_MAX - 1] = '\0';
+        a->rating = clamp_rating(a->rating);
+        table->names[name_slot(table, a->name)] = account + 1;
+        bucket_link(table, account);
+    }
+}
+
+static void lock_table(RatingTable *table) {
+    if (pthread_mutex_lock(&table->index->lock) == EOWNERDEAD) {
+        // Il processo che lo teneva è terminato a metà di un aggiornamento: l'indice può essere incoerente
+        rebuild_index(table);
+        pthread_mutex_consistent(&table->index->lock);
+    }
+}
+
+static void unlock_table(RatingTable *table) {
+    pthread_mutex_unlock(&table->index->lock);
+}
+
+// Mappa le voci dal file (creandolo se serve) e restituisce la capacità effettiva, 0 in caso di errore
+static uint32_t map_accounts_file(RatingTable *table, const char *path, uint32_t capacity) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    RatingFileHeader header;
+    if (st.st_size == 0) {
+        memcpy(header.magic, RATINGS_MAGIC, sizeof(header.magic));
+        header.capacity = capacity;
+        header.reserved[0] = header.reserved[1] = 0;
+        if (ftruncate(fd, (off_t)(sizeof(header) + (size_t)capacity * sizeof(RatingAccount))) < 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            perror(path);
+            close(fd);
+            return 0;
+        }
+    } else if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               memcmp(header.magic, RATINGS_MAGIC, sizeof(header.magic)) != 0 || header.capacity == 0 ||
+               (uint64_t)st.st_size < sizeof(header) + (uint64_t)header.capacity * sizeof(RatingAccount)) {
+        fprintf(stderr, "%s: file dei giocatori non valido\n", path);
+        close(fd);
+        return 0;
+    }
+    size_t size = sizeof(header) + (size_t)header.capacity * sizeof(RatingAccount);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // La mappatura resta valida
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 0;
+    }
+    table->accounts = (RatingAccount *)((char *)map + sizeof(header));
+    return header.capacity;
+}
+
+int ratings_create(RatingTable *table, const char *path, uint32_t capacity) {
+    memset(table, 0, sizeof(*table));
+    if (path) {
+        capacity = map_accounts_file(table, path, capacity);
+        if (capacity == 0) {
+            return -1;
+        }
+    }
+    uint32_t names = 1;
+    while (names < 2 * capacity) {
+        names *= 2;
+    }
+    size_t accounts_size = path ? 0 : (size_t)capacity * sizeof(RatingAccount);
+    size_t links_size = 2 * (size_t)capacity * sizeof(int32_t);
+    size_t names_size = (size_t)names * sizeof(int32_t);
+    void *mem = mmap(NULL, sizeof(RatingIndex) + links_size + names_size + accounts_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    table->capacity = capacity;
+    table->index = mem;
+    table->next = (int32_t *)((char *)mem + sizeof(RatingIndex));
+    table->prev = table->next + capacity;
+    table->names = table->prev + capacity;
+    table->names_mask = names - 1;
+    if (!path) {
+        table->accounts = (RatingAccount *)(table->names + names);
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&table->index->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    rebuild_index(table);
+    return 0;
+}
+
+int ratings_valid_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= RATING_NAME_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int32_t ratings_login(RatingTable *table, const char *name) {
+    if (!ratings_valid_name(name)) {
+        return -1;
+    }
+    lock_table(table);
+    RatingIndex *index = table->index;
+    uint32_t slot = name_slot(table, name);
+    int32_t account = table->names[slot] - 1;
+    if (account < 0 && index->count < table->capacity) {
+        account = (int32_t)index->count;
+        RatingAccount *a = &table->accounts[account];
+        a->rating = RATING_INITIAL;
+        a->wins = a->draws = a->losses = 0;
+        snprintf(a->name, sizeof(a->name), "%s", name); // Per ultimo: una voce con il nome è completa
+        index->count++;
+        table->names[slot] = account + 1;
+        bucket_link(table, account);
+    }
+    unlock_table(table);
+    return account;
+}
+
+int32_t ratings_find(RatingTable *table, const char *name) {
+    if (!ratings_valid_name(name)) {
+        return -1;
+    }
+    lock_table(table);
+    int32_t account = table->names[name_slot(table, name)] - 1;
+    unlock_table(table);
+    return account;
+}
+
+int32_t ratings_rating(RatingTable *table, int32_t account) {
+    if (account < 0 || (uint32_t)account >= table->capacity) {
+        return RATING_INITIAL;
+    }
+    return __atomic_load_n(&table->accounts[account].rating, __ATOMIC_RELAXED); // Un valore vecchio va bene per abbinare
+}
+
+// Variazione Elo per un giocatore da rating contro opponent con punteggio score (0, 0.5 o 1)
+static int32_t elo_delta(const RatingAccount *player, int32_t opponent, double score) {
+    double expected = 1.0 / (1.0 + pow(10.0, (opponent - player->rating) / 400.0));
+    uint32_t games = player->wins + player->draws + player->losses;
+    int k = games < RATING_PROVISIONAL_GAMES ? 2 * RATING_K : RATING_K;
+    return (int32_t)lround(k * (score - expected));
+}
+
+static void apply_result(RatingTable *table, int32_t account, int32_t delta, double score) {
+    RatingAccount *a = &table->accounts[account];
+    bucket_unlink(table, account);
+    __atomic_store_n(&a->rating, clamp_rating(a->rating + delta), __ATOMIC_RELAXED);
+    if (score > 0.75) {
+        a->wins++;
+    } else if (score > 0.25) {
+        a->draws++;
+    } else {
+        a->losses++;
+    }
+    bucket_link(table, account);
+}
+
+void ratings_record(RatingTable *table, int32_t a, int32_t b, RatingOutcome outcome, int32_t *delta_a, int32_t *delta_b) {
+    *delta_a = *delta_b = 0;
+    lock_table(table);
+    int32_t count = (int32_t)table->index->count;
+    if (a >= 0 && b >= 0 && a < count && b < count && a != b) {
+        double score = outcome / 2.0;
+        RatingAccount *pa = &table->accounts[a];
+        RatingAccount *pb = &table->accounts[b];
+        int32_t rating_a = pa->rating;
+        int32_t rating_b = pb->rating;
+        *delta_a = elo_delta(pa, rating_b, score);
+        *delta_b = elo_delta(pb, rating_a, 1.0 - score);
+        apply_result(table, a, *delta_a, score);
+        apply_result(table, b, *delta_b, 1.0 - score);
+    }
+    unlock_table(table);
+}
+
+// Copia lo stato del giocatore con la posizione del suo bucket; va chiamata con il lock
+static void fill_info(const RatingTable *table, int32_t account, uint32_t rank, RatingInfo *out) {
+    const RatingAccount *a = &table->accounts[account];
+    out->account = account;
+    memcpy(out->name, a->name, sizeof(out->name));
+    out->rating = a->rating;
+    out->rank = rank;
+    out->players = table->index->count;
+    out->wins = a->wins;
+    out->draws = a->draws;
+    out->losses = a->losses;
+}
+
+int ratings_get(RatingTable *table, int32_t account, RatingInfo *out) {
+    int rc = -1;
+    lock_table(table);
+    if (account >= 0 && (uint32_t)account < table->index->count) {
+        uint32_t ahead = fenwick_prefix(table->index, bucket_of(table->accounts[account].rating));
+        fill_info(table, account, ahead + 1, out);
+        rc = 0;
+    }
+    unlock_table(table);
+    return rc;
+}
+
+int ratings_top(RatingTable *table, int n, RatingInfo *out) {
+    if (n > RATING_TOP_MAX) {
+        n = RATING_TOP_MAX;
+    }
+    int written = 0;
+    lock_table(table);
+    RatingIndex *index = table->index;
+    uint32_t rank = 1;
+    // Per ogni bucket non vuoto si scende nell'albero una volta sola e se ne elencano i giocatori
+    while (written < n && rank <= index->count) {
+        int bucket = fenwick_find(index, rank);
+        uint32_t bucket_rank = rank; // Tutti i giocatori del bucket hanno lo stesso punteggio e la stessa posizione
+        for (int32_t a = index->bucket_head[bucket]; a >= 0 && written < n; a = table->next[a]) {
+            fill_info(table, a, bucket_rank, &out[written++]);
+        }
+        rank = fenwick_prefix(index, bucket + 1) + 1; // Primo giocatore del bucket successivo
+    }
+    unlock_table(table);
+    return written;
+}
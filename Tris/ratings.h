@@ -0,0 +1,88 @@
+#ifndef RATINGS_H
+#define RATINGS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define RATING_NAME_MAX 32      // Byte del nome di un giocatore, terminatore compreso
+#define RATING_INITIAL 1500     // Punteggio Elo di un nuovo giocatore
+#define RATING_MAX 4000         // I punteggi sono limitati a [0, RATING_MAX): un bucket della classifica per punto
+#define RATING_PROVISIONAL_GAMES 30 // Partite in cui il punteggio si muove più in fretta (K doppio)
+#define RATING_TOP_MAX 50       // Voci al più restituite da ratings_top
+
+// Esito di una partita valutata, dal punto di vista del primo giocatore
+typedef enum {
+    RATING_LOSS = 0,
+    RATING_DRAW = 1,
+    RATING_WIN = 2
+} RatingOutcome;
+
+// Giocatore registrato. È l'unica parte della tabella salvata nel file: l'indice si ricostruisce all'apertura.
+typedef struct {
+    char name[RATING_NAME_MAX]; // Nome del giocatore ("" = voce libera)
+    int32_t rating;         // Punteggio Elo
+    uint32_t wins;
+    uint32_t draws;
+    uint32_t losses;
+} RatingAccount;
+
+// Stato di un giocatore restituito dalle interrogazioni
+typedef struct {
+    int32_t account;        // Indice del giocatore
+    char name[RATING_NAME_MAX];
+    int32_t rating;
+    uint32_t rank;          // Posizione in classifica (1 = primo; pari punteggio, pari posizione)
+    uint32_t players;       // Giocatori in classifica
+    uint32_t wins;
+    uint32_t draws;
+    uint32_t losses;
+} RatingInfo;
+
+// Indice in memoria condivisa anonima, ricostruito dai giocatori a ogni apertura
+typedef struct {
+    pthread_mutex_t lock;   // Mutex tra processi, robusto: un worker che termina tenendolo non blocca gli altri
+    uint32_t count;         // Giocatori registrati (le voci [0, count) sono occupate)
+    uint32_t fenwick[RATING_MAX + 1]; // Albero di Fenwick dei giocatori per bucket, dal punteggio più alto (indici da 1)
+    int32_t bucket_head[RATING_MAX]; // Primo giocatore di ogni bucket (-1 se vuoto)
+} RatingIndex;
+
+// Tabella dei giocatori condivisa da tutti i worker: va creata prima della fork.
+// Le voci stanno in una mappatura condivisa del file (se indicato), così i punteggi sopravvivono ai riavvii
+// e, senza msync(), a un crash del processo; l'indice per nome e per punteggio sta in memoria anonima.
+typedef struct {
+    uint32_t capacity;      // Giocatori al più registrabili
+    RatingAccount *accounts; // capacity voci
+    RatingIndex *index;
+    int32_t *next;          // next[a] = giocatore successivo nel bucket di a (-1 se ultimo)
+    int32_t *prev;          // prev[a] = giocatore precedente nel bucket di a (-1 se primo)
+    int32_t *names;         // Tabella hash ad indirizzamento aperto: indice del giocatore + 1 (0 = libera)
+    uint32_t names_mask;    // Dimensione della tabella hash - 1 (potenza di 2, almeno il doppio di capacity)
+} RatingTable;
+
+// Crea la tabella per capacity giocatori, caricando quelli del file path (NULL = solo in memoria).
+// Un file esistente conserva la capacità con cui è stato creato. Restituisce 0 se riuscito, -1 altrimenti.
+int ratings_create(RatingTable *table, const char *path, uint32_t capacity);
+
+// Vero se name è un nome valido: da 1 a RATING_NAME_MAX - 1 lettere, cifre, '_' o '-'
+int ratings_valid_name(const char *name);
+
+// Restituisce l'indice del giocatore name, registrandolo se nuovo; -1 se il nome non è valido o la tabella è piena
+int32_t ratings_login(RatingTable *table, const char *name);
+
+// Restituisce l'indice del giocatore name, -1 se non registrato
+int32_t ratings_find(RatingTable *table, const char *name);
+
+// Punteggio del giocatore (RATING_INITIAL per un indice non valido)
+int32_t ratings_rating(RatingTable *table, int32_t account);
+
+// Aggiorna i punteggi di a e b dopo una partita con l'esito indicato per a; scrive le variazioni in delta_a e delta_b
+void ratings_record(RatingTable *table, int32_t a, int32_t b, RatingOutcome outcome, int32_t *delta_a, int32_t *delta_b);
+
+// Legge lo stato e la posizione in classifica del giocatore: O(log RATING_MAX). Restituisce 0 se riuscito, -1 altrimenti.
+int ratings_get(RatingTable *table, int32_t account, RatingInfo *out);
+
+// Scrive in out i primi n giocatori della classifica (n <= RATING_TOP_MAX): O(n log RATING_MAX).
+// Restituisce il numero di voci scritte.
+int ratings_top(RatingTable *table, int n, RatingInfo *out);
+
+#endif // RATINGS_H
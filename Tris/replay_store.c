@@ -0,0 +1,524 @@
+#define _GNU_SOURCE // O_CLOEXEC e MAP_NORESERVE non sono definiti in modalità C99 stretta
+#include "replay_store.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REPLAY_MAGIC "TRR2" // TRR2: intestazione dei record con i giocatori e le loro catene
+#define REPLAY_INITIAL_BUFFER 4096
+#define REPLAY_INITIAL_INDEX 256
+
+// Intestazione del file dei replay
+typedef struct {
+    char magic[4];          // REPLAY_MAGIC
+    uint32_t layout;        // ReplayStore.layout di chi ha scritto il file
+    uint32_t shard;         // Shard a cui il file appartiene (entra negli ID dei replay)
+    uint32_t reserved;
+} ReplayFileHeader;
+
+int replay_move_bits(int cells) {
+    int bits = 1;
+    while ((1 << bits) < cells) {
+        bits++;
+    }
+    return bits;
+}
+
+size_t replay_packed_size(int cells, int moves) {
+    return ((size_t)moves * (size_t)replay_move_bits(cells) + 7) / 8;
+}
+
+// Le mosse sono al più 9 bit: una mossa occupa al più due byte consecutivi
+void replay_pack_move(uint8_t *packed, int bits, int index, int cell) {
+    size_t bit = (size_t)index * (size_t)bits;
+    uint32_t value = (uint32_t)cell << (bit & 7);
+    packed[bit >> 3] |= (uint8_t)value;
+    if ((bit & 7) + (size_t)bits > 8) {
+        packed[(bit >> 3) + 1] |= (uint8_t)(value >> 8);
+    }
+}
+
+int replay_unpack_move(const uint8_t *packed, int bits, int index) {
+    size_t bit = (size_t)index * (size_t)bits;
+    uint32_t value = packed[bit >> 3];
+    if ((bit & 7) + (size_t)bits > 8) {
+        value |= (uint32_t)packed[(bit >> 3) + 1] << 8;
+    }
+    return (int)((value >> (bit & 7)) & ((1u << bits) - 1));
+}
+
+// Scrive tutto il buffer, riprendendo dopo le scritture parziali
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static size_t align_record(size_t len) {
+    return (len + REPLAY_ALIGN - 1) & ~(size_t)(REPLAY_ALIGN - 1);
+}
+
+static uint32_t game_home(int32_t game_id, uint32_t capacity) {
+    return ((uint32_t)game_id * 2654435761u) & (capacity - 1);
+}
+
+int64_t replay_store_last_of_game(const ReplayStore *store, int32_t game_id) {
+    if (store->games_capacity == 0 || game_id == 0) {
+        return -1;
+    }
+    for (uint32_t i = game_home(game_id, store->games_capacity);; i = (i + 1) & (store->games_capacity - 1)) {
+        if (store->games[2 * i] == game_id) {
+            return store->games[2 * i + 1];
+        }
+        if (store->games[2 * i] == 0) {
+            return -1;
+        }
+    }
+}
+
+// Imposta l'ultimo record di una partita, facendo crescere la tabella oltre metà riempimento
+static bool put_game(ReplayStore *store, int32_t game_id, int32_t seq) {
+    if (2 * (store->games_count + 1) > store->games_capacity) {
+        uint32_t capacity = store->games_capacity > 0 ? store->games_capacity * 2 : REPLAY_INITIAL_INDEX;
+        int32_t *games = calloc((size_t)capacity * 2, sizeof(int32_t));
+        if (!games) {
+            perror("calloc");
+            return false;
+        }
+        for (uint32_t i = 0; i < store->games_capacity; ++i) {
+            if (store->games[2 * i] != 0) {
+                uint32_t j = game_home(store->games[2 * i], capacity);
+                while (games[2 * j] != 0) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                games[2 * j] = store->games[2 * i];
+                games[2 * j + 1] = store->games[2 * i + 1];
+            }
+        }
+        free(store->games);
+        store->games = games;
+        store->games_capacity = capacity;
+    }
+    uint32_t i = game_home(game_id, store->games_capacity);
+    while (store->games[2 * i] != 0 && store->games[2 * i] != game_id) {
+        i = (i + 1) & (store->games_capacity - 1);
+    }
+    if (store->games[2 * i] == 0) {
+        store->games[2 * i] = game_id;
+        store->games_count++;
+    }
+    store->games[2 * i + 1] = seq;
+    return true;
+}
+
+int replay_heads_create(ReplayHeads *heads, uint32_t shards, uint32_t accounts) {
+    // Le pagine di memoria anonima vengono allocate solo quando un giocatore salva il primo replay nello shard
+    size_t bytes = (size_t)shards * accounts * sizeof(uint32_t);
+    void *mem = mmap(NULL, bytes > 0 ? bytes : 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    heads->heads = mem;
+    heads->shards = shards;
+    heads->accounts = accounts;
+    heads->stable = false;
+    return 0;
+}
+
+// Posto di un giocatore in un record, -1 se non vi compare
+static int account_seat(const ReplayHeader *header, int32_t account) {
+    return header->accounts[0] == account ? 0 : header->accounts[1] == account ? 1 : -1;
+}
+
+static bool indexed_account(const ReplayStore *store, int32_t account) {
+    return store->account_heads && account >= 0 && (uint32_t)account < store->accounts;
+}
+
+// Ultimo record di un giocatore, anche se ancora in attesa del commit
+static uint32_t account_head(const ReplayStore *store, int32_t account) {
+    for (size_t i = store->pending_heads_len; i > 0; i -= 2) {
+        if (store->pending_heads[i - 2] == (uint32_t)account) {
+            return store->pending_heads[i - 1];
+        }
+    }
+    return __atomic_load_n(&store->account_heads[account], __ATOMIC_RELAXED);
+}
+
+// Aggiunge all'indice il record che inizia all'offset dato, collegandolo al record precedente della stessa partita.
+// Restituisce il suo numero di sequenza o -1.
+static int64_t index_record(ReplayStore *store, uint64_t offset, int32_t game_id) {
+    int64_t previous = replay_store_last_of_game(store, game_id);
+    if (store->count == store->capacity) {
+        uint32_t capacity = store->capacity > 0 ? store->capacity * 2 : REPLAY_INITIAL_INDEX;
+        uint64_t *offsets = realloc(store->offsets, (size_t)capacity * sizeof(uint64_t));
+        if (offsets) {
+            store->offsets = offsets;
+        }
+        int32_t *prev = offsets ? realloc(store->prev, (size_t)capacity * sizeof(int32_t)) : NULL;
+        if (!prev) {
+            perror("realloc");
+            return -1;
+        }
+        store->prev = prev;
+        store->capacity = capacity;
+    }
+    uint32_t seq = store->count;
+    if (!put_game(store, game_id, (int32_t)seq)) {
+        return -1;
+    }
+    store->offsets[seq] = offset;
+    store->prev[seq] = (int32_t)previous;
+    store->count++;
+    return seq;
+}
+
+// Vero se all'offset dato inizia un record completo del file mappato
+static bool valid_record(const ReplayStore *store, uint64_t offset) {
+    if (offset + sizeof(ReplayHeader) > store->size) {
+        return false;
+    }
+    const ReplayHeader *header = (const ReplayHeader *)(store->map + offset);
+    size_t cells = (size_t)header->rows * header->cols;
+    return header->len >= sizeof(ReplayHeader) && header->len % REPLAY_ALIGN == 0 && offset + header->len <= store->size &&
+           cells > 0 && sizeof(ReplayHeader) + replay_packed_size((int)cells, header->moves) <= header->len;
+}
+
+int replay_store_open(ReplayStore *store, const char *dir, int shard, uint32_t layout, ReplayHeads *heads) {
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+    store->layout = layout;
+    if (heads && (uint32_t)shard < heads->shards) {
+        store->account_heads = heads->heads + (size_t)shard * heads->accounts;
+        store->accounts = heads->accounts;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        return -1;
+    }
+    if (snprintf(store->path, sizeof(store->path), "%s/replay-%d.bin", dir, shard) >= (int)sizeof(store->path)) {
+        fprintf(stderr, "Percorso dei replay troppo lungo: %s\n", dir);
+        return -1;
+    }
+    int fd = open(store->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(store->path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    ReplayFileHeader header;
+    if (st.st_size == 0) {
+        memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+        header.layout = layout;
+        header.shard = (uint32_t)shard;
+        header.reserved = 0;
+        if (write_all(fd, &header, sizeof(header)) < 0) {
+            perror(store->path);
+            close(fd);
+            return -1;
+        }
+        st.st_size = sizeof(header);
+    } else if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0 || header.layout != layout) {
+        // Gli ID dei replay dipendono dal numero di shard: un file di un'altra configurazione non va esteso
+        fprintf(stderr, "%s: file non valido o scritto con un'altra configurazione, replay disattivati (spostare il file per ripartire)\n", store->path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, REPLAY_MAP_BYTES, PROT_READ, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+    store->fd = fd;
+    store->map = map;
+    store->size = (uint64_t)st.st_size < REPLAY_MAP_BYTES ? (uint64_t)st.st_size : REPLAY_MAP_BYTES;
+
+    // La riga delle teste può essere di un worker terminato: la si ricostruisce dal file, in ordine di scrittura
+    for (uint32_t i = 0; store->account_heads && i < store->accounts; ++i) {
+        __atomic_store_n(&store->account_heads[i], 0, __ATOMIC_RELAXED);
+    }
+    uint64_t offset = sizeof(ReplayFileHeader);
+    while (offset < store->size && valid_record(store, offset)) {
+        const ReplayHeader *record = (const ReplayHeader *)(store->map + offset);
+        if (index_record(store, offset, record->game_id) < 0) {
+            break;
+        }
+        for (int seat = 0; seat < 2 && heads && heads->stable; ++seat) {
+            if (indexed_account(store, record->accounts[seat])) {
+                __atomic_store_n(&store->account_heads[record->accounts[seat]], (uint32_t)offset, __ATOMIC_RELEASE);
+            }
+        }
+        offset += record->len;
+    }
+    if (offset < (uint64_t)st.st_size) {
+        fprintf(stderr, "%s: record incompleto all'offset %llu (scrittura interrotta), tagliati %llu byte\n",
+                store->path, (unsigned long long)offset, (unsigned long long)((uint64_t)st.st_size - offset));
+        if (ftruncate(fd, (off_t)offset) < 0) {
+            perror("ftruncate");
+        }
+        store->size = offset;
+    }
+    return 0;
+}
+
+int64_t replay_store_append(ReplayStore *store, const ReplayHeader *header, const uint8_t *packed) {
+    if (store->fd < 0) {
+        return -1;
+    }
+    size_t moves_len = replay_packed_size(header->rows * header->cols, header->moves);
+    size_t len = align_record(sizeof(ReplayHeader) + moves_len);
+    uint64_t offset = store->size + store->pending_len;
+    if (offset + len > REPLAY_MAP_BYTES) {
+        if (!store->full) {
+            fprintf(stderr, "%s: spazio dei replay esaurito, i prossimi replay non vengono salvati\n", store->path);
+            store->full = true;
+        }
+        return -1;
+    }
+    if (store->pending_heads_len + 4 > store->pending_heads_cap) {
+        size_t cap = store->pending_heads_cap > 0 ? store->pending_heads_cap * 2 : REPLAY_INITIAL_INDEX;
+        uint32_t *pending_heads = realloc(store->pending_heads, cap * sizeof(uint32_t));
+        if (!pending_heads) {
+            perror("realloc");
+            return -1;
+        }
+        store->pending_heads = pending_heads;
+        store->pending_heads_cap = cap;
+    }
+    if (store->pending_len + len > store->pending_cap) {
+        size_t cap = store->pending_cap > 0 ? store->pending_cap : REPLAY_INITIAL_BUFFER;
+        while (store->pending_len + len > cap) {
+            cap *= 2;
+        }
+        uint8_t *pending = realloc(store->pending, cap);
+        if (!pending) {
+            perror("realloc");
+            return -1;
+        }
+        store->pending = pending;
+        store->pending_cap = cap;
+    }
+    int64_t seq = index_record(store, offset, header->game_id);
+    if (seq < 0) {
+        return -1;
+    }
+    uint8_t *record = store->pending + store->pending_len;
+    memset(record, 0, len);
+    memcpy(record, header, sizeof(ReplayHeader));
+    ReplayHeader *written = (ReplayHeader *)record;
+    written->len = (uint16_t)len;
+    written->seq = (uint32_t)seq;
+    written->reserved_tail = 0;
+    // Catene per giocatore: ogni posto punta al replay precedente dello stesso giocatore in questo file.
+    // Le teste si calcolano prima di accodare le nuove, così chi gioca contro se stesso non punta al record stesso.
+    for (int seat = 0; seat < 2; ++seat) {
+        written->account_prev[seat] = indexed_account(store, header->accounts[seat]) ? account_head(store, header->accounts[seat]) : 0;
+    }
+    for (int seat = 0; seat < 2; ++seat) {
+        if (indexed_account(store, header->accounts[seat])) {
+            store->pending_heads[store->pending_heads_len++] = (uint32_t)header->accounts[seat];
+            store->pending_heads[store->pending_heads_len++] = (uint32_t)offset;
+        }
+    }
+    memcpy(record + sizeof(ReplayHeader), packed, moves_len);
+    store->pending_len += len;
+    return seq;
+}
+
+// Una scrittura fallita viene tagliata e ritentata al commit successivo: gli offset già assegnati restano validi
+int replay_store_commit(ReplayStore *store) {
+    if (store->fd < 0 || store->pending_len == 0) {
+        return 0;
+    }
+    if (write_all(store->fd, store->pending, store->pending_len) < 0) {
+        perror(store->path);
+        if (ftruncate(store->fd, (off_t)store->size) < 0) {
+            perror("ftruncate");
+        }
+        return -1;
+    }
+    store->size += store->pending_len;
+    store->pending_len = 0;
+    // Solo ora i record sono leggibili dagli altri shard: se ne pubblicano le teste, in ordine di scrittura
+    for (size_t i = 0; i < store->pending_heads_len; i += 2) {
+        __atomic_store_n(&store->account_heads[store->pending_heads[i]], store->pending_heads[i + 1], __ATOMIC_RELEASE);
+    }
+    store->pending_heads_len = 0;
+    return 0;
+}
+
+const ReplayHeader *replay_store_get(const ReplayStore *store, uint32_t seq) {
+    if (store->fd < 0 || seq >= store->count || store->offsets[seq] + sizeof(ReplayHeader) > store->size) {
+        return NULL; // Inesistente o non ancora scritto
+    }
+    return (const ReplayHeader *)(store->map + store->offsets[seq]);
+}
+
+int replay_read_account_chain(int fd, uint32_t head, int32_t account, ReplayHeader *out, int max) {
+    int count = 0;
+    uint32_t offset = head;
+    // Gli offset di una catena decrescono strettamente: un record danneggiato non può creare un ciclo
+    while (count < max && offset >= sizeof(ReplayFileHeader)) {
+        ReplayHeader header;
+        if (pread(fd, &header, sizeof(header), offset) != (ssize_t)sizeof(header)) {
+            break;
+        }
+        int seat = account_seat(&header, account);
+        if (seat < 0 || header.len < sizeof(header) || header.len % REPLAY_ALIGN != 0 || header.rows * header.cols == 0) {
+            break;
+        }
+        out[count++] = header;
+        if (header.account_prev[seat] >= offset) {
+            break;
+        }
+        offset = header.account_prev[seat];
+    }
+    return count;
+}
+
+// Esporta i record di un file già letto in memoria
+static long export_records(const uint8_t *data, size_t size, uint32_t layout, uint32_t shard, FILE *out) {
+    long count = 0;
+    size_t offset = sizeof(ReplayFileHeader);
+    while (offset + sizeof(ReplayHeader) <= size) {
+        ReplayHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        int cells = header.rows * header.cols;
+        if (header.len < sizeof(header) || offset + header.len > size || cells == 0 ||
+            sizeof(header) + replay_packed_size(cells, header.moves) > header.len) {
+            break; // Coda troncata
+        }
+        const char *result = header.result == REPLAY_X_WINS ? "X" : header.result == REPLAY_O_WINS ? "O" : "pareggio";
+        fprintf(out, "%llu\t%d\t%dx%dx%d\t%s\t%c\t%d\t%d\t%d\t%lld\t", (unsigned long long)count * layout + shard, header.game_id,
+                header.rows, header.cols, header.k, result, header.first ? 'O' : 'X', header.bot_level, header.accounts[0],
+                header.accounts[1], (long long)header.finished_at);
+        int bits = replay_move_bits(cells);
+        for (int i = 0; i < header.moves; ++i) {
+            int cell = replay_unpack_move(data + offset + sizeof(header), bits, i);
+            fprintf(out, "%s%d,%d", i > 0 ? " " : "", cell / header.cols, cell % header.cols);
+        }
+        fputc('\n', out);
+        offset += header.len;
+        count++;
+    }
+    return count;
+}
+
+static int compare_shards(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Shard dei file replay-<shard>.bin presenti in dir, in ordine crescente. Restituisce quanti sono o -1.
+// Si elencano i file invece di contare fino al layout: uno shard senza file non nasconde quelli successivi.
+static long list_replay_files(const char *dir, uint32_t **shards) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return -1;
+    }
+    long count = 0, cap = 0;
+    *shards = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        unsigned shard;
+        int end = -1;
+        if (sscanf(entry->d_name, "replay-%u.bin%n", &shard, &end) != 1 || end < 0 || entry->d_name[end] != '\0') {
+            continue; // Non è un file dei replay
+        }
+        if (count == cap) {
+            cap = cap > 0 ? cap * 2 : 16;
+            uint32_t *grown = realloc(*shards, (size_t)cap * sizeof(uint32_t));
+            if (!grown) {
+                perror("realloc");
+                free(*shards);
+                closedir(d);
+                return -1;
+            }
+            *shards = grown;
+        }
+        (*shards)[count++] = shard;
+    }
+    closedir(d);
+    qsort(*shards, (size_t)count, sizeof(uint32_t), compare_shards);
+    return count;
+}
+
+long replay_export(const char *dir, FILE *out) {
+    if (!dir) {
+        fprintf(stderr, "TRIS_REPLAY_DIR non impostata: nessun replay da esportare\n");
+        return -1;
+    }
+    uint32_t *shards;
+    long files = list_replay_files(dir, &shards);
+    if (files < 0) {
+        return -1;
+    }
+    fprintf(out, "# replay\tpartita\tvariante\tvincitore\tprimo\tbot\tgiocatore X\tgiocatore O\tfine\tmosse (riga,colonna)\n");
+    long total = 0;
+    for (long f = 0; f < files; ++f) {
+        char path[REPLAY_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/replay-%u.bin", dir, shards[f]);
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            perror(path);
+            free(shards);
+            return -1;
+        }
+        uint8_t *data = NULL;
+        size_t size = 0, cap = 0;
+        for (;;) {
+            if (size == cap) {
+                cap = cap > 0 ? cap * 2 : 1 << 16;
+                uint8_t *grown = realloc(data, cap);
+                if (!grown) {
+                    perror("realloc");
+                    free(data);
+                    fclose(file);
+                    free(shards);
+                    return -1;
+                }
+                data = grown;
+            }
+            size_t n = fread(data + size, 1, cap - size, file);
+            if (n == 0) {
+                break;
+            }
+            size += n;
+        }
+        fclose(file);
+        ReplayFileHeader header;
+        if (size >= sizeof(header)) {
+            memcpy(&header, data, sizeof(header));
+        }
+        if (size < sizeof(header) || memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0) {
+            fprintf(stderr, "%s: file dei replay non valido, ignorato\n", path);
+        } else {
+            total += export_records(data, size, header.layout, header.shard, out);
+        }
+        free(data);
+    }
+    free(shards);
+    return total;
+}
@@ -0,0 +1,126 @@
+#ifndef REPLAY_STORE_H
+#define REPLAY_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define REPLAY_PATH_MAX 256
+#define REPLAY_MAP_BYTES ((size_t)256 << 20) // Spazio di indirizzi riservato per il file di ogni shard: oltre, i replay non vengono più salvati
+#define REPLAY_ALIGN 8          // I record occupano multipli di 8 byte: un record si invia così com'è, dopo un frame di 8 byte
+
+// Esito registrato in un replay
+typedef enum {
+    REPLAY_X_WINS = 1,
+    REPLAY_O_WINS,
+    REPLAY_DRAW
+} ReplayResult;
+
+// Intestazione di un record del file dei replay, seguita dalle mosse impacchettate:
+// la mossa i occupa i bit [i*bits, (i+1)*bits) (dal bit meno significativo di ogni byte), con
+// bits = replay_move_bits(rows * cols) e valore = indice della cella (riga * cols + colonna).
+// Il record è completato con zeri fino a un multiplo di REPLAY_ALIGN byte.
+typedef struct {
+    uint16_t len;           // Byte del record, intestazione e riempimento compresi (0 = fine dei record validi)
+    uint8_t rows;           // Variante m,n,k
+    uint8_t cols;
+    uint8_t k;
+    uint8_t result;         // ReplayResult
+    uint8_t first;          // Chi ha fatto la prima mossa: 0 = X, 1 = O
+    uint8_t bot_level;      // Livello del bot che giocava come O (0 se l'avversario era umano)
+    uint16_t moves;         // Numero di mosse
+    uint16_t reserved;
+    int32_t game_id;        // Partita di cui il replay è un round
+    int64_t finished_at;    // Istante di fine (secondi dall'epoca Unix)
+    int32_t accounts[2];    // Giocatori registrati nei posti X e O (-1 se nessuno)
+    uint32_t seq;           // Numero di sequenza del record nel file: l'ID del replay è seq * layout + shard
+    uint32_t account_prev[2]; // Per ogni posto, offset del replay precedente dello stesso giocatore nel file (0 = nessuno)
+    uint32_t reserved_tail; // Allinea l'intestazione a REPLAY_ALIGN byte
+} ReplayHeader;
+
+// Ultimo replay di ogni giocatore in ogni shard: teste delle catene per giocatore dei file, in memoria condivisa
+// (va creata prima della fork). heads[shard * accounts + account] = offset del record nel file dello shard
+// (0 = nessuno). Ogni shard scrive solo la propria riga, e solo dopo che il record è sul file.
+typedef struct {
+    uint32_t *heads;
+    uint32_t shards;
+    uint32_t accounts;
+    bool stable;            // Gli indici dei giocatori sopravvivono al riavvio (classifica su file): solo allora le
+                            // righe si ricostruiscono dai record già scritti
+} ReplayHeads;
+
+// File dei replay di uno shard (replay-<shard>.bin): append-only, mappato in memoria per intero.
+// I record accodati vengono scritti con una sola write() a ogni commit; la mappatura (MAP_SHARED, riservata
+// una volta sola per REPLAY_MAP_BYTES) vede i byte appena scritti senza essere mai spostata, quindi un record
+// già scritto resta leggibile allo stesso indirizzo fino all'uscita del processo e può essere inviato senza copie.
+// Il numero di sequenza di un record è la sua posizione nel file; l'indice in memoria è ricostruito all'apertura.
+typedef struct {
+    int fd;                 // File dei replay (-1 se disattivato)
+    char path[REPLAY_PATH_MAX];
+    uint32_t layout;        // Valore che deve coincidere tra una esecuzione e la successiva (es. il numero di shard)
+    const uint8_t *map;     // Mappatura del file (REPLAY_MAP_BYTES di indirizzi riservati)
+    uint64_t size;          // Byte del file già scritti
+    uint8_t *pending;       // Record accodati per il prossimo commit
+    size_t pending_len;
+    size_t pending_cap;
+    uint64_t *offsets;      // offsets[seq] = posizione del record seq nel file
+    int32_t *prev;          // prev[seq] = record precedente della stessa partita (-1 se nessuno)
+    uint32_t count;         // Record indicizzati (scritti o in attesa di commit)
+    uint32_t capacity;
+    int32_t *games;         // Tabella hash ad indirizzamento aperto: coppie (ID partita, ultimo record), ID 0 = libera
+    uint32_t games_capacity; // Potenza di 2, almeno il doppio di games_count
+    uint32_t games_count;
+    uint32_t *account_heads; // Riga dello shard in ReplayHeads (NULL = nessun indice per giocatore)
+    uint32_t accounts;      // Voci della riga
+    uint32_t *pending_heads; // Coppie (giocatore, offset) dei record accodati, pubblicate nella riga al commit
+    size_t pending_heads_len;
+    size_t pending_heads_cap;
+    bool full;              // Spazio riservato esaurito: già segnalato
+} ReplayStore;
+
+// Bit di una mossa in un tabellone di cells celle (4 nel tris classico, 9 su 19x19)
+int replay_move_bits(int cells);
+
+// Byte occupati da moves mosse impacchettate in un tabellone di cells celle
+size_t replay_packed_size(int cells, int moves);
+
+// Scrive la mossa index (cella cell) nelle mosse impacchettate
+void replay_pack_move(uint8_t *packed, int bits, int index, int cell);
+
+// Legge la mossa index dalle mosse impacchettate
+int replay_unpack_move(const uint8_t *packed, int bits, int index);
+
+// Alloca le teste delle catene per giocatore di shards shard e accounts giocatori in memoria condivisa.
+// Restituisce 0 se riuscito, -1 altrimenti.
+int replay_heads_create(ReplayHeads *heads, uint32_t shards, uint32_t accounts);
+
+// Apre (o crea) il file dei replay dello shard in dir, lo mappa e ne ricostruisce l'indice per partita e la riga
+// dello shard in heads (che può essere NULL). Un record troncato da un crash viene tagliato.
+// Restituisce 0 se riuscito, -1 altrimenti (archivio disattivato).
+int replay_store_open(ReplayStore *store, const char *dir, int shard, uint32_t layout, ReplayHeads *heads);
+
+// Accoda un record per il prossimo commit, completandone seq e catene per giocatore dai posti in header->accounts;
+// restituisce il suo numero di sequenza o -1 se non salvato
+int64_t replay_store_append(ReplayStore *store, const ReplayHeader *header, const uint8_t *packed);
+
+// Scrive su disco i record accodati con una sola write(); restituisce 0 se riuscito, -1 altrimenti
+int replay_store_commit(ReplayStore *store);
+
+// Restituisce il record seq già scritto (puntatore nella mappatura, valido fino all'uscita), NULL se non esiste
+const ReplayHeader *replay_store_get(const ReplayStore *store, uint32_t seq);
+
+// Ultimo record della partita game_id, -1 se nessuno; i precedenti si percorrono con store->prev
+int64_t replay_store_last_of_game(const ReplayStore *store, int32_t game_id);
+
+// Legge con pread, dal file dei replay fd di uno shard, al più max intestazioni dei replay del giocatore account,
+// dal più recente, partendo dalla testa head letta da ReplayHeads. Non usa la mappatura: funziona su file di
+// altri shard e di altri worker. La catena si ferma a un record non (ancora) leggibile o di un altro giocatore.
+// Restituisce il numero di intestazioni lette.
+int replay_read_account_chain(int fd, uint32_t head, int32_t account, ReplayHeader *out, int max);
+
+// Scrive su out, una riga per replay, tutti i replay dei file in dir (esportazione per le analisi).
+// L'ID di un replay è seq * layout + shard. Restituisce il numero di replay esportati o -1 in caso di errore.
+long replay_export(const char *dir, FILE *out);
+
+#endif // REPLAY_STORE_H
@@ -1,25 +1,103 @@
+#define _GNU_SOURCE // epoll, eventfd, io_uring e affinità dei thread sono estensioni Linux/GNU
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
-#include <sys/select.h> 
+#include <sys/epoll.h>
 #include <stdbool.h>
 #include <errno.h> 
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <sys/random.h>
+#include <poll.h>
 
 #include "tris_game.h" // Include il file di intestazione per la logica del gioco del tris
+#include "game_directory.h" // Directory delle partite condivisa tra i worker
+#include "tris_protocol.h" // Frame del protocollo binario
+#include "tris_ai.h" // Bot con tabella di gioco perfetto precalcolata
+#include "tris_search.h" // Ricerca alpha-beta per le varianti m,n,k
+#include "timer_wheel.h" // Timer di turno, di accettazione e di inattività
+#include "journal.h" // Journal delle partite per il ripristino dopo un riavvio
+#include "replay_store.h" // Archivio dei replay delle partite terminate
+#include "ratings.h" // Giocatori registrati, punteggi Elo e classifica condivisi tra i worker
+#include "metrics.h" // Contatori e istogrammi di latenza degli shard, esposti con "stats" e sulla porta delle statistiche
+#include "uring.h" // Anello io_uring degli shard, alternativo a epoll (TRIS_IO_URING=1)
+#include "slab_pool.h" // Slab per client, partite e buffer di output, con free list per shard
 
 #define PORT 8080
-#define MAX_CLIENTS 10
+#define DEFAULT_MAX_CLIENTS 65536 // Capacità predefinita della tabella client (modificabile con TRIS_MAX_CLIENTS)
 #define BUFFER_SIZE 1024
-#define MAX_GAMES 5
+#define INPUT_BUFFER_SIZE 4096 // Dimensione del buffer circolare di input di ogni client (potenza di 2)
+#define INPUT_BUFFER_MASK (INPUT_BUFFER_SIZE - 1)
+#define MAX_LINE_LENGTH 256    // Lunghezza massima di un comando testuale (terminatore escluso)
+#define OUTPUT_CHUNK_SIZE 4096 // Dimensione minima di un buffer della coda di output
+#define DEFAULT_MAX_OUTPUT_QUEUE (256 * 1024) // Byte in coda oltre i quali un client viene disconnesso (TRIS_MAX_OUTPUT_QUEUE)
+#define MAX_WRITE_SEGMENTS 64  // Segmenti inviati con una singola writev()
+#define HANDOFF_OUTPUT_MAX 16384 // Output non ancora inviato trasportabile con un client verso un altro worker
+#define IPC_OUTBOX_MAX 1024 // Pacchetti in attesa verso uno shard di un altro worker: oltre, il trasferimento fallisce
+#define BINARY_LIST_MAX 4096   // Voci di una pagina della lista inviata con il protocollo binario
+#define LIST_PAGE_SIZE 50      // Voci di una pagina della lista testuale
+#define LIST_LINE_MAX 128      // Lunghezza massima di una riga della lista testuale
+#define WATCH_MAX_BACKLOG 8192 // Byte in coda oltre i quali uno spettatore salta gli aggiornamenti (poi riceve lo stato più recente)
+#define BOT_FD -2              // opponent_fd di una partita contro il bot: avversario presente ma senza socket
+#define DETACHED_FD DIRECTORY_OWNER_DETACHED // owner_fd/opponent_fd di un posto tenuto per un giocatore non connesso, che può rientrare con "resume"
+#define DEFAULT_SEARCH_MS 5    // Tempo per mossa della ricerca nelle varianti m,n,k (TRIS_SEARCH_MS)
+#define SEARCH_TT_BITS 18      // Voci della tabella delle trasposizioni di ogni worker: 2^18 (4 MB)
+#define DEFAULT_TURN_TIMEOUT 60   // Secondi per fare una mossa (TRIS_TURN_TIMEOUT)
+#define DEFAULT_ACCEPT_TIMEOUT 30 // Secondi per accettare o rifiutare una richiesta di unione (TRIS_ACCEPT_TIMEOUT)
+#define DEFAULT_IDLE_TIMEOUT 600  // Secondi senza comandi dopo cui un client viene disconnesso (TRIS_IDLE_TIMEOUT)
+#define DEFAULT_REJOIN_TIMEOUT 120 // Secondi per rientrare dopo una disconnessione o un riavvio (TRIS_REJOIN_TIMEOUT)
+#define JOURNAL_SNAPSHOT_BYTES (4 * 1024 * 1024) // Dimensione del journal oltre cui lo shard scrive un'istantanea e lo svuota
+#define SEAT_TOKEN_BITS 56        // Bit di un codice di rientro: sta nei campi code, aux e arg di un frame
+#define DEFAULT_MAX_GAMES 32768   // Capacità predefinita della tabella partite (modificabile con TRIS_MAX_GAMES)
+#define DEFAULT_MAX_PLAYERS 100000 // Giocatori registrabili con "login" (TRIS_MAX_PLAYERS)
+#define QUEUE_RATING_WINDOW 100   // Differenza di punteggio accettata subito dal matchmaking
+#define QUEUE_RATING_WIDEN 50     // Punti di differenza accettati in più per ogni secondo di attesa in coda
+#define QUEUE_RETRY_MS 1000       // Intervallo con cui la coda di una variante riprova ad abbinare chi aspetta
+#define QUEUE_BITMAP_WORDS ((RATING_MAX + 63) / 64) // Parole della mappa dei bucket occupati di una coda
+#define STATS_SUMMARY_MAX 4096    // Dimensione massima della risposta al comando "stats"
+#define INITIAL_TABLE_SIZE 64     // Dimensione iniziale delle tabelle, che crescono per raddoppio
+#define OUTBUF_SMALL_SLOT 256     // Slot del pool dei buffer di output brevi (intestazione compresa)
+#define POOL_KEEP_SLABS 1         // Slab di ogni pool conservate quando lo shard resta senza client e partite
+
+// L'ID di una partita impacchetta lo shard proprietario, lo slot nella tabella dello shard e la generazione
+// dello slot: ID = ((slot << GAME_GEN_BITS) | generazione) * num_shards + shard.
+// La ricerca per ID è un accesso diretto e un ID ormai chiuso non trova la partita che ha riusato lo slot.
+#define GAME_GEN_BITS  8
+#define GAME_GEN_MASK  ((1u << GAME_GEN_BITS) - 1)
+#define GAME_MAX_SLOTS (1 << 23) // 8 + 23 bit: con un solo shard l'ID resta un int positivo
+#define MAX_SHARDS 64 // Numero massimo di shard in totale (TRIS_WORKERS * TRIS_THREADS)
+#define MAX_EVENTS 64 // Numero massimo di eventi restituiti da una singola epoll_wait()
+#define URING_ENTRIES 1024     // Posti della coda di submission dell'anello di ogni shard (la coda di completion ne ha 4 volte tanti)
+#define URING_BUFFERS 512      // Buffer forniti al kernel per le recv multishot di ogni shard (potenza di 2)
+#define URING_BUFFER_SIZE 2048 // Dimensione di un buffer fornito: sta sempre nello spazio libero del buffer di input
+#define URING_WRITE_SEGMENTS 16 // Segmenti di una writev inviata con io_uring (il resto parte alla sua completion)
+#define URING_WRITE_BATCH 256  // writev preparate oltre le quali gli SQE vengono inviati senza attendere la fine del giro
+#define URING_ACCEPT_RETRY_MS 100 // Pausa prima di riarmare la accept dopo un errore (es. EMFILE), invece di riprovare a vuoto
+
+// Dopo l'esecuzione dei comandi in un buffer di input restano al più MAX_LINE_LENGTH byte: i dati di una completion ci stanno interi
+#if URING_BUFFER_SIZE > INPUT_BUFFER_SIZE - MAX_LINE_LENGTH - 1
+#error "URING_BUFFER_SIZE deve stare nello spazio libero del buffer di input"
+#endif
 
 // Enumerazione per lo stato di un giocatore
 typedef enum {
     PLAYER_CONNECTED,     // Connesso ma non in partita
     PLAYER_IN_GAME,       // In una partita
-    PLAYER_WAITING_ACCEPT // Ha richiesto di unirsi ad una partita, in attesa di accettazione
+    PLAYER_WAITING_ACCEPT, // Ha richiesto di unirsi ad una partita, in attesa di accettazione
+    PLAYER_QUEUED         // In coda di matchmaking, in attesa di un avversario per la stessa variante
 } PlayerStatus;
 
 // Enumerazione per lo stato della partita estesa
@@ -30,15 +108,87 @@ typedef enum {
     GAME_ENDED            // Partita terminata
 } GameState;
 
+// Buffer della coda di output, condivisibile tra più segmenti tramite conteggio dei riferimenti
+typedef struct {
+    int refs;               // Segmenti in coda che puntano a questo buffer
+    uint32_t len;           // Byte occupati
+    uint32_t cap;           // Byte disponibili in data
+    int8_t pool;            // Pool dello shard da cui proviene (MetricPool), -1 se allocato con malloc
+    char data[];            // Contenuto
+} OutBuf;
+
+// Segmento della coda di output: una porzione contigua di un OutBuf ancora da inviare
+typedef struct {
+    const char *data;       // Primo byte non ancora inviato
+    uint32_t len;           // Byte rimanenti
+    OutBuf *buf;            // Buffer proprietario (rilasciato quando il segmento è inviato)
+} OutSegment;
+
+// Frammento di testo costante con la lunghezza calcolata in compilazione: si accoda per riferimento, senza strlen
+typedef struct {
+    const char *data;
+    uint32_t len;
+} TextFragment;
+
+#define TEXT_FRAGMENT(literal) { literal, sizeof(literal) - 1 }
+
+// Messaggio testuale che accompagna un tabellone: frammenti costanti attorno al tabellone renderizzato.
+// Ogni parte diventa un segmento della coda di output e la writev() di fine giro le invia come un solo messaggio.
+typedef struct {
+    TextFragment head;      // Prima del tabellone
+    bool with_id;           // Tra head e il tabellone va "<id della partita>:\n"
+    TextFragment tail;      // Dopo il tabellone (len 0 se assente)
+} BoardMessage;
+
+// Tabellone testuale di un aggiornamento, renderizzato al primo destinatario testuale e poi accodato
+// per riferimento a tutti gli altri (giocatori e spettatori)
+typedef struct {
+    OutBuf *buf;            // "<id>:\n" seguito dal tabellone; NULL se non ancora renderizzato
+    uint32_t board_offset;  // Inizio del tabellone in buf
+} BoardText;
+
 // Struttura per rappresentare un giocatore
 typedef struct {
     int fd;                 // File descriptor del socket del client
     PlayerStatus status;    // Stato attuale del giocatore
-    char username[32];      // Nome utente (opzionale)
+    char username[32];      // Nome utente (quello del giocatore registrato dopo "login")
+    int32_t account;        // Giocatore registrato con "login" (-1 se nessuno)
     int game_id;            // ID della partita a cui il giocatore appartiene (-1 se non in partita)
     Cell player_symbol;     // Simbolo del giocatore (X o O)
     bool is_current_turn;   // Vero se è il turno di questo giocatore
     bool wants_rematch;     // Vero se il giocatore ha chiesto una rivincita (dopo un pareggio)
+    uint16_t queue_variant; // Variante (PROTO_VARIANT) per cui il giocatore è in coda (solo PLAYER_QUEUED)
+    int queue_prev;         // Giocatori in coda per la stessa variante in ordine di arrivo: lista doppiamente collegata di fd (-1 = nessuno)
+    int queue_next;
+    int bucket_prev;        // Giocatori in coda con lo stesso punteggio, in ordine di arrivo (-1 = nessuno)
+    int bucket_next;
+    int32_t queue_rating;   // Punteggio con cui il giocatore è entrato in coda
+    uint64_t queued_at_ms;  // Istante di ingresso in coda: la differenza di punteggio accettata cresce con l'attesa
+    int watch_game_id;      // Partita seguita come spettatore con "watch" (-1 se nessuna)
+    int watch_index;        // Posizione del client nell'array degli spettatori della partita
+    bool watch_stale;       // Ha saltato aggiornamenti perché non leggeva: al prossimo riceve un'istantanea completa
+
+    // Buffer circolare di input: i comandi arrivano come flusso e vengono separati per riga
+    char in_buf[INPUT_BUFFER_SIZE]; // Dati ricevuti e non ancora consumati
+    uint32_t in_head;       // Posizione (assoluta) del primo byte non consumato
+    uint32_t in_tail;       // Posizione (assoluta) successiva all'ultimo byte ricevuto
+    uint32_t in_scan;       // Posizione fino a cui si è già cercato il '\n' (evita di riscandire)
+    bool in_discarding;     // Vero mentre si scarta il resto di una riga troppo lunga
+    bool binary;            // Vero dopo il comando "binary": input e risposte sono frame di PROTO_FRAME_SIZE byte
+
+    // Coda di output: i messaggi di un giro di eventi vengono raccolti e inviati con una sola writev()
+    OutSegment *out_segs;   // Array circolare di segmenti (capacità potenza di 2)
+    uint32_t out_cap;       // Capacità dell'array
+    uint32_t out_head;      // Indice del primo segmento da inviare
+    uint32_t out_count;     // Segmenti in coda
+    size_t out_bytes;       // Byte in coda in totale
+    bool out_dirty;         // Vero se il client è nella lista degli svuotamenti di fine giro
+    bool out_overflow;      // Vero se il client ha superato il limite della coda e va disconnesso
+    bool write_pending;     // Con io_uring: una writev della coda è in corso (i segmenti restano in coda fino alla completion)
+    bool write_blocked;     // Con io_uring: il socket era pieno, si riprende alla completion di un poll su POLLOUT
+
+    TimerNode idle_timer;   // Disconnessione per inattività
+    uint64_t last_activity_ms; // Istante dell'ultimo dato ricevuto (orologio monotono)
 } Client;
 
 // Struttura per rappresentare una partita
@@ -49,44 +199,424 @@ typedef struct {
     int opponent_fd;        // File descriptor del secondo giocatore (-1 se non c'è)
     TrisGame tris_game;     // Stato del gioco del tris
     GameResult last_result; // Risultato dell'ultima partita (WIN, DRAW, IN_PROGRESS)
+    BotLevel bot_level;     // Livello del bot che gioca come O (BOT_NONE se l'avversario è umano)
+    TimerNode turn_timer;   // Scadenza del turno del giocatore che deve muovere
+    TimerNode accept_timer; // Scadenza della richiesta di unione in attesa
+    TimerNode rejoin_timer; // Scadenza dei posti tenuti per i giocatori non connessi (DETACHED_FD), armato sulla prima
+    uint64_t rejoin_deadline[2]; // Istante (orologio dello shard) in cui scade il posto tenuto di ciascun giocatore
+    uint64_t seat_tokens[2]; // Codici di rientro dei posti X (proprietario) e O (0 se il posto è libero o del bot)
+    int32_t seat_accounts[2]; // Giocatori registrati seduti nei posti X e O (-1 se nessuno): solo tra due registrati la partita è valutata
+    uint8_t *move_log;      // Mosse del round in corso, impacchettate come nei replay (NULL finché non serve)
+    uint16_t move_log_count; // Mosse registrate in move_log
+    uint8_t move_log_first; // Chi ha aperto il round: 0 = X, 1 = O
+    int *watchers;          // Spettatori iscritti con "watch" (fd, tutti nello shard della partita)
+    int num_watchers;
+    int watchers_capacity;
 } Game;
 
+// Slot della tabella delle partite
+typedef struct {
+    Game *game;             // Partita che occupa lo slot (NULL se libero)
+    uint32_t generation;    // Generazione corrente dello slot, incrementata a ogni riuso
+    int next_free;          // Prossimo slot libero nella free list (-1 se ultimo)
+} GameSlot;
+
+// Voce dell'indice dei codici di rientro di uno shard
+typedef struct {
+    uint64_t token;         // Codice di rientro (0 se la voce è libera)
+    int32_t game_id;        // Partita in cui il codice tiene un posto
+} SeatTokenSlot;
+
+// Tipi dei record del journal di uno shard
+typedef enum {
+    JOURNAL_GAME = 1,       // Stato completo di una partita: scritto a ogni pubblicazione e nelle istantanee
+    JOURNAL_MOVE,           // Mossa in una partita in corso
+    JOURNAL_CLOSE           // Partita chiusa
+} JournalRecordType;
+
+// Record JOURNAL_GAME. I record restano sulla macchina che li scrive: i campi sono nell'ordine dei byte nativo.
+typedef struct {
+    uint8_t type;           // JOURNAL_GAME
+    uint8_t state;          // GameState
+    uint8_t bot_level;      // BotLevel
+    uint8_t last_result;    // GameResult
+    int32_t game_id;
+    uint64_t seat_tokens[2]; // Codici di rientro dei due posti
+    TrisGame board;         // Variante, tabellone e turno
+} JournalGameRecord;
+
+// Record JOURNAL_MOVE e JOURNAL_CLOSE: 8 byte
+typedef struct {
+    uint8_t type;
+    uint8_t unused;
+    uint16_t cell;          // Cella giocata (solo JOURNAL_MOVE)
+    int32_t game_id;
+} JournalMoveRecord;
+
+// Richiesta di lista: filtri, pagina o versione da cui inviare le sole modifiche
+typedef struct {
+    bool waiting_only;      // Solo partite in attesa di un giocatore
+    int variant;            // Solo questa variante (PROTO_VARIANT, 0 = tris classico), -1 per tutte
+    int page;               // Pagina richiesta (da 0; oltre l'ultima si riceve l'ultima)
+    bool delta;             // Vero per ricevere solo le modifiche successive a since
+    uint32_t since;         // Versione della lista già nota al client
+} LobbyQuery;
+
+// Voce dell'indice della lista: posizione di una partita nell'array della cache
+typedef struct {
+    int32_t game_id;        // ID della partita (0 se la voce è libera)
+    int index;              // Posizione in LobbyCache.entries
+} LobbyIndexSlot;
+
+// Copia locale della lista delle partite di tutti i worker, aggiornata applicando il log della directory.
+// Le pagine della lista completa sono renderizzate una volta per versione e inviate a tutti i client
+// per riferimento (sono OutBuf condivisi tra le code di output).
+typedef struct {
+    bool valid;                 // Falso finché la cache non è stata costruita
+    uint32_t version;           // Versione della directory riflessa dalla cache
+    DirectoryEntry *entries;    // Partite attive (ordine non significativo: una rimozione sposta l'ultima voce al suo posto)
+    int count;
+    int capacity;
+    LobbyIndexSlot *index;      // Tabella hash ad indirizzamento aperto: ID della partita -> posizione in entries
+    int index_capacity;         // Potenza di 2, almeno il doppio di count
+    OutBuf **text_pages;        // Pagine testuali della lista completa alla versione corrente (NULL se non ancora renderizzate)
+    int text_pages_capacity;
+    OutBuf **binary_pages;      // Pagine di frame della lista completa alla versione corrente
+    int binary_pages_capacity;
+    DirectoryChange *changes;   // Buffer in cui leggere il log della directory (DIRECTORY_LOG_SIZE voci)
+} LobbyCache;
+
+// Configurazione del server letta all'avvio dalle variabili d'ambiente
+typedef struct {
+    int port;               // Porta TCP di ascolto (TRIS_PORT)
+    int max_clients;        // Numero massimo di client connessi (TRIS_MAX_CLIENTS)
+    int max_games;          // Numero massimo di partite attive (TRIS_MAX_GAMES)
+    int threads;            // Numero di thread reactor/shard per worker (TRIS_THREADS, "auto" = uno per core)
+    int workers;            // Numero di processi worker pre-fork su SO_REUSEPORT (TRIS_WORKERS, "auto" = uno per core)
+    int max_output_queue;   // Byte di output in coda oltre i quali un client viene disconnesso (TRIS_MAX_OUTPUT_QUEUE)
+    int search_ms;          // Millisecondi di ricerca per mossa di bot e suggerimenti nelle varianti m,n,k (TRIS_SEARCH_MS)
+    int search_threads;     // Thread di ogni ricerca, in parallelo con tabella condivisa (TRIS_SEARCH_THREADS)
+    int turn_timeout;       // Secondi concessi per ogni mossa (TRIS_TURN_TIMEOUT)
+    int accept_timeout;     // Secondi concessi al proprietario per rispondere a una richiesta di unione (TRIS_ACCEPT_TIMEOUT)
+    int idle_timeout;       // Secondi di inattività dopo cui un client viene disconnesso (TRIS_IDLE_TIMEOUT)
+    const char *journal_dir; // Directory del journal delle partite (TRIS_JOURNAL_DIR, NULL = nessun journal)
+    bool journal_sync;      // fdatasync() a ogni commit del journal (TRIS_JOURNAL_SYNC=1)
+    int rejoin_timeout;     // Secondi per cui resta tenuto il posto di un giocatore disconnesso (TRIS_REJOIN_TIMEOUT)
+    const char *replay_dir; // Directory dei replay delle partite terminate (TRIS_REPLAY_DIR, NULL = replay non salvati)
+    const char *ratings_file; // File dei giocatori registrati (TRIS_RATINGS_FILE, NULL = punteggi persi al riavvio)
+    int max_players;        // Giocatori registrabili (TRIS_MAX_PLAYERS)
+    int stats_port;         // Porta locale delle metriche in formato Prometheus (TRIS_STATS_PORT, 0 = disattivata)
+    bool io_uring;          // Eventi e scritture con io_uring invece di epoll, se il kernel lo consente (TRIS_IO_URING=1)
+} ServerConfig;
+
+// Operazione io_uring di uno shard: il tipo sta nei 32 bit alti di user_data, il fd in quelli bassi
+typedef enum {
+    IO_OP_ACCEPT = 1,       // Accept multishot sul listener
+    IO_OP_RECV,             // Recv multishot di un client, nei buffer forniti
+    IO_OP_WRITE,            // writev della coda di output di un client
+    IO_OP_POLLOUT,          // Attesa che il socket di un client torni scrivibile
+    IO_OP_WAKE,             // Poll multishot sull'eventfd dei messaggi da altri shard
+    IO_OP_IPC,              // Poll multishot sul socket UNIX dei pacchetti da altri worker
+    IO_OP_IPC_OUT           // Attesa che il socket UNIX verso un altro worker torni scrivibile (al posto del fd: lo shard)
+} IoOp;
+
+#define IO_USER_DATA(op, fd) (((uint64_t)(op) << 32) | (uint32_t)(fd))
+
+// Tipo di messaggio scambiato tra shard
+typedef enum {
+    SHARD_MSG_HANDOFF    // Un client viene trasferito allo shard destinatario insieme al comando da eseguire
+} ShardMessageType;
+
+// Pacchetto inviato allo shard di un altro worker sul suo socket UNIX (il fd del client viaggia con SCM_RIGHTS)
+typedef struct {
+    int32_t type;              // ShardMessageType
+    int32_t binary;            // Protocollo del client trasferito (1 = binario)
+    char username[32];         // Nome utente del client trasferito
+    int32_t account;           // Giocatore registrato del client trasferito (-1 se nessuno)
+    char text[BUFFER_SIZE];    // Comando da rieseguire
+    uint32_t pending_len;      // Byte di input già ricevuti e non ancora elaborati dal client trasferito
+    uint32_t output_len;       // Byte di output non ancora inviati al client trasferito
+    char pending[INPUT_BUFFER_SIZE + HANDOFF_OUTPUT_MAX]; // Copia lineare dell'input e poi dell'output
+} ShardPacket;
+
+// Messaggio nella inbox di uno shard
+typedef struct ShardMessage {
+    ShardMessageType type;     // Tipo del messaggio
+    Client *client;            // Client trasferito
+    char *text;                // Comando da rieseguire (allocato, liberato dal destinatario)
+    struct ShardMessage *next; // Messaggio successivo nella coda
+} ShardMessage;
+
+// Pacchetto già composto per lo shard di un altro worker, in attesa che il suo socket UNIX torni scrivibile
+typedef struct PendingPacket {
+    struct PendingPacket *next; // Pacchetto successivo verso lo stesso shard
+    int client_fd;             // Socket del client trasferito, chiuso dopo l'invio (-1 se nessuno)
+    size_t len;                // Byte del pacchetto
+    unsigned char data[];      // Il pacchetto (ShardPacket troncato alla parte usata)
+} PendingPacket;
+
+// Pacchetti in attesa verso uno shard di un altro worker (FIFO)
+typedef struct {
+    PendingPacket *head;
+    PendingPacket *tail;
+    int count;
+    bool watching;             // Scrivibilità del socket UNIX sorvegliata (epoll o poll io_uring)
+} IpcOutbox;
+
+// Coda di matchmaking di una variante. I giocatori in attesa sono divisi per punteggio, un bucket per punto come
+// nell'indice della classifica, e una mappa di bit segna i bucket occupati: l'avversario più vicino si trova
+// saltando i bucket vuoti a parole di 64, senza scorrere i giocatori. In un bucket il primo è quello in attesa
+// da più tempo, cioè quello con la differenza accettata più ampia: se non va bene lui, non va bene nessuno.
+typedef struct {
+    uint16_t variant;          // Variante (PROTO_VARIANT) della coda
+    int count;                 // Giocatori in coda
+    int oldest;                // Estremi della lista in ordine di arrivo (fd, -1 se vuota)
+    int newest;
+    int bucket_head[RATING_MAX]; // Per ogni punteggio, il giocatore in attesa da più tempo (fd, -1 se nessuno)
+    int bucket_tail[RATING_MAX];
+    uint64_t occupied[QUEUE_BITMAP_WORDS]; // Bit b acceso se il bucket b non è vuoto
+    TimerNode widen_timer;     // Ogni QUEUE_RETRY_MS, finché ci sono almeno due giocatori: le differenze accettate crescono
+} MatchQueue;
+
+// Uno shard è un thread reactor con il proprio epoll e le proprie tabelle di client e partite.
+// Ogni partita e ogni client appartengono a un solo shard: il percorso delle mosse non usa lock.
+typedef struct {
+    int index;                 // Indice dello shard (codificato negli ID delle partite)
+    pthread_t thread;          // Thread che esegue il reactor dello shard
+    int epoll_fd;              // Istanza epoll del reactor
+    int wake_fd;               // eventfd che risveglia il reactor quando arrivano messaggi da altri shard
+    int ipc_fd;                // Socket UNIX su cui arrivano i pacchetti dagli shard di altri worker
+    IpcOutbox *ipc_outbox;     // Per ogni shard globale, pacchetti che il suo socket UNIX non ha ancora accettato
+    int ipc_backlog;           // Code di ipc_outbox non vuote
+
+    Client **clients;          // Tabella dei client indicizzata direttamente per file descriptor
+    int clients_capacity;      // Dimensione corrente della tabella dei client
+    int num_clients;           // Numero di client connessi a questo shard
+
+    GameSlot *game_slots;      // Tabella delle partite indicizzata per slot (estratto dall'ID)
+    int game_slots_capacity;   // Dimensione corrente della tabella delle partite
+    int free_game_slot;        // Testa della free list degli slot di gioco
+    int num_games;             // Numero di partite attive in questo shard
+    uint32_t rng;              // Stato del generatore pseudo-casuale usato dal bot
+    TimerWheel timers;         // Timer di turno, di accettazione e di inattività dei client e delle partite dello shard
+    uint64_t now_ms;           // Orologio monotono letto all'inizio del giro di eventi corrente
+    LobbyCache lobby;          // Lista delle partite servita dallo shard
+    MatchQueue **match_queues; // Coda di matchmaking per variante (PROTO_VARIANT), allocata al primo giocatore (NULL se mai usata)
+    Journal journal;           // Journal delle partite dello shard (fd -1 se disattivato)
+    ReplayStore replays;       // Replay dei round terminati nello shard (fd -1 se disattivato)
+    int *replay_readers;       // File dei replay degli altri shard aperti in lettura per "replays player" (-1 = non ancora)
+    ShardMetrics *metrics;     // Metriche dello shard nella memoria condivisa
+    SeatTokenSlot *seat_index; // Tabella hash ad indirizzamento aperto: codice di rientro -> partita
+    int seat_index_capacity;   // Potenza di 2, almeno il doppio di seat_index_count
+    int seat_index_count;
+
+    int *dirty_fds;            // Client con output in coda da inviare a fine giro di eventi
+    int dirty_count;
+    int dirty_capacity;
+
+    bool io_uring;             // Eventi dall'anello io_uring invece che dall'epoll (TRIS_IO_URING=1 e kernel adatto)
+    Uring ring;                // Anello io_uring dello shard
+    struct iovec *write_iov;   // iovec delle writev preparate: URING_WRITE_BATCH gruppi di URING_WRITE_SEGMENTS
+    int write_batch;           // Gruppi in uso, finché il kernel non legge i loro SQE
+    int writes_inflight;       // writev inviate di cui manca la completion
+    TimerNode accept_timer;    // Nuovo tentativo di armare la accept dopo un errore
+
+    SlabPool pools[METRIC_POOL_COUNT]; // Client, partite e buffer di output dello shard (indicizzati per MetricPool)
+
+    pthread_mutex_t inbox_lock; // Protegge la inbox
+    ShardMessage *inbox_head;   // Messaggi in arrivo da altri shard (FIFO)
+    ShardMessage *inbox_tail;
+} Shard;
+
 // --- Variabili Globali ---
-Client clients[MAX_CLIENTS]; // Array di client connessi
-Game games[MAX_GAMES]; // Array di partite attive
+ServerConfig config = { PORT, DEFAULT_MAX_CLIENTS, DEFAULT_MAX_GAMES, 1, 1, DEFAULT_MAX_OUTPUT_QUEUE, DEFAULT_SEARCH_MS, 1,
+                        DEFAULT_TURN_TIMEOUT, DEFAULT_ACCEPT_TIMEOUT, DEFAULT_IDLE_TIMEOUT, NULL, false,
+                        DEFAULT_REJOIN_TIMEOUT, NULL, NULL, DEFAULT_MAX_PLAYERS, 0, false }; // Configurazione attiva
 
-int num_clients = 0; // Numero di client connessi
-int num_games = 0; // Numero di partite attive
-int next_game_id = 1; // ID univoco per le partite
+Shard *shards = NULL; // Array degli shard di questo worker (uno per thread reactor)
+int num_shards = 1;   // Numero totale di shard (di tutti i worker): entra nella codifica degli ID
+int worker_index = 0; // Indice di questo processo worker; i suoi shard hanno indici globali consecutivi
+int listen_fd = -1;   // Socket in ascolto del worker, condiviso dai suoi shard
+GameDirectory directory; // Directory delle partite in memoria condivisa, letta senza lock da tutti i worker
+RatingTable ratings; // Giocatori registrati e classifica in memoria condivisa tra tutti i worker
+Metrics metrics; // Metriche di tutti gli shard in memoria condivisa: ognuno scrive solo le proprie
+ReplayHeads replay_heads; // Ultimo replay di ogni giocatore in ogni shard, in memoria condivisa tra tutti i worker
+int *ipc_recv_fds = NULL; // Per ogni shard globale: estremità di ricezione del suo socket UNIX
+int *ipc_send_fds = NULL; // Per ogni shard globale: estremità di invio del suo socket UNIX
+int max_clients_per_shard; // Limite di client per shard derivato da config.max_clients
+int max_games_per_shard;   // Limite di partite per shard derivato da config.max_games
 
-fd_set master_fds; // Set di descrittori di file master per select()
-int max_sd;        // Massimo descrittore di file nel set per select()
+__thread Shard *current_shard = NULL; // Shard servito dal thread corrente
 
 // --- Prototipi delle Funzioni ---
+void load_config(void); // Legge la configurazione dalle variabili d'ambiente
+bool ensure_client_capacity(int fd); // Fa crescere la tabella dei client fino a contenere fd
+Game* allocate_game(void); // Alloca una partita in uno slot libero e le assegna un ID
 void send_to_client(int client_fd, const char *message); // Funzione per inviare messaggi ai client
-void initialize_client(int client_fd); // Funzione per inizializzare un nuovo client
+void enqueue_output(Client *client, const char *data, size_t len); // Accoda dati nella coda di output di un client
+bool flush_client_output(Client *client); // Invia con writev() quanto possibile della coda di output
+void flush_dirty_clients(void); // Svuota a fine giro le code di output dei client che hanno nuovi messaggi
+void release_client_output(Client *client); // Libera tutti i segmenti in coda di un client
+void send_frame(int client_fd, const ProtoFrame *frame); // Accoda un frame binario per un client
+void send_event(int client_fd, ProtoEvent event, int game_id, const char *text); // Invia un evento come frame o come testo
+void send_error(int client_fd, ProtoError error, const char *text); // Invia un errore come frame o come testo
+int set_nonblocking(int fd); // Imposta un file descriptor in modalità non bloccante
+Client* initialize_client(int client_fd); // Funzione per inizializzare un nuovo client
 void cleanup_game(Game *game); // Funzione per pulire una partita, rendendola disponibile
 void remove_client_from_game(int client_fd); // Rimuove un client da qualsiasi partita in cui si trova
 void remove_client(int client_fd); // Rimuove un client dal server (disconnessione completa)
 Game* find_game_by_id(int game_id); // Trova una partita tramite il suo ID
 Game* find_game_by_player_fd(int player_fd); // Trova una partita a cui è associato un giocatore
 Client* find_client_by_fd(int client_fd); // Trova un client tramite il suo file descriptor
-void print_game_list(int client_fd); // Stampa la lista delle partite disponibili a un client
-void notify_all_spectators(Game *game, const char *message); // Notifica gli spettatori di una partita
+void enqueue_shared_output(Client *client, OutBuf *buf); // Accoda per riferimento un buffer condiviso tra più client
+void enqueue_shared_range(Client *client, OutBuf *buf, const char *data, size_t len); // Accoda per riferimento una porzione di un buffer condiviso
+void enqueue_static_output(Client *client, const void *data, size_t len); // Accoda per riferimento dati validi fino all'uscita
+void print_game_list(int client_fd, const LobbyQuery *query); // Invia a un client una pagina della lista o le sue modifiche
+void send_board_state(int client_fd, Game *game, uint8_t flags, BoardText *text, const BoardMessage *message); // Invia il tabellone come frame o come testo
 void send_game_state_to_players(Game *game); // Invia lo stato attuale del tabellone e il turno ai giocatori della partita
+void broadcast_to_watchers(Game *game, uint8_t flags, BoardText *text); // Invia il tabellone, codificato una volta sola, a tutti gli spettatori
+void stop_watching(Client *client); // Toglie un client dagli spettatori della partita che segue
 
 // Prototipi per la gestione dei comandi
-void handle_create_command(int client_fd, Client *current_client); // Gestisce il comando "create"
-void handle_join_command(int client_fd, Client *current_client, const char *buffer); // Gestisce il comando "join"
+void handle_create_command(int client_fd, Client *current_client, int rows, int cols, int k, BotLevel bot_level); // Gestisce il comando "create"
+void handle_join_command(int client_fd, Client *current_client, int game_id_to_join); // Gestisce il comando "join"
 void handle_accept_command(int client_fd, Client *current_client); // Gestisce il comando "accept"
 void handle_reject_command(int client_fd, Client *current_client); // Gestisce il comando "reject"
 void handle_leave_command(int client_fd, Client *current_client); // Gestisce il comando "leave"
-void handle_move_command(int sd, const char* buffer); // Gestisce il comando "move"
+void handle_move_command(int sd, int row, int col); // Gestisce il comando "move"
 void handle_rematch_command(int sd); // Gestisce il comando "rematch" per richiedere una rivincita
+void play_bot_move(Game *game); // Fa giocare al bot la sua mossa e ne gestisce l'esito
+void handle_hint_command(int sd); // Gestisce il comando "hint": suggerisce una mossa al giocatore di turno
+void handle_queue_command(int client_fd, Client *current_client, int rows, int cols, int k); // Gestisce il comando "queue"
+void handle_watch_command(int client_fd, Client *current_client, int game_id); // Gestisce il comando "watch"
+void handle_resume_command(int client_fd, Client *current_client, uint64_t token); // Gestisce il comando "resume"
+void handle_replay_command(int client_fd, Client *current_client, int replay_id); // Gestisce il comando "replay"
+void handle_replays_command(int client_fd, Client *current_client, int game_id); // Gestisce il comando "replays"
+void handle_player_replays_command(int client_fd, Client *current_client, const char *name); // Gestisce il comando "replays player"
+void handle_login_command(int client_fd, Client *current_client, const char *name); // Gestisce il comando "login"
+void handle_rating_command(int client_fd, Client *current_client, const char *name); // Gestisce il comando "rating"
+void handle_top_command(int client_fd, int n); // Gestisce il comando "top"
+void handle_stats_command(int client_fd); // Gestisce il comando "stats"
+bool detach_player(Client *client); // Tiene il posto in partita di un client la cui connessione è caduta
+void arm_rejoin_timer(Game *game); // Arma la scadenza dei posti tenuti sulla prima ancora in sospeso
+void leave_match_queue(Client *client); // Toglie un client dalla coda di matchmaking
+void turn_timer_expired(TimerNode *timer); // Il giocatore di turno non ha mosso in tempo
+void accept_timer_expired(TimerNode *timer); // Il proprietario non ha risposto in tempo a una richiesta di unione
+void idle_timer_expired(TimerNode *timer); // Un client è rimasto inattivo troppo a lungo
+void rejoin_timer_expired(TimerNode *timer); // I giocatori non connessi di una partita non sono rientrati in tempo
+void queue_timer_expired(TimerNode *timer); // Nuovo tentativo di abbinare i giocatori in coda per una variante
 void handle_client_data(int sd, char *buffer, int valread); // Gestisce i dati ricevuti da un client
+void handle_client_frame(Client *client, const ProtoFrame *frame); // Gestisce un frame binario ricevuto da un client
+void handle_new_connections(int master_socket); // Accetta tutte le connessioni in coda sul socket master
+void handle_client_readable(Client *client); // Legge tutti i dati disponibili sul socket di un client
+bool process_client_input(Client *client); // Estrae ed esegue tutti i comandi completi nel buffer di input
+
+// Prototipi per la gestione degli shard
+int game_id_shard(int game_id); // Estrae l'indice dello shard proprietario da un ID di partita
+int game_id_slot(int game_id); // Estrae lo slot nella tabella dello shard da un ID di partita
+Shard* local_shard(int shard_index); // Restituisce lo shard se appartiene a questo worker, altrimenti NULL
+void publish_game(Game *game); // Pubblica lo stato della partita nella directory condivisa e lo registra nel journal
+void record_game(Game *game); // Accoda nel journal lo stato completo della partita
+void record_move(Game *game); // Accoda nel journal l'ultima mossa della partita
+void log_move(Game *game); // Aggiunge l'ultima mossa al registro del round, da cui nasce il replay
+void rate_game(Game *game, int winner_seat); // Aggiorna i punteggi dei giocatori registrati dopo un risultato
+void set_seat_token(Game *game, int seat, uint64_t token); // Assegna (o libera, con 0) il codice di rientro di un posto
+void recover_games(void); // Ricostruisce le partite dello shard corrente da istantanea e journal
+int send_shard_packet(int target_shard, ShardMessageType type, const Client *client, const char *text); // Invia un pacchetto a uno shard di un altro worker
+void drain_shard_ipc(void); // Elabora i pacchetti arrivati da shard di altri worker
+void watch_ipc_outbox(Shard *sh, int target_shard); // Attende che il socket UNIX verso uno shard torni scrivibile
+void flush_ipc_outbox(Shard *sh, int target_shard); // Invia i pacchetti in attesa verso uno shard di un altro worker
+bool register_client_fd(int fd); // Registra il socket di un client negli eventi (epoll o io_uring) dello shard corrente
+bool unregister_client_fd(int fd); // Toglie il socket di un client dagli eventi dello shard corrente
+void accept_timer_retry(TimerNode *timer); // Riarma la accept io_uring dopo un errore
+void handoff_client(Client *client, int target_shard, const char *command); // Trasferisce un client a un altro shard
+void post_shard_message(Shard *target, ShardMessage *msg); // Accoda un messaggio nella inbox di uno shard
+void drain_shard_inbox(void); // Elabora i messaggi arrivati da altri shard
+void *run_shard(void *arg); // Ciclo principale del reactor di uno shard
 
 // --- Implementazioni delle Funzioni di Utilità ---
 
+/**
+ * @brief Legge un intero positivo da una variabile d'ambiente.
+ * @param name Nome della variabile.
+ * @param fallback Valore restituito se la variabile è assente o non valida.
+ */
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    if (value == NULL) {
+        return fallback;
+    }
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || parsed <= 0 || parsed > 0x7FFFFFFF) {
+        fprintf(stderr, "%s non valido (%s), uso default: %d\n", name, value, fallback);
+        return fallback;
+    }
+    return (int)parsed;
+}
+
+/**
+ * @brief Legge l'orologio monotono in millisecondi (non risente delle modifiche all'ora di sistema).
+ */
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Carica la configurazione del server dalle variabili d'ambiente (con valori predefiniti).
+ */
+void load_config(void) {
+    config.port = env_int("TRIS_PORT", PORT);
+    config.max_clients = env_int("TRIS_MAX_CLIENTS", DEFAULT_MAX_CLIENTS);
+    config.max_games = env_int("TRIS_MAX_GAMES", DEFAULT_MAX_GAMES);
+    config.max_output_queue = env_int("TRIS_MAX_OUTPUT_QUEUE", DEFAULT_MAX_OUTPUT_QUEUE);
+    config.search_ms = env_int("TRIS_SEARCH_MS", DEFAULT_SEARCH_MS);
+    config.search_threads = env_int("TRIS_SEARCH_THREADS", 1);
+    config.turn_timeout = env_int("TRIS_TURN_TIMEOUT", DEFAULT_TURN_TIMEOUT);
+    config.accept_timeout = env_int("TRIS_ACCEPT_TIMEOUT", DEFAULT_ACCEPT_TIMEOUT);
+    config.idle_timeout = env_int("TRIS_IDLE_TIMEOUT", DEFAULT_IDLE_TIMEOUT);
+    config.rejoin_timeout = env_int("TRIS_REJOIN_TIMEOUT", DEFAULT_REJOIN_TIMEOUT);
+    const char *journal_dir = getenv("TRIS_JOURNAL_DIR");
+    config.journal_dir = journal_dir && *journal_dir ? journal_dir : NULL;
+    const char *journal_sync = getenv("TRIS_JOURNAL_SYNC");
+    config.journal_sync = journal_sync && strcmp(journal_sync, "1") == 0;
+    const char *replay_dir = getenv("TRIS_REPLAY_DIR");
+    config.replay_dir = replay_dir && *replay_dir ? replay_dir : NULL;
+    const char *ratings_file = getenv("TRIS_RATINGS_FILE");
+    config.ratings_file = ratings_file && *ratings_file ? ratings_file : NULL;
+    config.max_players = env_int("TRIS_MAX_PLAYERS", DEFAULT_MAX_PLAYERS);
+    config.stats_port = env_int("TRIS_STATS_PORT", 0);
+    const char *io_uring = getenv("TRIS_IO_URING");
+    config.io_uring = io_uring && strcmp(io_uring, "1") == 0;
+    if (config.search_threads > SEARCH_MAX_THREADS) {
+        config.search_threads = SEARCH_MAX_THREADS;
+    }
+
+    const char *threads = getenv("TRIS_THREADS");
+    if (threads && strcmp(threads, "auto") == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN); // Un reactor per core
+        config.threads = cores > 0 ? (int)cores : 1;
+    } else {
+        config.threads = env_int("TRIS_THREADS", 1);
+    }
+
+    const char *workers = getenv("TRIS_WORKERS");
+    if (workers && strcmp(workers, "auto") == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN); // Un worker per core
+        config.workers = cores > 0 ? (int)cores : 1;
+    } else {
+        config.workers = env_int("TRIS_WORKERS", 1);
+    }
+    if (config.workers > MAX_SHARDS) {
+        config.workers = MAX_SHARDS;
+    }
+    if (config.workers * config.threads > MAX_SHARDS) {
+        config.threads = MAX_SHARDS / config.workers;
+    }
+}
+
 /**
  * @brief Invia un messaggio a un client specifico.
  * @param client_fd Il file descriptor del client.
@@ -94,756 +624,5172 @@ void handle_client_data(int sd, char *buffer, int valread); // Gestisce i dati r
  */
 void send_to_client(int client_fd, const char *message) {
     if (client_fd > 0) {
-        if (send(client_fd, message, strlen(message), 0) == -1) {
-            perror("send");
+        Client *client = find_client_by_fd(client_fd);
+        if (client) {
+            // Il messaggio viene accodato e inviato a fine giro insieme agli altri dello stesso handler
+            enqueue_output(client, message, strlen(message));
+        } else if (send(client_fd, message, strlen(message), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+            perror("send"); // Socket non ancora registrato (es. "Server pieno")
         }
     }
 }
 
 /**
- * @brief Inizializza una nuova struttura Client per un client connesso.
- * @param client_fd Il file descriptor del nuovo client.
+ * @brief Segna un client come da svuotare a fine giro di eventi.
+ * @param client Il client con nuovo output in coda.
  */
-void initialize_client(int client_fd) {
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (clients[i].fd == 0) { // Trova uno slot libero
-            clients[i].fd = client_fd; // Assegna il file descriptor
-            clients[i].status = PLAYER_CONNECTED; // Stato iniziale del client
-            clients[i].game_id = -1; // Non in partita inizialmente
-            clients[i].player_symbol = EMPTY; // Simbolo iniziale vuoto
-            clients[i].is_current_turn = false; // Non è il turno del client
-            clients[i].wants_rematch = false; // Non ha richiesto una rivincita
-            snprintf(clients[i].username, sizeof(clients[i].username), "Giocatore%d", client_fd); // Nome utente predefinito
-            num_clients++; // Incrementa il numero di client connessi
-            printf("Nuovo client connesso: FD %d. Totale client: %d\n", client_fd, num_clients);
-            send_to_client(client_fd, "\nBenvenuto al gioco del Tris (Tic-Tac-Toe)!\n\n");
-            send_to_client(client_fd, "Comandi disponibili:\n");
-            send_to_client(client_fd, "  create - Crea una nuova partita\n");
-            send_to_client(client_fd, "  join <game_id> - Unisciti a una partita esistente\n");
-            send_to_client(client_fd, "  list - Elenca le partite disponibili\n");
-            send_to_client(client_fd, "  leave - Lascia la partita corrente\n");
-            send_to_client(client_fd, "  move <row> <col> - Effettua una mossa (es. move 0 0)\n");
-            send_to_client(client_fd, "  quit - Disconnettiti dal server\n");
-            return;
+static void mark_client_dirty(Client *client) {
+    if (client->out_dirty) {
+        return;
+    }
+    Shard *sh = current_shard;
+    if (sh->dirty_count == sh->dirty_capacity) {
+        int new_capacity = sh->dirty_capacity > 0 ? sh->dirty_capacity * 2 : INITIAL_TABLE_SIZE;
+        int *new_fds = realloc(sh->dirty_fds, (size_t)new_capacity * sizeof(int));
+        if (!new_fds) {
+            perror("realloc");
+            return; // Verrà svuotato al prossimo evento EPOLLOUT o all'accodamento successivo
         }
+        sh->dirty_fds = new_fds;
+        sh->dirty_capacity = new_capacity;
     }
-    send_to_client(client_fd, "Server pieno, riprova più tardi.\n");
-    close(client_fd);
+    sh->dirty_fds[sh->dirty_count++] = client->fd;
+    client->out_dirty = true;
 }
 
 /**
- * @brief Resetta uno slot di gioco, rendendolo disponibile.
- * @param game Puntatore alla struttura Game da pulire.
+ * @brief Alloca un OutBuf vuoto con un riferimento (del chiamante).
+ * I buffer che stanno in uno slot vengono dai pool dello shard, con la capacità piena dello slot;
+ * quelli più grandi (pagine della lista) da malloc.
+ * @param cap Byte disponibili almeno.
+ * @return Il buffer o NULL se l'allocazione fallisce.
  */
-void cleanup_game(Game *game) {
-    if (game) {
-        printf("Pulizia partita ID: %d\n", game->id);
-        game->id = -1; // Indica che lo slot è libero
-        game->state = GAME_NEW; // Stato iniziale
-        game->owner_fd = -1; // Nessun proprietario
-        game->opponent_fd = -1; // Nessun avversario
-        game->last_result = IN_PROGRESS; // Resetta il risultato
-        // Non è necessario pulire esplicitamente tris_game, verrà reinizializzato alla creazione
-        num_games--;
-        if (num_games < 0) num_games = 0; // Prevenire valori negativi
+static OutBuf *alloc_outbuf(size_t cap) {
+    Shard *sh = current_shard;
+    int pool = -1;
+    if (cap <= OUTBUF_SMALL_SLOT - sizeof(OutBuf)) {
+        pool = METRIC_POOL_BUFFER_SMALL;
+    } else if (cap <= OUTPUT_CHUNK_SIZE) {
+        pool = METRIC_POOL_BUFFER;
+    }
+    OutBuf *buf;
+    if (pool >= 0) {
+        buf = slab_pool_alloc(&sh->pools[pool]);
+        cap = sh->pools[pool].object_size - sizeof(OutBuf);
+    } else {
+        buf = malloc(sizeof(OutBuf) + cap);
+    }
+    if (!buf) {
+        perror(pool >= 0 ? "slab_pool_alloc" : "malloc");
+        return NULL;
     }
+    buf->refs = 1;
+    buf->len = 0;
+    buf->cap = (uint32_t)cap;
+    buf->pool = (int8_t)pool;
+    return buf;
 }
 
 /**
- * @brief Rimuove un client da qualsiasi partita in cui si trovi, riportandolo a PLAYER_CONNECTED.
- * @param client_fd Il file descriptor del client.
+ * @brief Restituisce la memoria di un OutBuf senza più riferimenti al pool da cui proviene (o a free).
  */
-void remove_client_from_game(int client_fd) {
-    Client* client_to_remove = find_client_by_fd(client_fd);
-    if (!client_to_remove || client_to_remove->game_id == -1) {
-        return; // Client non trovato o non in gioco
+static void free_outbuf(OutBuf *buf) {
+    if (buf->pool >= 0) {
+        slab_pool_free(&current_shard->pools[buf->pool], buf);
+    } else {
+        free(buf);
     }
+}
 
-    Game* game = find_game_by_id(client_to_remove->game_id);
-    if (!game) {
-        // Partita non trovata, stato inconsistente. Resetta solo il client.
-        printf("ATTENZIONE: Partita ID %d per client %d non trovata durante rimozione da gioco.\n", client_to_remove->game_id, client_fd);
-        client_to_remove->game_id = -1; 
-        client_to_remove->status = PLAYER_CONNECTED; 
-        client_to_remove->player_symbol = EMPTY;
-        client_to_remove->is_current_turn = false;
-        client_to_remove->wants_rematch = false;
-        return;
+/**
+ * @brief Rilascia un riferimento a un OutBuf, liberandolo se era l'ultimo.
+ * @param buf Il buffer (può essere NULL).
+ */
+static void release_outbuf(OutBuf *buf) {
+    if (buf && --buf->refs == 0) {
+        free_outbuf(buf);
     }
+}
 
-    // Se il client che sta uscendo è l'opponente
-    if (game->opponent_fd == client_to_remove->fd) {
-        game->opponent_fd = -1; // Rimuovi l'opponente
-        // Se c'è un proprietario, notifica e imposta la partita in attesa
-        if (game->owner_fd != -1) {
-            send_to_client(game->owner_fd, "Il tuo avversario ha lasciato la partita. La partita è ora in attesa di un nuovo giocatore.\n");
-            game->state = GAME_WAITING_FOR_PLAYER;
-            printf("Partita %d: Avversario FD %d lasciato, proprietario FD %d ora in attesa.\n", game->id, client_to_remove->fd, game->owner_fd);
-        } else {
-            // Se non c'è più neanche l'owner, la partita è vuota, puliscila
-            cleanup_game(game);
+/**
+ * @brief Aggiunge un segmento in fondo alla coda di output, facendo crescere l'array se necessario.
+ * @return true in caso di successo.
+ */
+static bool push_output_segment(Client *client, const char *data, uint32_t len, OutBuf *buf) {
+    if (client->out_count == client->out_cap) {
+        uint32_t new_cap = client->out_cap > 0 ? client->out_cap * 2 : 8;
+        OutSegment *segs = malloc((size_t)new_cap * sizeof(OutSegment));
+        if (!segs) {
+            perror("malloc");
+            return false;
         }
-    }
-    // Se il client che sta uscendo è il proprietario
-    else if (game->owner_fd == client_to_remove->fd) {
-        // Se c'è un opponente, notifica e pulisci la partita
-        if (game->opponent_fd != -1) {
-            send_to_client(game->opponent_fd, "Il proprietario della partita ha lasciato. La partita è terminata per mancanza di giocatori.\n");
-            Client* other_player = find_client_by_fd(game->opponent_fd);
-            if (other_player) {
-                other_player->game_id = -1;
-                other_player->status = PLAYER_CONNECTED;
-                other_player->player_symbol = EMPTY;
-                other_player->is_current_turn = false;
-                other_player->wants_rematch = false;
-            }
+        // Linearizza l'array circolare nel nuovo array
+        for (uint32_t i = 0; i < client->out_count; i++) {
+            segs[i] = client->out_segs[(client->out_head + i) & (client->out_cap - 1)];
         }
-        printf("Partita %d: Proprietario FD %d lasciato. Partita pulita.\n", game->id, client_to_remove->fd);
-        cleanup_game(game); // Pulisci la partita
-    } else {
-        // Client in gioco ma non owner né opponent (es. in stato di accettazione ma non matchato)
-        printf("Client FD %d non era owner né opponent in partita %d, ma era associato. Dissocia.\n", client_to_remove->fd, client_to_remove->game_id);
+        free(client->out_segs);
+        client->out_segs = segs;
+        client->out_cap = new_cap;
+        client->out_head = 0;
     }
-
-    // Resetta lo stato del client che ha lasciato la partita
-    client_to_remove->game_id = -1;
-    client_to_remove->status = PLAYER_CONNECTED;
-    client_to_remove->player_symbol = EMPTY;
-    client_to_remove->is_current_turn = false;
-    client_to_remove->wants_rematch = false;
-
-    printf("Client FD %d rimosso dalla partita (stato resettato).\n", client_fd);
+    OutSegment *seg = &client->out_segs[(client->out_head + client->out_count) & (client->out_cap - 1)];
+    seg->data = data;
+    seg->len = len;
+    seg->buf = buf;
+    client->out_count++;
+    client->out_bytes += len;
+    return true;
 }
 
 /**
- * @brief Rimuove un client dal server (disconnessione completa).
- * @param client_fd Il file descriptor del client da rimuovere.
+ * @brief Accoda dati nella coda di output di un client.
+ * I messaggi brevi vengono accostati nello stesso buffer, così un handler che invia più messaggi
+ * produce pochi segmenti contigui. Oltre il limite configurato il client viene marcato per la disconnessione.
+ * @param client Il client destinatario.
+ * @param data I dati da inviare.
+ * @param len La loro lunghezza.
  */
-void remove_client(int sd) {
-    // Prima, rimuovi il client da qualsiasi partita
-    remove_client_from_game(sd);
+void enqueue_output(Client *client, const char *data, size_t len) {
+    if (len == 0 || client->out_overflow) {
+        return;
+    }
+    if (client->out_bytes + len > (size_t)config.max_output_queue) {
+        // Il client non legge: invece di far crescere la coda all'infinito lo si disconnette a fine giro
+        client->out_overflow = true;
+        mark_client_dirty(client);
+        return;
+    }
 
-    close(sd); // Chiude il socket
-    FD_CLR(sd, &master_fds); // Rimuove il FD dal set master
-
-    // Trova lo slot del client e lo sposta
-    for (int i = 0; i < num_clients; ++i) {
-        if (clients[i].fd == sd) {
-            // Sposta l'ultimo client nella posizione corrente per riempire il buco
-            clients[i] = clients[num_clients - 1];
-            // Resetta l'ultimo slot, non strettamente necessario ma buona pratica
-            clients[num_clients - 1].fd = 0;
-            num_clients--;
-            printf("Client FD %d disconnesso e rimosso dal server. Client attivi: %d\n", sd, num_clients);
+    // Se l'ultimo segmento termina alla fine di un buffer privato con spazio, i dati vi vengono accodati
+    if (client->out_count > 0) {
+        OutSegment *last = &client->out_segs[(client->out_head + client->out_count - 1) & (client->out_cap - 1)];
+        OutBuf *buf = last->buf;
+        if (buf && buf->refs == 1 && last->data + last->len == buf->data + buf->len && buf->cap - buf->len >= len) {
+            memcpy(buf->data + buf->len, data, len);
+            buf->len += (uint32_t)len;
+            last->len += (uint32_t)len;
+            client->out_bytes += len;
+            mark_client_dirty(client);
             return;
         }
     }
+
+    OutBuf *buf = alloc_outbuf(len > OUTPUT_CHUNK_SIZE ? len : OUTPUT_CHUNK_SIZE);
+    if (!buf) {
+        return;
+    }
+    buf->len = (uint32_t)len;
+    memcpy(buf->data, data, len);
+    if (!push_output_segment(client, buf->data, (uint32_t)len, buf)) {
+        free_outbuf(buf);
+        return;
+    }
+    mark_client_dirty(client);
 }
 
 /**
- * @brief Trova una partita tramite il suo ID.
- * @param game_id L'ID della partita.
- * @return Puntatore alla struttura Game o NULL se non trovata.
+ * @brief Accoda un buffer condiviso senza copiarlo: il segmento ne prende un riferimento.
+ * @param client Il client destinatario.
+ * @param buf Il buffer (resta del chiamante, che rilascia il proprio riferimento quando vuole).
  */
-Game* find_game_by_id(int game_id) {
-    for (int i = 0; i < MAX_GAMES; ++i) {
-        if (games[i].id == game_id) {
-            return &games[i];
-        }
-    }
-    return NULL;
+void enqueue_shared_output(Client *client, OutBuf *buf) {
+    enqueue_shared_range(client, buf, buf->data, buf->len);
 }
 
 /**
- * @brief Trova una partita a cui è associato un dato giocatore.
- * @param player_fd Il file descriptor del giocatore.
- * @return Puntatore alla struttura Game o NULL se non in partita.
+ * @brief Accoda per riferimento una porzione di un buffer condiviso: il segmento ne prende un riferimento.
+ * @param client Il client destinatario.
+ * @param buf Il buffer (resta del chiamante).
+ * @param data Inizio della porzione, all'interno di buf.
+ * @param len La sua lunghezza.
  */
-Game* find_game_by_player_fd(int player_fd) {
-    Client *client = find_client_by_fd(player_fd);
-    if (client && client->game_id != -1) {
-        return find_game_by_id(client->game_id);
+void enqueue_shared_range(Client *client, OutBuf *buf, const char *data, size_t len) {
+    if (len == 0 || client->out_overflow) {
+        return;
     }
-    return NULL;
+    if (client->out_bytes + len > (size_t)config.max_output_queue) {
+        client->out_overflow = true;
+        mark_client_dirty(client);
+        return;
+    }
+    if (!push_output_segment(client, data, (uint32_t)len, buf)) {
+        return;
+    }
+    buf->refs++;
+    mark_client_dirty(client);
 }
 
 /**
- * @brief Trova un client tramite il suo file descriptor.
- * @param client_fd Il file descriptor del client.
- * @return Puntatore alla struttura Client o NULL se non trovata.
+ * @brief Accoda dati che restano validi fino all'uscita del processo (come i record della mappatura dei replay)
+ * senza copiarli: il segmento non ha un buffer proprietario da rilasciare.
+ * @param client Il client destinatario.
+ * @param data I dati.
+ * @param len La loro lunghezza.
  */
-Client* find_client_by_fd(int client_fd) {
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (clients[i].fd == client_fd) {
-            return &clients[i];
-        }
+void enqueue_static_output(Client *client, const void *data, size_t len) {
+    if (len == 0 || client->out_overflow) {
+        return;
+    }
+    if (client->out_bytes + len > (size_t)config.max_output_queue) {
+        client->out_overflow = true;
+        mark_client_dirty(client);
+        return;
+    }
+    if (push_output_segment(client, data, (uint32_t)len, NULL)) {
+        mark_client_dirty(client);
     }
-    return NULL;
 }
 
 /**
- * @brief Stampa la lista delle partite disponibili a un client.
- * @param client_fd Il file descriptor del client a cui inviare la lista.
+ * @brief Rilascia il riferimento di un segmento al suo buffer.
  */
-void print_game_list(int client_fd) {
-    char buffer[BUFFER_SIZE];
-    int offset = snprintf(buffer, sizeof(buffer), "--- Lista Partite ---\n");
-    bool found_games = false;
-
-    for (int i = 0; i < MAX_GAMES; ++i) {
-        if (games[i].id != -1) { // Se la partita è attiva
-            found_games = true;
-            char *state_str;
-            // Determina lo stato della partita
-            switch (games[i].state) {
-                case GAME_NEW:
-                    state_str = "NUOVA (in attesa del proprietario)";
-                    break;
-                case GAME_WAITING_FOR_PLAYER:
-                    state_str = "IN ATTESA DI GIOCATORE";
-                    break;
-                case GAME_IN_PROGRESS:
-                    state_str = "IN CORSO";
-                    break;
-                case GAME_ENDED:
-                    state_str = "TERMINATA";
-                    break;
-                default:
-                    state_str = "SCONOSCIUTO";
-                    break;
-            }
-            offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                               "ID: %d | Stato: %s | Proprietario: FD %d\n",
-                               games[i].id, state_str, games[i].owner_fd);
-        }
-    }
-    // Se non sono state trovate partite, informa il client
-    if (!found_games) {
-        offset += snprintf(buffer + offset, sizeof(buffer) - offset, "Nessuna partita disponibile. Crea una nuova partita con 'create'.\n");
+static void release_segment(OutSegment *seg) {
+    release_outbuf(seg->buf);
+    seg->buf = NULL;
+}
+
+/**
+ * @brief Prepara gli iovec dei primi segmenti della coda di output.
+ * @return Il numero di iovec preparati (al più max).
+ */
+static int fill_output_iov(const Client *client, struct iovec *iov, int max) {
+    int iovcnt = 0;
+    for (uint32_t i = 0; i < client->out_count && iovcnt < max; i++) {
+        const OutSegment *seg = &client->out_segs[(client->out_head + i) & (client->out_cap - 1)];
+        iov[iovcnt].iov_base = (void *)seg->data;
+        iov[iovcnt].iov_len = seg->len;
+        iovcnt++;
     }
-    offset += snprintf(buffer + offset, sizeof(buffer) - offset, "---------------------\n");
-    send_to_client(client_fd, buffer);
+    return iovcnt;
 }
 
 /**
- * @brief Notifica gli "spettatori" di una partita (client non coinvolti direttamente).
- * @param game Puntatore alla struttura Game.
- * @param message Il messaggio per gli spettatori.
+ * @brief Toglie dalla coda di output i byte scritti sul socket.
+ * Consuma i segmenti inviati per intero e accorcia quello inviato in parte.
+ * @param client Il client.
+ * @param written I byte scritti dall'ultima writev.
  */
-void notify_all_spectators(Game *game, const char *message) {
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (clients[i].fd > 0 && clients[i].fd != game->owner_fd && clients[i].fd != game->opponent_fd) {
-            send_to_client(clients[i].fd, message);
+static void consume_client_output(Client *client, size_t written) {
+    METRICS_ADD(current_shard->metrics->bytes_out, written);
+    client->out_bytes -= written;
+    while (written > 0) {
+        OutSegment *seg = &client->out_segs[client->out_head];
+        if (written >= seg->len) {
+            written -= seg->len;
+            release_segment(seg);
+            client->out_head = (client->out_head + 1) & (client->out_cap - 1);
+            client->out_count--;
+        } else {
+            seg->data += written;
+            seg->len -= (uint32_t)written;
+            written = 0;
         }
     }
+    if (client->out_count == 0) {
+        client->out_head = 0;
+    }
 }
 
 /**
- * @brief Invia lo stato attuale del tabellone e il turno ai giocatori della partita.
- * @param game Puntatore alla struttura Game.
+ * @brief Invia con writev() quanto possibile della coda di output del client.
+ * @param client Il client da svuotare.
+ * @return false se il socket è in errore (il chiamante deve rimuovere il client), true altrimenti.
  */
-void send_game_state_to_players(Game *game) {
-    char board_buffer[BUFFER_SIZE];
-    print_board(&game->tris_game, board_buffer); // Assumendo print_board in tris_game.h
+bool flush_client_output(Client *client) {
+    while (client->out_count > 0) {
+        struct iovec iov[MAX_WRITE_SEGMENTS];
+        int iovcnt = fill_output_iov(client, iov, MAX_WRITE_SEGMENTS);
 
-    char msg_owner[BUFFER_SIZE * 2]; // Dimensione aumentata per messaggio combinato
-    char msg_opponent[BUFFER_SIZE * 2]; 
-    
-    // Inizializza i messaggi con lo stato del gioco
-    snprintf(msg_owner, sizeof(msg_owner), "\nStato attuale della partita %d:\n%s", game->id, board_buffer);
-    snprintf(msg_opponent, sizeof(msg_opponent), "\nStato attuale della partita %d:\n%s", game->id, board_buffer);
-    
-    // Aggiungi informazioni sul turno corrente
-    if (game->state == GAME_IN_PROGRESS) {
-        Client* owner_client = find_client_by_fd(game->owner_fd);
-        Client* opponent_client = find_client_by_fd(game->opponent_fd);
-        // Controlla se i client sono validi
-        if (game->tris_game.turn == 0) { // Turno di X (proprietario per la prima mossa)
-            strcat(msg_owner, "È il tuo turno (X).\n");
-            strcat(msg_opponent, "È il turno del tuo avversario (X).\n");
-            if (owner_client) owner_client->is_current_turn = true;
-            if (opponent_client) opponent_client->is_current_turn = false;
-        // Imposta il turno del proprietario come attivo
-        } else { // Turno di O (avversario)
-            strcat(msg_owner, "È il turno del tuo avversario (O).\n");
-            strcat(msg_opponent, "È il tuo turno (O).\n");
-            if (owner_client) owner_client->is_current_turn = false;
-            if (opponent_client) opponent_client->is_current_turn = true;
+        ssize_t written = writev(client->fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                METRICS_ADD(current_shard->metrics->output_backlogged, 1);
+                return true; // Socket pieno: si riprende all'evento EPOLLOUT
+            }
+            return false;
         }
+        consume_client_output(client, (size_t)written);
     }
-    // Invia i messaggi ai giocatori della partita
-    send_to_client(game->owner_fd, msg_owner);
-    if (game->opponent_fd != -1) {
-        send_to_client(game->opponent_fd, msg_opponent);
-    }
+    return true;
 }
 
-// --- Implementazioni delle Funzioni di Gestione Comandi ---
+/**
+ * @brief Posto per un SQE nell'anello di uno shard; se la coda è piena passa prima al kernel gli SQE preparati.
+ * @return L'SQE azzerato, NULL se il kernel non ha potuto leggere la coda.
+ */
+static struct io_uring_sqe *shard_sqe(Shard *sh) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&sh->ring);
+    if (!sqe && uring_submit(&sh->ring) == 0) {
+        sh->write_batch = 0; // Il kernel ha letto gli SQE: gli iovec delle writev si possono riusare
+        sqe = uring_get_sqe(&sh->ring);
+    }
+    return sqe;
+}
 
 /**
- * @brief Gestisce il comando "create".
- * @param client_fd Il file descriptor del client.
- * @param current_client La struttura Client per il client corrente.
+ * @brief Prepara la writev della coda di output di un client sull'anello io_uring dello shard corrente.
+ * La writev parte con la successiva io_uring_enter, insieme all'attesa degli eventi del giro dopo;
+ * i segmenti restano in coda fino alla sua completion, che consuma i byte scritti.
+ * @param client Il client da svuotare.
+ * @return false se il socket è in errore (il chiamante deve rimuovere il client), true altrimenti.
  */
-void handle_create_command(int client_fd, Client *current_client) {
-    // Controlla se il client è già in una partita
-    if (current_client->game_id != -1) {
-        send_to_client(client_fd, "Sei già in una partita. Lasciala prima di crearne una nuova.\n");
-        return;
+static bool submit_client_write(Client *client) {
+    Shard *sh = current_shard;
+    if (client->write_pending || client->write_blocked || client->out_count == 0) {
+        return true; // Riparte alla completion della writev in corso o del poll su POLLOUT
     }
-    // Controlla se il numero massimo di partite è stato raggiunto
-    if (num_games >= MAX_GAMES) {
-        send_to_client(client_fd, "Massimo numero di partite raggiunto. Riprova più tardi.\n");
-        return;
+    if (sh->write_batch == URING_WRITE_BATCH && uring_submit(&sh->ring) == 0) {
+        sh->write_batch = 0; // iovec esauriti: il kernel ha letto gli SQE preparati, gli iovec si possono riusare
     }
-    // Trova uno slot libero per una nuova partita
-    int game_idx = -1;
-    for (int j = 0; j < MAX_GAMES; ++j) {
-        if (games[j].id == -1) { // Trova uno slot di gioco libero
-            game_idx = j;
-            break;
-        }
+    struct io_uring_sqe *sqe = sh->write_batch < URING_WRITE_BATCH ? shard_sqe(sh) : NULL;
+    if (!sqe) {
+        return flush_client_output(client); // Anello saturo: si scrive subito, come con epoll
     }
-    // Se trovato uno slot libero, inizializza la nuova partita
-    if (game_idx != -1) {
-        Game *new_game = &games[game_idx];
-        new_game->id = next_game_id++;
-        new_game->owner_fd = client_fd;
-        new_game->opponent_fd = -1;
-        new_game->state = GAME_WAITING_FOR_PLAYER;
-        new_game->last_result = IN_PROGRESS;
-
-        init_game(&new_game->tris_game); // Inizializza la logica di gioco del tris
-        
-        // Inizializza il tabellone di gioco
-        current_client->game_id = new_game->id;
-        current_client->status = PLAYER_IN_GAME;
-        current_client->player_symbol = X;
-        current_client->is_current_turn = false; // Il turno sarà assegnato all'inizio del gioco
-        current_client->wants_rematch = false;
-        
-        // Aggiungi il nuovo client alla partita
-        num_games++;
-        char msg[BUFFER_SIZE];
-        snprintf(msg, sizeof(msg), "Partita creata con successo! ID: %d. Sei il giocatore X. In attesa di un avversario...\n", new_game->id);
-        send_to_client(client_fd, msg);
-        printf("Partita %d creata da FD %d. Stato: WAIT_FOR_PLAYER\n", new_game->id, client_fd);
+    struct iovec *iov = sh->write_iov + (size_t)sh->write_batch * URING_WRITE_SEGMENTS;
+    int iovcnt = fill_output_iov(client, iov, URING_WRITE_SEGMENTS);
+    uring_prep_writev(sqe, client->fd, iov, (unsigned)iovcnt, IO_USER_DATA(IO_OP_WRITE, client->fd));
+    sh->write_batch++;
+    sh->writes_inflight++;
+    client->write_pending = true;
+    return true;
+}
 
-        snprintf(msg, sizeof(msg), "Nuova partita disponibile (ID: %d) in attesa di un giocatore.\n", new_game->id);
-        notify_all_spectators(new_game, msg);
-    // Non è stato possibile trovare uno slot libero
-    } else {
-        send_to_client(client_fd, "Impossibile creare una nuova partita in questo momento.\n");
+/**
+ * @brief Svuota le code di output dei client che hanno ricevuto messaggi durante il giro di eventi.
+ * I client che hanno superato il limite della coda o il cui socket è in errore vengono rimossi qui,
+ * dopo che tutti gli handler hanno terminato di usarli.
+ */
+void flush_dirty_clients(void) {
+    Shard *sh = current_shard;
+    // La rimozione di un client può accodare messaggi ad altri: la lista può crescere durante il ciclo
+    for (int i = 0; i < sh->dirty_count; i++) {
+        int fd = sh->dirty_fds[i];
+        Client *client = find_client_by_fd(fd);
+        if (!client || !client->out_dirty) {
+            continue; // Client rimosso o trasferito dopo l'accodamento
+        }
+        client->out_dirty = false;
+        if (client->out_overflow) {
+            printf("Client FD %d non legge il proprio output (%zu byte in coda): disconnesso.\n", fd, client->out_bytes);
+            METRICS_ADD(sh->metrics->output_overflows, 1);
+            remove_client(fd);
+            continue;
+        }
+        metrics_observe_output(sh->metrics, client->out_bytes);
+        if (!(sh->io_uring ? submit_client_write(client) : flush_client_output(client))) {
+            perror("writev");
+            remove_client(fd);
+        }
     }
+    sh->dirty_count = 0;
 }
 
 /**
- * @brief Gestisce il comando "join".
- * @param client_fd Il file descriptor del client.
+ * @brief Libera tutti i segmenti ancora in coda di un client.
+ * @param client Il client.
+ */
+void release_client_output(Client *client) {
+    for (uint32_t i = 0; i < client->out_count; i++) {
+        release_segment(&client->out_segs[(client->out_head + i) & (client->out_cap - 1)]);
+    }
+    free(client->out_segs);
+    client->out_segs = NULL;
+    client->out_cap = client->out_head = client->out_count = 0;
+    client->out_bytes = 0;
+}
+
+/**
+ * @brief Accoda un frame binario per un client.
+ * @param client_fd Il file descriptor del client.
+ * @param frame Il frame da inviare.
+ */
+void send_frame(int client_fd, const ProtoFrame *frame) {
+    Client *client = find_client_by_fd(client_fd);
+    if (client) {
+        uint8_t wire[PROTO_FRAME_SIZE];
+        proto_encode(frame, wire);
+        enqueue_output(client, (const char *)wire, sizeof(wire));
+    }
+}
+
+/**
+ * @brief Invia un evento a un client: un frame PROTO_OP_EVENT se usa il protocollo binario, altrimenti il testo.
+ * @param client_fd Il file descriptor del client.
+ * @param event L'evento.
+ * @param game_id L'ID della partita a cui l'evento si riferisce (-1 se nessuna).
+ * @param text Il messaggio per i client testuali.
+ */
+void send_event(int client_fd, ProtoEvent event, int game_id, const char *text) {
+    Client *client = find_client_by_fd(client_fd);
+    if (client && client->binary) {
+        ProtoFrame frame = { PROTO_OP_EVENT, (uint8_t)event, 0, game_id > 0 ? (uint32_t)game_id : 0 };
+        send_frame(client_fd, &frame);
+    } else {
+        send_to_client(client_fd, text);
+    }
+}
+
+/**
+ * @brief Invia un errore a un client: un frame PROTO_OP_ERROR se usa il protocollo binario, altrimenti il testo.
+ * @param client_fd Il file descriptor del client.
+ * @param error Il codice di errore.
+ * @param text Il messaggio per i client testuali.
+ */
+void send_error(int client_fd, ProtoError error, const char *text) {
+    Client *client = find_client_by_fd(client_fd);
+    if (client && client->binary) {
+        ProtoFrame frame = { PROTO_OP_ERROR, (uint8_t)error, 0, 0 };
+        send_frame(client_fd, &frame);
+    } else {
+        send_to_client(client_fd, text);
+    }
+}
+
+/**
+ * @brief Imposta un file descriptor in modalità non bloccante (necessario con epoll edge-triggered).
+ * @param fd Il file descriptor da modificare.
+ * @return 0 in caso di successo, -1 in caso di errore.
+ */
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @brief Alloca un client azzerato dal pool dello shard corrente.
+ * @return Il client o NULL se non si può mappare una nuova slab.
+ */
+static Client *alloc_client(void) {
+    Client *client = slab_pool_alloc(&current_shard->pools[METRIC_POOL_CLIENT]);
+    if (client) {
+        memset(client, 0, sizeof(*client));
+    }
+    return client;
+}
+
+/**
+ * @brief Restituisce un client al pool da cui proviene: se è stato trasferito da un altro shard
+ * del worker, la memoria torna a quello shard.
+ */
+static void free_client(Client *client) {
+    slab_pool_free(&current_shard->pools[METRIC_POOL_CLIENT], client);
+}
+
+/**
+ * @brief Alloca una partita azzerata dal pool dello shard corrente.
+ * @return La partita o NULL se non si può mappare una nuova slab.
+ */
+static Game *alloc_game(void) {
+    Game *game = slab_pool_alloc(&current_shard->pools[METRIC_POOL_GAME]);
+    if (game) {
+        memset(game, 0, sizeof(*game));
+    }
+    return game;
+}
+
+/**
+ * @brief Libera una partita con gli array che possiede.
+ */
+static void free_game(Game *game) {
+    free(game->watchers);
+    free(game->move_log);
+    slab_pool_free(&current_shard->pools[METRIC_POOL_GAME], game);
+}
+
+/**
+ * @brief Inizializza una nuova struttura Client per un client connesso.
+ * @param client_fd Il file descriptor del nuovo client.
+ * @return Puntatore allo slot Client assegnato, NULL se il server è pieno (il socket viene chiuso).
+ */
+Client* initialize_client(int client_fd) {
+    if (current_shard->num_clients >= max_clients_per_shard || !ensure_client_capacity(client_fd)) {
+        send_to_client(client_fd, "Server pieno, riprova più tardi.\n");
+        close(client_fd);
+        return NULL;
+    }
+
+    Client *client = alloc_client();
+    if (!client) {
+        perror("alloc_client");
+        close(client_fd);
+        return NULL;
+    }
+    client->fd = client_fd; // Assegna il file descriptor
+    client->status = PLAYER_CONNECTED; // Stato iniziale del client
+    client->game_id = -1; // Non in partita inizialmente
+    client->watch_game_id = -1; // Non segue nessuna partita
+    client->player_symbol = EMPTY; // Simbolo iniziale vuoto
+    client->is_current_turn = false; // Non è il turno del client
+    client->wants_rematch = false; // Non ha richiesto una rivincita
+    snprintf(client->username, sizeof(client->username), "Giocatore%d", client_fd); // Nome utente predefinito
+    client->account = -1; // Nessun giocatore registrato finché non usa "login"
+    client->last_activity_ms = current_shard->now_ms;
+    timer_init(&client->idle_timer, idle_timer_expired);
+    timer_arm(&current_shard->timers, &client->idle_timer, (uint64_t)config.idle_timeout * 1000);
+    current_shard->clients[client_fd] = client; // Lo slot coincide con il file descriptor
+    current_shard->num_clients++; // Incrementa il numero di client connessi
+    printf("Nuovo client connesso: FD %d (shard %d). Client nello shard: %d\n", client_fd, current_shard->index, current_shard->num_clients);
+    send_to_client(client_fd, "\nBenvenuto al gioco del Tris (Tic-Tac-Toe)!\n\n");
+    send_to_client(client_fd, "Comandi disponibili:\n");
+    send_to_client(client_fd, "  login <nome> | rating [nome] | top [n] - Entra come giocatore registrato, punteggio Elo e classifica\n");
+    send_to_client(client_fd, "  create - Crea una nuova partita\n");
+    send_to_client(client_fd, "  create <righe> <colonne> <k> | create gomoku - Crea una partita su un tabellone più grande\n");
+    send_to_client(client_fd, "  create bot [facile|medio|difficile] [gomoku | <righe> <colonne> <k>] - Gioca subito contro il server\n");
+    send_to_client(client_fd, "  join <game_id> - Unisciti a una partita esistente\n");
+    send_to_client(client_fd, "  queue [gomoku | <righe> <colonne> <k>] - Entra in coda: la partita inizia appena arriva un avversario di punteggio vicino\n");
+    send_to_client(client_fd, "  watch <game_id> | unwatch - Segui (o smetti di seguire) una partita come spettatore\n");
+    send_to_client(client_fd, "  list [waiting] [gomoku | <righe> <colonne> <k>] [page <n> | since <versione>] - Elenca le partite, filtrate e a pagine\n");
+    send_to_client(client_fd, "  replays <game_id> | replays player [nome] | replay <id> - Elenca i round conclusi di una partita o di un giocatore registrato, o rivedine uno mossa per mossa\n");
+    send_to_client(client_fd, "  resume <codice> - Rientra nella tua partita dopo una disconnessione o un riavvio\n");
+    send_to_client(client_fd, "  leave - Lascia la partita corrente\n");
+    send_to_client(client_fd, "  move <row> <col> - Effettua una mossa (es. move 0 0)\n");
+    send_to_client(client_fd, "  hint - Suggerisce la mossa migliore quando è il tuo turno\n");
+    send_to_client(client_fd, "  quit - Disconnettiti dal server\n");
+    send_to_client(client_fd, "  binary - Passa al protocollo binario a frame fissi (per i bot)\n");
+    send_to_client(client_fd, "  stats - Metriche del server (solo da connessioni locali)\n");
+    return client;
+}
+
+/**
+ * @brief Resetta uno slot di gioco, rendendolo disponibile.
+ * @param game Puntatore alla struttura Game da pulire.
+ */
+void cleanup_game(Game *game) {
+    if (game) {
+        printf("Pulizia partita ID: %d\n", game->id);
+        Shard *sh = current_shard;
+        int slot = game_id_slot(game->id);
+        directory_clear(&directory, sh->index, slot); // La partita sparisce dalla lista di tutti i worker
+        JournalMoveRecord record = { JOURNAL_CLOSE, 0, 0, game->id };
+        journal_append(&sh->journal, &record, sizeof(record));
+        set_seat_token(game, 0, 0);
+        set_seat_token(game, 1, 0);
+        GameSlot *gs = &sh->game_slots[slot];
+        gs->game = NULL; // Indica che lo slot è libero
+        gs->generation = (gs->generation + 1) & GAME_GEN_MASK; // Invalida gli ID emessi per questo slot
+        if (gs->generation == 0) gs->generation = 1; // La generazione 0 produrrebbe l'ID 0 per il primo slot
+        gs->next_free = sh->free_game_slot; // Rimette lo slot in testa alla free list
+        sh->free_game_slot = slot;
+        timer_cancel(&sh->timers, &game->turn_timer);
+        timer_cancel(&sh->timers, &game->accept_timer);
+        timer_cancel(&sh->timers, &game->rejoin_timer);
+        for (int i = 0; i < game->num_watchers; ++i) {
+            Client *watcher = find_client_by_fd(game->watchers[i]);
+            if (watcher) {
+                watcher->watch_game_id = -1;
+                send_event(watcher->fd, PROTO_EV_WATCH_ENDED, game->id, "La partita che seguivi è stata chiusa.\n");
+            }
+        }
+        free_game(game);
+        sh->num_games--;
+        if (sh->num_games < 0) sh->num_games = 0; // Prevenire valori negativi
+    }
+}
+
+/**
+ * @brief Libera un posto della partita come se il giocatore fosse uscito: se esce l'avversario la partita
+ * torna in attesa, se esce il proprietario la partita viene chiusa. Vale anche per i posti tenuti per un
+ * giocatore non connesso (DETACHED_FD), che non hanno un client da aggiornare.
+ * @param game La partita.
+ * @param seat 0 per il proprietario (X), 1 per l'avversario (O).
+ */
+static void release_seat(Game *game, int seat) {
+    if (game->state == GAME_IN_PROGRESS) {
+        rate_game(game, seat ^ 1); // Abbandonare una partita in corso (anche per tempo scaduto) vale una sconfitta
+    }
+    if (seat == 1) {
+        int leaving_fd = game->opponent_fd;
+        game->opponent_fd = -1; // Rimuovi l'opponente
+        set_seat_token(game, 1, 0);
+        game->seat_accounts[1] = -1;
+        // Se c'è un proprietario, notifica e imposta la partita in attesa
+        if (game->owner_fd != -1) {
+            send_event(game->owner_fd, PROTO_EV_OPPONENT_LEFT, game->id, "Il tuo avversario ha lasciato la partita. La partita è ora in attesa di un nuovo giocatore.\n");
+            game->state = GAME_WAITING_FOR_PLAYER;
+            publish_game(game);
+            printf("Partita %d: Avversario FD %d lasciato, proprietario FD %d ora in attesa.\n", game->id, leaving_fd, game->owner_fd);
+        } else {
+            // Se non c'è più neanche l'owner, la partita è vuota, puliscila
+            cleanup_game(game);
+        }
+        return;
+    }
+    // Se c'è un opponente, notifica e pulisci la partita
+    if (game->opponent_fd != -1) {
+        send_event(game->opponent_fd, PROTO_EV_OWNER_LEFT, game->id, "Il proprietario della partita ha lasciato. La partita è terminata per mancanza di giocatori.\n");
+        Client* other_player = find_client_by_fd(game->opponent_fd);
+        if (other_player) {
+            other_player->game_id = -1;
+            other_player->status = PLAYER_CONNECTED;
+            other_player->player_symbol = EMPTY;
+            other_player->is_current_turn = false;
+            other_player->wants_rematch = false;
+        }
+    }
+    printf("Partita %d: Proprietario FD %d lasciato. Partita pulita.\n", game->id, game->owner_fd);
+    cleanup_game(game); // Pulisci la partita
+}
+
+/**
+ * @brief Rimuove un client da qualsiasi partita in cui si trovi, riportandolo a PLAYER_CONNECTED.
+ * @param client_fd Il file descriptor del client.
+ */
+void remove_client_from_game(int client_fd) {
+    Client* client_to_remove = find_client_by_fd(client_fd);
+    if (!client_to_remove || client_to_remove->game_id == -1) {
+        return; // Client non trovato o non in gioco
+    }
+
+    Game* game = find_game_by_id(client_to_remove->game_id);
+    if (!game) {
+        // Partita non trovata, stato inconsistente. Resetta solo il client.
+        printf("ATTENZIONE: Partita ID %d per client %d non trovata durante rimozione da gioco.\n", client_to_remove->game_id, client_fd);
+        client_to_remove->game_id = -1; 
+        client_to_remove->status = PLAYER_CONNECTED; 
+        client_to_remove->player_symbol = EMPTY;
+        client_to_remove->is_current_turn = false;
+        client_to_remove->wants_rematch = false;
+        return;
+    }
+
+    if (game->opponent_fd == client_to_remove->fd) {
+        release_seat(game, 1);
+    } else if (game->owner_fd == client_to_remove->fd) {
+        release_seat(game, 0);
+    } else {
+        // Client in gioco ma non owner né opponent (es. in stato di accettazione ma non matchato)
+        printf("Client FD %d non era owner né opponent in partita %d, ma era associato. Dissocia.\n", client_to_remove->fd, client_to_remove->game_id);
+    }
+
+    // Resetta lo stato del client che ha lasciato la partita
+    client_to_remove->game_id = -1;
+    client_to_remove->status = PLAYER_CONNECTED;
+    client_to_remove->player_symbol = EMPTY;
+    client_to_remove->is_current_turn = false;
+    client_to_remove->wants_rematch = false;
+
+    printf("Client FD %d rimosso dalla partita (stato resettato).\n", client_fd);
+}
+
+/**
+ * @brief Rimuove un client dal server (disconnessione completa). Se era seduto in una partita il suo posto
+ * resta tenuto per TRIS_REJOIN_TIMEOUT secondi (detach_player).
+ * @param client_fd Il file descriptor del client da rimuovere.
+ */
+void remove_client(int sd) {
+    // Prima, rimuovi il client da qualsiasi partita o dalla coda di matchmaking.
+    // Una connessione caduta non fa perdere la partita: il posto resta tenuto per il rientro ("quit" lo libera prima)
+    Client *leaving = find_client_by_fd(sd);
+    if (!leaving || !detach_player(leaving)) {
+        remove_client_from_game(sd);
+    }
+    Client *queued = find_client_by_fd(sd);
+    if (queued && queued->status == PLAYER_QUEUED) {
+        leave_match_queue(queued);
+    }
+    if (queued) {
+        stop_watching(queued);
+    }
+
+    // Il socket esce dagli eventi dello shard (con io_uring non resta nessuna operazione in corso su di esso),
+    // poi un ultimo tentativo, non bloccante, di consegnare i messaggi in coda (es. "Arrivederci!")
+    unregister_client_fd(sd);
+    Client *client = find_client_by_fd(sd);
+    if (client && !client->out_overflow) {
+        flush_client_output(client);
+    }
+    close(sd); // Chiude il socket
+
+    // Libera lo slot del client (indicizzato per file descriptor)
+    if (client) {
+        current_shard->clients[sd] = NULL;
+        timer_cancel(&current_shard->timers, &client->idle_timer);
+        release_client_output(client);
+        free_client(client);
+        current_shard->num_clients--;
+        printf("Client FD %d disconnesso e rimosso dal server. Client nello shard %d: %d\n", sd, current_shard->index, current_shard->num_clients);
+    }
+}
+
+/**
+ * @brief Trova una partita tramite il suo ID.
+ * @param game_id L'ID della partita.
+ * @return Puntatore alla struttura Game o NULL se non trovata.
+ */
+Game* find_game_by_id(int game_id) {
+    // Solo le partite dello shard corrente sono visibili: le altre si raggiungono con un handoff
+    if (game_id <= 0 || game_id_shard(game_id) != current_shard->index) {
+        return NULL;
+    }
+    unsigned slot = (unsigned)game_id_slot(game_id);
+    if (slot >= (unsigned)current_shard->game_slots_capacity) {
+        return NULL;
+    }
+    Game *game = current_shard->game_slots[slot].game;
+    // L'ID deve coincidere per intero: una generazione diversa indica una partita ormai chiusa
+    return (game && game->id == game_id) ? game : NULL;
+}
+
+/**
+ * @brief Trova una partita a cui è associato un dato giocatore.
+ * @param player_fd Il file descriptor del giocatore.
+ * @return Puntatore alla struttura Game o NULL se non in partita.
+ */
+Game* find_game_by_player_fd(int player_fd) {
+    Client *client = find_client_by_fd(player_fd);
+    if (client && client->game_id != -1) {
+        return find_game_by_id(client->game_id);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Trova un client tramite il suo file descriptor.
+ * @param client_fd Il file descriptor del client.
+ * @return Puntatore alla struttura Client o NULL se non trovata.
+ */
+Client* find_client_by_fd(int client_fd) {
+    if (client_fd < 0 || client_fd >= current_shard->clients_capacity) {
+        return NULL;
+    }
+    return current_shard->clients[client_fd];
+}
+
+/**
+ * @brief Estrae l'indice dello shard proprietario da un ID di partita.
+ * @param game_id L'ID della partita.
+ * @return L'indice dello shard, -1 se l'ID non è valido.
+ */
+int game_id_shard(int game_id) {
+    if (game_id <= 0) {
+        return -1;
+    }
+    return game_id % num_shards;
+}
+
+/**
+ * @brief Estrae lo slot nella tabella dello shard proprietario da un ID di partita.
+ * @param game_id L'ID della partita (valido).
+ * @return L'indice dello slot.
+ */
+int game_id_slot(int game_id) {
+    return (int)(((unsigned)game_id / (unsigned)num_shards) >> GAME_GEN_BITS);
+}
+
+/**
+ * @brief Restituisce lo shard con l'indice globale dato se è ospitato da questo worker.
+ * @param shard_index L'indice globale dello shard.
+ * @return Puntatore allo shard locale o NULL se appartiene a un altro worker.
+ */
+Shard* local_shard(int shard_index) {
+    int local = shard_index - worker_index * config.threads;
+    if (local < 0 || local >= config.threads) {
+        return NULL;
+    }
+    return &shards[local];
+}
+
+// Scrive la voce della partita nella directory condivisa
+static void publish_directory_entry(Game *game) {
+    const TrisGame *tg = &game->tris_game;
+    int32_t variant = is_classic_game(tg) ? 0 : PROTO_VARIANT(tg->rows, tg->cols, tg->k);
+    directory_publish(&directory, current_shard->index, game_id_slot(game->id), game->id, (int32_t)game->state, game->owner_fd, variant);
+}
+
+/**
+ * @brief Pubblica lo stato corrente della partita nella directory condivisa, letta da "list" in tutti i worker,
+ * e lo registra nel journal dello shard.
+ * Va chiamata dallo shard proprietario dopo ogni cambio di stato o di proprietario.
+ * @param game Puntatore alla struttura Game.
+ */
+void publish_game(Game *game) {
+    publish_directory_entry(game);
+    record_game(game);
+}
+
+/**
+ * @brief Fa crescere (per raddoppio) la tabella dei client finché non contiene l'indice fd.
+ * @param fd Il file descriptor da ospitare.
+ * @return true se la tabella contiene ora lo slot, false se l'allocazione è fallita.
+ */
+bool ensure_client_capacity(int fd) {
+    Shard *sh = current_shard;
+    if (fd < sh->clients_capacity) {
+        return true;
+    }
+    int new_capacity = sh->clients_capacity > 0 ? sh->clients_capacity : INITIAL_TABLE_SIZE;
+    while (new_capacity <= fd) {
+        new_capacity *= 2;
+    }
+    Client **new_table = realloc(sh->clients, (size_t)new_capacity * sizeof(Client *));
+    if (!new_table) {
+        perror("realloc");
+        return false;
+    }
+    memset(new_table + sh->clients_capacity, 0, (size_t)(new_capacity - sh->clients_capacity) * sizeof(Client *));
+    sh->clients = new_table;
+    sh->clients_capacity = new_capacity;
+    return true;
+}
+
+/**
+ * @brief Fa crescere (per raddoppio) la tabella delle partite dello shard corrente fino ad almeno min_capacity slot.
+ * I nuovi slot entrano in testa alla free list, in ordine crescente.
+ * @param min_capacity Numero di slot richiesto.
+ * @return true se la tabella contiene ora gli slot, false se si supera il limite di partite o l'allocazione fallisce.
+ */
+static bool grow_game_slots(int min_capacity) {
+    Shard *sh = current_shard;
+    int old_capacity = sh->game_slots_capacity;
+    int new_capacity = old_capacity > 0 ? old_capacity : INITIAL_TABLE_SIZE;
+    while (new_capacity < min_capacity) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > max_games_per_shard) {
+        new_capacity = max_games_per_shard; // La directory condivisa ha una voce per slot
+    }
+    if (new_capacity < min_capacity || new_capacity <= old_capacity) {
+        return false;
+    }
+    GameSlot *new_slots = realloc(sh->game_slots, (size_t)new_capacity * sizeof(GameSlot));
+    if (!new_slots) {
+        perror("realloc");
+        return false;
+    }
+    for (int i = old_capacity; i < new_capacity; ++i) {
+        new_slots[i].game = NULL;
+        new_slots[i].generation = 1;
+        new_slots[i].next_free = (i + 1 < new_capacity) ? i + 1 : sh->free_game_slot;
+    }
+    sh->game_slots = new_slots;
+    sh->game_slots_capacity = new_capacity;
+    sh->free_game_slot = old_capacity;
+    return true;
+}
+
+/**
+ * @brief Alloca una nuova partita in uno slot libero, facendo crescere la tabella se necessario.
+ * L'ID restituito codifica slot e generazione (vedi GAME_GEN_BITS).
+ * @return Puntatore alla partita (già inserita nella tabella) o NULL se non c'è spazio.
+ */
+Game* allocate_game(void) {
+    Shard *sh = current_shard;
+    if (sh->num_games >= max_games_per_shard) {
+        return NULL;
+    }
+    Game *game = alloc_game();
+    if (!game) {
+        perror("alloc_game");
+        return NULL;
+    }
+    timer_init(&game->turn_timer, turn_timer_expired);
+    timer_init(&game->accept_timer, accept_timer_expired);
+    timer_init(&game->rejoin_timer, rejoin_timer_expired);
+    game->seat_accounts[0] = game->seat_accounts[1] = -1;
+
+    if (sh->free_game_slot == -1 && !grow_game_slots(sh->game_slots_capacity + 1)) {
+        free_game(game);
+        return NULL; // Spazio degli slot esaurito o allocazione fallita
+    }
+
+    int slot = sh->free_game_slot;
+    GameSlot *gs = &sh->game_slots[slot];
+    sh->free_game_slot = gs->next_free;
+    game->id = (int)((((unsigned)slot << GAME_GEN_BITS) | gs->generation) * (unsigned)num_shards + (unsigned)sh->index);
+    gs->game = game;
+    sh->num_games++;
+    return game;
+}
+
+// --- Journal e Ripristino ---
+
+// Il journal di ogni shard registra le pubblicazioni delle sue partite (JOURNAL_GAME, che contiene lo stato completo),
+// le mosse e le chiusure. I record di un giro di eventi vengono scritti con una sola write() prima delle risposte
+// di quel giro: nel percorso di una mossa resta solo la copia di un record di 8 byte nel buffer del journal.
+// All'avvio lo shard rilegge istantanea e journal, tiene il posto di ogni giocatore (DETACHED_FD) finché non rientra
+// con il suo codice o scade TRIS_REJOIN_TIMEOUT, e scrive subito una nuova istantanea.
+
+// Posizione iniziale di un codice nell'indice dei codici di rientro (hash moltiplicativo di Fibonacci)
+static int seat_home(uint64_t token, int capacity) {
+    return (int)((token * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+// Posizione del codice nell'indice, -1 se assente
+static int seat_find(uint64_t token) {
+    Shard *sh = current_shard;
+    if (sh->seat_index_capacity == 0) {
+        return -1;
+    }
+    int mask = sh->seat_index_capacity - 1;
+    for (int i = seat_home(token, sh->seat_index_capacity); sh->seat_index[i].token != 0; i = (i + 1) & mask) {
+        if (sh->seat_index[i].token == token) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Libera la posizione pos dell'indice riportando indietro le voci successive della stessa sequenza (come per la lista)
+static void seat_index_remove(int pos) {
+    Shard *sh = current_shard;
+    int mask = sh->seat_index_capacity - 1;
+    int hole = pos;
+    int i = pos;
+    sh->seat_index[hole].token = 0;
+    sh->seat_index_count--;
+    for (;;) {
+        i = (i + 1) & mask;
+        if (sh->seat_index[i].token == 0) {
+            return;
+        }
+        int home = seat_home(sh->seat_index[i].token, sh->seat_index_capacity);
+        bool stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!stays) {
+            sh->seat_index[hole] = sh->seat_index[i];
+            sh->seat_index[i].token = 0;
+            hole = i;
+        }
+    }
+}
+
+// Associa il codice alla partita, facendo crescere l'indice per tenerlo pieno al più a metà
+static void seat_index_put(uint64_t token, int32_t game_id) {
+    Shard *sh = current_shard;
+    int pos = seat_find(token);
+    if (pos >= 0) {
+        sh->seat_index[pos].game_id = game_id;
+        return;
+    }
+    if ((sh->seat_index_count + 1) * 2 > sh->seat_index_capacity) {
+        int new_capacity = sh->seat_index_capacity > 0 ? sh->seat_index_capacity * 2 : INITIAL_TABLE_SIZE * 2;
+        SeatTokenSlot *index = calloc((size_t)new_capacity, sizeof(SeatTokenSlot));
+        if (!index) {
+            perror("calloc");
+            return; // Il posto resta valido, ma senza journal non potrà essere ritrovato dopo un riavvio
+        }
+        SeatTokenSlot *old = sh->seat_index;
+        int old_capacity = sh->seat_index_capacity;
+        sh->seat_index = index;
+        sh->seat_index_capacity = new_capacity;
+        for (int i = 0; i < old_capacity; ++i) {
+            if (old[i].token != 0) {
+                int j = seat_home(old[i].token, new_capacity);
+                while (index[j].token != 0) {
+                    j = (j + 1) & (new_capacity - 1);
+                }
+                index[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    int i = seat_home(token, sh->seat_index_capacity);
+    while (sh->seat_index[i].token != 0) {
+        i = (i + 1) & (sh->seat_index_capacity - 1);
+    }
+    sh->seat_index[i].token = token;
+    sh->seat_index[i].game_id = game_id;
+    sh->seat_index_count++;
+}
+
+/**
+ * @brief Assegna il codice di rientro di un posto della partita, aggiornando l'indice dello shard.
+ * Un codice passato all'altro posto (il vincitore O che diventa X) resta nell'indice.
+ * @param game La partita.
+ * @param seat 0 per il proprietario (X), 1 per l'avversario (O).
+ * @param token Il nuovo codice, 0 per liberare il posto.
+ */
+void set_seat_token(Game *game, int seat, uint64_t token) {
+    uint64_t old = game->seat_tokens[seat];
+    game->seat_tokens[seat] = token;
+    if (old != 0 && old != game->seat_tokens[1 - seat]) {
+        int pos = seat_find(old);
+        if (pos >= 0) {
+            seat_index_remove(pos);
+        }
+    }
+    if (token != 0) {
+        seat_index_put(token, game->id);
+    }
+}
+
+/**
+ * @brief Genera un codice di rientro casuale di SEAT_TOKEN_BITS bit che codifica lo shard corrente
+ * (codice modulo numero di shard), così "resume" raggiunge lo shard della partita senza altre informazioni.
+ * @return Il codice, mai 0 e non già in uso nello shard.
+ */
+static uint64_t new_seat_token(void) {
+    const uint64_t mask = ((uint64_t)1 << SEAT_TOKEN_BITS) - 1;
+    uint64_t token;
+    do {
+        if (getrandom(&token, sizeof(token), 0) != (ssize_t)sizeof(token)) {
+            struct timespec ts; // Ripiego se getrandom() non è disponibile
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            token = (((uint64_t)ts.tv_nsec << 32) ^ (uint64_t)ts.tv_sec ^ current_shard->rng) * 0x9E3779B97F4A7C15ull;
+        }
+        token &= mask;
+        token = token - token % (uint64_t)num_shards + (uint64_t)current_shard->index;
+        if (token > mask) {
+            token -= (uint64_t)num_shards;
+        }
+    } while (token == 0 || seat_find(token) >= 0);
+    return token;
+}
+
+/**
+ * @brief Invia al giocatore seduto in un posto il suo codice di rientro, che gli permette di riprendere il posto
+ * da un'altra connessione se la sua cade (o dopo un riavvio, se lo shard ha un journal).
+ * @param game La partita.
+ * @param seat 0 per il proprietario (X), 1 per l'avversario (O).
+ */
+static void send_seat_token(Game *game, int seat) {
+    int fd = seat == 0 ? game->owner_fd : game->opponent_fd;
+    uint64_t token = game->seat_tokens[seat];
+    Client *client = find_client_by_fd(fd);
+    if (!client || token == 0) {
+        return;
+    }
+    if (client->binary) {
+        ProtoFrame frame = { PROTO_OP_TOKEN, (uint8_t)(token >> 48), (uint16_t)(token >> 32), (uint32_t)token };
+        send_frame(fd, &frame);
+    } else {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Codice di rientro per la partita %d: %014llx (se la connessione cade: resume <codice>).\n",
+                 game->id, (unsigned long long)token);
+        send_to_client(fd, msg);
+    }
+}
+
+/**
+ * @brief Accoda nel journal lo stato completo della partita (record JOURNAL_GAME).
+ * @param game La partita.
+ */
+void record_game(Game *game) {
+    Journal *journal = &current_shard->journal;
+    if (journal->fd < 0) {
+        return;
+    }
+    JournalGameRecord record;
+    record.type = JOURNAL_GAME;
+    record.state = (uint8_t)game->state;
+    record.bot_level = (uint8_t)game->bot_level;
+    record.last_result = (uint8_t)game->last_result;
+    record.game_id = game->id;
+    record.seat_tokens[0] = game->seat_tokens[0];
+    record.seat_tokens[1] = game->seat_tokens[1];
+    record.board = game->tris_game;
+    journal_append(journal, &record, sizeof(record));
+}
+
+/**
+ * @brief Accoda nel journal l'ultima mossa giocata nella partita: è il record del percorso caldo, 8 byte copiati in memoria.
+ * @param game La partita.
+ */
+void record_move(Game *game) {
+    JournalMoveRecord record = { JOURNAL_MOVE, 0, (uint16_t)game->tris_game.last_move, game->id };
+    journal_append(&current_shard->journal, &record, sizeof(record));
+}
+
+// Libera lo slot di una partita ripristinata e poi chiusa nel journal; la free list viene ricostruita a fine ripristino
+static void discard_restored_game(Game *game) {
+    Shard *sh = current_shard;
+    GameSlot *gs = &sh->game_slots[game_id_slot(game->id)];
+    gs->game = NULL;
+    gs->generation = (gs->generation + 1) & GAME_GEN_MASK; // L'ID chiuso non torna a indicare una nuova partita
+    if (gs->generation == 0) gs->generation = 1;
+    free_game(game);
+    sh->num_games--;
+}
+
+// Restituisce la partita con l'ID dato, creandola nel suo slot (con la sua generazione) se non esiste ancora
+static Game *restore_game(int32_t game_id) {
+    Shard *sh = current_shard;
+    if (game_id_shard(game_id) != sh->index) {
+        return NULL;
+    }
+    int slot = game_id_slot(game_id);
+    if (slot >= sh->game_slots_capacity && !grow_game_slots(slot + 1)) {
+        fprintf(stderr, "Partita %d non ripristinata: oltre il limite di partite dello shard\n", game_id);
+        return NULL;
+    }
+    GameSlot *gs = &sh->game_slots[slot];
+    if (gs->game && gs->game->id == game_id) {
+        return gs->game;
+    }
+    if (gs->game) {
+        discard_restored_game(gs->game); // Partita precedente dello stesso slot senza record di chiusura
+    }
+    Game *game = alloc_game();
+    if (!game) {
+        perror("alloc_game");
+        return NULL;
+    }
+    timer_init(&game->turn_timer, turn_timer_expired);
+    timer_init(&game->accept_timer, accept_timer_expired);
+    timer_init(&game->rejoin_timer, rejoin_timer_expired);
+    game->seat_accounts[0] = game->seat_accounts[1] = -1;
+    game->id = game_id;
+    gs->game = game;
+    gs->generation = ((unsigned)game_id / (unsigned)num_shards) & GAME_GEN_MASK;
+    sh->num_games++;
+    return game;
+}
+
+// Applica un record letto da istantanea o journal alle partite dello shard corrente
+static void apply_journal_record(const uint8_t *data, size_t len, void *ctx) {
+    (void)ctx;
+    if (data[0] == JOURNAL_GAME && len == sizeof(JournalGameRecord)) {
+        JournalGameRecord record;
+        memcpy(&record, data, sizeof(record));
+        TrisGame check;
+        if (init_game_variant(&check, record.board.rows, record.board.cols, record.board.k) < 0 ||
+            record.board.turn < 0 || record.board.turn > 1 || record.state > GAME_ENDED || record.bot_level > BOT_HARD) {
+            return; // Record non plausibile
+        }
+        Game *game = restore_game(record.game_id);
+        if (game) {
+            game->state = (GameState)record.state;
+            game->bot_level = (BotLevel)record.bot_level;
+            game->last_result = (GameResult)record.last_result;
+            game->seat_tokens[0] = record.seat_tokens[0];
+            game->seat_tokens[1] = record.seat_tokens[1];
+            game->tris_game = record.board;
+        }
+    } else if ((data[0] == JOURNAL_MOVE || data[0] == JOURNAL_CLOSE) && len == sizeof(JournalMoveRecord)) {
+        JournalMoveRecord record;
+        memcpy(&record, data, sizeof(record));
+        Game *game = find_game_by_id(record.game_id);
+        if (game && record.type == JOURNAL_MOVE) {
+            if (make_move_index(&game->tris_game, record.cell) == 0) {
+                log_move(game); // Il registro del round si ricostruisce dalle mosse del journal
+            }
+        } else if (game) {
+            discard_restored_game(game);
+        }
+    }
+}
+
+// Scrive nell'istantanea lo stato completo di tutte le partite dello shard
+static void write_snapshot_records(Journal *journal, void *ctx) {
+    (void)journal;
+    (void)ctx;
+    Shard *sh = current_shard;
+    for (int i = 0; i < sh->game_slots_capacity; ++i) {
+        if (sh->game_slots[i].game) {
+            record_game(sh->game_slots[i].game);
+        }
+    }
+}
+
+/**
+ * @brief Ricostruisce le partite dello shard corrente dall'ultima istantanea e dal journal che la segue.
+ * I posti dei giocatori restano tenuti (DETACHED_FD) per TRIS_REJOIN_TIMEOUT secondi: chi rientra con il proprio
+ * codice ritrova la partita dov'era. Al termine scrive una nuova istantanea e riparte con un journal vuoto.
+ */
+void recover_games(void) {
+    Shard *sh = current_shard;
+    if (sh->journal.fd < 0) {
+        return;
+    }
+    int records = journal_replay(&sh->journal, apply_journal_record, NULL);
+
+    int restored = 0;
+    sh->free_game_slot = -1;
+    for (int i = sh->game_slots_capacity - 1; i >= 0; --i) {
+        GameSlot *gs = &sh->game_slots[i];
+        if (gs->game && gs->game->seat_tokens[0] == 0) {
+            discard_restored_game(gs->game); // Nessun proprietario che possa rientrare
+        }
+        Game *game = gs->game;
+        if (!game) {
+            gs->next_free = sh->free_game_slot; // Free list in ordine crescente di slot
+            sh->free_game_slot = i;
+            continue;
+        }
+        game->owner_fd = DETACHED_FD;
+        game->opponent_fd = game->bot_level != BOT_NONE ? BOT_FD : game->seat_tokens[1] != 0 ? DETACHED_FD : -1;
+        seat_index_put(game->seat_tokens[0], game->id);
+        if (game->seat_tokens[1] != 0) {
+            seat_index_put(game->seat_tokens[1], game->id);
+        }
+        publish_directory_entry(game);
+        game->rejoin_deadline[0] = game->rejoin_deadline[1] = sh->now_ms + (uint64_t)config.rejoin_timeout * 1000;
+        arm_rejoin_timer(game);
+        restored++;
+    }
+    journal_snapshot(&sh->journal, write_snapshot_records, NULL);
+    printf("Shard %d: %d partite ripristinate dal journal (%d record letti).\n", sh->index, restored, records);
+}
+
+/**
+ * @brief Scrive i record del giro di eventi (group commit) e, se il journal è cresciuto oltre JOURNAL_SNAPSHOT_BYTES,
+ * lo sostituisce con un'istantanea delle partite dello shard.
+ */
+static void commit_journal(void) {
+    Journal *journal = &current_shard->journal;
+    journal_commit(journal);
+    if (journal->fd >= 0 && journal->size > JOURNAL_SNAPSHOT_BYTES) {
+        journal_snapshot(journal, write_snapshot_records, NULL);
+    }
+}
+
+// --- Giocatori Registrati e Classifica ---
+// "login <nome>" lega la connessione a un giocatore della tabella condivisa tra i worker. Le partite tra due
+// giocatori registrati aggiornano il punteggio Elo di entrambi; la classifica è un albero di Fenwick sui bucket
+// di punteggio, quindi posizione e primi N si leggono in tempo logaritmico senza ordinare i giocatori.
+
+/**
+ * @brief Invia a un client il punteggio e la posizione in classifica di un giocatore registrato.
+ * @param client_fd Il file descriptor del destinatario.
+ * @param info Lo stato del giocatore.
+ * @param delta Variazione dopo una partita valutata (0 in risposta a "rating").
+ * @param after_game Vero se il messaggio segue una partita valutata.
+ */
+static void send_rating_info(int client_fd, const RatingInfo *info, int32_t delta, bool after_game) {
+    Client *client = find_client_by_fd(client_fd);
+    if (!client) {
+        return;
+    }
+    if (client->binary) {
+        ProtoFrame frame = { PROTO_OP_RATING_INFO, after_game ? 1 : 0, (uint16_t)info->rating, info->rank };
+        send_frame(client_fd, &frame);
+        return;
+    }
+    char msg[BUFFER_SIZE];
+    if (after_game) {
+        snprintf(msg, sizeof(msg), "Partita valutata: il tuo punteggio è ora %d (%+d), posizione %u su %u.\n",
+                 info->rating, delta, info->rank, info->players);
+    } else {
+        snprintf(msg, sizeof(msg), "%s: punteggio %d, posizione %u su %u (%u vittorie, %u pareggi, %u sconfitte).\n",
+                 info->name, info->rating, info->rank, info->players, info->wins, info->draws, info->losses);
+    }
+    send_to_client(client_fd, msg);
+}
+
+/**
+ * @brief Aggiorna i punteggi dopo il risultato di una partita tra due giocatori registrati e lo comunica loro.
+ * Le partite contro il bot e quelle con un giocatore non registrato non sono valutate.
+ * @param game La partita, con i posti ancora assegnati.
+ * @param winner_seat Il posto del vincitore (0 = X, 1 = O), -1 per un pareggio.
+ */
+void rate_game(Game *game, int winner_seat) {
+    int32_t x = game->seat_accounts[0];
+    int32_t o = game->seat_accounts[1];
+    if (game->bot_level != BOT_NONE || x < 0 || o < 0 || x == o) {
+        return;
+    }
+    RatingOutcome outcome = winner_seat < 0 ? RATING_DRAW : winner_seat == 0 ? RATING_WIN : RATING_LOSS;
+    int32_t deltas[2];
+    ratings_record(&ratings, x, o, outcome, &deltas[0], &deltas[1]);
+    int fds[2] = { game->owner_fd, game->opponent_fd };
+    for (int seat = 0; seat < 2; ++seat) {
+        RatingInfo info;
+        if (fds[seat] >= 0 && ratings_get(&ratings, game->seat_accounts[seat], &info) == 0) {
+            send_rating_info(fds[seat], &info, deltas[seat], true);
+        }
+    }
+    printf("Partita %d valutata: X %+d, O %+d.\n", game->id, deltas[0], deltas[1]);
+}
+
+/**
+ * @brief Gestisce il comando "login": registra il giocatore se il nome è nuovo e lo lega alla connessione.
+ * Non è possibile cambiare giocatore durante una partita o in coda.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param name Il nome scelto.
+ */
+void handle_login_command(int client_fd, Client *current_client, const char *name) {
+    if (current_client->game_id != -1 || current_client->status == PLAYER_QUEUED) {
+        send_error(client_fd, PROTO_ERR_ALREADY_IN_GAME, "Lascia la partita (o la coda) prima di cambiare giocatore.\n");
+        return;
+    }
+    if (!ratings_valid_name(name)) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Nome non valido: da 1 a %d lettere, cifre, '_' o '-'.\n", RATING_NAME_MAX - 1);
+        send_to_client(client_fd, msg);
+        return;
+    }
+    int32_t account = ratings_login(&ratings, name);
+    if (account < 0) {
+        send_error(client_fd, PROTO_ERR_INTERNAL, "Non è possibile registrare altri giocatori, riprova più tardi.\n");
+        return;
+    }
+    current_client->account = account;
+    snprintf(current_client->username, sizeof(current_client->username), "%s", name);
+    RatingInfo info;
+    if (ratings_get(&ratings, account, &info) == 0) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Benvenuto %s! Punteggio %d, posizione %u su %u.\n", info.name, info.rating, info.rank, info.players);
+        send_to_client(client_fd, msg);
+    }
+    printf("Client FD %d entrato come %s (giocatore %d).\n", client_fd, name, account);
+}
+
+/**
+ * @brief Gestisce il comando "rating": punteggio e posizione del giocatore indicato o di quello della connessione.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param name Il nome del giocatore, NULL per il giocatore della connessione.
+ */
+void handle_rating_command(int client_fd, Client *current_client, const char *name) {
+    int32_t account = name ? ratings_find(&ratings, name) : current_client->account;
+    RatingInfo info;
+    if (account < 0 || ratings_get(&ratings, account, &info) < 0) {
+        send_error(client_fd, PROTO_ERR_NOT_LOGGED_IN, name ? "Giocatore non registrato.\n" : "Non sei registrato: digita 'login <nome>'.\n");
+        return;
+    }
+    send_rating_info(client_fd, &info, 0, false);
+}
+
+/**
+ * @brief Gestisce il comando "top": invia i primi n giocatori della classifica.
+ * @param client_fd Il file descriptor del client.
+ * @param n Voci richieste (al più RATING_TOP_MAX).
+ */
+void handle_top_command(int client_fd, int n) {
+    RatingInfo top[RATING_TOP_MAX];
+    int count = ratings_top(&ratings, n, top);
+    char text[RATING_TOP_MAX * 96 + BUFFER_SIZE];
+    size_t len = (size_t)snprintf(text, sizeof(text), "--- Classifica ---\n");
+    for (int i = 0; i < count; ++i) {
+        len += (size_t)snprintf(text + len, sizeof(text) - len, "%4u. %-31s %5d  (%u/%u/%u)\n", top[i].rank, top[i].name,
+                                top[i].rating, top[i].wins, top[i].draws, top[i].losses);
+    }
+    if (count == 0) {
+        len += (size_t)snprintf(text + len, sizeof(text) - len, "Nessun giocatore registrato.\n");
+    }
+    send_to_client(client_fd, text);
+}
+
+// --- Metriche ---
+// Ogni shard aggiorna contatori e istogrammi nella propria linea di cache della memoria condivisa, con semplici
+// load e store: nessun lock e nessuna stampa sul percorso dei comandi. "stats" (solo da connessioni locali) e la
+// porta TRIS_STATS_PORT leggono le metriche di tutti gli shard di tutti i worker e le partite della directory.
+
+/**
+ * @brief Vero se il client è connesso dall'interfaccia di loopback.
+ * @param client_fd Il file descriptor del client.
+ */
+static bool is_local_peer(int client_fd) {
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(client_fd, (struct sockaddr *)&peer, &len) < 0 || peer.sin_family != AF_INET) {
+        return false;
+    }
+    return (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
+}
+
+/**
+ * @brief Gestisce il comando "stats": invia un riepilogo delle metriche di tutto il server.
+ * @param client_fd Il file descriptor del client.
+ */
+void handle_stats_command(int client_fd) {
+    if (!is_local_peer(client_fd)) {
+        send_to_client(client_fd, "Comando riservato alle connessioni locali.\n");
+        return;
+    }
+    MetricsSnapshot snapshot;
+    metrics_snapshot(&metrics, &directory, monotonic_ms(), &snapshot);
+    char text[STATS_SUMMARY_MAX];
+    metrics_format_summary(&snapshot, text, sizeof(text));
+    send_to_client(client_fd, text);
+}
+
+/**
+ * @brief Thread della porta delle statistiche: a ogni connessione risponde con le metriche in formato Prometheus
+ * e chiude. Serve una richiesta alla volta, fuori dai reactor: un lettore lento non rallenta il gioco.
+ * @param arg Il socket in ascolto (intptr_t).
+ */
+static void *serve_stats(void *arg) {
+    int stats_fd = (int)(intptr_t)arg;
+    char *body = malloc(METRICS_TEXT_MAX);
+    if (!body) {
+        perror("malloc");
+        return NULL;
+    }
+    while (true) {
+        int fd = accept4(stats_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        // La richiesta (qualsiasi percorso) si legge solo per svuotarla: non deve bloccare il thread a lungo
+        struct timeval timeout = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[BUFFER_SIZE];
+        if (recv(fd, request, sizeof(request), 0) >= 0) {
+            MetricsSnapshot snapshot;
+            metrics_snapshot(&metrics, &directory, monotonic_ms(), &snapshot);
+            size_t len = metrics_format_prometheus(&snapshot, body, METRICS_TEXT_MAX);
+            char header[160];
+            int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                      "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+            struct iovec iov[2] = { { header, (size_t)header_len }, { body, len } };
+            writev(fd, iov, 2);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Apre la porta delle statistiche su 127.0.0.1 e avvia il thread che la serve.
+ * Va chiamata dopo la fork: il thread appartiene al solo processo che lo crea.
+ */
+static void start_stats_server(void) {
+    int stats_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (stats_fd < 0) {
+        perror("socket");
+        return;
+    }
+    int opt = 1;
+    setsockopt(stats_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Le metriche non escono dalla macchina
+    address.sin_port = htons(config.stats_port);
+    pthread_t thread;
+    if (bind(stats_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(stats_fd, 16) < 0 ||
+        pthread_create(&thread, NULL, serve_stats, (void *)(intptr_t)stats_fd) != 0) {
+        perror("porta delle statistiche");
+        close(stats_fd);
+        return;
+    }
+    pthread_detach(thread);
+    printf("Statistiche su http://127.0.0.1:%d/metrics\n", config.stats_port);
+}
+
+// --- Replay delle Partite ---
+// Ogni partita tiene il registro delle mosse del round in corso, già impacchettato come nei replay (4 bit per mossa
+// nel tris classico). A fine round il registro diventa un record dell'archivio dello shard, scritto insieme al journal
+// a fine giro di eventi. "replay <id>" invia ai client binari il record direttamente dalla mappatura del file.
+// L'ID di un replay codifica lo shard come quello delle partite: ID = sequenza * num_shards + shard.
+
+#define REPLAY_LIST_MAX 20 // Replay più recenti elencati da "replays <game_id>" e "replays player"
+
+/**
+ * @brief Aggiunge l'ultima mossa giocata al registro del round. La prima mossa di un round azzera il registro;
+ * un round ripreso da un'istantanea (mosse precedenti sconosciute) resta senza replay.
+ * @param game La partita, dopo la mossa.
+ */
+void log_move(Game *game) {
+    const TrisGame *tg = &game->tris_game;
+    if (current_shard->replays.fd < 0 || tg->last_move < 0) {
+        return;
+    }
+    int cells = tg->rows * tg->cols;
+    size_t size = replay_packed_size(cells, cells);
+    if (!game->move_log && !(game->move_log = malloc(size))) {
+        perror("malloc");
+        return;
+    }
+    if (tg->moves == 1) {
+        memset(game->move_log, 0, size);
+        game->move_log_count = 0;
+        game->move_log_first = (uint8_t)(tg->turn ^ 1); // Il turno è già passato all'altro giocatore
+    }
+    if (game->move_log_count + 1 != tg->moves) {
+        return;
+    }
+    replay_pack_move(game->move_log, replay_move_bits(cells), game->move_log_count++, tg->last_move);
+}
+
+/**
+ * @brief Salva il round appena terminato nell'archivio dei replay e ne comunica l'ID ai giocatori.
+ * Va chiamata prima che il tabellone venga svuotato o la partita chiusa.
+ * @param game La partita, con il tabellone finale.
+ * @param result WIN (ha vinto chi ha fatto l'ultima mossa) o DRAW.
+ */
+static void save_replay(Game *game, GameResult result) {
+    const TrisGame *tg = &game->tris_game;
+    Shard *sh = current_shard;
+    if (sh->replays.fd < 0 || !game->move_log || game->move_log_count != tg->moves) {
+        return;
+    }
+    ReplayHeader header;
+    memset(&header, 0, sizeof(header));
+    header.rows = tg->rows;
+    header.cols = tg->cols;
+    header.k = tg->k;
+    header.result = result == DRAW ? REPLAY_DRAW : tg->turn == 1 ? REPLAY_X_WINS : REPLAY_O_WINS;
+    header.first = game->move_log_first;
+    header.bot_level = (uint8_t)game->bot_level;
+    header.moves = game->move_log_count;
+    header.game_id = game->id;
+    header.finished_at = (int64_t)time(NULL);
+    header.accounts[0] = game->seat_accounts[0];
+    header.accounts[1] = game->seat_accounts[1];
+    int64_t seq = replay_store_append(&sh->replays, &header, game->move_log);
+    game->move_log_count = 0;
+    if (seq < 0 || seq > (INT32_MAX - sh->index) / num_shards) {
+        return;
+    }
+    int replay_id = (int)seq * num_shards + sh->index;
+    char msg[BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "Replay salvato: digita 'replay %d' per rivederlo.\n", replay_id);
+    send_event(game->owner_fd, PROTO_EV_REPLAY_SAVED, replay_id, msg);
+    if (game->opponent_fd >= 0) {
+        send_event(game->opponent_fd, PROTO_EV_REPLAY_SAVED, replay_id, msg);
+    }
+}
+
+/**
+ * @brief Decide se un comando su un replay (o sui replay di una partita) va eseguito in un altro shard
+ * e, se il client può essere trasferito, ve lo trasferisce.
+ * @param client Il client.
+ * @param target_shard Lo shard che custodisce il replay.
+ * @param command Il comando testuale da rieseguire nello shard destinatario.
+ * @return true se il comando è stato gestito qui (trasferimento o errore), false se va eseguito nello shard corrente.
+ */
+static bool route_replay_command(Client *client, int target_shard, const char *command) {
+    if (target_shard == current_shard->index) {
+        return false;
+    }
+    if (target_shard >= 0 && client->status == PLAYER_CONNECTED && client->watch_game_id == -1) {
+        handoff_client(client, target_shard, command);
+    } else if (target_shard >= 0) {
+        // Giocatori e spettatori restano nello shard della loro partita
+        send_error(client->fd, PROTO_ERR_REPLAY_NOT_FOUND, "Questo replay è in un altro shard: lascia la partita (o smetti di seguirla) per rivederlo.\n");
+    } else {
+        send_error(client->fd, PROTO_ERR_REPLAY_NOT_FOUND, "Replay non trovato.\n");
+    }
+    return true;
+}
+
+// Descrive in una riga l'esito e la data di un replay
+static void describe_replay(const ReplayHeader *record, char *out, size_t size) {
+    char when[32];
+    time_t finished = (time_t)record->finished_at;
+    struct tm tm;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S UTC", gmtime_r(&finished, &tm));
+    const char *outcome = record->result == REPLAY_X_WINS ? "vince X" : record->result == REPLAY_O_WINS ? "vince O" : "pareggio";
+    snprintf(out, size, "%s in %d mosse%s, %s", outcome, record->moves, record->bot_level ? " contro il bot" : "", when);
+}
+
+/**
+ * @brief Gestisce il comando "replay": ai client binari invia PROTO_OP_REPLAY_DATA seguito dal record così come è
+ * nel file, accodato per riferimento alla mappatura (nessuna copia); ai client testuali la sequenza delle mosse
+ * e il tabellone finale.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param replay_id L'ID del replay.
+ */
+void handle_replay_command(int client_fd, Client *current_client, int replay_id) {
+    char command[32];
+    snprintf(command, sizeof(command), "replay %d", replay_id);
+    if (route_replay_command(current_client, replay_id >= 0 ? replay_id % num_shards : -1, command)) {
+        return;
+    }
+    const ReplayHeader *record = replay_store_get(&current_shard->replays, (uint32_t)(replay_id / num_shards));
+    if (!record) {
+        send_error(client_fd, PROTO_ERR_REPLAY_NOT_FOUND, "Replay non trovato.\n");
+        return;
+    }
+    if (current_client->binary) {
+        ProtoFrame frame = { PROTO_OP_REPLAY_DATA, 0, record->len, (uint32_t)replay_id };
+        send_frame(client_fd, &frame);
+        enqueue_static_output(current_client, record, record->len);
+        return;
+    }
+
+    TrisGame board;
+    init_game_variant(&board, record->rows, record->cols, record->k);
+    board.turn = record->first;
+    const uint8_t *packed = (const uint8_t *)(record + 1);
+    int bits = replay_move_bits(record->rows * record->cols);
+    size_t cap = BOARD_TEXT_SIZE + BUFFER_SIZE + (size_t)record->moves * 24;
+    char *text = malloc(cap);
+    if (!text) {
+        send_error(client_fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+        return;
+    }
+    char summary[128];
+    describe_replay(record, summary, sizeof(summary));
+    size_t len = (size_t)snprintf(text, cap, "\n--- Replay %d (partita %d, %dx%d con %d in fila) ---\n%s.\n",
+                                  replay_id, record->game_id, record->rows, record->cols, record->k, summary);
+    for (int i = 0; i < record->moves; ++i) {
+        int cell = replay_unpack_move(packed, bits, i);
+        len += (size_t)snprintf(text + len, cap - len, "%3d. %c %d %d\n", i + 1, board.turn == 0 ? 'X' : 'O',
+                                cell / record->cols, cell % record->cols);
+        make_move_index(&board, cell);
+    }
+    char final_board[BOARD_TEXT_SIZE];
+    print_board(&board, final_board);
+    len += (size_t)snprintf(text + len, cap - len, "%s", final_board);
+    enqueue_output(current_client, text, len < cap ? len : cap - 1);
+    free(text);
+}
+
+/**
+ * @brief Gestisce il comando "replays": elenca i replay più recenti di una partita (un round per replay),
+ * percorrendo l'indice per partita dell'archivio dello shard.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param game_id L'ID della partita.
+ */
+void handle_replays_command(int client_fd, Client *current_client, int game_id) {
+    char command[32];
+    snprintf(command, sizeof(command), "replays %d", game_id);
+    if (route_replay_command(current_client, game_id > 0 ? game_id_shard(game_id) : -1, command)) {
+        return;
+    }
+    const ReplayStore *store = &current_shard->replays;
+    char text[REPLAY_LIST_MAX * 96 + BUFFER_SIZE];
+    size_t len = (size_t)snprintf(text, sizeof(text), "--- Replay della partita %d ---\n", game_id);
+    int shown = 0;
+    for (int64_t seq = replay_store_last_of_game(store, game_id); seq >= 0 && shown < REPLAY_LIST_MAX; seq = store->prev[seq]) {
+        const ReplayHeader *record = replay_store_get(store, (uint32_t)seq);
+        if (!record || seq > (INT32_MAX - current_shard->index) / num_shards) {
+            continue; // Non ancora scritto: compare dal prossimo giro
+        }
+        int replay_id = (int)seq * num_shards + current_shard->index;
+        if (current_client->binary) {
+            ProtoFrame frame = { PROTO_OP_REPLAY_ENTRY, record->result, record->moves, (uint32_t)replay_id };
+            send_frame(client_fd, &frame);
+        } else {
+            char summary[128];
+            describe_replay(record, summary, sizeof(summary));
+            len += (size_t)snprintf(text + len, sizeof(text) - len, "  replay %d: %s\n", replay_id, summary);
+        }
+        shown++;
+    }
+    if (current_client->binary) {
+        ProtoFrame end = { PROTO_OP_LIST_END, 0, (uint16_t)shown, 0 };
+        send_frame(client_fd, &end);
+        return;
+    }
+    if (shown == 0) {
+        len += (size_t)snprintf(text + len, sizeof(text) - len, "Nessun replay salvato per questa partita.\n");
+    }
+    send_to_client(client_fd, text);
+}
+
+// Replay di un giocatore letto dal file di uno shard
+typedef struct {
+    ReplayHeader header;
+    int replay_id;
+} PlayerReplay;
+
+// Ordina dal replay più recente
+static int compare_player_replays(const void *a, const void *b) {
+    const PlayerReplay *x = a, *y = b;
+    if (x->header.finished_at != y->header.finished_at) {
+        return x->header.finished_at > y->header.finished_at ? -1 : 1;
+    }
+    return x->replay_id > y->replay_id ? -1 : x->replay_id < y->replay_id;
+}
+
+/**
+ * @brief Restituisce un descrittore in lettura del file dei replay di uno shard, aperto alla prima richiesta.
+ * @param shard Lo shard.
+ * @return Il descrittore, -1 se il file non è disponibile.
+ */
+static int replay_reader_fd(int shard) {
+    Shard *sh = current_shard;
+    if (shard == sh->index) {
+        return sh->replays.fd;
+    }
+    if (!sh->replay_readers) {
+        sh->replay_readers = malloc((size_t)num_shards * sizeof(int));
+        if (!sh->replay_readers) {
+            return -1;
+        }
+        for (int i = 0; i < num_shards; ++i) {
+            sh->replay_readers[i] = -1;
+        }
+    }
+    if (sh->replay_readers[shard] < 0) {
+        char path[REPLAY_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/replay-%d.bin", config.replay_dir, shard);
+        sh->replay_readers[shard] = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    return sh->replay_readers[shard];
+}
+
+/**
+ * @brief Gestisce il comando "replays player": elenca i replay più recenti di un giocatore registrato.
+ * Le catene per giocatore di tutti gli shard si leggono dai file con pread, partendo dalle teste in memoria
+ * condivisa: il client non viene trasferito.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param name Il nome del giocatore, NULL per il giocatore della connessione.
+ */
+void handle_player_replays_command(int client_fd, Client *current_client, const char *name) {
+    int32_t account = name ? ratings_find(&ratings, name) : current_client->account;
+    RatingInfo info;
+    if (account < 0 || ratings_get(&ratings, account, &info) < 0) {
+        send_error(client_fd, PROTO_ERR_NOT_LOGGED_IN, name ? "Giocatore non registrato.\n" : "Non sei registrato: digita 'login <nome>'.\n");
+        return;
+    }
+    PlayerReplay *found = NULL;
+    int count = 0;
+    if (replay_heads.heads && (uint32_t)account < replay_heads.accounts) {
+        found = malloc((size_t)num_shards * REPLAY_LIST_MAX * sizeof(PlayerReplay));
+        if (!found) {
+            send_error(client_fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+            return;
+        }
+        ReplayHeader headers[REPLAY_LIST_MAX];
+        for (int shard = 0; shard < num_shards; ++shard) {
+            uint32_t head = __atomic_load_n(&replay_heads.heads[(size_t)shard * replay_heads.accounts + (uint32_t)account], __ATOMIC_ACQUIRE);
+            int fd = head > 0 ? replay_reader_fd(shard) : -1;
+            int n = fd >= 0 ? replay_read_account_chain(fd, head, account, headers, REPLAY_LIST_MAX) : 0;
+            for (int i = 0; i < n; ++i) {
+                if (headers[i].seq > (uint32_t)((INT32_MAX - shard) / num_shards)) {
+                    continue;
+                }
+                found[count].header = headers[i];
+                found[count].replay_id = (int)headers[i].seq * num_shards + shard;
+                count++;
+            }
+        }
+        qsort(found, (size_t)count, sizeof(PlayerReplay), compare_player_replays);
+    }
+    int shown = count < REPLAY_LIST_MAX ? count : REPLAY_LIST_MAX;
+    char text[REPLAY_LIST_MAX * 96 + BUFFER_SIZE];
+    size_t len = (size_t)snprintf(text, sizeof(text), "--- Replay di %s ---\n", info.name);
+    for (int i = 0; i < shown; ++i) {
+        const ReplayHeader *record = &found[i].header;
+        if (current_client->binary) {
+            ProtoFrame frame = { PROTO_OP_REPLAY_ENTRY, record->result, record->moves, (uint32_t)found[i].replay_id };
+            send_frame(client_fd, &frame);
+        } else {
+            char summary[128];
+            describe_replay(record, summary, sizeof(summary));
+            len += (size_t)snprintf(text + len, sizeof(text) - len, "  replay %d (partita %d, %s): %s\n", found[i].replay_id,
+                                    record->game_id, record->accounts[0] == account ? "X" : "O", summary);
+        }
+    }
+    free(found);
+    if (current_client->binary) {
+        ProtoFrame end = { PROTO_OP_LIST_END, 0, (uint16_t)shown, 0 };
+        send_frame(client_fd, &end);
+        return;
+    }
+    if (shown == 0) {
+        len += (size_t)snprintf(text + len, sizeof(text) - len, "Nessun replay salvato per questo giocatore.\n");
+    }
+    send_to_client(client_fd, text);
+}
+
+// --- Lista delle Partite ---
+
+// Posizione iniziale di un ID nella tabella hash dell'indice (hash moltiplicativo di Knuth)
+static int lobby_home(int32_t game_id, int capacity) {
+    return (int)(((uint32_t)game_id * 2654435761u) & (uint32_t)(capacity - 1));
+}
+
+// Posizione dell'ID nell'indice, -1 se assente
+static int lobby_find(const LobbyCache *cache, int32_t game_id) {
+    if (cache->index_capacity == 0) {
+        return -1;
+    }
+    int mask = cache->index_capacity - 1;
+    for (int i = lobby_home(game_id, cache->index_capacity); cache->index[i].game_id != 0; i = (i + 1) & mask) {
+        if (cache->index[i].game_id == game_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Inserisce un ID assente nell'indice (che ha sempre almeno metà delle voci libere)
+static void lobby_index_put(LobbyCache *cache, int32_t game_id, int index) {
+    int mask = cache->index_capacity - 1;
+    int i = lobby_home(game_id, cache->index_capacity);
+    while (cache->index[i].game_id != 0) {
+        i = (i + 1) & mask;
+    }
+    cache->index[i].game_id = game_id;
+    cache->index[i].index = index;
+}
+
+// Libera la posizione pos dell'indice e riporta indietro le voci successive della stessa sequenza,
+// così nessuna ricerca si ferma su un buco (niente lapidi)
+static void lobby_index_remove(LobbyCache *cache, int pos) {
+    int mask = cache->index_capacity - 1;
+    int hole = pos;
+    int i = pos;
+    cache->index[hole].game_id = 0;
+    for (;;) {
+        i = (i + 1) & mask;
+        if (cache->index[i].game_id == 0) {
+            return;
+        }
+        int home = lobby_home(cache->index[i].game_id, cache->index_capacity);
+        // La voce resta dov'è se la sua posizione iniziale cade (ciclicamente) tra il buco escluso e lei inclusa
+        bool stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!stays) {
+            cache->index[hole] = cache->index[i];
+            cache->index[i].game_id = 0;
+            hole = i;
+        }
+    }
+}
+
+// Garantisce spazio per un'altra partita nell'array e nell'indice
+static bool lobby_reserve(LobbyCache *cache) {
+    if (cache->count == cache->capacity) {
+        int new_capacity = cache->capacity > 0 ? cache->capacity * 2 : INITIAL_TABLE_SIZE;
+        DirectoryEntry *entries = realloc(cache->entries, (size_t)new_capacity * sizeof(DirectoryEntry));
+        if (!entries) {
+            perror("realloc");
+            return false;
+        }
+        cache->entries = entries;
+        cache->capacity = new_capacity;
+    }
+    if ((cache->count + 1) * 2 > cache->index_capacity) {
+        int new_capacity = cache->index_capacity > 0 ? cache->index_capacity * 2 : INITIAL_TABLE_SIZE * 2;
+        LobbyIndexSlot *index = calloc((size_t)new_capacity, sizeof(LobbyIndexSlot));
+        if (!index) {
+            perror("calloc");
+            return false;
+        }
+        free(cache->index);
+        cache->index = index;
+        cache->index_capacity = new_capacity;
+        for (int i = 0; i < cache->count; ++i) {
+            lobby_index_put(cache, cache->entries[i].game_id, i);
+        }
+    }
+    return true;
+}
+
+// Applica una modifica del log: inserisce o aggiorna la partita, oppure la toglie spostando l'ultima voce al suo posto
+static bool lobby_apply(LobbyCache *cache, const DirectoryChange *change) {
+    int pos = lobby_find(cache, change->game_id);
+    if (change->state == DIRECTORY_REMOVED) {
+        if (pos >= 0) {
+            int index = cache->index[pos].index;
+            lobby_index_remove(cache, pos);
+            if (--cache->count != index) {
+                cache->entries[index] = cache->entries[cache->count];
+                cache->index[lobby_find(cache, cache->entries[index].game_id)].index = index;
+            }
+        }
+        return true;
+    }
+    DirectoryEntry *entry;
+    if (pos >= 0) {
+        entry = &cache->entries[cache->index[pos].index];
+    } else {
+        if (!lobby_reserve(cache)) {
+            return false;
+        }
+        lobby_index_put(cache, change->game_id, cache->count);
+        entry = &cache->entries[cache->count++];
+    }
+    entry->game_id = change->game_id;
+    entry->state = change->state;
+    entry->owner_fd = change->owner_fd;
+    entry->variant = change->variant;
+    return true;
+}
+
+// Ricostruisce la cache scandendo tutta la directory (prima costruzione o client della cache rimasto troppo indietro nel log)
+static bool lobby_rescan(LobbyCache *cache) {
+    cache->valid = false;
+    cache->version = directory_version(&directory); // Letta prima della scansione: le modifiche successive verranno riapplicate
+    cache->count = 0;
+    if (cache->index) {
+        memset(cache->index, 0, (size_t)cache->index_capacity * sizeof(LobbyIndexSlot));
+    }
+    for (int sh = 0; sh < num_shards; ++sh) {
+        int used = (int)__atomic_load_n(&directory.high_water[sh], __ATOMIC_ACQUIRE);
+        for (int i = 0; i < used; ++i) {
+            DirectoryEntry entry;
+            if (directory_read(&directory, sh, i, &entry) == 0) {
+                if (!lobby_reserve(cache)) {
+                    return false;
+                }
+                lobby_index_put(cache, entry.game_id, cache->count);
+                cache->entries[cache->count++] = entry;
+            }
+        }
+    }
+    cache->valid = true;
+    return true;
+}
+
+// Rilascia le pagine renderizzate per la versione precedente (i client che le hanno in coda mantengono il loro riferimento)
+static void lobby_release_pages(LobbyCache *cache) {
+    for (int i = 0; i < cache->text_pages_capacity; ++i) {
+        release_outbuf(cache->text_pages[i]);
+        cache->text_pages[i] = NULL;
+    }
+    for (int i = 0; i < cache->binary_pages_capacity; ++i) {
+        release_outbuf(cache->binary_pages[i]);
+        cache->binary_pages[i] = NULL;
+    }
+}
+
+/**
+ * @brief Porta la cache della lista dello shard corrente alla versione attuale della directory.
+ * Di norma applica solo le modifiche registrate nel log dall'ultima richiesta: O(modifiche), non O(partite).
+ * @return false se manca la memoria.
+ */
+static bool refresh_lobby(void) {
+    LobbyCache *cache = &current_shard->lobby;
+    if (!cache->changes && !(cache->changes = malloc(DIRECTORY_LOG_SIZE * sizeof(DirectoryChange)))) {
+        perror("malloc");
+        return false;
+    }
+    uint32_t current = directory_version(&directory);
+    if (cache->valid && cache->version == current) {
+        return true;
+    }
+    lobby_release_pages(cache);
+    if (cache->valid) {
+        uint32_t reached;
+        int count = directory_changes(&directory, cache->version, cache->changes, DIRECTORY_LOG_SIZE, &reached);
+        if (count >= 0) {
+            for (int i = 0; i < count; ++i) {
+                if (!lobby_apply(cache, &cache->changes[i])) {
+                    return lobby_rescan(cache);
+                }
+            }
+            cache->version = reached;
+            return true;
+        }
+    }
+    return lobby_rescan(cache);
+}
+
+// Etichetta testuale dello stato di una partita
+static const char *game_state_label(int32_t state) {
+    switch (state) {
+        case GAME_NEW:
+            return "NUOVA (in attesa del proprietario)";
+        case GAME_WAITING_FOR_PLAYER:
+            return "IN ATTESA DI GIOCATORE";
+        case GAME_IN_PROGRESS:
+            return "IN CORSO";
+        case GAME_ENDED:
+            return "TERMINATA";
+        case DIRECTORY_REMOVED:
+            return "RIMOSSA";
+        default:
+            return "SCONOSCIUTO";
+    }
+}
+
+// Scrive la riga di una partita (terminata da '\n') e ne restituisce la lunghezza
+static int format_game_line(char *out, size_t size, int32_t game_id, int32_t state, int32_t owner_fd, int32_t variant) {
+    int len;
+    if (state == DIRECTORY_REMOVED) {
+        len = snprintf(out, size, "ID: %d | Stato: %s", game_id, game_state_label(state));
+    } else if (owner_fd == DIRECTORY_OWNER_DETACHED) {
+        len = snprintf(out, size, "ID: %d | Stato: %s | Proprietario: disconnesso", game_id, game_state_label(state));
+    } else {
+        len = snprintf(out, size, "ID: %d | Stato: %s | Proprietario: FD %d", game_id, game_state_label(state), owner_fd);
+    }
+    if (variant != 0 && len < (int)size) {
+        len += snprintf(out + len, size - len, " | %dx%d, %d in fila", PROTO_VARIANT_ROWS(variant), PROTO_VARIANT_COLS(variant), PROTO_VARIANT_K(variant));
+    }
+    if (len < (int)size) {
+        len += snprintf(out + len, size - len, "\n");
+    }
+    return len < (int)size ? len : (int)size - 1;
+}
+
+// Vero se la richiesta filtra le partite (le pagine filtrate non sono in cache)
+static bool lobby_filtered(const LobbyQuery *query) {
+    return query->waiting_only || query->variant >= 0;
+}
+
+// Vero se una partita nello stato, con il proprietario e nella variante dati passa i filtri della richiesta.
+// Una partita in attesa il cui proprietario è disconnesso non accetta "join": non è tra quelle in attesa.
+static bool lobby_matches(const LobbyQuery *query, int32_t state, int32_t owner_fd, int32_t variant) {
+    return (!query->waiting_only || (state == GAME_WAITING_FOR_PLAYER && owner_fd != DIRECTORY_OWNER_DETACHED)) &&
+           (query->variant < 0 || query->variant == variant);
+}
+
+// Aggiunge un frame codificato in fondo a un OutBuf (dimensionato dal chiamante)
+static void append_frame(OutBuf *buf, const ProtoFrame *frame) {
+    proto_encode(frame, (uint8_t *)buf->data + buf->len);
+    buf->len += PROTO_FRAME_SIZE;
+}
+
+/**
+ * @brief Renderizza una pagina della lista dalla cache: righe di testo oppure frame PROTO_OP_GAME e PROTO_OP_LIST_END.
+ * @param query Filtri della richiesta.
+ * @param page Pagina da renderizzare (già ricondotta all'intervallo valido).
+ * @param pages Numero totale di pagine.
+ * @param matches Partite che passano i filtri.
+ * @param binary Vero per la forma binaria.
+ * @return Il buffer (con un riferimento per il chiamante) o NULL se manca la memoria.
+ */
+static OutBuf *render_list_page(const LobbyQuery *query, int page, int pages, int matches, bool binary) {
+    const LobbyCache *cache = &current_shard->lobby;
+    int per_page = binary ? BINARY_LIST_MAX : LIST_PAGE_SIZE;
+    int first = page * per_page;
+    int last = first + per_page < matches ? first + per_page : matches;
+    OutBuf *buf = alloc_outbuf(binary ? (size_t)(per_page + 1) * PROTO_FRAME_SIZE : (size_t)per_page * LIST_LINE_MAX + 2 * BUFFER_SIZE);
+    if (!buf) {
+        return NULL;
+    }
+    if (!binary) {
+        buf->len += (uint32_t)snprintf(buf->data, buf->cap, "--- Lista Partite ---\n");
+    }
+    // Con filtri si scorre tutta la cache, ma si formattano solo le voci della pagina
+    bool filtered = lobby_filtered(query);
+    int position = filtered ? 0 : first; // Posizione nella lista filtrata della prossima voce che passa i filtri
+    for (int i = position; i < cache->count && position < last; ++i) {
+        const DirectoryEntry *e = &cache->entries[i];
+        if (filtered && !lobby_matches(query, e->state, e->owner_fd, e->variant)) {
+            continue;
+        }
+        if (position++ < first) {
+            continue;
+        }
+        if (binary) {
+            ProtoFrame frame = { PROTO_OP_GAME, (uint8_t)e->state, (uint16_t)e->variant, (uint32_t)e->game_id };
+            append_frame(buf, &frame);
+        } else {
+            buf->len += (uint32_t)format_game_line(buf->data + buf->len, buf->cap - buf->len, e->game_id, e->state, e->owner_fd, e->variant);
+        }
+    }
+    if (binary) {
+        ProtoFrame end = { PROTO_OP_LIST_END, page + 1 < pages ? PROTO_LIST_MORE : 0, (uint16_t)(last - first), cache->version };
+        append_frame(buf, &end);
+        return buf;
+    }
+    char *tail = buf->data + buf->len;
+    size_t room = buf->cap - buf->len;
+    int len = 0;
+    if (matches == 0) {
+        len += snprintf(tail + len, room - len, "Nessuna partita disponibile. Crea una nuova partita con 'create' o entra in coda con 'queue'.\n");
+    }
+    if (pages > 1) {
+        len += snprintf(tail + len, room - len, "Pagina %d di %d ('list page <n>' per le altre). ", page + 1, pages);
+    }
+    len += snprintf(tail + len, room - len, "Versione %u ('list since %u' per le sole modifiche).\n---------------------\n",
+                    cache->version, cache->version);
+    buf->len += (uint32_t)len;
+    return buf;
+}
+
+// Restituisce la posizione della pagina nell'array della cache, facendolo crescere se serve (NULL se manca la memoria)
+static OutBuf **lobby_page_slot(OutBuf ***pages, int *capacity, int page) {
+    if (page >= *capacity) {
+        int new_capacity = *capacity > 0 ? *capacity : 8;
+        while (new_capacity <= page) {
+            new_capacity *= 2;
+        }
+        OutBuf **grown = realloc(*pages, (size_t)new_capacity * sizeof(OutBuf *));
+        if (!grown) {
+            perror("realloc");
+            return NULL;
+        }
+        memset(grown + *capacity, 0, (size_t)(new_capacity - *capacity) * sizeof(OutBuf *));
+        *pages = grown;
+        *capacity = new_capacity;
+    }
+    return &(*pages)[page];
+}
+
+/**
+ * @brief Invia solo le modifiche alla lista successive alla versione nota al client, lette dal log della directory.
+ * Con il filtro "waiting" una partita che non è più in attesa viene inviata come rimossa.
+ * @param client Il client destinatario.
+ * @param query La richiesta (delta e since impostati).
+ * @return false se il log non copre più la versione o le modifiche superano una pagina: il chiamante invia la lista completa.
+ */
+static bool send_list_changes(Client *client, const LobbyQuery *query) {
+    LobbyCache *cache = &current_shard->lobby;
+    uint32_t reached;
+    int count = directory_changes(&directory, query->since, cache->changes, DIRECTORY_LOG_SIZE, &reached);
+    if (count < 0) {
+        return false;
+    }
+    int shown = 0;
+    for (int i = 0; i < count; ++i) {
+        if (query->variant < 0 || query->variant == cache->changes[i].variant) {
+            shown++;
+        }
+    }
+    if (shown > (client->binary ? BINARY_LIST_MAX : LIST_PAGE_SIZE)) {
+        return false;
+    }
+    OutBuf *buf = alloc_outbuf(client->binary ? (size_t)(shown + 1) * PROTO_FRAME_SIZE : (size_t)shown * LIST_LINE_MAX + BUFFER_SIZE);
+    if (!buf) {
+        return false;
+    }
+    if (!client->binary && shown > 0) {
+        buf->len += (uint32_t)snprintf(buf->data, buf->cap, "--- Modifiche alla lista (versione %u -> %u) ---\n", query->since, reached);
+    }
+    for (int i = 0; i < count; ++i) {
+        const DirectoryChange *c = &cache->changes[i];
+        if (query->variant >= 0 && query->variant != c->variant) {
+            continue;
+        }
+        int32_t state = lobby_matches(query, c->state, c->owner_fd, c->variant) ? c->state : DIRECTORY_REMOVED;
+        if (client->binary) {
+            ProtoFrame frame = { PROTO_OP_GAME, state == DIRECTORY_REMOVED ? PROTO_GAME_REMOVED : (uint8_t)state, (uint16_t)c->variant, (uint32_t)c->game_id };
+            append_frame(buf, &frame);
+        } else {
+            buf->len += (uint32_t)format_game_line(buf->data + buf->len, buf->cap - buf->len, c->game_id, state, c->owner_fd, c->variant);
+        }
+    }
+    if (client->binary) {
+        ProtoFrame end = { PROTO_OP_LIST_END, PROTO_LIST_DELTA, (uint16_t)shown, reached };
+        append_frame(buf, &end);
+    } else if (shown == 0) {
+        buf->len += (uint32_t)snprintf(buf->data + buf->len, buf->cap - buf->len, "La lista è aggiornata (versione %u).\n", reached);
+    } else {
+        buf->len += (uint32_t)snprintf(buf->data + buf->len, buf->cap - buf->len, "Versione %u.\n---------------------\n", reached);
+    }
+    enqueue_shared_output(client, buf);
+    release_outbuf(buf);
+    return true;
+}
+
+/**
+ * @brief Invia a un client una pagina della lista delle partite di tutti i worker, oppure le sole modifiche.
+ * La lista viene servita dalla cache dello shard: le pagine senza filtri sono renderizzate una volta per versione
+ * e condivise da tutti i client che le chiedono; con filtri si formattano solo le voci della pagina.
+ * @param client_fd Il file descriptor del client a cui inviare la lista.
+ * @param query Filtri, pagina o versione nota al client.
+ */
+void print_game_list(int client_fd, const LobbyQuery *query) {
+    Client *client = find_client_by_fd(client_fd);
+    if (!client) {
+        return;
+    }
+    if (!refresh_lobby()) {
+        send_error(client_fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+        return;
+    }
+    if (query->delta && send_list_changes(client, query)) {
+        return;
+    }
+
+    LobbyCache *cache = &current_shard->lobby;
+    bool binary = client->binary;
+    int per_page = binary ? BINARY_LIST_MAX : LIST_PAGE_SIZE;
+    bool filtered = lobby_filtered(query);
+    int matches = cache->count;
+    if (filtered) {
+        matches = 0;
+        for (int i = 0; i < cache->count; ++i) {
+            matches += lobby_matches(query, cache->entries[i].state, cache->entries[i].owner_fd, cache->entries[i].variant);
+        }
+    }
+    int pages = matches > 0 ? (matches + per_page - 1) / per_page : 1;
+    int page = query->delta ? 0 : (query->page < pages ? query->page : pages - 1);
+
+    if (filtered) {
+        OutBuf *buf = render_list_page(query, page, pages, matches, binary);
+        if (buf) {
+            enqueue_shared_output(client, buf);
+            release_outbuf(buf);
+        }
+        return;
+    }
+    OutBuf **slot = binary ? lobby_page_slot(&cache->binary_pages, &cache->binary_pages_capacity, page)
+                           : lobby_page_slot(&cache->text_pages, &cache->text_pages_capacity, page);
+    if (slot && !*slot) {
+        *slot = render_list_page(query, page, pages, matches, binary);
+    }
+    if (slot && *slot) {
+        enqueue_shared_output(client, *slot);
+    }
+}
+
+/**
+ * @brief Interpreta le opzioni del comando "list": [waiting] [gomoku | <righe> <colonne> <k>] [page <n> | since <versione>].
+ * @param args Il testo dopo "list".
+ * @param query La richiesta da compilare.
+ * @return false se le opzioni non sono valide.
+ */
+static bool parse_list_query(const char *args, LobbyQuery *query) {
+    memset(query, 0, sizeof(*query));
+    query->variant = -1;
+    char word[16];
+    int consumed;
+    while (sscanf(args, " %15s%n", word, &consumed) == 1) {
+        args += consumed;
+        if (strcmp(word, "waiting") == 0) {
+            query->waiting_only = true;
+        } else if (strcmp(word, "gomoku") == 0) {
+            query->variant = PROTO_VARIANT(15, 15, 5);
+        } else if (strcmp(word, "page") == 0) {
+            int page;
+            if (sscanf(args, "%d%n", &page, &consumed) != 1 || page < 1) {
+                return false;
+            }
+            args += consumed;
+            query->page = page - 1;
+        } else if (strcmp(word, "since") == 0) {
+            unsigned since;
+            if (sscanf(args, "%u%n", &since, &consumed) != 1) {
+                return false;
+            }
+            args += consumed;
+            query->delta = true;
+            query->since = since;
+        } else {
+            int rows, cols, k;
+            TrisGame variant;
+            if (sscanf(word, "%d", &rows) != 1 || sscanf(args, "%d %d%n", &cols, &k, &consumed) != 2 ||
+                init_game_variant(&variant, rows, cols, k) < 0) {
+                return false;
+            }
+            args += consumed;
+            query->variant = is_classic_game(&variant) ? 0 : PROTO_VARIANT(rows, cols, k);
+        }
+    }
+    return true;
+}
+
+// Messaggi testuali dei tabelloni: solo frammenti costanti, il tabellone e l'ID vengono da BoardText
+static const BoardMessage MSG_BOARD_STATE = { TEXT_FRAGMENT("\nStato attuale della partita "), true, { NULL, 0 } };
+static const BoardMessage MSG_BOARD_YOUR_TURN_X = { TEXT_FRAGMENT("\nStato attuale della partita "), true, TEXT_FRAGMENT("È il tuo turno (X).\n") };
+static const BoardMessage MSG_BOARD_YOUR_TURN_O = { TEXT_FRAGMENT("\nStato attuale della partita "), true, TEXT_FRAGMENT("È il tuo turno (O).\n") };
+static const BoardMessage MSG_BOARD_THEIR_TURN_X = { TEXT_FRAGMENT("\nStato attuale della partita "), true, TEXT_FRAGMENT("È il turno del tuo avversario (X).\n") };
+static const BoardMessage MSG_BOARD_THEIR_TURN_O = { TEXT_FRAGMENT("\nStato attuale della partita "), true, TEXT_FRAGMENT("È il turno del tuo avversario (O).\n") };
+static const BoardMessage MSG_BOARD_WAITING = { TEXT_FRAGMENT("\nStato attuale della partita "), true, TEXT_FRAGMENT("In attesa di un avversario...\n") };
+static const BoardMessage MSG_BOARD_END = { TEXT_FRAGMENT("\nLa partita è terminata!\n"), false, { NULL, 0 } };
+static const BoardMessage MSG_BOARD_DRAW = { TEXT_FRAGMENT("\nLa partita è terminata in pareggio!\n"), false, { NULL, 0 } };
+static const BoardMessage MSG_WATCH_WIN_X = { TEXT_FRAGMENT("\n[Spettatore] Partita "), true, TEXT_FRAGMENT("Vince X.\n") };
+static const BoardMessage MSG_WATCH_WIN_O = { TEXT_FRAGMENT("\n[Spettatore] Partita "), true, TEXT_FRAGMENT("Vince O.\n") };
+static const BoardMessage MSG_WATCH_DRAW = { TEXT_FRAGMENT("\n[Spettatore] Partita "), true, TEXT_FRAGMENT("Pareggio.\n") };
+static const BoardMessage MSG_WATCH_TURN_X = { TEXT_FRAGMENT("\n[Spettatore] Partita "), true, TEXT_FRAGMENT("Turno di X.\n") };
+static const BoardMessage MSG_WATCH_TURN_O = { TEXT_FRAGMENT("\n[Spettatore] Partita "), true, TEXT_FRAGMENT("Turno di O.\n") };
+static const BoardMessage MSG_WATCH_WAITING = { TEXT_FRAGMENT("\n[Spettatore] Partita "), true, TEXT_FRAGMENT("In attesa di un giocatore.\n") };
+
+/**
+ * @brief Renderizza il tabellone di un aggiornamento, se non è già stato fatto: "<id>:\n" e il tabellone
+ * copiato dal modello della variante, in un OutBuf che i destinatari testuali condividono.
+ * @param text Il tabellone dell'aggiornamento.
+ * @param game La partita.
+ * @return true se il tabellone è disponibile.
+ */
+static bool board_text_render(BoardText *text, Game *game) {
+    if (text->buf) {
+        return true;
+    }
+    char id[16];
+    int id_len = snprintf(id, sizeof(id), "%d:\n", game->id);
+    OutBuf *buf = alloc_outbuf((size_t)id_len + board_text_length(&game->tris_game));
+    if (!buf) {
+        return false;
+    }
+    memcpy(buf->data, id, (size_t)id_len);
+    buf->len = (uint32_t)id_len + (uint32_t)render_board(&game->tris_game, buf->data + id_len);
+    text->buf = buf;
+    text->board_offset = (uint32_t)id_len;
+    return true;
+}
+
+/**
+ * @brief Rilascia il riferimento dell'aggiornamento al tabellone: restano quelli dei segmenti in coda.
+ * @param text Il tabellone dell'aggiornamento.
+ */
+static void board_text_release(BoardText *text) {
+    release_outbuf(text->buf);
+    text->buf = NULL;
+}
+
+/**
+ * @brief Accoda a un client testuale un messaggio con il tabellone: frammento iniziale, tabellone (preceduto
+ * dall'ID se richiesto) e frammento finale, tre segmenti senza copie.
+ * @param client Il destinatario.
+ * @param game La partita.
+ * @param text Il tabellone dell'aggiornamento (renderizzato qui se necessario).
+ * @param message Il messaggio.
+ */
+static void enqueue_board_message(Client *client, Game *game, BoardText *text, const BoardMessage *message) {
+    if (!board_text_render(text, game)) {
+        return;
+    }
+    const char *board = message->with_id ? text->buf->data : text->buf->data + text->board_offset;
+    enqueue_static_output(client, message->head.data, message->head.len);
+    enqueue_shared_range(client, text->buf, board, (size_t)(text->buf->data + text->buf->len - board));
+    enqueue_static_output(client, message->tail.data, message->tail.len);
+}
+
+/**
+ * @brief Invia lo stato attuale del tabellone e il turno ai giocatori della partita.
+ * @param game Puntatore alla struttura Game.
+ */
+void send_game_state_to_players(Game *game) {
+    Client* owner_client = find_client_by_fd(game->owner_fd);
+    Client* opponent_client = find_client_by_fd(game->opponent_fd);
+    const BoardMessage *msg_owner = &MSG_BOARD_STATE;
+    const BoardMessage *msg_opponent = &MSG_BOARD_STATE;
+
+    // Aggiungi informazioni sul turno corrente
+    if (game->state == GAME_IN_PROGRESS) {
+        // Controlla se i client sono validi
+        if (game->tris_game.turn == 0) { // Turno di X (proprietario per la prima mossa)
+            msg_owner = &MSG_BOARD_YOUR_TURN_X;
+            msg_opponent = &MSG_BOARD_THEIR_TURN_X;
+            if (owner_client) owner_client->is_current_turn = true;
+            if (opponent_client) opponent_client->is_current_turn = false;
+        // Imposta il turno del proprietario come attivo
+        } else { // Turno di O (avversario)
+            msg_owner = &MSG_BOARD_THEIR_TURN_O;
+            msg_opponent = &MSG_BOARD_YOUR_TURN_O;
+            if (owner_client) owner_client->is_current_turn = false;
+            if (opponent_client) opponent_client->is_current_turn = true;
+        }
+        // L'orologio del turno riparte a ogni mossa; il bot muove subito e non ne ha bisogno
+        int mover_fd = game->tris_game.turn == 0 ? game->owner_fd : game->opponent_fd;
+        if (mover_fd >= 0) {
+            timer_arm(&current_shard->timers, &game->turn_timer, (uint64_t)config.turn_timeout * 1000);
+        } else {
+            timer_cancel(&current_shard->timers, &game->turn_timer);
+        }
+    }
+    // Invia i messaggi ai giocatori della partita: il tabellone testuale è renderizzato una volta per tutti
+    BoardText text = { NULL, 0 };
+    send_board_state(game->owner_fd, game, 0, &text, msg_owner);
+    if (game->opponent_fd != -1) {
+        send_board_state(game->opponent_fd, game, 0, &text, msg_opponent);
+    }
+    broadcast_to_watchers(game, 0, &text);
+    board_text_release(&text);
+}
+
+/**
+ * @brief Invia il tabellone a un giocatore: un frame PROTO_OP_STATE compatto se usa il protocollo binario,
+ * altrimenti il messaggio testuale costruito attorno al tabellone dell'aggiornamento.
+ * @param client_fd Il file descriptor del giocatore.
+ * @param game La partita.
+ * @param flags Flag aggiuntivi (PROTO_STATE_WIN, PROTO_STATE_DRAW); turno e "tocca a te" sono calcolati qui.
+ * @param text Il tabellone dell'aggiornamento, condiviso tra i destinatari (renderizzato al primo client testuale).
+ * @param message Il messaggio per i client testuali.
+ */
+static ProtoFrame board_frame(const Game *game, uint8_t flags);
+
+void send_board_state(int client_fd, Game *game, uint8_t flags, BoardText *text, const BoardMessage *message) {
+    Client *client = find_client_by_fd(client_fd);
+    if (!client) {
+        return;
+    }
+    if (client->binary) {
+        if (client->is_current_turn) flags |= PROTO_STATE_YOUR_TURN;
+        ProtoFrame frame = board_frame(game, flags);
+        send_frame(client_fd, &frame);
+    } else {
+        enqueue_board_message(client, game, text, message);
+    }
+}
+
+/**
+ * @brief Compone il frame PROTO_OP_STATE di una partita.
+ * @param game La partita.
+ * @param flags Flag già noti (vittoria, pareggio, tocca al destinatario); turno e ultima mossa sono aggiunti qui.
+ * @return Il frame.
+ */
+static ProtoFrame board_frame(const Game *game, uint8_t flags) {
+    const TrisGame *tg = &game->tris_game;
+    if (tg->turn == 1) flags |= PROTO_STATE_TURN_O;
+    uint16_t aux;
+    if (is_classic_game(tg)) {
+        aux = proto_pack_board(tg);
+    } else {
+        // I tabelloni m,n,k non stanno in 16 bit: si invia solo l'ultima mossa
+        flags |= PROTO_STATE_LAST_MOVE;
+        aux = tg->last_move >= 0 ? (uint16_t)tg->last_move : 0xFFFF;
+    }
+    ProtoFrame frame = { PROTO_OP_STATE, flags, aux, (uint32_t)game->id };
+    return frame;
+}
+
+// --- Spettatori ---
+
+/**
+ * @brief Sceglie il messaggio testuale per gli spettatori: tabellone e turno o esito.
+ * @param game La partita.
+ * @param flags PROTO_STATE_WIN o PROTO_STATE_DRAW per il tabellone finale, 0 altrimenti.
+ * @return Il messaggio (costante).
+ */
+static const BoardMessage *watch_message(const Game *game, uint8_t flags) {
+    const TrisGame *tg = &game->tris_game;
+    if (flags & PROTO_STATE_WIN) {
+        Cell mark = get_cell(tg, tg->last_move / tg->cols, tg->last_move % tg->cols);
+        return mark == X ? &MSG_WATCH_WIN_X : &MSG_WATCH_WIN_O;
+    }
+    if ((flags & PROTO_STATE_DRAW) || game->state == GAME_ENDED) {
+        return &MSG_WATCH_DRAW;
+    }
+    if (game->state == GAME_IN_PROGRESS) {
+        return tg->turn == 0 ? &MSG_WATCH_TURN_X : &MSG_WATCH_TURN_O;
+    }
+    return &MSG_WATCH_WAITING;
+}
+
+/**
+ * @brief Invia a un client binario le celle occupate di una variante m,n,k, una per frame PROTO_OP_CELL:
+ * il frame STATE che segue porta solo l'ultima mossa. Nel tris classico STATE contiene già l'intero tabellone.
+ * @param client Il client (spettatore o giocatore che rientra).
+ * @param game La partita.
+ */
+static void send_board_cells(Client *client, Game *game) {
+    const TrisGame *tg = &game->tris_game;
+    if (is_classic_game(tg)) {
+        return;
+    }
+    for (int cell = 0; cell < tg->rows * tg->cols; ++cell) {
+        Cell mark = get_cell(tg, cell / tg->cols, cell % tg->cols);
+        if (mark != EMPTY) {
+            ProtoFrame frame = { PROTO_OP_CELL, (uint8_t)mark, (uint16_t)cell, (uint32_t)game->id };
+            send_frame(client->fd, &frame);
+        }
+    }
+}
+
+/**
+ * @brief Invia a un solo spettatore lo stato completo della partita: all'iscrizione e dopo aver saltato aggiornamenti.
+ * Ai client binari di una variante m,n,k, a cui STATE porta solo l'ultima mossa, si inviano prima tutte le celle occupate.
+ * @param client Lo spettatore.
+ * @param game La partita.
+ */
+static void send_watch_snapshot(Client *client, Game *game) {
+    uint8_t flags = game->state == GAME_ENDED ? PROTO_STATE_DRAW : 0;
+    if (!client->binary) {
+        BoardText text = { NULL, 0 };
+        enqueue_board_message(client, game, &text, watch_message(game, flags));
+        board_text_release(&text);
+        return;
+    }
+    send_board_cells(client, game);
+    ProtoFrame state = board_frame(game, flags);
+    send_frame(client->fd, &state);
+}
+
+/**
+ * @brief Invia lo stato della partita a tutti i suoi spettatori. Testo e frame sono composti una sola volta
+ * e accodati per riferimento: il costo per spettatore è un segmento nella sua coda di output.
+ * Uno spettatore che non legge (coda oltre WATCH_MAX_BACKLOG) salta l'aggiornamento; quando la sua coda
+ * si svuota riceve lo stato più recente, per intero se il singolo frame non basta a ricostruirlo.
+ * @param game La partita.
+ * @param flags PROTO_STATE_WIN o PROTO_STATE_DRAW per il tabellone finale, 0 altrimenti.
+ * @param text Il tabellone dell'aggiornamento, già renderizzato se lo hanno ricevuto giocatori testuali.
+ */
+void broadcast_to_watchers(Game *game, uint8_t flags, BoardText *text) {
+    OutBuf *frame = NULL;
+    const BoardMessage *message = NULL;
+    bool classic = is_classic_game(&game->tris_game);
+    for (int i = 0; i < game->num_watchers; ++i) {
+        Client *watcher = find_client_by_fd(game->watchers[i]);
+        if (!watcher) {
+            continue;
+        }
+        if (watcher->out_bytes > WATCH_MAX_BACKLOG) {
+            watcher->watch_stale = true;
+            continue;
+        }
+        if (watcher->binary && watcher->watch_stale && !classic) {
+            send_watch_snapshot(watcher, game);
+        } else if (watcher->binary) {
+            if (!frame && (frame = alloc_outbuf(PROTO_FRAME_SIZE))) {
+                ProtoFrame state = board_frame(game, flags);
+                append_frame(frame, &state);
+            }
+            if (frame) {
+                enqueue_shared_output(watcher, frame);
+            }
+        } else {
+            if (!message) {
+                message = watch_message(game, flags);
+            }
+            enqueue_board_message(watcher, game, text, message);
+        }
+        watcher->watch_stale = false;
+    }
+    release_outbuf(frame);
+}
+
+/**
+ * @brief Toglie un client dagli spettatori della partita che segue, se ne segue una (O(1): l'ultimo prende il suo posto).
+ * @param client Il client.
+ */
+void stop_watching(Client *client) {
+    if (client->watch_game_id == -1) {
+        return;
+    }
+    Game *game = find_game_by_id(client->watch_game_id);
+    int i = client->watch_index;
+    if (game && i < game->num_watchers && game->watchers[i] == client->fd) {
+        game->watchers[i] = game->watchers[--game->num_watchers];
+        Client *moved = find_client_by_fd(game->watchers[i]);
+        if (moved && i < game->num_watchers) {
+            moved->watch_index = i;
+        }
+    }
+    client->watch_game_id = -1;
+    client->watch_stale = false;
+}
+
+/**
+ * @brief Gestisce il comando "watch": iscrive il client agli aggiornamenti di una partita dello shard corrente
+ * (il comando arriva qui con un handoff se la partita vive altrove) e gli invia subito lo stato attuale.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param game_id L'ID della partita da seguire.
+ */
+void handle_watch_command(int client_fd, Client *current_client, int game_id) {
+    if (current_client->game_id != -1 || current_client->status == PLAYER_QUEUED) {
+        send_error(client_fd, PROTO_ERR_ALREADY_IN_GAME, "Non puoi seguire una partita mentre giochi o sei in coda.\n");
+        return;
+    }
+    Game *game = find_game_by_id(game_id);
+    if (!game) {
+        send_error(client_fd, PROTO_ERR_GAME_NOT_FOUND, "Partita non trovata o ID non valido.\n");
+        return;
+    }
+    if (current_client->watch_game_id != game->id) {
+        stop_watching(current_client);
+        if (game->num_watchers == game->watchers_capacity) {
+            int new_capacity = game->watchers_capacity > 0 ? game->watchers_capacity * 2 : 8;
+            int *watchers = realloc(game->watchers, (size_t)new_capacity * sizeof(int));
+            if (!watchers) {
+                send_error(client_fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+                return;
+            }
+            game->watchers = watchers;
+            game->watchers_capacity = new_capacity;
+        }
+        current_client->watch_game_id = game->id;
+        current_client->watch_index = game->num_watchers;
+        game->watchers[game->num_watchers++] = client_fd;
+    }
+    char msg[BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "Stai seguendo la partita %d. Digita 'unwatch' per smettere.\n", game->id);
+    send_event(client_fd, PROTO_EV_WATCHING, game->id, msg);
+    send_watch_snapshot(current_client, game);
+    printf("Client FD %d segue la partita %d (%d spettatori).\n", client_fd, game->id, game->num_watchers);
+}
+
+// --- Implementazioni delle Funzioni di Gestione Comandi ---
+
+/**
+ * @brief Gestisce il comando "create".
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param rows Righe del tabellone (SIZE per il tris classico).
+ * @param cols Colonne del tabellone.
+ * @param k Simboli in fila necessari per vincere.
+ * @param bot_level Livello del bot avversario (BOT_NONE per attendere un giocatore umano).
+ */
+void handle_create_command(int client_fd, Client *current_client, int rows, int cols, int k, BotLevel bot_level) {
+    // Controlla se il client è già in una partita
+    if (current_client->game_id != -1) {
+        send_error(client_fd, PROTO_ERR_ALREADY_IN_GAME, "Sei già in una partita. Lasciala prima di crearne una nuova.\n");
+        return;
+    }
+    if (current_client->status == PLAYER_QUEUED) {
+        send_error(client_fd, PROTO_ERR_QUEUED, "Sei in coda per una partita. Digita 'leave' per uscire dalla coda.\n");
+        return;
+    }
+    // Controlla se il numero massimo di partite è stato raggiunto
+    if (current_shard->num_games >= max_games_per_shard) {
+        send_error(client_fd, PROTO_ERR_MAX_GAMES, "Massimo numero di partite raggiunto. Riprova più tardi.\n");
+        return;
+    }
+    // Controlla la variante prima di occupare uno slot
+    TrisGame variant;
+    if (init_game_variant(&variant, rows, cols, k) < 0) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Variante non valida. Usa: create <righe> <colonne> <k> (lati da %d a %d, k da %d al lato maggiore) oppure create gomoku.\n",
+                 MIN_BOARD_SIDE, MAX_BOARD_SIDE, MIN_BOARD_SIDE);
+        send_error(client_fd, PROTO_ERR_INVALID_VARIANT, msg);
+        return;
+    }
+    // Alloca uno slot libero per una nuova partita (l'ID viene assegnato dalla tabella)
+    Game *new_game = allocate_game();
+    if (new_game) {
+        stop_watching(current_client); // Chi gioca smette di seguire altre partite
+    }
+    // Se trovato uno slot libero, inizializza la nuova partita
+    if (new_game) {
+        new_game->owner_fd = client_fd;
+        new_game->opponent_fd = -1;
+        new_game->state = GAME_WAITING_FOR_PLAYER;
+        new_game->last_result = IN_PROGRESS;
+        new_game->bot_level = bot_level;
+
+        new_game->tris_game = variant; // Tabellone vuoto della variante scelta
+        set_seat_token(new_game, 0, new_seat_token());
+        new_game->seat_accounts[0] = current_client->account;
+        publish_game(new_game); // Rende la partita visibile nella lista di tutti i worker
+        
+        // Inizializza il tabellone di gioco
+        current_client->game_id = new_game->id;
+        current_client->status = PLAYER_IN_GAME;
+        current_client->player_symbol = X;
+        current_client->is_current_turn = false; // Il turno sarà assegnato all'inizio del gioco
+        current_client->wants_rematch = false;
+
+        if (bot_level != BOT_NONE) {
+            // Contro il bot la partita inizia subito: nessuna attesa e nessun annuncio agli spettatori
+            new_game->opponent_fd = BOT_FD;
+            new_game->state = GAME_IN_PROGRESS;
+            publish_game(new_game);
+            char msg[BUFFER_SIZE];
+            if (is_classic_game(&variant)) {
+                snprintf(msg, sizeof(msg), "Partita contro il bot creata! ID: %d. Sei il giocatore X e inizi tu.\n", new_game->id);
+            } else {
+                snprintf(msg, sizeof(msg), "Partita contro il bot creata! ID: %d (%dx%d, %d in fila). Sei il giocatore X e inizi tu.\n",
+                         new_game->id, rows, cols, k);
+            }
+            send_event(client_fd, PROTO_EV_GAME_STARTED, new_game->id, msg);
+            send_seat_token(new_game, 0);
+            send_game_state_to_players(new_game);
+            printf("Partita %d creata da FD %d contro il bot (livello %d). Stato: IN_PROGRESS\n", new_game->id, client_fd, (int)bot_level);
+            return;
+        }
+        
+        char msg[BUFFER_SIZE];
+        if (is_classic_game(&variant)) {
+            snprintf(msg, sizeof(msg), "Partita creata con successo! ID: %d. Sei il giocatore X. In attesa di un avversario...\n", new_game->id);
+        } else {
+            snprintf(msg, sizeof(msg), "Partita creata con successo! ID: %d (%dx%d, %d in fila). Sei il giocatore X. In attesa di un avversario...\n",
+                     new_game->id, rows, cols, k);
+        }
+        send_event(client_fd, PROTO_EV_GAME_CREATED, new_game->id, msg);
+        send_seat_token(new_game, 0);
+        printf("Partita %d creata da FD %d. Stato: WAIT_FOR_PLAYER\n", new_game->id, client_fd);
+    // Non è stato possibile trovare uno slot libero
+    } else {
+        send_error(client_fd, PROTO_ERR_MAX_GAMES, "Impossibile creare una nuova partita in questo momento.\n");
+    }
+}
+
+/**
+ * @brief Gestisce il comando "join".
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param game_id_to_join L'ID della partita richiesta.
+ */
+void handle_join_command(int client_fd, Client *current_client, int game_id_to_join) {
+    // Controlla se il client è già in una partita
+    if (current_client->game_id != -1) {
+        send_error(client_fd, PROTO_ERR_ALREADY_IN_GAME, "Sei già in una partita. Lasciala prima di unirti a una nuova.\n");
+        return;
+    }
+    if (current_client->status == PLAYER_QUEUED) {
+        send_error(client_fd, PROTO_ERR_QUEUED, "Sei in coda per una partita. Digita 'leave' per uscire dalla coda.\n");
+        return;
+    }
+
+    Game *game = find_game_by_id(game_id_to_join);
+    
+    // Controlla se la partita esiste e se è in uno stato valido per unirsi
+    if (!game || game->id == -1) {
+        send_error(client_fd, PROTO_ERR_GAME_NOT_FOUND, "Partita non trovata o ID non valido.\n");
+        // La partita è già in corso o ha un avversario
+    } else if (game->state == GAME_IN_PROGRESS || game->state == GAME_ENDED || game->opponent_fd != -1) { 
+        send_error(client_fd, PROTO_ERR_GAME_UNAVAILABLE, "La partita è già in corso, terminata o ha già un avversario.\n");
+        // Il client è il proprietario della partita
+    } else if (game->owner_fd == DETACHED_FD) {
+        send_error(client_fd, PROTO_ERR_GAME_UNAVAILABLE, "Il proprietario della partita non è connesso (connessione caduta o server riavviato): riprova quando sarà rientrato.\n");
+        // Il client è il proprietario della partita
+    } else if (game->owner_fd == client_fd) { 
+        send_error(client_fd, PROTO_ERR_OWN_GAME, "Non puoi unirti alla tua stessa partita. Sei già il proprietario.\n");
+        // La partita è in attesa di un avversario
+    } else { 
+        // Il client richiede di unirsi
+        stop_watching(current_client); // Chi gioca smette di seguire altre partite
+        game->opponent_fd = client_fd; // Imposta il file descriptor del client come avversario
+        current_client->game_id = game->id; // Associa il client alla partita
+        current_client->status = PLAYER_WAITING_ACCEPT; // Stato in attesa di accettazione
+        current_client->player_symbol = O; // L'avversario è sempre O
+        current_client->is_current_turn = false; // Non è il turno del nuovo giocatore
+        current_client->wants_rematch = false; // Resetta la richiesta di rivincita
+        
+        // Invia un messaggio di conferma al client
+        send_event(client_fd, PROTO_EV_JOIN_SENT, game->id, "Richiesta inviata. In attesa di accettazione dal proprietario della partita...\n");
+        char msg_owner[BUFFER_SIZE];
+        snprintf(msg_owner, sizeof(msg_owner), "Il giocatore FD %d vuole unirsi alla tua partita %d. Digita 'accept' o 'reject'.\n", client_fd, game->id);
+        send_event(game->owner_fd, PROTO_EV_JOIN_REQUEST, game->id, msg_owner);
+        timer_arm(&current_shard->timers, &game->accept_timer, (uint64_t)config.accept_timeout * 1000);
+        printf("FD %d ha richiesto di unirsi alla partita %d.\n", client_fd, game->id);
+    }
+}
+
+/**
+ * @brief Gestisce il comando "accept".
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ */
+void handle_accept_command(int client_fd, Client *current_client) {
+    Game *game = find_game_by_player_fd(client_fd); // Trova la partita a cui il client appartiene
+    // Controlla se il client è il proprietario della partita e se è in attesa di un avversario
+    if (!game || game->owner_fd != client_fd) {
+        send_error(client_fd, PROTO_ERR_NOT_OWNER, "Questo comando è solo per i proprietari di partita in attesa di un avversario.\n");
+        return;
+    }
+    // Controlla se la partita è in attesa di un avversario
+    if (game->state != GAME_WAITING_FOR_PLAYER || game->opponent_fd == -1) {
+        send_error(client_fd, PROTO_ERR_NO_PENDING_PLAYER, "Nessun giocatore in attesa di accettazione o la partita non è in stato di attesa.\n");
+        return;
+    }
+
+    game->state = GAME_IN_PROGRESS; // Imposta lo stato della partita come in corso
+    set_seat_token(game, 1, new_seat_token());
+    publish_game(game);
+    timer_cancel(&current_shard->timers, &game->accept_timer);
+    Client *opponent_client = find_client_by_fd(game->opponent_fd); // Trova il client avversario
+    // Controlla se l'avversario è valido
+    if (opponent_client) {
+        game->seat_accounts[1] = opponent_client->account;
+        opponent_client->status = PLAYER_IN_GAME;
+        current_client->is_current_turn = true; // X (owner) inizia
+        opponent_client->is_current_turn = false;
+    }
+    // Imposta lo stato del gioco per entrambi i giocatori
+    send_event(client_fd, PROTO_EV_GAME_STARTED, game->id, "Hai accettato il giocatore. La partita è iniziata!\n");
+    // Invia un messaggio all'avversario
+    if (game->opponent_fd != -1) { // Invia all'opponente solo se valido
+        send_event(game->opponent_fd, PROTO_EV_GAME_STARTED, game->id, "La tua richiesta è stata accettata. La partita è iniziata!\n");
+        send_seat_token(game, 1);
+    }
+
+    send_game_state_to_players(game); // Invia lo stato iniziale del gioco
+
+    printf("Partita %d: Il proprietario (FD %d) ha accettato FD %d. Stato: IN_PROGRESS.\n", game->id, client_fd, game->opponent_fd);
+}
+
+/**
+ * @brief Gestisce il comando "reject".
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ */
+void handle_reject_command(int client_fd, Client *current_client) {
+    Game *game = find_game_by_player_fd(client_fd);
+    // Controlla se il client è il proprietario della partita e se è in attesa di un avversario
+    if (!game || game->owner_fd != client_fd) {
+        send_error(client_fd, PROTO_ERR_NOT_OWNER, "Questo comando è solo per i proprietari di partita in attesa di un avversario.\n");
+        return;
+    }
+    // Controlla se la partita è in attesa di un avversario
+    if (game->state != GAME_WAITING_FOR_PLAYER || game->opponent_fd == -1) {
+        send_error(client_fd, PROTO_ERR_NO_PENDING_PLAYER, "Nessun giocatore in attesa di rifiuto o la partita non è in stato di attesa.\n");
+        return;
+    }
+
+    Client *opponent_client = find_client_by_fd(game->opponent_fd); // Trova il client avversario
+    // Controlla se l'avversario è valido
+    if (opponent_client) {
+        send_event(opponent_client->fd, PROTO_EV_JOIN_REJECTED, game->id, "La tua richiesta di unirti alla partita è stata rifiutata.\n");
+        opponent_client->game_id = -1; // Resetta lo stato del client avversario
+        opponent_client->status = PLAYER_CONNECTED; // Resetta lo stato del client avversario
+        opponent_client->player_symbol = EMPTY; // Resetta il simbolo del client avversario
+        opponent_client->is_current_turn = false; // Resetta il turno del client avversario
+        opponent_client->wants_rematch = false; // Resetta la richiesta di rivincita dell'avversario
+    }
+    game->opponent_fd = -1; // Rimuovi l'opponente dallo slot del gioco
+    timer_cancel(&current_shard->timers, &game->accept_timer);
+    send_event(client_fd, PROTO_EV_PLAYER_REJECTED, game->id, "Hai rifiutato il giocatore. La tua partita è di nuovo in attesa di un avversario.\n");
+    printf("Partita %d: Il proprietario (FD %d) ha rifiutato FD %d. Stato: WAIT_FOR_PLAYER.\n", game->id, client_fd, opponent_client ? opponent_client->fd : -1);
+}
+
+/**
+ * @brief Gestisce il comando "leave".
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ */
+void handle_leave_command(int client_fd, Client *current_client) {
+    // Un giocatore in coda esce dalla coda
+    if (current_client->status == PLAYER_QUEUED) {
+        leave_match_queue(current_client);
+        send_event(client_fd, PROTO_EV_QUEUE_LEFT, -1, "Sei uscito dalla coda.\n");
+        return;
+    }
+    // Controlla se il client è in una partita
+    if (current_client->game_id == -1 && current_client->watch_game_id != -1) {
+        stop_watching(current_client);
+        send_event(client_fd, PROTO_EV_UNWATCHED, -1, "Non segui più la partita.\n");
+        return;
+    }
+    if (current_client->game_id == -1) {
+        send_error(client_fd, PROTO_ERR_NOT_IN_GAME, "Non sei in una partita da lasciare.\n");
+        return;
+    }
+
+    Game* game = find_game_by_id(current_client->game_id); // Trova la partita a cui il client appartiene
+    // Controlla se la partita esiste
+    if (!game) {
+        // Dovrebbe essere gestito da remove_client_from_game, ma precauzione
+        send_error(client_fd, PROTO_ERR_INTERNAL, "Errore interno: partita non trovata. Riprova o disconnetti.\n");
+        current_client->game_id = -1; // Resetta stato del client
+        current_client->status = PLAYER_CONNECTED; // Resetta lo stato del client
+        current_client->player_symbol = EMPTY; // Resetta il simbolo del client
+        current_client->is_current_turn = false; // Resetta il turno del client
+        current_client->wants_rematch = false; // Resetta la richiesta di rivincita
+        return;
+    }
+    
+    send_event(client_fd, PROTO_EV_LEFT, game->id, "Hai lasciato la partita.\n"); // Informa il client che ha lasciato la partita
+    printf("Client FD %d ha lasciato la partita %d.\n", client_fd, game->id);
+    
+    // Rimuovi il client dalla partita
+    remove_client_from_game(client_fd);
+}
+
+/**
+ * @brief Gestisce il comando "move".
+ * @param sd Il file descriptor del client che ha inviato il comando.
+ * @param row La riga della mossa.
+ * @param col La colonna della mossa.
+ */
+void handle_move_command(int sd, int row, int col) {
+    Client* current_client = find_client_by_fd(sd); // Trova il client corrente
+    // Controlla se il client è in una partita
+    if (!current_client || current_client->status != PLAYER_IN_GAME) {
+        send_error(sd, PROTO_ERR_NOT_IN_GAME, "Non sei in una partita. Digita 'join <game_id>' o 'create'.\n");
+        return;
+    }
+
+    Game* game = find_game_by_id(current_client->game_id); // Trova la partita a cui il client appartiene
+    // Controlla se la partita esiste e se è in corso
+    if (!game || game->state != GAME_IN_PROGRESS) {
+        // Se la partita non esiste o non è in corso, informa il client
+        if (game && game->state == GAME_ENDED) {
+            send_error(sd, PROTO_ERR_GAME_ENDED, "La partita è terminata. Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
+        } else {
+            send_error(sd, PROTO_ERR_GAME_NOT_RUNNING, "La partita non è in corso o non valida.\n");
+        }
+        return;
+    }
+    // Controlla se è il turno del client corrente
+    if (!current_client->is_current_turn) {
+        send_error(sd, PROTO_ERR_NOT_YOUR_TURN, "Non è il tuo turno.\n");
+        return;
+    }
+
+    // Effettua la mossa
+    // Assumiamo che make_move ritorni 0 per successo e -1 per fallimento (mossa invalida)
+    if (make_move(&game->tris_game, row, col) == 0) {
+        record_move(game); // Solo accodata: va su disco con le altre mosse del giro, prima delle risposte
+        log_move(game);
+        METRICS_ADD(current_shard->metrics->moves, 1);
+        GameResult result = check_winner(&game->tris_game); // Controlla il risultato della partita
+        Client* owner_client = find_client_by_fd(game->owner_fd); // Trova il proprietario della partita
+        Client* opponent_client = (game->opponent_fd != -1) ? find_client_by_fd(game->opponent_fd) : NULL; // Trova l'avversario della partita
+
+        // Il tabellone testuale viene renderizzato solo se un destinatario usa il protocollo testuale, una volta per tutti
+        BoardText board_text = { NULL, 0 };
+
+        // Vittoria
+        if (result == WIN) { 
+            Client* winner_client = current_client; // Il client corrente è il vincitore
+            Client* loser_client = (winner_client == owner_client) ? opponent_client : owner_client; // Il perdente è l'altro giocatore
+
+            winner_client->is_current_turn = false;
+            if (loser_client) loser_client->is_current_turn = false;
+
+            send_board_state(winner_client->fd, game, PROTO_STATE_WIN, &board_text, &MSG_BOARD_END); // Invia il tabellone finale al vincitore
+            send_event(winner_client->fd, PROTO_EV_WIN, game->id, "Hai vinto!\n"); // Invia messaggio di vittoria al vincitore
+
+            // Invia messaggio di fine partita al perdente
+            if (loser_client && loser_client->fd != winner_client->fd) { 
+                send_board_state(loser_client->fd, game, PROTO_STATE_WIN, &board_text, &MSG_BOARD_END); // Invia il tabellone finale al perdente
+                send_event(loser_client->fd, PROTO_EV_LOSE, game->id, "Hai perso.\n"); // Invia messaggio di sconfitta al perdente
+            }
+            broadcast_to_watchers(game, PROTO_STATE_WIN, &board_text); // Prima del reset: gli spettatori vedono il tabellone finale
+            board_text_release(&board_text);
+            save_replay(game, WIN);
+            rate_game(game, winner_client->fd == game->owner_fd ? 0 : 1);
+            
+            // --- Gestione Post-Vittoria ---
+            // Il vincitore diventa il nuovo proprietario della partita e attende un nuovo giocatore.
+            // La partita viene resettata per un nuovo round.
+            if (winner_client->fd == game->opponent_fd) {
+                set_seat_token(game, 0, game->seat_tokens[1]); // Il vincitore conserva il suo codice di rientro
+                game->seat_accounts[0] = game->seat_accounts[1];
+            }
+            set_seat_token(game, 1, 0);
+            game->seat_accounts[1] = -1;
+            game->owner_fd = winner_client->fd; // Il vincitore diventa il proprietario della partita
+            game->opponent_fd = -1; // L'avversario precedente viene rimosso
+            game->bot_level = BOT_NONE; // Anche se era il bot: ora si attende un giocatore umano
+            game->state = GAME_WAITING_FOR_PLAYER; // Imposta lo stato della partita come in attesa di un nuovo giocatore
+            reset_game(&game->tris_game); // Svuota il tabellone per la nuova partita, con la stessa variante
+            game->last_result = IN_PROGRESS; // Resetta il risultato per la nuova partita
+            publish_game(game);
+
+            winner_client->game_id = game->id; // Associa il vincitore alla partita
+            winner_client->status = PLAYER_IN_GAME; // Resta in gioco, ora come proprietario
+            winner_client->player_symbol = X; // Il vincitore è X per la prossima partita
+            winner_client->is_current_turn = false; // Il turno verrà assegnato quando l'opponente si unisce
+            winner_client->wants_rematch = false; // Resetta
+
+            // Messaggio per il vincitore
+            char winner_prompt[BUFFER_SIZE]; 
+            snprintf(winner_prompt, sizeof(winner_prompt), "Sei diventato il proprietario della partita %d e attendi un nuovo giocatore (X).\n", game->id);
+            send_event(winner_client->fd, PROTO_EV_NEW_OWNER, game->id, winner_prompt); // Invia messaggio al vincitore
+
+            // Rimuovi il perdente dal gioco
+            if (loser_client && loser_client->fd != winner_client->fd) {
+                send_event(loser_client->fd, PROTO_EV_REMOVED, game->id, "Sei stato rimosso dalla partita. Digita 'list' per vedere altre partite o 'create' per crearne una nuova.\n");
+                remove_client_from_game(loser_client->fd); // Rimuove il perdente dal gioco
+            }
+            
+            printf("Partita %d terminata. Vincitore FD %d. Partita resettata per un nuovo giro con FD %d proprietario.\n", game->id, winner_client->fd, winner_client->fd);
+            
+            //In caso di Pareggio Invia il messaggio di pareggio a entrambi i giocatori
+        } else if (result == DRAW) { 
+
+            if(owner_client) owner_client->is_current_turn = false;
+            if(opponent_client) opponent_client->is_current_turn = false;
+            send_board_state(game->owner_fd, game, PROTO_STATE_DRAW, &board_text, &MSG_BOARD_DRAW);
+            send_event(game->owner_fd, PROTO_EV_DRAW, game->id, "Vuoi giocare un'altra partita? Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
+            // Invia il messaggio di pareggio all'avversario, se esiste
+            if (game->opponent_fd != -1) { 
+                send_board_state(game->opponent_fd, game, PROTO_STATE_DRAW, &board_text, &MSG_BOARD_DRAW);
+                send_event(game->opponent_fd, PROTO_EV_DRAW, game->id, "Vuoi giocare un'altra partita? Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
+            }
+            broadcast_to_watchers(game, PROTO_STATE_DRAW, &board_text);
+            board_text_release(&board_text);
+            save_replay(game, DRAW);
+            rate_game(game, -1);
+
+            game->state = GAME_ENDED; // Passa a uno stato di "ended" in cui si attende 'rematch' o 'leave'
+            game->last_result = DRAW; // Registra il pareggio
+            publish_game(game);
+            if(owner_client) owner_client->is_current_turn = false; // Resetta i turni
+            if(opponent_client) opponent_client->is_current_turn = false; // Resetta i turni
+
+            printf("Partita %d terminata. Risultato: PAREGGIO. In attesa di 'rematch' o 'leave'.\n", game->id);
+
+        } else if (game->bot_level != BOT_NONE) {
+            // Il bot risponde nello stesso giro di eventi: il giocatore riceve un solo tabellone con entrambe le mosse
+            play_bot_move(game);
+        } else { // IN_PROGRESS
+            // La partita continua, invia lo stato aggiornato
+            send_game_state_to_players(game);
+        }
+    } else { // Mossa non valida
+        send_error(sd, PROTO_ERR_INVALID_MOVE, "Mossa non valida. Controlla riga/colonna o se la cella è già occupata.\n");
+    }
+}
+
+/**
+ * @brief Gestisce il comando "rematch".
+ * @param sd Il file descriptor del client che ha inviato il comando.
+ */
+void handle_rematch_command(int sd) {
+    Client* current_client = find_client_by_fd(sd); // Trova il client corrente
+    // Controlla se il client è in una partita
+    if (!current_client || current_client->game_id == -1) { 
+        send_error(sd, PROTO_ERR_NOT_IN_GAME, "Non sei in una partita terminata per richiedere una rivincita.\n");
+        return;
+    }
+
+    Game* game = find_game_by_id(current_client->game_id); // Trova la partita a cui il client appartiene
+    // Controlla se la partita esiste e se è in uno stato di pareggio
+    if (!game || game->state != GAME_ENDED || game->last_result != DRAW) {
+        send_error(sd, PROTO_ERR_NO_REMATCH, "Questa partita non è in stato di pareggio per una rivincita.\n");
+        return;
+    }
+
+    if (game->bot_level != BOT_NONE) {
+        // Il bot accetta sempre la rivincita; come tra umani, la nuova partita la inizia O (il bot)
+        reset_game(&game->tris_game);
+        game->state = GAME_IN_PROGRESS;
+        game->last_result = IN_PROGRESS;
+        game->tris_game.turn = 1;
+        publish_game(game);
+        current_client->is_current_turn = false;
+        current_client->wants_rematch = false;
+        send_event(sd, PROTO_EV_REMATCH_STARTED, game->id, "Il bot accetta la rivincita! La nuova partita inizia con la sua mossa.\n");
+        printf("Partita %d: rivincita contro il bot.\n", game->id);
+        play_bot_move(game);
+        return;
+    }
+
+    // Registra la richiesta di rivincita del client
+    current_client->wants_rematch = true; // Indica che il client vuole una rivincita
+    send_event(sd, PROTO_EV_REMATCH_SENT, game->id, "Richiesta di rivincita inviata. In attesa dell'altro giocatore...\n");
+    printf("Client FD %d ha richiesto rivincita per partita %d.\n", sd, game->id);
+
+    // Controlla se entrambi i giocatori vogliono la rivincita
+    Client* owner_client = find_client_by_fd(game->owner_fd);
+    Client* opponent_client = find_client_by_fd(game->opponent_fd);
+
+    if (owner_client && opponent_client && owner_client->wants_rematch && opponent_client->wants_rematch) {
+        // Entrambi i giocatori vogliono una rivincita!
+        reset_game(&game->tris_game); // Reset della board (la variante resta la stessa)
+        game->state = GAME_IN_PROGRESS; // Ritorna in corso
+        game->last_result = IN_PROGRESS; // Resetta risultato
+
+        // Resetta i turni e i simboli dei giocatori
+        if (game->tris_game.turn == 0) { // Se X (owner) aveva iniziato
+            game->tris_game.turn = 1; // O (opponent) inizia ora
+            owner_client->is_current_turn = false; // Resetta il turno del proprietario
+            opponent_client->is_current_turn = true; // O (avversario) inizia ora
+        } else { // Se O (opponent) aveva iniziato (o se fosse stato reimpostato a 0 dopo vittoria)
+            game->tris_game.turn = 0; // X (owner) inizia ora
+            owner_client->is_current_turn = true; // X (proprietario) inizia ora
+            opponent_client->is_current_turn = false; // Resetta il turno dell'avversario
+        }
+        publish_game(game); // Dopo il turno: il journal registra chi inizia la rivincita
+        
+        owner_client->wants_rematch = false; // Resetta lo stato di richiesta
+        opponent_client->wants_rematch = false; // Resetta lo stato di richiesta
+
+        send_event(owner_client->fd, PROTO_EV_REMATCH_STARTED, game->id, "Entrambi avete richiesto una rivincita! La nuova partita inizia.\n");
+        send_event(opponent_client->fd, PROTO_EV_REMATCH_STARTED, game->id, "Entrambi avete richiesto una rivincita! La nuova partita inizia.\n");
+        printf("Partita %d: Rivincita accettata. Nuova partita iniziata.\n", game->id);
+
+        send_game_state_to_players(game); // Invia il nuovo stato del tabellone e il turno
+        // Solo uno dei giocatori ha richiesto una rivincita
+    } else { 
+        // Notifica l'altro giocatore della richiesta di rivincita
+        Client* other_player = (current_client == owner_client) ? opponent_client : owner_client;
+        if (other_player && other_player->game_id == game->id) { // Assicurati che l'altro giocatore sia ancora nella stessa partita
+            send_event(other_player->fd, PROTO_EV_REMATCH_REQUESTED, game->id, "L'altro giocatore ha richiesto una rivincita. Digita 'rematch' per accettare o 'leave' per uscire.\n");
+        }
+    }
+}
+
+/**
+ * @brief Fa giocare al bot la sua mossa e ne gestisce l'esito: nel tris classico con un accesso alla tabella precalcolata,
+ * nelle varianti m,n,k con una ricerca alpha-beta entro il tempo per mossa configurato.
+ * Se il bot vince la partita viene chiusa; in caso di pareggio si attende 'rematch' o 'leave'.
+ * @param game La partita contro il bot, con il turno di O.
+ */
+void play_bot_move(Game *game) {
+    Client *owner_client = find_client_by_fd(game->owner_fd);
+    int cell = ai_choose_move(&game->tris_game, game->bot_level, &current_shard->rng);
+    if (cell < 0 || make_move_index(&game->tris_game, cell) < 0) {
+        return; // Nessuna mossa disponibile: non può accadere in una partita in corso
+    }
+    record_move(game);
+    log_move(game);
+    METRICS_ADD(current_shard->metrics->moves, 1);
+
+    GameResult result = check_winner(&game->tris_game);
+    if (result == IN_PROGRESS) {
+        send_game_state_to_players(game); // Torna il turno del giocatore
+        return;
+    }
+
+    BoardText board_text = { NULL, 0 };
+    if (owner_client) owner_client->is_current_turn = false;
+
+    if (result == WIN) {
+        send_board_state(game->owner_fd, game, PROTO_STATE_WIN, &board_text, &MSG_BOARD_END);
+        broadcast_to_watchers(game, PROTO_STATE_WIN, &board_text);
+        board_text_release(&board_text);
+        send_event(game->owner_fd, PROTO_EV_LOSE, game->id, "Hai perso contro il bot.\n");
+        save_replay(game, WIN);
+        send_event(game->owner_fd, PROTO_EV_REMOVED, game->id, "La partita è chiusa. Digita 'create bot' per riprovare, 'list' o 'create' per sfidare un altro giocatore.\n");
+        printf("Partita %d terminata. Vincitore: bot.\n", game->id);
+        remove_client_from_game(game->owner_fd); // Il giocatore esce e la partita, ormai vuota, viene pulita
+    } else {
+        game->state = GAME_ENDED;
+        game->last_result = DRAW;
+        publish_game(game);
+        send_board_state(game->owner_fd, game, PROTO_STATE_DRAW, &board_text, &MSG_BOARD_DRAW);
+        broadcast_to_watchers(game, PROTO_STATE_DRAW, &board_text);
+        board_text_release(&board_text);
+        send_event(game->owner_fd, PROTO_EV_DRAW, game->id, "Vuoi giocare un'altra partita? Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
+        save_replay(game, DRAW);
+        printf("Partita %d terminata. Risultato: PAREGGIO contro il bot.\n", game->id);
+    }
+}
+
+/**
+ * @brief Gestisce il comando "hint": suggerisce la mossa migliore al giocatore di turno, con l'esito previsto.
+ * Nel tris classico il suggerimento viene dalla tabella precalcolata, nelle varianti m,n,k dalla ricerca alpha-beta.
+ * @param sd Il file descriptor del client che ha inviato il comando.
+ */
+void handle_hint_command(int sd) {
+    Client *current_client = find_client_by_fd(sd);
+    if (!current_client || current_client->status != PLAYER_IN_GAME) {
+        send_error(sd, PROTO_ERR_NOT_IN_GAME, "Non sei in una partita. Digita 'join <game_id>' o 'create'.\n");
+        return;
+    }
+    Game *game = find_game_by_id(current_client->game_id);
+    if (!game || game->state != GAME_IN_PROGRESS) {
+        send_error(sd, PROTO_ERR_GAME_NOT_RUNNING, "La partita non è in corso o non valida.\n");
+        return;
+    }
+    if (!current_client->is_current_turn) {
+        send_error(sd, PROTO_ERR_NOT_YOUR_TURN, "Non è il tuo turno.\n");
+        return;
+    }
+
+    int outcome;
+    int cell = ai_suggest_move(&game->tris_game, &outcome);
+    if (cell < 0) {
+        send_error(sd, PROTO_ERR_INTERNAL, "Nessun suggerimento disponibile.\n");
+        return;
+    }
+    int cols = game->tris_game.cols;
+    if (current_client->binary) {
+        ProtoFrame frame = { PROTO_OP_HINT_REPLY, outcome > 0 ? PROTO_HINT_WIN : outcome < 0 ? PROTO_HINT_LOSS : PROTO_HINT_OPEN,
+                             (uint16_t)cell, (uint32_t)game->id };
+        send_frame(sd, &frame);
+        return;
+    }
+    char msg[BUFFER_SIZE];
+    const char *forecast = outcome > 0 ? "vittoria forzata" :
+                           outcome < 0 ? "posizione persa contro un gioco perfetto" :
+                           is_classic_game(&game->tris_game) ? "pareggio con il gioco perfetto" : "esito ancora aperto";
+    snprintf(msg, sizeof(msg), "Suggerimento: move %d %d (%s).\n", cell / cols, cell % cols, forecast);
+    send_to_client(sd, msg);
+}
+
+// Bucket di un punteggio nella coda
+static int queue_bucket(int32_t rating) {
+    return rating < 0 ? 0 : rating >= RATING_MAX ? RATING_MAX - 1 : rating;
+}
+
+// Coda di una variante, creata se serve; NULL se manca la memoria
+static MatchQueue *match_queue_of(uint16_t variant) {
+    Shard *sh = current_shard;
+    if (!sh->match_queues && !(sh->match_queues = calloc((size_t)PROTO_VARIANT(0x1F, 0x1F, 0x1F) + 1, sizeof(MatchQueue *)))) {
+        return NULL;
+    }
+    MatchQueue *q = sh->match_queues[variant];
+    if (!q) {
+        if (!(q = malloc(sizeof(MatchQueue)))) {
+            return NULL;
+        }
+        q->variant = variant;
+        q->count = 0;
+        q->oldest = q->newest = -1;
+        memset(q->bucket_head, 0xFF, sizeof(q->bucket_head)); // -1 in ogni bucket
+        memset(q->bucket_tail, 0xFF, sizeof(q->bucket_tail));
+        memset(q->occupied, 0, sizeof(q->occupied));
+        timer_init(&q->widen_timer, queue_timer_expired);
+        sh->match_queues[variant] = q;
+    }
+    return q;
+}
+
+// Primo bucket occupato a partire da from (compreso), -1 se nessuno
+static int queue_next_bucket(const MatchQueue *q, int from) {
+    if (from < 0) {
+        from = 0;
+    }
+    for (int word = from / 64; from < RATING_MAX && word < QUEUE_BITMAP_WORDS; word++) {
+        uint64_t bits = q->occupied[word] & (~0ULL << (word == from / 64 ? from % 64 : 0));
+        if (bits) {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+// Ultimo bucket occupato fino a from (compreso), -1 se nessuno
+static int queue_prev_bucket(const MatchQueue *q, int from) {
+    if (from >= RATING_MAX) {
+        from = RATING_MAX - 1;
+    }
+    for (int word = from / 64; from >= 0 && word >= 0; word--) {
+        uint64_t bits = q->occupied[word] & (word == from / 64 ? ~0ULL >> (63 - from % 64) : ~0ULL);
+        if (bits) {
+            return word * 64 + 63 - __builtin_clzll(bits);
+        }
+    }
+    return -1;
+}
+
+// Accoda il client nella coda della sua variante e nel bucket del suo punteggio, in ordine di ingresso in coda:
+// chi arriva va in fondo, chi torna in coda dopo un abbinamento fallito riprende il suo posto
+static void queue_link(MatchQueue *q, Client *client) {
+    int bucket = queue_bucket(client->queue_rating);
+    Client *before = find_client_by_fd(q->newest);
+    while (before && before->queued_at_ms > client->queued_at_ms) {
+        before = find_client_by_fd(before->queue_prev);
+    }
+    Client *after = before ? find_client_by_fd(before->queue_next) : find_client_by_fd(q->oldest);
+    client->queue_prev = before ? before->fd : -1;
+    client->queue_next = after ? after->fd : -1;
+    if (before) {
+        before->queue_next = client->fd;
+    } else {
+        q->oldest = client->fd;
+    }
+    if (after) {
+        after->queue_prev = client->fd;
+    } else {
+        q->newest = client->fd;
+    }
+
+    before = find_client_by_fd(q->bucket_tail[bucket]);
+    while (before && before->queued_at_ms > client->queued_at_ms) {
+        before = find_client_by_fd(before->bucket_prev);
+    }
+    after = before ? find_client_by_fd(before->bucket_next) : find_client_by_fd(q->bucket_head[bucket]);
+    client->bucket_prev = before ? before->fd : -1;
+    client->bucket_next = after ? after->fd : -1;
+    if (before) {
+        before->bucket_next = client->fd;
+    } else {
+        q->bucket_head[bucket] = client->fd;
+        q->occupied[bucket / 64] |= 1ULL << (bucket % 64);
+    }
+    if (after) {
+        after->bucket_prev = client->fd;
+    } else {
+        q->bucket_tail[bucket] = client->fd;
+    }
+    if (++q->count >= 2 && !timer_pending(&q->widen_timer)) {
+        timer_arm(&current_shard->timers, &q->widen_timer, QUEUE_RETRY_MS);
+    }
+}
+
+// Toglie il client dalla coda della sua variante e dal bucket del suo punteggio
+static void queue_unlink(Client *client) {
+    MatchQueue *q = current_shard->match_queues ? current_shard->match_queues[client->queue_variant] : NULL;
+    if (!q) {
+        return;
+    }
+    int bucket = queue_bucket(client->queue_rating);
+    Client *prev = find_client_by_fd(client->queue_prev);
+    Client *next = find_client_by_fd(client->queue_next);
+    if (prev) {
+        prev->queue_next = client->queue_next;
+    } else if (q->oldest == client->fd) {
+        q->oldest = client->queue_next;
+    }
+    if (next) {
+        next->queue_prev = client->queue_prev;
+    } else if (q->newest == client->fd) {
+        q->newest = client->queue_prev;
+    }
+    prev = find_client_by_fd(client->bucket_prev);
+    next = find_client_by_fd(client->bucket_next);
+    if (prev) {
+        prev->bucket_next = client->bucket_next;
+    } else if (q->bucket_head[bucket] == client->fd) {
+        q->bucket_head[bucket] = client->bucket_next;
+    }
+    if (next) {
+        next->bucket_prev = client->bucket_prev;
+    } else if (q->bucket_tail[bucket] == client->fd) {
+        q->bucket_tail[bucket] = client->bucket_prev;
+    }
+    if (q->bucket_head[bucket] == -1) {
+        q->occupied[bucket / 64] &= ~(1ULL << (bucket % 64));
+    }
+    client->queue_prev = client->queue_next = client->bucket_prev = client->bucket_next = -1;
+    if (--q->count < 2) {
+        timer_cancel(&current_shard->timers, &q->widen_timer);
+    }
+}
+
+// Differenza di punteggio che il client accetta: cresce con il tempo passato in coda
+static int32_t queue_window(const Client *client) {
+    uint64_t waited_ms = current_shard->now_ms - client->queued_at_ms;
+    uint64_t window = QUEUE_RATING_WINDOW + QUEUE_RATING_WIDEN * (waited_ms / 1000);
+    return window < RATING_MAX ? (int32_t)window : RATING_MAX;
+}
+
+// Vero se due giocatori in coda possono essere abbinati: la differenza rientra in quella accettata dal più paziente
+static bool queue_compatible(const Client *a, const Client *b) {
+    int32_t diff = abs(a->queue_rating - b->queue_rating);
+    return diff <= queue_window(a) || diff <= queue_window(b);
+}
+
+/**
+ * @brief Cerca nella coda l'avversario dal punteggio più vicino a quello del client, entro la differenza accettata
+ * dal più paziente dei due; a parità di differenza vince chi aspetta da più tempo. Si visitano solo i bucket
+ * occupati, dal più vicino, e di ciascuno solo il primo giocatore; la ricerca si ferma oltre la differenza
+ * accettata dal client e da chi è in coda da più tempo, che nessun altro può superare.
+ * @param q La coda della variante.
+ * @param client Il client da abbinare (queue_variant e queue_rating impostati; non in coda).
+ * @return L'avversario, NULL se nessuno è abbastanza vicino.
+ */
+static Client *find_queue_partner(const MatchQueue *q, const Client *client) {
+    Client *oldest = find_client_by_fd(q->oldest);
+    if (!oldest) {
+        return NULL;
+    }
+    int32_t own_window = queue_window(client);
+    int32_t limit = own_window > queue_window(oldest) ? own_window : queue_window(oldest);
+    int center = queue_bucket(client->queue_rating);
+    int below = queue_prev_bucket(q, center);
+    int above = queue_next_bucket(q, center + 1);
+    while (below >= 0 || above >= 0) {
+        Client *low = below >= 0 ? find_client_by_fd(q->bucket_head[below]) : NULL;
+        Client *high = above >= 0 ? find_client_by_fd(q->bucket_head[above]) : NULL;
+        int32_t low_diff = low ? abs(low->queue_rating - client->queue_rating) : RATING_MAX + 1;
+        int32_t high_diff = high ? abs(high->queue_rating - client->queue_rating) : RATING_MAX + 1;
+        bool take_low = low && (!high || low_diff < high_diff || (low_diff == high_diff && low->queued_at_ms <= high->queued_at_ms));
+        Client *w = take_low ? low : high;
+        if (!w || (take_low ? low_diff : high_diff) > limit) {
+            return NULL;
+        }
+        if (queue_compatible(client, w)) {
+            return w;
+        }
+        if (take_low) {
+            below = queue_prev_bucket(q, below - 1);
+        } else {
+            above = queue_next_bucket(q, above + 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Toglie un client dalla coda di matchmaking e lo riporta a PLAYER_CONNECTED.
+ * La coda vive nello shard corrente: un giocatore in coda non cambia mai shard.
+ * @param client Il client in coda.
+ */
+void leave_match_queue(Client *client) {
+    queue_unlink(client);
+    client->status = PLAYER_CONNECTED;
+    client->queue_variant = 0;
+    printf("Client FD %d uscito dalla coda di matchmaking.\n", client->fd);
+}
+
+/**
+ * @brief Crea una partita già in corso tra due giocatori abbinati dalla coda, senza richiesta né accettazione.
+ * @param waiting Il giocatore che era in coda: diventa il proprietario e gioca X.
+ * @param arrived Il giocatore appena arrivato: gioca O.
+ * @param variant Tabellone vuoto della variante per cui sono stati abbinati.
+ * @return true se la partita è iniziata, false se non c'è uno slot libero.
+ */
+static bool start_matched_game(Client *waiting, Client *arrived, const TrisGame *variant) {
+    if (current_shard->num_games >= max_games_per_shard) {
+        return false;
+    }
+    Game *game = allocate_game();
+    if (!game) {
+        return false;
+    }
+    game->owner_fd = waiting->fd;
+    game->opponent_fd = arrived->fd;
+    game->state = GAME_IN_PROGRESS;
+    game->last_result = IN_PROGRESS;
+    game->bot_level = BOT_NONE;
+    game->tris_game = *variant;
+    set_seat_token(game, 0, new_seat_token());
+    set_seat_token(game, 1, new_seat_token());
+    publish_game(game);
+
+    Client *players[2] = { waiting, arrived };
+    for (int i = 0; i < 2; ++i) {
+        game->seat_accounts[i] = players[i]->account;
+        players[i]->game_id = game->id;
+        players[i]->status = PLAYER_IN_GAME;
+        players[i]->player_symbol = i == 0 ? X : O;
+        players[i]->wants_rematch = false;
+        players[i]->queue_variant = 0;
+    }
+
+    char msg[BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "Avversario trovato! Partita %d iniziata. Sei il giocatore X e inizi tu.\n", game->id);
+    send_event(waiting->fd, PROTO_EV_MATCH_FOUND, game->id, msg);
+    snprintf(msg, sizeof(msg), "Avversario trovato! Partita %d iniziata. Sei il giocatore O.\n", game->id);
+    send_event(arrived->fd, PROTO_EV_MATCH_FOUND, game->id, msg);
+    send_seat_token(game, 0);
+    send_seat_token(game, 1);
+    send_game_state_to_players(game); // Assegna il turno e avvia l'orologio della prima mossa
+    printf("Partita %d avviata dal matchmaking: FD %d (X) contro FD %d (O). Stato: IN_PROGRESS\n", game->id, waiting->fd, arrived->fd);
+    return true;
+}
+
+/**
+ * @brief Abbina due giocatori usciti dalla coda; chi aspetta da più tempo gioca X.
+ * @return true se la partita è iniziata, false se non c'è uno slot libero (entrambi tornano in coda).
+ */
+static bool start_queued_pair(MatchQueue *q, Client *a, Client *b) {
+    TrisGame variant;
+    init_game_variant(&variant, PROTO_VARIANT_ROWS(q->variant), PROTO_VARIANT_COLS(q->variant), PROTO_VARIANT_K(q->variant));
+    Client *older = a->queued_at_ms <= b->queued_at_ms ? a : b;
+    Client *newer = older == a ? b : a;
+    queue_unlink(older);
+    queue_unlink(newer);
+    if (start_matched_game(older, newer, &variant)) {
+        return true;
+    }
+    queue_link(q, older);
+    queue_link(q, newer);
+    return false;
+}
+
+/**
+ * @brief Riprova ad abbinare i giocatori in coda per una variante: ogni secondo di attesa allarga la differenza di
+ * punteggio accettata. Se due giocatori qualsiasi sono compatibili lo sono anche due vicini nell'ordine dei
+ * punteggi (il più paziente dei due accetta anche chi sta in mezzo), quindi basta confrontare i primi giocatori
+ * di bucket occupati consecutivi (e i primi due di un bucket con più giocatori): il costo dipende dai bucket
+ * occupati, non da quanti aspettano.
+ * @param timer Il widen_timer della coda.
+ */
+void queue_timer_expired(TimerNode *timer) {
+    MatchQueue *q = TIMER_CONTAINER(timer, MatchQueue, widen_timer);
+    Client *left = NULL;
+    int bucket = queue_next_bucket(q, 0);
+    while (bucket >= 0) {
+        Client *right = find_client_by_fd(q->bucket_head[bucket]);
+        Client *second = right ? find_client_by_fd(right->bucket_next) : NULL;
+        Client *a = second ? right : left;
+        Client *b = second ? second : right;
+        if (a && b && (second || queue_compatible(a, b))) {
+            int restart = queue_bucket(a->queue_rating);
+            if (!start_queued_pair(q, a, b)) {
+                break; // Nessuno slot libero: si riprova al prossimo giro
+            }
+            // I bucket rimasti ai lati dei due abbinati diventano vicini: si riparte dal bucket che precede
+            left = NULL;
+            bucket = queue_prev_bucket(q, restart - 1);
+            if (bucket < 0) {
+                bucket = queue_next_bucket(q, 0);
+            }
+            continue;
+        }
+        left = right;
+        bucket = queue_next_bucket(q, bucket + 1);
+    }
+    if (q->count >= 2) {
+        timer_arm(&current_shard->timers, &q->widen_timer, QUEUE_RETRY_MS);
+    }
+}
+
+/**
+ * @brief Gestisce il comando "queue": abbina il giocatore all'avversario in attesa per la stessa variante
+ * con il punteggio più vicino o lo mette in coda. La coda di ogni variante vive in un solo shard (variante
+ * modulo numero di shard), raggiunto con un handoff come per "join"; lì la partita nasce già in corso.
+ * La differenza di punteggio accettata cresce con l'attesa (widen_timer della coda); i giocatori non registrati
+ * valgono RATING_INITIAL, quindi senza "login" si abbina il primo in attesa come prima.
+ * @param client_fd Il file descriptor del client.
+ * @param current_client La struttura Client per il client corrente.
+ * @param rows Righe del tabellone (SIZE per il tris classico).
+ * @param cols Colonne del tabellone.
+ * @param k Simboli in fila necessari per vincere.
+ */
+void handle_queue_command(int client_fd, Client *current_client, int rows, int cols, int k) {
+    if (current_client->game_id != -1) {
+        send_error(client_fd, PROTO_ERR_ALREADY_IN_GAME, "Sei già in una partita. Lasciala prima di entrare in coda.\n");
+        return;
+    }
+    if (current_client->status == PLAYER_QUEUED) {
+        send_error(client_fd, PROTO_ERR_QUEUED, "Sei già in coda. Digita 'leave' per uscire dalla coda.\n");
+        return;
+    }
+    TrisGame variant;
+    if (init_game_variant(&variant, rows, cols, k) < 0) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Variante non valida. Usa: queue <righe> <colonne> <k> (lati da %d a %d, k da %d al lato maggiore) oppure queue gomoku.\n",
+                 MIN_BOARD_SIDE, MAX_BOARD_SIDE, MIN_BOARD_SIDE);
+        send_error(client_fd, PROTO_ERR_INVALID_VARIANT, msg);
+        return;
+    }
+
+    uint16_t key = PROTO_VARIANT(rows, cols, k);
+    int target_shard = key % num_shards;
+    if (target_shard != current_shard->index) {
+        // Lo shard della coda riesegue il comando nella forma testuale, che vale per entrambi i protocolli
+        char command[32];
+        snprintf(command, sizeof(command), "queue %d %d %d", rows, cols, k);
+        handoff_client(current_client, target_shard, command);
+        return;
+    }
+
+    Shard *sh = current_shard;
+    MatchQueue *q = match_queue_of(key);
+    if (!q) {
+        send_error(client_fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+        return;
+    }
+    stop_watching(current_client); // Chi gioca smette di seguire altre partite
+    current_client->queue_variant = key;
+    current_client->queue_rating = ratings_rating(&ratings, current_client->account);
+    current_client->queued_at_ms = sh->now_ms;
+    Client *waiting = find_queue_partner(q, current_client);
+    if (waiting) {
+        queue_unlink(waiting);
+        if (start_matched_game(waiting, current_client, &variant)) {
+            return;
+        }
+        queue_link(q, waiting); // Nessuno slot libero: chi era in coda resta in coda (in fondo all'ordine di arrivo)
+        current_client->queue_variant = 0;
+        send_error(client_fd, PROTO_ERR_MAX_GAMES, "Massimo numero di partite raggiunto. Riprova più tardi.\n");
+        return;
+    }
+
+    queue_link(q, current_client);
+    current_client->status = PLAYER_QUEUED;
+    send_event(client_fd, PROTO_EV_QUEUED, -1, "Sei in coda. La partita inizierà appena arriva un avversario ('leave' per uscire).\n");
+    printf("Client FD %d in coda per la variante %dx%d, %d in fila (shard %d).\n", client_fd, rows, cols, k, sh->index);
+}
+
+/**
+ * @brief Arma il rejoin_timer della partita sulla prima scadenza dei posti ancora tenuti (DETACHED_FD),
+ * o lo annulla se non ne resta nessuno: ogni giocatore ha la propria finestra di rientro.
+ * @param game La partita.
+ */
+void arm_rejoin_timer(Game *game) {
+    Shard *sh = current_shard;
+    uint64_t first = 0;
+    for (int seat = 0; seat < 2; ++seat) {
+        int fd = seat == 0 ? game->owner_fd : game->opponent_fd;
+        if (fd == DETACHED_FD && (first == 0 || game->rejoin_deadline[seat] < first)) {
+            first = game->rejoin_deadline[seat];
+        }
+    }
+    if (first == 0) {
+        timer_cancel(&sh->timers, &game->rejoin_timer);
+    } else {
+        timer_arm(&sh->timers, &game->rejoin_timer, first > sh->now_ms ? first - sh->now_ms : 0);
+    }
+}
+
+/**
+ * @brief Tiene il posto di un giocatore la cui connessione è caduta: il posto diventa DETACHED_FD e il giocatore
+ * può riprenderlo da un'altra connessione con "resume" entro TRIS_REJOIN_TIMEOUT secondi, poi viene liberato
+ * come con "leave". L'avversario resta in partita e viene avvisato. Un posto senza codice di rientro
+ * (richiesta di unione non ancora accettata) o un proprietario con una richiesta in sospeso non vengono tenuti.
+ * @param client Il client che sta per essere rimosso.
+ * @return true se il posto è stato tenuto, false se il client va tolto dalla partita.
+ */
+bool detach_player(Client *client) {
+    Game *game = client->game_id != -1 ? find_game_by_id(client->game_id) : NULL;
+    if (!game) {
+        return false;
+    }
+    int seat = game->owner_fd == client->fd ? 0 : game->opponent_fd == client->fd ? 1 : -1;
+    if (seat < 0 || game->seat_tokens[seat] == 0 || (game->state == GAME_WAITING_FOR_PLAYER && game->opponent_fd >= 0)) {
+        return false;
+    }
+    if (seat == 0) {
+        game->owner_fd = DETACHED_FD;
+        publish_directory_entry(game); // "join" resta rifiutato finché il proprietario non rientra
+    } else {
+        game->opponent_fd = DETACHED_FD;
+    }
+    if (game->state == GAME_IN_PROGRESS && game->tris_game.turn == seat) {
+        timer_cancel(&current_shard->timers, &game->turn_timer); // L'orologio riparte al rientro
+    }
+    game->rejoin_deadline[seat] = current_shard->now_ms + (uint64_t)config.rejoin_timeout * 1000;
+    arm_rejoin_timer(game); // Un secondo distacco non allunga la finestra del primo
+    client->game_id = -1;
+    client->status = PLAYER_CONNECTED;
+
+    int other_fd = seat == 0 ? game->opponent_fd : game->owner_fd;
+    if (other_fd >= 0) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Il tuo avversario si è disconnesso: ha %d secondi per rientrare nella partita.\n", config.rejoin_timeout);
+        send_event(other_fd, PROTO_EV_PLAYER_DETACHED, game->id, msg);
+    }
+    printf("Partita %d: FD %d disconnesso, posto %c tenuto per %d secondi.\n", game->id, client->fd, seat == 0 ? 'X' : 'O', config.rejoin_timeout);
+    return true;
+}
+
+/**
+ * @brief Gestisce il comando "resume": rimette il client nel posto che il suo codice di rientro tiene in una partita,
+ * dopo una disconnessione o un ripristino dal journal. Se il posto è ancora legato a una vecchia connessione
+ * (caduta senza che il server se ne sia accorto, es. un cambio di rete) il codice prevale: la vecchia connessione
+ * viene chiusa. Lo shard della partita è codificato nel codice (codice modulo numero di shard):
+ * se è un altro, il client vi viene trasferito come per "join".
+ * @param client_fd Il file descriptor del client.
  * @param current_client La struttura Client per il client corrente.
- * @param buffer La stringa del comando ricevuto.
+ * @param token Il codice di rientro ricevuto con la partita.
+ */
+void handle_resume_command(int client_fd, Client *current_client, uint64_t token) {
+    if (current_client->game_id != -1) {
+        send_error(client_fd, PROTO_ERR_ALREADY_IN_GAME, "Sei già in una partita. Lasciala prima di rientrare in un'altra.\n");
+        return;
+    }
+    if (current_client->status == PLAYER_QUEUED) {
+        send_error(client_fd, PROTO_ERR_QUEUED, "Sei in coda per una partita. Digita 'leave' per uscire dalla coda.\n");
+        return;
+    }
+    if (token == 0 || (token >> SEAT_TOKEN_BITS) != 0) {
+        send_error(client_fd, PROTO_ERR_RESUME_DENIED, "Codice di rientro non valido.\n");
+        return;
+    }
+    int target_shard = (int)(token % (uint64_t)num_shards);
+    if (target_shard != current_shard->index) {
+        char command[48];
+        snprintf(command, sizeof(command), "resume %llx", (unsigned long long)token);
+        handoff_client(current_client, target_shard, command);
+        return;
+    }
+
+    int pos = seat_find(token);
+    int game_id = pos >= 0 ? current_shard->seat_index[pos].game_id : -1;
+    Game *game = find_game_by_id(game_id);
+    int seat = (game && game->seat_tokens[0] == token) ? 0 : 1;
+    Client *stale = game ? find_client_by_fd(seat == 0 ? game->owner_fd : game->opponent_fd) : NULL;
+    if (stale) {
+        send_event(stale->fd, PROTO_EV_SESSION_REPLACED, game->id, "La tua partita è stata ripresa da un'altra connessione.\n");
+        remove_client(stale->fd); // Il posto diventa DETACHED_FD, oppure viene liberato se non può essere tenuto
+        game = find_game_by_id(game_id);
+    }
+    int *seat_fd = seat == 0 ? (game ? &game->owner_fd : NULL) : (game ? &game->opponent_fd : NULL);
+    if (!game || *seat_fd != DETACHED_FD || game->seat_tokens[seat] != token) {
+        send_error(client_fd, PROTO_ERR_RESUME_DENIED, "Codice di rientro non valido o partita non più disponibile.\n");
+        return;
+    }
+
+    stop_watching(current_client); // Chi gioca smette di seguire altre partite
+    *seat_fd = client_fd;
+    current_client->game_id = game->id;
+    current_client->status = PLAYER_IN_GAME;
+    current_client->player_symbol = seat == 0 ? X : O;
+    current_client->is_current_turn = false; // Assegnato dall'invio dello stato
+    current_client->wants_rematch = false;
+    RatingInfo info;
+    if (ratings_get(&ratings, game->seat_accounts[seat], &info) == 0) {
+        // Il codice di rientro vale come "login": la connessione torna al giocatore registrato del posto
+        current_client->account = info.account;
+        snprintf(current_client->username, sizeof(current_client->username), "%s", info.name);
+    }
+    arm_rejoin_timer(game); // Resta armato solo per l'altro posto, se è ancora tenuto
+    if (seat == 0) {
+        publish_directory_entry(game); // La lista mostra il proprietario con il nuovo socket
+    }
+
+    char msg[BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "Sei rientrato nella partita %d come giocatore %c.\n", game->id, seat == 0 ? 'X' : 'O');
+    send_event(client_fd, PROTO_EV_RESUMED, game->id, msg);
+    int other_fd = seat == 0 ? game->opponent_fd : game->owner_fd;
+    if (other_fd >= 0) {
+        send_event(other_fd, PROTO_EV_PLAYER_RESUMED, game->id, "Il tuo avversario è rientrato nella partita.\n");
+    }
+    printf("Partita %d: FD %d rientrato come %c.\n", game->id, client_fd, seat == 0 ? 'X' : 'O');
+
+    if (current_client->binary) {
+        send_board_cells(current_client, game); // Il nuovo socket non ha visto le mosse precedenti
+    }
+    if (game->state == GAME_IN_PROGRESS) {
+        if (game->bot_level != BOT_NONE && game->tris_game.turn == 1) {
+            play_bot_move(game); // Il bot non aveva ancora risposto all'ultima mossa registrata
+            return;
+        }
+        // Lo stato va solo al socket rientrato: avversario e spettatori hanno già il tabellone. L'orologio della mossa,
+        // fermato al distacco, riparte solo se tocca a questo posto; quello dell'avversario continua a scorrere.
+        bool my_turn = game->tris_game.turn == seat;
+        current_client->is_current_turn = my_turn;
+        if (my_turn) {
+            timer_arm(&current_shard->timers, &game->turn_timer, (uint64_t)config.turn_timeout * 1000);
+        }
+        const BoardMessage *message = seat == 0 ? (my_turn ? &MSG_BOARD_YOUR_TURN_X : &MSG_BOARD_THEIR_TURN_O)
+                                                : (my_turn ? &MSG_BOARD_YOUR_TURN_O : &MSG_BOARD_THEIR_TURN_X);
+        BoardText board_text = { NULL, 0 };
+        send_board_state(client_fd, game, 0, &board_text, message);
+        board_text_release(&board_text);
+        return;
+    }
+    BoardText board_text = { NULL, 0 };
+    if (game->state == GAME_ENDED) {
+        send_board_state(client_fd, game, PROTO_STATE_DRAW, &board_text, &MSG_BOARD_DRAW);
+        send_event(client_fd, PROTO_EV_DRAW, game->id, "Vuoi giocare un'altra partita? Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
+    } else {
+        send_board_state(client_fd, game, 0, &board_text, &MSG_BOARD_WAITING);
+    }
+    board_text_release(&board_text);
+}
+
+/**
+ * @brief Gestisce i dati in ingresso da un client.
+ * @param sd Il file descriptor del client.
+ * @param buffer Il buffer contenente i dati ricevuti.
+ * @param valread Il numero di byte letti.
+ */
+void handle_client_data(int sd, char *buffer, int valread) {
+    buffer[valread] = '\0';
+    // Rimuovi il carattere newline finale se presente
+    buffer[strcspn(buffer, "\n")] = 0;
+
+    Client *current_client = find_client_by_fd(sd);
+    if (!current_client) {
+        send_to_client(sd, "Errore interno del server, client non trovato.\n");
+        return;
+    }
+    // Latenza dell'handler: lo shard non cambia anche se il comando trasferisce o rimuove il client
+    ShardMetrics *shard_metrics = current_shard->metrics;
+    MetricCommand measured = metrics_text_command(buffer);
+    uint64_t started_ns = metrics_clock_ns();
+
+    if (strcmp(buffer, "list") == 0 || strncmp(buffer, "list ", 5) == 0) { // Comando per elencare le partite disponibili
+        LobbyQuery query;
+        if (parse_list_query(buffer + 4, &query)) {
+            print_game_list(sd, &query);
+        } else {
+            send_to_client(sd, "Formato comando 'list' non valido. Usa: list [waiting] [gomoku | <righe> <colonne> <k>] [page <n> | since <versione>].\n");
+        }
+    } else if (strcmp(buffer, "create") == 0) { // Comando per creare una nuova partita
+        handle_create_command(sd, current_client, SIZE, SIZE, SIZE, BOT_NONE);
+    } else if (strcmp(buffer, "create gomoku") == 0) { // Gomoku: 15x15, 5 in fila
+        handle_create_command(sd, current_client, 15, 15, 5, BOT_NONE);
+    } else if (strncmp(buffer, "create bot", 10) == 0 && (buffer[10] == '\0' || buffer[10] == ' ')) { // Partita contro il bot
+        // create bot [facile|medio|difficile] [gomoku | <righe> <colonne> <k>]
+        const char *args = buffer + 10;
+        BotLevel level = BOT_HARD;
+        int rows = SIZE, cols = SIZE, k = SIZE;
+        char word[16];
+        int consumed = 0;
+        if (sscanf(args, " %15s%n", word, &consumed) == 1) {
+            if (strcmp(word, "difficile") == 0 || strcmp(word, "medio") == 0 || strcmp(word, "facile") == 0) {
+                level = word[0] == 'd' ? BOT_HARD : word[0] == 'm' ? BOT_MEDIUM : BOT_EASY;
+                args += consumed;
+            }
+        }
+        consumed = 0;
+        if (sscanf(args, " gomoku%n", &consumed) == 0 && consumed > 0) {
+            rows = 15; cols = 15; k = 5;
+            args += consumed;
+        } else if (sscanf(args, "%d %d %d%n", &rows, &cols, &k, &consumed) == 3) {
+            args += consumed;
+        } else {
+            rows = cols = k = SIZE;
+        }
+        args += strspn(args, " ");
+        if (*args == '\0') {
+            handle_create_command(sd, current_client, rows, cols, k, level);
+        } else {
+            send_to_client(sd, "Formato non valido. Usa: create bot [facile|medio|difficile] [gomoku | <righe> <colonne> <k>].\n");
+        }
+    } else if (strncmp(buffer, "create ", 7) == 0) { // Variante m,n,k: create <righe> <colonne> <k>
+        int rows, cols, k;
+        if (sscanf(buffer, "create %d %d %d", &rows, &cols, &k) != 3) {
+            send_to_client(sd, "Formato comando 'create' non valido. Usa: create, create <righe> <colonne> <k> oppure create gomoku.\n");
+        } else {
+            handle_create_command(sd, current_client, rows, cols, k, BOT_NONE);
+        }
+    } else if (strncmp(buffer, "join ", 5) == 0) { // Comando per unirsi a una partita
+        int game_id_to_join = atoi(buffer + 5); // Estrae l'ID dopo "join "
+        int target_shard = game_id_shard(game_id_to_join);
+        if (target_shard >= 0 && target_shard != current_shard->index && current_client->status == PLAYER_CONNECTED) {
+            // La partita vive in un altro shard: il client vi viene trasferito e il comando rieseguito lì
+            handoff_client(current_client, target_shard, buffer);
+        } else {
+            handle_join_command(sd, current_client, game_id_to_join);
+        }
+    } else if (strcmp(buffer, "queue") == 0) { // Coda di matchmaking per il tris classico
+        handle_queue_command(sd, current_client, SIZE, SIZE, SIZE);
+    } else if (strcmp(buffer, "queue gomoku") == 0) {
+        handle_queue_command(sd, current_client, 15, 15, 5);
+    } else if (strncmp(buffer, "queue ", 6) == 0) { // Coda per una variante m,n,k: queue <righe> <colonne> <k>
+        int rows, cols, k;
+        if (sscanf(buffer, "queue %d %d %d", &rows, &cols, &k) != 3) {
+            send_to_client(sd, "Formato comando 'queue' non valido. Usa: queue, queue <righe> <colonne> <k> oppure queue gomoku.\n");
+        } else {
+            handle_queue_command(sd, current_client, rows, cols, k);
+        }
+    } else if (strncmp(buffer, "watch ", 6) == 0) { // Segui una partita come spettatore
+        int game_id = atoi(buffer + 6);
+        int target_shard = game_id_shard(game_id);
+        if (target_shard >= 0 && target_shard != current_shard->index && current_client->status == PLAYER_CONNECTED) {
+            handoff_client(current_client, target_shard, buffer); // Gli spettatori vivono nello shard della partita
+        } else {
+            handle_watch_command(sd, current_client, game_id);
+        }
+    } else if (strncmp(buffer, "resume ", 7) == 0) { // Rientra in una partita ripristinata dopo un riavvio
+        char *end;
+        unsigned long long token = strtoull(buffer + 7, &end, 16);
+        if (end == buffer + 7 || *end != '\0') {
+            send_to_client(sd, "Formato comando 'resume' non valido. Usa: resume <codice di rientro>.\n");
+        } else {
+            handle_resume_command(sd, current_client, (uint64_t)token);
+        }
+    } else if (strncmp(buffer, "login ", 6) == 0) { // Entra come giocatore registrato (creato se nuovo)
+        handle_login_command(sd, current_client, buffer + 6);
+    } else if (strcmp(buffer, "rating") == 0) { // Punteggio e posizione in classifica
+        handle_rating_command(sd, current_client, NULL);
+    } else if (strncmp(buffer, "rating ", 7) == 0) {
+        handle_rating_command(sd, current_client, buffer + 7);
+    } else if (strcmp(buffer, "top") == 0 || strncmp(buffer, "top ", 4) == 0) { // Primi giocatori della classifica
+        int n = buffer[3] ? atoi(buffer + 4) : 10;
+        handle_top_command(sd, n > 0 ? n : 10);
+    } else if (strncmp(buffer, "replay ", 7) == 0) { // Rivedi un round concluso
+        char *end;
+        long replay_id = strtol(buffer + 7, &end, 10);
+        if (end == buffer + 7 || *end != '\0' || replay_id < 0 || replay_id > INT32_MAX) {
+            send_to_client(sd, "Formato comando 'replay' non valido. Usa: replay <id del replay>.\n");
+        } else {
+            handle_replay_command(sd, current_client, (int)replay_id);
+        }
+    } else if (strcmp(buffer, "replays player") == 0) { // Elenca i replay del giocatore della connessione
+        handle_player_replays_command(sd, current_client, NULL);
+    } else if (strncmp(buffer, "replays player ", 15) == 0) { // Elenca i replay di un giocatore registrato
+        handle_player_replays_command(sd, current_client, buffer + 15);
+    } else if (strncmp(buffer, "replays ", 8) == 0) { // Elenca i replay di una partita
+        handle_replays_command(sd, current_client, atoi(buffer + 8));
+    } else if (strcmp(buffer, "unwatch") == 0) { // Smetti di seguire la partita
+        if (current_client->watch_game_id == -1) {
+            send_error(sd, PROTO_ERR_NOT_WATCHING, "Non stai seguendo nessuna partita.\n");
+        } else {
+            stop_watching(current_client);
+            send_event(sd, PROTO_EV_UNWATCHED, -1, "Non segui più la partita.\n");
+        }
+    } else if (strcmp(buffer, "accept") == 0) { // Comando per accettare una richiesta di unione a una partita
+        handle_accept_command(sd, current_client);
+    } else if (strcmp(buffer, "reject") == 0) { // Comando per rifiutare una richiesta di unione a una partita
+        handle_reject_command(sd, current_client);
+    } else if (strcmp(buffer, "leave") == 0) { // Comando per lasciare una partita
+        handle_leave_command(sd, current_client);
+    } else if (strncmp(buffer, "move ", 5) == 0) { // Comando per effettuare una mossa
+        int row, col;
+        // Controlla se il comando è nel formato corretto
+        if (sscanf(buffer, "move %d %d", &row, &col) != 2) {
+            send_to_client(sd, "Formato comando 'move' non valido. Usa: move <riga> <colonna> (es. move 0 0).\n");
+        } else {
+            handle_move_command(sd, row, col);
+        }
+    } else if (strcmp(buffer, "rematch") == 0) { // Comando per richiedere una rivincita
+        handle_rematch_command(sd); // Chiamata corretta con 1 argomento
+    } else if (strcmp(buffer, "hint") == 0) { // Suggerimento della mossa migliore
+        handle_hint_command(sd);
+    } else if (strcmp(buffer, "quit") == 0) { // Comando per uscire dal server
+        send_event(sd, PROTO_EV_BYE, -1, "Arrivederci!\n");
+        remove_client_from_game(sd); // Uscita voluta: il posto in partita non resta tenuto
+        remove_client(sd); // Rimuovi il client completamente
+    } else if (strcmp(buffer, "binary") == 0) { // Passaggio al protocollo binario (frame di lunghezza fissa)
+        current_client->binary = true;
+        ProtoFrame hello = { PROTO_OP_HELLO, PROTO_VERSION, 0, 0 };
+        send_frame(sd, &hello);
+        printf("Client FD %d passato al protocollo binario.\n", sd);
+    } else if (strcmp(buffer, "stats") == 0) { // Metriche del server (solo da connessioni locali)
+        handle_stats_command(sd);
+    } else {
+        send_to_client(sd, "Digita <create> per creare una stanza, <join> per unirti, <queue> per trovare subito un avversario, <accept> per accettare una richiesta, <reject> per rifiutare una richiesta, <leave> per disconetterti dalla partita, <move> <riga> <colonna> per fare la tua mossa, <hint> per un suggerimento, <rematch> per la rivincita, "
+                           "<list> [waiting] [gomoku | <righe> <colonne> <k>] [page <n> | since <versione>] per elencare le partite, <watch> <id> per seguire una partita e <unwatch> per smettere, <resume> <codice> per rientrare nella tua partita, "
+                           "<login> <nome> per entrare come giocatore registrato, <rating> [nome] per il punteggio, <top> [n] per la classifica, <replays> <id> o <replays> player [nome] per elencare i replay e <replay> <id> per rivederne uno, "
+                           "<stats> per le metriche del server (solo in locale), <quit> per uscire dal gioco, <binary> per passare al protocollo binario.\n"); // Potresti aggiungere un comando 'help'
+    }
+    metrics_observe_command(shard_metrics, measured, metrics_clock_ns() - started_ns);
+}
+
+/**
+ * @brief Gestisce un frame del protocollo binario: chiama gli stessi gestori dei comandi testuali.
+ * @param client Il client che ha inviato il frame.
+ * @param frame Il frame decodificato.
+ */
+void handle_client_frame(Client *client, const ProtoFrame *frame) {
+    int sd = client->fd;
+    ShardMetrics *shard_metrics = current_shard->metrics;
+    uint64_t started_ns = metrics_clock_ns();
+    switch (frame->op) {
+        case PROTO_OP_LIST: {
+            LobbyQuery query = { (frame->code & PROTO_LIST_WAITING) != 0, -1, 0, (frame->code & PROTO_LIST_SINCE) != 0, frame->arg };
+            if (frame->aux != 0) {
+                TrisGame variant;
+                int rows = PROTO_VARIANT_ROWS(frame->aux), cols = PROTO_VARIANT_COLS(frame->aux), k = PROTO_VARIANT_K(frame->aux);
+                if (init_game_variant(&variant, rows, cols, k) < 0) {
+                    send_error(sd, PROTO_ERR_INVALID_VARIANT, "Variante non valida.\n");
+                    break;
+                }
+                query.variant = is_classic_game(&variant) ? 0 : frame->aux;
+            }
+            if (!query.delta) {
+                query.page = frame->arg > INT32_MAX ? INT32_MAX : (int)frame->arg;
+            }
+            print_game_list(sd, &query);
+            break;
+        }
+        case PROTO_OP_CREATE:
+            if (frame->code > BOT_HARD) {
+                send_error(sd, PROTO_ERR_INVALID_VARIANT, "Livello del bot non valido.\n");
+            } else if (frame->aux == 0) {
+                handle_create_command(sd, client, SIZE, SIZE, SIZE, (BotLevel)frame->code);
+            } else {
+                handle_create_command(sd, client, PROTO_VARIANT_ROWS(frame->aux), PROTO_VARIANT_COLS(frame->aux), PROTO_VARIANT_K(frame->aux),
+                                      (BotLevel)frame->code);
+            }
+            break;
+        case PROTO_OP_JOIN: {
+            int game_id_to_join = (int)frame->arg;
+            int target_shard = game_id_shard(game_id_to_join);
+            if (target_shard >= 0 && target_shard != current_shard->index && client->status == PLAYER_CONNECTED) {
+                // Lo shard destinatario riesegue il comando nella forma testuale, che vale per entrambi i protocolli
+                char command[32];
+                snprintf(command, sizeof(command), "join %d", game_id_to_join);
+                handoff_client(client, target_shard, command);
+            } else {
+                handle_join_command(sd, client, game_id_to_join);
+            }
+            break;
+        }
+        case PROTO_OP_QUEUE:
+            if (frame->aux == 0) {
+                handle_queue_command(sd, client, SIZE, SIZE, SIZE);
+            } else {
+                handle_queue_command(sd, client, PROTO_VARIANT_ROWS(frame->aux), PROTO_VARIANT_COLS(frame->aux), PROTO_VARIANT_K(frame->aux));
+            }
+            break;
+        case PROTO_OP_WATCH: {
+            int game_id = (int)frame->arg;
+            int target_shard = game_id_shard(game_id);
+            if (target_shard >= 0 && target_shard != current_shard->index && client->status == PLAYER_CONNECTED) {
+                char command[32];
+                snprintf(command, sizeof(command), "watch %d", game_id);
+                handoff_client(client, target_shard, command);
+            } else {
+                handle_watch_command(sd, client, game_id);
+            }
+            break;
+        }
+        case PROTO_OP_RESUME:
+            handle_resume_command(sd, client, ((uint64_t)frame->code << 48) | ((uint64_t)frame->aux << 32) | frame->arg);
+            break;
+        case PROTO_OP_RATING:
+            handle_rating_command(sd, client, NULL);
+            break;
+        case PROTO_OP_REPLAY:
+            handle_replay_command(sd, client, frame->arg > INT32_MAX ? -1 : (int)frame->arg);
+            break;
+        case PROTO_OP_REPLAYS:
+            if (frame->code == PROTO_REPLAYS_PLAYER) {
+                handle_player_replays_command(sd, client, NULL);
+            } else {
+                handle_replays_command(sd, client, frame->arg > INT32_MAX ? -1 : (int)frame->arg);
+            }
+            break;
+        case PROTO_OP_UNWATCH:
+            if (client->watch_game_id == -1) {
+                send_error(sd, PROTO_ERR_NOT_WATCHING, "Non stai seguendo nessuna partita.\n");
+            } else {
+                stop_watching(client);
+                send_event(sd, PROTO_EV_UNWATCHED, -1, "Non segui più la partita.\n");
+            }
+            break;
+        case PROTO_OP_ACCEPT:
+            handle_accept_command(sd, client);
+            break;
+        case PROTO_OP_REJECT:
+            handle_reject_command(sd, client);
+            break;
+        case PROTO_OP_LEAVE:
+            handle_leave_command(sd, client);
+            break;
+        case PROTO_OP_MOVE:
+            handle_move_command(sd, frame->code, frame->aux);
+            break;
+        case PROTO_OP_REMATCH:
+            handle_rematch_command(sd);
+            break;
+        case PROTO_OP_HINT:
+            handle_hint_command(sd);
+            break;
+        case PROTO_OP_QUIT:
+            send_event(sd, PROTO_EV_BYE, -1, "Arrivederci!\n");
+            remove_client_from_game(sd);
+            remove_client(sd);
+            break;
+        default:
+            send_error(sd, PROTO_ERR_UNKNOWN_COMMAND, "Comando sconosciuto.\n");
+            break;
+    }
+    metrics_observe_command(shard_metrics, metrics_frame_command(frame->op), metrics_clock_ns() - started_ns);
+}
+
+/**
+ * @brief Registra il socket di un client nell'epoll dello shard corrente, o vi arma la recv multishot di io_uring.
+ * L'evento porta con sé il fd, che indicizza direttamente la tabella dei client dello shard.
+ * @param fd Il file descriptor del client.
+ * @return true in caso di successo.
+ */
+bool register_client_fd(int fd) {
+    Shard *sh = current_shard;
+    if (sh->io_uring) {
+        // Una recv multishot resta attiva per tutta la connessione: i dati arrivano come completion, senza read()
+        struct io_uring_sqe *sqe = shard_sqe(sh);
+        if (!sqe) {
+            fprintf(stderr, "Shard %d: coda di submission io_uring piena, FD %d non registrato\n", sh->index, fd);
+            return false;
+        }
+        uring_prep_recv_multishot(sqe, fd, IO_USER_DATA(IO_OP_RECV, fd));
+        return true;
+    }
+    struct epoll_event ev;
+    // Con edge-triggered EPOLLOUT scatta solo quando il socket torna scrivibile: nessun costo se la coda è vuota
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Copia dati ricevuti in fondo al buffer circolare di input di un client.
+ * @return I byte copiati: quelli che non stanno nello spazio libero vengono scartati.
+ */
+static uint32_t append_client_input(Client *client, const char *data, uint32_t len) {
+    uint32_t free_space = INPUT_BUFFER_SIZE - (client->in_tail - client->in_head);
+    if (len > free_space) {
+        len = free_space;
+    }
+    uint32_t offset = client->in_tail & INPUT_BUFFER_MASK;
+    uint32_t first = len < INPUT_BUFFER_SIZE - offset ? len : INPUT_BUFFER_SIZE - offset;
+    memcpy(client->in_buf + offset, data, first);
+    memcpy(client->in_buf, data + first, len - first);
+    client->in_tail += len;
+    return len;
+}
+
+/**
+ * @brief Toglie il socket di un client dagli eventi dello shard corrente, prima di chiuderlo o trasferirlo.
+ * Con io_uring le operazioni in corso sul socket vengono annullate in modo sincrono; delle completion raccolte
+ * e non ancora elaborate, i dati ricevuti passano nel buffer di input del client (in un trasferimento
+ * viaggiano con lui) e l'esito di una writev viene applicato alla coda di output.
+ * @param fd Il file descriptor del client.
+ * @return false se parte dei dati ricevuti non stava nel buffer di input ed è andata persa.
+ */
+bool unregister_client_fd(int fd) {
+    Shard *sh = current_shard;
+    if (!sh->io_uring) {
+        epoll_ctl(sh->epoll_fd, EPOLL_CTL_DEL, fd, NULL); // I dati non letti restano nel socket
+        return true;
+    }
+    bool complete = true;
+    int err = uring_cancel_fd(&sh->ring, fd);
+    if (err < 0) {
+        fprintf(stderr, "Shard %d: annullamento delle operazioni io_uring di FD %d non riuscito: %s\n", sh->index, fd, strerror(-err));
+    }
+    uring_harvest(&sh->ring);
+    Client *client = find_client_by_fd(fd);
+    for (unsigned i = sh->ring.event_pos; i < sh->ring.event_count; i++) {
+        UringEvent *event = &sh->ring.events[i];
+        IoOp op = (IoOp)(event->user_data >> 32);
+        if (event->user_data == URING_EVENT_NONE || (int)(uint32_t)event->user_data != fd ||
+            (op != IO_OP_RECV && op != IO_OP_WRITE && op != IO_OP_POLLOUT)) {
+            continue;
+        }
+        if (op == IO_OP_WRITE) {
+            sh->writes_inflight--;
+            if (client && client->write_pending && event->res > 0) {
+                consume_client_output(client, (size_t)event->res);
+            }
+        } else if (op == IO_OP_RECV && client && event->res > 0) {
+            // Qui non si eseguono comandi: quello che non sta nello spazio libero è perso, e il chiamante lo sa
+            if (append_client_input(client, uring_buffer(&sh->ring, event->flags), (uint32_t)event->res) < (uint32_t)event->res) {
+                complete = false;
+            }
+            METRICS_ADD(sh->metrics->bytes_in, event->res);
+        }
+        uring_recycle_buffer(&sh->ring, event->flags);
+        event->user_data = URING_EVENT_NONE;
+    }
+    if (client) {
+        client->write_pending = false;
+        client->write_blocked = false;
+    }
+    return complete;
+}
+
+/**
+ * @brief Prepara una connessione appena accettata e la registra nello shard corrente.
+ * @param new_socket Il socket del client (non bloccante).
+ */
+static void accept_client(int new_socket) {
+    METRICS_ADD(current_shard->metrics->accepted, 1);
+    // Le risposte di un giro partono già insieme con una sola writev(): Nagle le tratterrebbe solo in attesa
+    // dell'ACK (ritardato) della precedente, aggiungendo fino a 40 ms a ogni risposta che la segue
+    int nodelay = 1;
+    setsockopt(new_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    Client *client = initialize_client(new_socket); // Inizializza la struttura client
+    if (!client) {
+        return; // Server pieno, il socket è già stato chiuso
+    }
+    if (!register_client_fd(new_socket)) {
+        remove_client(new_socket);
+    }
+}
+
+/**
+ * @brief Accetta tutte le connessioni pendenti sul socket master.
+ * Con epoll edge-triggered la notifica arriva una sola volta, quindi si accetta fino a EAGAIN.
+ * Il listener è condiviso: ogni connessione appartiene allo shard che la accetta.
+ * @param master_socket Il socket in ascolto (non bloccante).
+ */
+void handle_new_connections(int master_socket) {
+    while (true) {
+        struct sockaddr_in address; // Indirizzo del client che si connette
+        socklen_t addrlen = sizeof(address);
+        int new_socket = accept4(master_socket, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK);
+        if (new_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return; // Coda delle connessioni svuotata (o errore transitorio)
+        }
+        printf("Nuova connessione, socket fd è %d, ip è : %s, porta : %d\n", new_socket, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+        accept_client(new_socket);
+    }
+}
+
+/**
+ * @brief Estrae dal buffer circolare del client ogni comando completo (terminato da '\n') e lo esegue.
+ * Una riga incompleta resta nel buffer in attesa del resto; una riga più lunga di MAX_LINE_LENGTH
+ * viene scartata fino al '\n' successivo.
+ * @param client Il client di cui elaborare l'input.
+ * @return true se il client è ancora gestito da questo shard, false se è stato rimosso o trasferito.
+ */
+bool process_client_input(Client *client) {
+    int sd = client->fd;
+    char line[MAX_LINE_LENGTH + 1]; // Copia lineare del comando (il buffer circolare può spezzarlo)
+
+    while (true) {
+        if (client->binary) {
+            // Protocollo binario: si consumano frame di lunghezza fissa, senza cercare separatori
+            if (client->in_tail - client->in_head < PROTO_FRAME_SIZE) {
+                client->in_scan = client->in_head;
+                return true;
+            }
+            uint8_t wire[PROTO_FRAME_SIZE];
+            for (int i = 0; i < PROTO_FRAME_SIZE; i++) {
+                wire[i] = (uint8_t)client->in_buf[(client->in_head + (uint32_t)i) & INPUT_BUFFER_MASK];
+            }
+            client->in_head = client->in_scan = client->in_head + PROTO_FRAME_SIZE;
+            ProtoFrame frame;
+            proto_decode(wire, &frame);
+            handle_client_frame(client, &frame);
+            if (find_client_by_fd(sd) != client) {
+                return false;
+            }
+            continue;
+        }
+
+        // Cerca il '\n' a partire da dove si era arrivati, al più in due segmenti contigui
+        uint32_t newline = client->in_tail;
+        while (client->in_scan != client->in_tail) {
+            uint32_t offset = client->in_scan & INPUT_BUFFER_MASK;
+            uint32_t chunk = client->in_tail - client->in_scan;
+            if (chunk > INPUT_BUFFER_SIZE - offset) {
+                chunk = INPUT_BUFFER_SIZE - offset;
+            }
+            char *found = memchr(client->in_buf + offset, '\n', chunk);
+            if (found) {
+                newline = client->in_scan + (uint32_t)(found - (client->in_buf + offset));
+                break;
+            }
+            client->in_scan += chunk;
+        }
+
+        uint32_t length = newline - client->in_head;
+        if (newline == client->in_tail) {
+            // Nessuna riga completa: se quella parziale è già troppo lunga la si scarta
+            if (!client->in_discarding && length > MAX_LINE_LENGTH) {
+                send_to_client(sd, "Comando troppo lungo, ignorato.\n");
+                client->in_discarding = true;
+            }
+            if (client->in_discarding) {
+                client->in_head = client->in_scan = client->in_tail;
+            }
+            return true;
+        }
+
+        // Consuma la riga (separatore incluso) prima di eseguirla
+        client->in_head = client->in_scan = newline + 1;
+        if (client->in_discarding) {
+            client->in_discarding = false; // Fine della riga troppo lunga
+            continue;
+        }
+        if (length > MAX_LINE_LENGTH) {
+            send_to_client(sd, "Comando troppo lungo, ignorato.\n");
+            continue;
+        }
+        uint32_t start = (newline - length) & INPUT_BUFFER_MASK;
+        uint32_t first = length < INPUT_BUFFER_SIZE - start ? length : INPUT_BUFFER_SIZE - start;
+        memcpy(line, client->in_buf + start, first);
+        memcpy(line + first, client->in_buf, length - first);
+        if (length > 0 && line[length - 1] == '\r') {
+            length--; // Tollera i terminatori "\r\n" (es. telnet)
+        }
+
+        handle_client_data(sd, line, (int)length);
+        // Il client può essere rimosso (es. "quit") o trasferito a un altro shard (es. "join") dal comando:
+        // in quel caso non va più toccato, il resto del suo input lo elabora il nuovo proprietario
+        if (find_client_by_fd(sd) != client) {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Legge tutti i dati disponibili sul socket di un client (fino a EAGAIN) nel suo buffer circolare
+ * ed esegue ogni comando completo, anche se più comandi arrivano nello stesso segmento.
+ * @param client Il client segnalato come leggibile da epoll.
  */
-void handle_join_command(int client_fd, Client *current_client, const char *buffer) {
-    // Controlla se il client è già in una partita
-    if (current_client->game_id != -1) {
-        send_to_client(client_fd, "Sei già in una partita. Lasciala prima di unirti a una nuova.\n");
+void handle_client_readable(Client *client) {
+    int sd = client->fd;
+
+    while (true) {
+        // Spazio libero nel buffer circolare, al più in due segmenti (fino alla fine e dall'inizio)
+        uint32_t used = client->in_tail - client->in_head;
+        uint32_t offset = client->in_tail & INPUT_BUFFER_MASK;
+        uint32_t free_space = INPUT_BUFFER_SIZE - used;
+        struct iovec iov[2];
+        int iovcnt = 1;
+        iov[0].iov_base = client->in_buf + offset;
+        iov[0].iov_len = free_space < INPUT_BUFFER_SIZE - offset ? free_space : INPUT_BUFFER_SIZE - offset;
+        if (iov[0].iov_len < free_space) {
+            iov[1].iov_base = client->in_buf;
+            iov[1].iov_len = free_space - iov[0].iov_len;
+            iovcnt = 2;
+        }
+
+        ssize_t valread = readv(sd, iov, iovcnt);
+        if (valread > 0) {
+            // C'è del dato dal client: si eseguono tutti i comandi completi
+            client->in_tail += (uint32_t)valread;
+            METRICS_ADD(current_shard->metrics->bytes_in, valread);
+            client->last_activity_ms = current_shard->now_ms; // Il timer di inattività se ne accorgerà alla scadenza
+            if (!process_client_input(client)) {
+                return;
+            }
+        } else if (valread == 0) {
+            // Client disconnesso
+            printf("Host disconnesso, fd %d\n", sd);
+            remove_client(sd); // Rimuovi il client
+            return;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("read");
+                remove_client(sd);
+            }
+            return; // Nessun altro dato disponibile
+        }
+    }
+}
+
+/**
+ * @brief Arma la accept multishot sul listener condiviso: una completion per ogni connessione accettata.
+ * @param sh Lo shard.
+ */
+static void arm_uring_accept(Shard *sh) {
+    struct io_uring_sqe *sqe = shard_sqe(sh);
+    if (!sqe) {
+        timer_arm(&sh->timers, &sh->accept_timer, URING_ACCEPT_RETRY_MS);
         return;
     }
+    uring_prep_accept_multishot(sqe, listen_fd, SOCK_NONBLOCK, IO_USER_DATA(IO_OP_ACCEPT, listen_fd));
+}
 
-    int game_id_to_join = atoi(buffer + 5); // Estrae l'ID dopo "join "
-    Game *game = find_game_by_id(game_id_to_join);
-    
-    // Controlla se la partita esiste e se è in uno stato valido per unirsi
-    if (!game || game->id == -1) {
-        send_to_client(client_fd, "Partita non trovata o ID non valido.\n");
-        // La partita è già in corso o ha un avversario
-    } else if (game->state == GAME_IN_PROGRESS || game->state == GAME_ENDED || game->opponent_fd != -1) { 
-        send_to_client(client_fd, "La partita è già in corso, terminata o ha già un avversario.\n");
-        // Il client è il proprietario della partita
-    } else if (game->owner_fd == client_fd) { 
-        send_to_client(client_fd, "Non puoi unirti alla tua stessa partita. Sei già il proprietario.\n");
-        // La partita è in attesa di un avversario
-    } else { 
-        // Il client richiede di unirsi
-        game->opponent_fd = client_fd; // Imposta il file descriptor del client come avversario
-        current_client->game_id = game->id; // Associa il client alla partita
-        current_client->status = PLAYER_WAITING_ACCEPT; // Stato in attesa di accettazione
-        current_client->player_symbol = O; // L'avversario è sempre O
-        current_client->is_current_turn = false; // Non è il turno del nuovo giocatore
-        current_client->wants_rematch = false; // Resetta la richiesta di rivincita
-        
-        // Invia un messaggio di conferma al client
-        send_to_client(client_fd, "Richiesta inviata. In attesa di accettazione dal proprietario della partita...\n");
-        char msg_owner[BUFFER_SIZE];
-        snprintf(msg_owner, sizeof(msg_owner), "Il giocatore FD %d vuole unirsi alla tua partita %d. Digita 'accept' o 'reject'.\n", client_fd, game->id);
-        send_to_client(game->owner_fd, msg_owner);
-        printf("FD %d ha richiesto di unirsi alla partita %d.\n", client_fd, game->id);
+/**
+ * @brief Arma un poll multishot su un fd interno dello shard (eventfd o socket UNIX).
+ * @param sh Lo shard.
+ * @param fd Il file descriptor.
+ * @param op IO_OP_WAKE o IO_OP_IPC.
+ */
+static void arm_uring_poll(Shard *sh, int fd, IoOp op) {
+    struct io_uring_sqe *sqe = shard_sqe(sh);
+    if (!sqe) {
+        fprintf(stderr, "Shard %d: coda di submission io_uring piena, poll su FD %d non armato\n", sh->index, fd);
+        return;
     }
+    uring_prep_poll(sqe, fd, POLLIN, true, IO_USER_DATA(op, fd));
 }
 
 /**
- * @brief Gestisce il comando "accept".
- * @param client_fd Il file descriptor del client.
- * @param current_client La struttura Client per il client corrente.
+ * @brief Scadenza della pausa dopo un errore della accept: la si riarma.
+ * @param timer L'accept_timer dello shard.
  */
-void handle_accept_command(int client_fd, Client *current_client) {
-    Game *game = find_game_by_player_fd(client_fd); // Trova la partita a cui il client appartiene
-    // Controlla se il client è il proprietario della partita e se è in attesa di un avversario
-    if (!game || game->owner_fd != client_fd) {
-        send_to_client(client_fd, "Questo comando è solo per i proprietari di partita in attesa di un avversario.\n");
+void accept_timer_retry(TimerNode *timer) {
+    arm_uring_accept(TIMER_CONTAINER(timer, Shard, accept_timer));
+}
+
+/**
+ * @brief Completion della accept multishot: una nuova connessione o un errore.
+ * @param event La completion.
+ */
+static void handle_uring_accept(const UringEvent *event) {
+    Shard *sh = current_shard;
+    if (event->res >= 0) {
+        // Una accept multishot non riceve l'indirizzo del client: si registra solo il fd
+        printf("Nuova connessione, socket fd è %d\n", event->res);
+        accept_client(event->res);
+    } else if (event->res != -ECANCELED) {
+        fprintf(stderr, "accept: %s\n", strerror(-event->res));
+    }
+    if (!(event->flags & IORING_CQE_F_MORE)) {
+        // La multishot è terminata: subito se ha solo esaurito la coda, dopo una pausa se è in errore (es. EMFILE)
+        if (event->res >= 0) {
+            arm_uring_accept(sh);
+        } else {
+            timer_arm(&sh->timers, &sh->accept_timer, URING_ACCEPT_RETRY_MS);
+        }
+    }
+}
+
+/**
+ * @brief Completion della recv multishot di un client: i dati sono nel buffer fornito indicato dalla completion.
+ * Vengono copiati nel buffer circolare di input (il buffer fornito torna subito al kernel) ed eseguiti
+ * come con epoll; una recv terminata (buffer forniti esauriti o coda di completion piena) viene riarmata.
+ * @param event La completion.
+ */
+static void handle_uring_recv(const UringEvent *event) {
+    Shard *sh = current_shard;
+    int fd = (int)(uint32_t)event->user_data;
+    Client *client = find_client_by_fd(fd);
+    if (!client || event->res == -ECANCELED) {
+        uring_recycle_buffer(&sh->ring, event->flags); // Client rimosso o trasferito: la recv era già annullata
         return;
     }
-    // Controlla se la partita è in attesa di un avversario
-    if (game->state != GAME_WAITING_FOR_PLAYER || game->opponent_fd == -1) {
-        send_to_client(client_fd, "Nessun giocatore in attesa di accettazione o la partita non è in stato di attesa.\n");
+    if (event->res > 0) {
+        append_client_input(client, uring_buffer(&sh->ring, event->flags), (uint32_t)event->res);
+        uring_recycle_buffer(&sh->ring, event->flags);
+        METRICS_ADD(sh->metrics->bytes_in, event->res);
+        client->last_activity_ms = sh->now_ms; // Il timer di inattività se ne accorgerà alla scadenza
+        if (!process_client_input(client)) {
+            return; // Rimosso o trasferito: la sua recv è stata annullata
+        }
+    } else if (event->res == 0) {
+        printf("Host disconnesso, fd %d\n", fd);
+        remove_client(fd);
         return;
+    } else if (event->res != -ENOBUFS) {
+        fprintf(stderr, "recv: %s\n", strerror(-event->res));
+        remove_client(fd);
+        return;
+    }
+    if (!(event->flags & IORING_CQE_F_MORE) && !register_client_fd(fd)) {
+        remove_client(fd);
     }
+}
 
-    game->state = GAME_IN_PROGRESS; // Imposta lo stato della partita come in corso
-    Client *opponent_client = find_client_by_fd(game->opponent_fd); // Trova il client avversario
-    // Controlla se l'avversario è valido
-    if (opponent_client) {
-        opponent_client->status = PLAYER_IN_GAME;
-        current_client->is_current_turn = true; // X (owner) inizia
-        opponent_client->is_current_turn = false;
+/**
+ * @brief Completion della writev di un client: consuma i byte scritti e, se ne restano, la ripete a fine giro.
+ * Con il socket pieno (i socket sono non bloccanti: EAGAIN arriva subito) si attende POLLOUT.
+ * @param event La completion.
+ */
+static void handle_uring_write(const UringEvent *event) {
+    Shard *sh = current_shard;
+    int fd = (int)(uint32_t)event->user_data;
+    sh->writes_inflight--;
+    Client *client = find_client_by_fd(fd);
+    if (!client || !client->write_pending) {
+        return; // Client rimosso o trasferito: l'esito è già stato applicato all'annullamento
     }
-    // Imposta lo stato del gioco per entrambi i giocatori
-    send_to_client(client_fd, "Hai accettato il giocatore. La partita è iniziata!\n");
-    // Invia un messaggio all'avversario
-    if (game->opponent_fd != -1) { // Invia all'opponente solo se valido
-        send_to_client(game->opponent_fd, "La tua richiesta è stata accettata. La partita è iniziata!\n");
+    client->write_pending = false;
+    if (event->res >= 0) {
+        consume_client_output(client, (size_t)event->res);
+    } else if (event->res == -EAGAIN) {
+        METRICS_ADD(sh->metrics->output_backlogged, 1);
+        struct io_uring_sqe *sqe = shard_sqe(sh);
+        if (sqe) {
+            uring_prep_poll(sqe, fd, POLLOUT, false, IO_USER_DATA(IO_OP_POLLOUT, fd));
+            client->write_blocked = true;
+            return;
+        }
+    } else if (event->res != -EINTR) {
+        fprintf(stderr, "writev: %s\n", strerror(-event->res));
+        remove_client(fd);
+        return;
     }
+    if (client->out_count > 0) {
+        mark_client_dirty(client); // Scrittura parziale o nuovo output accodato nel frattempo
+    }
+}
 
-    send_game_state_to_players(game); // Invia lo stato iniziale del gioco
+/**
+ * @brief Elabora le completion raccolte dall'anello io_uring dello shard corrente, nell'ordine di arrivo.
+ */
+static void handle_uring_events(void) {
+    Shard *sh = current_shard;
+    UringEvent event;
+    while (uring_next_event(&sh->ring, &event)) {
+        int fd = (int)(uint32_t)event.user_data;
+        switch ((IoOp)(event.user_data >> 32)) {
+        case IO_OP_ACCEPT:
+            handle_uring_accept(&event);
+            break;
+        case IO_OP_RECV:
+            handle_uring_recv(&event);
+            break;
+        case IO_OP_WRITE:
+            handle_uring_write(&event);
+            break;
+        case IO_OP_POLLOUT: {
+            Client *client = find_client_by_fd(fd);
+            if (client && client->write_blocked) {
+                client->write_blocked = false; // Socket di nuovo scrivibile: la writev riparte a fine giro
+                if (client->out_count > 0) {
+                    mark_client_dirty(client);
+                }
+            }
+            break;
+        }
+        case IO_OP_WAKE:
+            // Messaggi da altri shard dello stesso worker
+            drain_shard_inbox();
+            if (!(event.flags & IORING_CQE_F_MORE)) {
+                arm_uring_poll(sh, fd, IO_OP_WAKE);
+            }
+            break;
+        case IO_OP_IPC:
+            // Pacchetti da shard di altri worker
+            drain_shard_ipc();
+            if (!(event.flags & IORING_CQE_F_MORE)) {
+                arm_uring_poll(sh, fd, IO_OP_IPC);
+            }
+            break;
+        case IO_OP_IPC_OUT:
+            // Socket UNIX verso un altro worker di nuovo scrivibile (fd è l'indice dello shard destinatario)
+            sh->ipc_outbox[fd].watching = false;
+            flush_ipc_outbox(sh, fd);
+            if (sh->ipc_outbox[fd].head) {
+                watch_ipc_outbox(sh, fd);
+            }
+            break;
+        }
+    }
+}
 
-    printf("Partita %d: Il proprietario (FD %d) ha accettato FD %d. Stato: IN_PROGRESS.\n", game->id, client_fd, game->opponent_fd);
+/**
+ * @brief Prepara lo shard corrente a ricevere eventi da io_uring: poll sui fd interni e accept sul listener.
+ * Gli SQE vengono armati dal thread dello shard, che li invierà con la sua prima attesa.
+ */
+static void start_uring_shard(void) {
+    Shard *sh = current_shard;
+    timer_init(&sh->accept_timer, accept_timer_retry);
+    arm_uring_poll(sh, sh->wake_fd, IO_OP_WAKE);
+    arm_uring_poll(sh, sh->ipc_fd, IO_OP_IPC);
+    arm_uring_accept(sh);
 }
 
+// --- Implementazioni delle Funzioni dei Timer ---
+
 /**
- * @brief Gestisce il comando "reject".
- * @param client_fd Il file descriptor del client.
- * @param current_client La struttura Client per il client corrente.
+ * @brief Scadenza del turno: il giocatore che doveva muovere lascia la partita, come con "leave".
+ * L'avversario riceve la stessa notifica di un abbandono.
+ * @param timer Il turn_timer della partita.
  */
-void handle_reject_command(int client_fd, Client *current_client) {
-    Game *game = find_game_by_player_fd(client_fd);
-    // Controlla se il client è il proprietario della partita e se è in attesa di un avversario
-    if (!game || game->owner_fd != client_fd) {
-        send_to_client(client_fd, "Questo comando è solo per i proprietari di partita in attesa di un avversario.\n");
+void turn_timer_expired(TimerNode *timer) {
+    Game *game = TIMER_CONTAINER(timer, Game, turn_timer);
+    if (game->state != GAME_IN_PROGRESS) {
         return;
     }
-    // Controlla se la partita è in attesa di un avversario
-    if (game->state != GAME_WAITING_FOR_PLAYER || game->opponent_fd == -1) {
-        send_to_client(client_fd, "Nessun giocatore in attesa di rifiuto o la partita non è in stato di attesa.\n");
+    int idle_fd = game->tris_game.turn == 0 ? game->owner_fd : game->opponent_fd;
+    if (idle_fd < 0) {
         return;
     }
+    printf("Partita %d: FD %d non ha mosso entro %d secondi.\n", game->id, idle_fd, config.turn_timeout);
+    send_event(idle_fd, PROTO_EV_TURN_TIMEOUT, game->id, "Tempo scaduto: non hai mosso in tempo e hai lasciato la partita.\n");
+    remove_client_from_game(idle_fd);
+}
 
-    Client *opponent_client = find_client_by_fd(game->opponent_fd); // Trova il client avversario
-    // Controlla se l'avversario è valido
-    if (opponent_client) {
-        send_to_client(opponent_client->fd, "La tua richiesta di unirti alla partita è stata rifiutata.\n");
-        opponent_client->game_id = -1; // Resetta lo stato del client avversario
-        opponent_client->status = PLAYER_CONNECTED; // Resetta lo stato del client avversario
-        opponent_client->player_symbol = EMPTY; // Resetta il simbolo del client avversario
-        opponent_client->is_current_turn = false; // Resetta il turno del client avversario
-        opponent_client->wants_rematch = false; // Resetta la richiesta di rivincita dell'avversario
+/**
+ * @brief Scadenza di una richiesta di unione: viene rifiutata come se il proprietario avesse digitato "reject".
+ * @param timer L'accept_timer della partita.
+ */
+void accept_timer_expired(TimerNode *timer) {
+    Game *game = TIMER_CONTAINER(timer, Game, accept_timer);
+    Client *owner_client = find_client_by_fd(game->owner_fd);
+    if (game->state != GAME_WAITING_FOR_PLAYER || game->opponent_fd < 0 || !owner_client) {
+        return;
     }
-    game->opponent_fd = -1; // Rimuovi l'opponente dallo slot del gioco
-    send_to_client(client_fd, "Hai rifiutato il giocatore. La tua partita è di nuovo in attesa di un avversario.\n");
-    printf("Partita %d: Il proprietario (FD %d) ha rifiutato FD %d. Stato: WAIT_FOR_PLAYER.\n", game->id, client_fd, opponent_client ? opponent_client->fd : -1);
-    // Notifica che una partita è tornata disponibile
-    char msg_spectators[BUFFER_SIZE];
-    snprintf(msg_spectators, sizeof(msg_spectators), "La partita ID %d è tornata disponibile in attesa di un giocatore.\n", game->id);
-    notify_all_spectators(game, msg_spectators);
+    printf("Partita %d: richiesta di FD %d scaduta dopo %d secondi.\n", game->id, game->opponent_fd, config.accept_timeout);
+    send_event(game->opponent_fd, PROTO_EV_JOIN_EXPIRED, game->id, "Il proprietario non ha risposto in tempo alla tua richiesta.\n");
+    send_event(game->owner_fd, PROTO_EV_JOIN_EXPIRED, game->id, "Non hai risposto in tempo alla richiesta di unione.\n");
+    handle_reject_command(game->owner_fd, owner_client);
 }
 
 /**
- * @brief Gestisce il comando "leave".
- * @param client_fd Il file descriptor del client.
- * @param current_client La struttura Client per il client corrente.
+ * @brief Scadenza del timer di inattività. Il timer non viene riarmato a ogni comando ricevuto:
+ * alla scadenza si controlla l'ultima attività e, se il client ha parlato nel frattempo, si riarma per il tempo mancante.
+ * @param timer L'idle_timer del client.
  */
-void handle_leave_command(int client_fd, Client *current_client) {
-    // Controlla se il client è in una partita
-    if (current_client->game_id == -1) {
-        send_to_client(client_fd, "Non sei in una partita da lasciare.\n");
+void idle_timer_expired(TimerNode *timer) {
+    Client *client = TIMER_CONTAINER(timer, Client, idle_timer);
+    uint64_t limit_ms = (uint64_t)config.idle_timeout * 1000;
+    uint64_t idle_ms = current_shard->now_ms - client->last_activity_ms;
+    if (client->watch_game_id != -1) {
+        timer_arm(&current_shard->timers, timer, limit_ms); // Uno spettatore può restare in silenzio per tutta la partita
+        return;
+    }
+    if (idle_ms < limit_ms) {
+        timer_arm(&current_shard->timers, timer, limit_ms - idle_ms);
         return;
     }
+    printf("Client FD %d inattivo da %d secondi: disconnesso.\n", client->fd, config.idle_timeout);
+    send_event(client->fd, PROTO_EV_IDLE_TIMEOUT, -1, "Disconnesso per inattività.\n");
+    remove_client(client->fd);
+}
 
-    Game* game = find_game_by_id(current_client->game_id); // Trova la partita a cui il client appartiene
-    // Controlla se la partita esiste
-    if (!game) {
-        // Dovrebbe essere gestito da remove_client_from_game, ma precauzione
-        send_to_client(client_fd, "Errore interno: partita non trovata. Riprova o disconnetti.\n");
-        current_client->game_id = -1; // Resetta stato del client
-        current_client->status = PLAYER_CONNECTED; // Resetta lo stato del client
-        current_client->player_symbol = EMPTY; // Resetta il simbolo del client
-        current_client->is_current_turn = false; // Resetta il turno del client
-        current_client->wants_rematch = false; // Resetta la richiesta di rivincita
+/**
+ * @brief Scadenza dei posti tenuti per i giocatori disconnessi o di una partita ripristinata: chi non è rientrato
+ * entro la propria scadenza la lascia come con "leave" (se manca il proprietario la partita viene chiusa);
+ * se l'altro posto è ancora tenuto, il timer viene riarmato sulla sua scadenza.
+ * @param timer Il rejoin_timer della partita.
+ */
+void rejoin_timer_expired(TimerNode *timer) {
+    Game *game = TIMER_CONTAINER(timer, Game, rejoin_timer);
+    uint64_t now = current_shard->now_ms;
+    bool owner_expired = game->owner_fd == DETACHED_FD && game->rejoin_deadline[0] <= now;
+    if (game->opponent_fd == DETACHED_FD && game->rejoin_deadline[1] <= now) {
+        printf("Partita %d: il giocatore O non è rientrato entro %d secondi.\n", game->id, config.rejoin_timeout);
+        release_seat(game, 1); // Con il proprietario ancora presente (o in attesa) la partita resta aperta
+    }
+    if (owner_expired) {
+        printf("Partita %d: il giocatore X non è rientrato entro %d secondi.\n", game->id, config.rejoin_timeout);
+        release_seat(game, 0); // La partita viene chiusa
+        return;
+    }
+    arm_rejoin_timer(game);
+}
+
+// --- Implementazioni delle Funzioni di Gestione degli Shard ---
+
+/**
+ * @brief Accoda un messaggio nella inbox di uno shard e ne risveglia il reactor.
+ * @param target Lo shard destinatario.
+ * @param msg Il messaggio (la proprietà passa al destinatario).
+ */
+void post_shard_message(Shard *target, ShardMessage *msg) {
+    msg->next = NULL;
+    pthread_mutex_lock(&target->inbox_lock);
+    if (target->inbox_tail) {
+        target->inbox_tail->next = msg;
+    } else {
+        target->inbox_head = msg;
+    }
+    target->inbox_tail = msg;
+    pthread_mutex_unlock(&target->inbox_lock);
+
+    uint64_t one = 1;
+    if (write(target->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("write eventfd");
+    }
+}
+
+/**
+ * @brief Invia un datagramma sul socket UNIX di uno shard di un altro worker, con il socket di un client come SCM_RIGHTS.
+ * @param target_shard L'indice globale dello shard destinatario.
+ * @param data Il pacchetto.
+ * @param len I suoi byte.
+ * @param client_fd Il socket da passare (-1 se nessuno).
+ * @return 0 in caso di successo, -1 in caso di errore (errno EAGAIN se il socket non accetta altri pacchetti).
+ */
+static int send_ipc_datagram(int target_shard, void *data, size_t len, int client_fd) {
+    struct iovec iov = { data, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if (client_fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &client_fd, sizeof(int));
+    }
+
+    // Non bloccante: un worker bloccato o saturo non deve fermare il reactor del mittente
+    ssize_t sent;
+    do {
+        sent = sendmsg(ipc_send_fds[target_shard], &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Sorveglia la scrivibilità del socket UNIX verso uno shard con pacchetti in attesa.
+ * Con epoll il socket entra nell'epoll dello shard (a livello: l'evento si ripete finché la coda non si svuota
+ * e il socket viene tolto); con io_uring si arma un poll singolo, riarmato se dopo l'invio restano pacchetti.
+ * Il socket di invio è condiviso da tutti gli shard: ognuno lo sorveglia solo per la propria coda.
+ * @param sh Lo shard corrente.
+ * @param target_shard L'indice globale dello shard destinatario.
+ */
+void watch_ipc_outbox(Shard *sh, int target_shard) {
+    IpcOutbox *box = &sh->ipc_outbox[target_shard];
+    if (box->watching) {
+        return;
+    }
+    int fd = ipc_send_fds[target_shard];
+    if (sh->io_uring) {
+        struct io_uring_sqe *sqe = shard_sqe(sh);
+        if (!sqe) {
+            fprintf(stderr, "Shard %d: coda di submission io_uring piena, pacchetti per lo shard %d in attesa del prossimo trasferimento\n",
+                    sh->index, target_shard);
+            return;
+        }
+        uring_prep_poll(sqe, fd, POLLOUT, false, IO_USER_DATA(IO_OP_IPC_OUT, target_shard));
+    } else {
+        struct epoll_event ev;
+        ev.events = EPOLLOUT;
+        ev.data.fd = fd;
+        if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            return;
+        }
+    }
+    box->watching = true;
+}
+
+/**
+ * @brief Invia in ordine i pacchetti in attesa verso uno shard finché il suo socket UNIX li accetta.
+ * Il socket di un client trasferito viene chiuso solo dopo l'invio: fino ad allora resta aperto, fuori dagli eventi.
+ * @param sh Lo shard corrente.
+ * @param target_shard L'indice globale dello shard destinatario.
+ */
+void flush_ipc_outbox(Shard *sh, int target_shard) {
+    IpcOutbox *box = &sh->ipc_outbox[target_shard];
+    if (!box->head) {
+        return;
+    }
+    while (box->head) {
+        PendingPacket *pending = box->head;
+        if (send_ipc_datagram(target_shard, pending->data, pending->len, pending->client_fd) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return; // Si riprende quando il socket torna scrivibile
+            }
+            // Il client non può più essere consegnato: la connessione viene chiusa
+            fprintf(stderr, "Shard %d: pacchetto per lo shard %d perso (%s), FD %d chiuso\n",
+                    sh->index, target_shard, strerror(errno), pending->client_fd);
+        }
+        if (pending->client_fd >= 0) {
+            close(pending->client_fd);
+        }
+        box->head = pending->next;
+        box->count--;
+        free(pending);
+    }
+    box->tail = NULL;
+    sh->ipc_backlog--;
+    if (box->watching && !sh->io_uring) {
+        epoll_ctl(sh->epoll_fd, EPOLL_CTL_DEL, ipc_send_fds[target_shard], NULL);
+        box->watching = false;
+    }
+}
+
+/**
+ * @brief Gestisce un evento di scrittura su un fd senza client: se è il socket UNIX verso uno shard con pacchetti
+ * in attesa, li invia. Con epoll l'evento porta il fd, quindi si cerca lo shard che usa quel socket.
+ * @param fd Il file descriptor dell'evento.
+ */
+static void handle_ipc_writable(int fd) {
+    Shard *sh = current_shard;
+    for (int s = 0; s < num_shards; s++) {
+        if (ipc_send_fds[s] == fd && sh->ipc_outbox[s].head) {
+            flush_ipc_outbox(sh, s);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Invia un pacchetto allo shard di un altro worker tramite il suo socket UNIX.
+ * Per un handoff il socket del client viaggia come SCM_RIGHTS. Se il socket UNIX non accetta altri pacchetti
+ * (il destinatario non li ha ancora letti) o ce ne sono già in attesa, il pacchetto viene accodato e inviato
+ * quando il socket torna scrivibile: un picco di trasferimenti non fa fallire i comandi dei client.
+ * @param target_shard L'indice globale dello shard destinatario.
+ * @param type Il tipo di messaggio.
+ * @param client Il client da trasferire con il suo socket (NULL se nessuno).
+ * @param text Il comando da trasportare.
+ * @return 0 se inviato (il mittente chiude la propria copia del socket), 1 se accodato (il socket appartiene
+ *         alla coda, che lo chiude dopo l'invio), -1 in caso di errore.
+ */
+int send_shard_packet(int target_shard, ShardMessageType type, const Client *client, const char *text) {
+    Shard *sh = current_shard;
+    static __thread ShardPacket packet; // Troppo grande per lo stack di ogni chiamata
+    memset(&packet, 0, offsetof(ShardPacket, pending));
+    packet.type = (int32_t)type;
+    int client_fd = -1;
+    if (client) {
+        client_fd = client->fd;
+        packet.binary = client->binary ? 1 : 0;
+        snprintf(packet.username, sizeof(packet.username), "%s", client->username);
+        packet.account = client->account;
+        // L'input già ricevuto e non elaborato viaggia con il client, linearizzato
+        packet.pending_len = client->in_tail - client->in_head;
+        for (uint32_t i = 0; i < packet.pending_len; i++) {
+            packet.pending[i] = client->in_buf[(client->in_head + i) & INPUT_BUFFER_MASK];
+        }
+        for (uint32_t i = 0; i < client->out_count && packet.output_len < HANDOFF_OUTPUT_MAX; i++) {
+            const OutSegment *seg = &client->out_segs[(client->out_head + i) & (client->out_cap - 1)];
+            uint32_t len = seg->len < HANDOFF_OUTPUT_MAX - packet.output_len ? seg->len : HANDOFF_OUTPUT_MAX - packet.output_len;
+            memcpy(packet.pending + packet.pending_len + packet.output_len, seg->data, len);
+            packet.output_len += len;
+        }
+    }
+    snprintf(packet.text, sizeof(packet.text), "%s", text);
+    size_t len = offsetof(ShardPacket, pending) + packet.pending_len + packet.output_len;
+
+    IpcOutbox *box = &sh->ipc_outbox[target_shard];
+    if (!box->head) {
+        if (send_ipc_datagram(target_shard, &packet, len, client_fd) == 0) {
+            return 0;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("sendmsg");
+            return -1;
+        }
+    }
+    // I pacchetti già in attesa partono prima: l'ordine verso lo shard resta quello dei trasferimenti
+    PendingPacket *pending = box->count < IPC_OUTBOX_MAX ? malloc(sizeof(PendingPacket) + len) : NULL;
+    if (!pending) {
+        fprintf(stderr, "Shard %d: %d pacchetti già in attesa per lo shard %d, trasferimento rifiutato\n", sh->index, box->count, target_shard);
+        return -1;
+    }
+    pending->next = NULL;
+    pending->client_fd = client_fd;
+    pending->len = len;
+    memcpy(pending->data, &packet, len);
+    if (box->tail) {
+        box->tail->next = pending;
+    } else {
+        box->head = pending;
+        sh->ipc_backlog++;
+    }
+    box->tail = pending;
+    box->count++;
+    METRICS_ADD(sh->metrics->handoffs_queued, 1);
+    watch_ipc_outbox(sh, target_shard);
+    return 1;
+}
+
+/**
+ * @brief Chiude la connessione di un client il cui input ricevuto con io_uring non stava nel buffer al momento
+ * del trasferimento: i comandi persi non vengono eseguiti in silenzio da un altro shard.
+ * @param fd Il file descriptor del client.
+ */
+static void refuse_handoff_overflow(int fd) {
+    send_error(fd, PROTO_ERR_INPUT_OVERFLOW, "Troppi comandi inviati senza attendere le risposte: connessione chiusa.\n");
+    remove_client(fd);
+}
+
+/**
+ * @brief Trasferisce un client (non in partita) a un altro shard, che rieseguirà il comando indicato.
+ * Verso uno shard dello stesso worker si sposta la struttura Client; verso un altro worker si passa il socket.
+ * @param client Il client da trasferire.
+ * @param target_shard L'indice globale dello shard destinatario.
+ * @param command Il comando da eseguire nello shard destinatario (es. "join 5").
+ */
+void handoff_client(Client *client, int target_shard, const char *command) {
+    Shard *sh = current_shard;
+    Shard *target = local_shard(target_shard);
+    int fd = client->fd;
+    stop_watching(client); // Gli spettatori vivono nello shard della partita seguita
+
+    if (!target) {
+        // Shard di un altro processo: il socket viaggia sul socket UNIX, la copia locale viene chiusa (subito, o dalla
+        // coda dei pacchetti in attesa dopo l'invio). Il socket esce prima dagli eventi dello shard (con io_uring l'input
+        // già ricevuto passa nel buffer del client); l'output ancora in coda viene inviato per quanto possibile,
+        // il resto viaggia nel pacchetto.
+        if (!unregister_client_fd(fd)) {
+            refuse_handoff_overflow(fd);
+            return;
+        }
+        int sent = -1;
+        if (!flush_client_output(client) || client->out_bytes > HANDOFF_OUTPUT_MAX ||
+            (sent = send_shard_packet(target_shard, SHARD_MSG_HANDOFF, client, command)) < 0) {
+            if (!register_client_fd(fd)) {
+                fprintf(stderr, "Shard %d: FD %d non più registrato dopo un trasferimento fallito\n", sh->index, fd);
+            }
+            send_error(fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+            return;
+        }
+        METRICS_ADD(sh->metrics->handoffs, 1);
+        timer_cancel(&sh->timers, &client->idle_timer);
+        sh->clients[fd] = NULL;
+        sh->num_clients--;
+        if (sent == 0) {
+            close(fd);
+        }
+        release_client_output(client);
+        free_client(client);
+        return;
+    }
+
+    ShardMessage *msg = calloc(1, sizeof(ShardMessage));
+    if (!msg || !(msg->text = strdup(command))) {
+        free(msg);
+        send_error(fd, PROTO_ERR_INTERNAL, "Errore interno del server, riprova.\n");
+        return;
+    }
+    msg->type = SHARD_MSG_HANDOFF;
+    msg->client = client;
+
+    // Il socket resta aperto: viene solo tolto dagli eventi, dalla tabella e dalla ruota dei timer dello shard corrente
+    if (!unregister_client_fd(fd)) {
+        free(msg->text);
+        free(msg);
+        refuse_handoff_overflow(fd);
         return;
     }
-    
-    send_to_client(client_fd, "Hai lasciato la partita.\n"); // Informa il client che ha lasciato la partita
-    printf("Client FD %d ha lasciato la partita %d.\n", client_fd, game->id);
-    
-    // Rimuovi il client dalla partita
-    remove_client_from_game(client_fd);
+    timer_cancel(&sh->timers, &client->idle_timer);
+    sh->clients[fd] = NULL;
+    sh->num_clients--;
+    client->out_dirty = false; // La lista degli svuotamenti di questo shard non lo riguarda più
+    METRICS_ADD(sh->metrics->handoffs, 1);
+
+    post_shard_message(target, msg);
 }
 
 /**
- * @brief Gestisce il comando "move".
- * @param sd Il file descriptor del client che ha inviato il comando.
- * @param buffer Il buffer contenente il comando (es. "move 0 0").
+ * @brief Inserisce un client trasferito nelle tabelle e nell'epoll dello shard corrente ed esegue il suo comando.
+ * @param client Il client adottato (già allocato).
+ * @param command Il comando da eseguire (modificabile, terminato da '\0').
  */
-void handle_move_command(int sd, const char* buffer) {
-    Client* current_client = find_client_by_fd(sd); // Trova il client corrente
-    // Controlla se il client è in una partita
-    if (!current_client || current_client->status != PLAYER_IN_GAME) {
-        send_to_client(sd, "Non sei in una partita. Digita 'join <game_id>' o 'create'.\n");
+static void adopt_client(Client *client, char *command) {
+    Shard *sh = current_shard;
+    int fd = client->fd;
+    if (!ensure_client_capacity(fd)) {
+        close(fd);
+        release_client_output(client);
+        free_client(client);
         return;
     }
-
-    Game* game = find_game_by_id(current_client->game_id); // Trova la partita a cui il client appartiene
-    // Controlla se la partita esiste e se è in corso
-    if (!game || game->state != GAME_IN_PROGRESS) {
-        // Se la partita non esiste o non è in corso, informa il client
-        if (game && game->state == GAME_ENDED) {
-            send_to_client(sd, "La partita è terminata. Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
-        } else {
-            send_to_client(sd, "La partita non è in corso o non valida.\n");
-        }
-        return;
+    sh->clients[fd] = client;
+    sh->num_clients++;
+    client->last_activity_ms = sh->now_ms;
+    timer_init(&client->idle_timer, idle_timer_expired);
+    timer_arm(&sh->timers, &client->idle_timer, (uint64_t)config.idle_timeout * 1000);
+    // Il segno di svuotamento apparteneva allo shard di provenienza e può essere rimasto acceso a coda vuota
+    // (svuotata dall'evento EPOLLOUT nello stesso giro): si azzera sempre e si riaccende solo se c'è output
+    client->out_dirty = false;
+    if (client->out_count > 0) {
+        mark_client_dirty(client);
     }
-    // Controlla se è il turno del client corrente
-    if (!current_client->is_current_turn) {
-        send_to_client(sd, "Non è il tuo turno.\n");
-        return;
+    if (register_client_fd(fd)) {
+        // Si esegue il comando che ha causato il trasferimento, poi le righe già ricevute dopo di esso.
+        // L'epoll (o la recv multishot) segnala subito i dati arrivati durante il trasferimento; se il comando
+        // ha già chiuso il client il controllo sul fd nella tabella lo ignora.
+        handle_client_data(fd, command, (int)strlen(command));
+        if (find_client_by_fd(fd) == client) {
+            process_client_input(client);
+        }
+    } else {
+        remove_client(fd);
     }
+}
 
-    // Parsing della mossa
-    int row, col;
-    // Controlla se il comando è nel formato corretto
-    if (sscanf(buffer, "move %d %d", &row, &col) != 2) {
-        send_to_client(sd, "Formato comando 'move' non valido. Usa: move <riga> <colonna> (es. move 0 0).\n");
-        return;
+/**
+ * @brief Elabora i messaggi arrivati nella inbox dello shard corrente (client trasferiti).
+ */
+void drain_shard_inbox(void) {
+    Shard *sh = current_shard;
+    uint64_t count;
+    if (read(sh->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read eventfd");
     }
 
-    // Effettua la mossa
-    // Assumiamo che make_move ritorni 0 per successo e -1 per fallimento (mossa invalida)
-    if (make_move(&game->tris_game, row, col) == 0) {
-        GameResult result = check_winner(&game->tris_game); // Controlla il risultato della partita
-        Client* owner_client = find_client_by_fd(game->owner_fd); // Trova il proprietario della partita
-        Client* opponent_client = (game->opponent_fd != -1) ? find_client_by_fd(game->opponent_fd) : NULL; // Trova l'avversario della partita
-
-        char board_str[BUFFER_SIZE]; // Buffer per il tabellone
-        print_board(&game->tris_game, board_str); // Stampa il tabellone di gioco
+    // Stacca l'intera coda sotto lock e la elabora senza lock
+    pthread_mutex_lock(&sh->inbox_lock);
+    ShardMessage *msg = sh->inbox_head;
+    sh->inbox_head = sh->inbox_tail = NULL;
+    pthread_mutex_unlock(&sh->inbox_lock);
 
-        // Vittoria
-        if (result == WIN) { 
-            Client* winner_client = current_client; // Il client corrente è il vincitore
-            Client* loser_client = (winner_client->fd == owner_client->fd) ? opponent_client : owner_client; // Il perdente è l'altro giocatore
+    while (msg) {
+        ShardMessage *next = msg->next;
+        if (msg->type == SHARD_MSG_HANDOFF) {
+            // Adotta il client: stessa struttura, stesso socket, nuova tabella ed epoll
+            adopt_client(msg->client, msg->text);
+        }
+        free(msg->text);
+        free(msg);
+        msg = next;
+    }
+}
 
-            send_to_client(winner_client->fd, "\nLa partita è terminata!\n"); // Invia messaggio di fine partita al vincitore
-            send_to_client(winner_client->fd, board_str); // Invia il tabellone al vincitore
-            send_to_client(winner_client->fd, "Hai vinto!\n"); // Invia messaggio di vittoria al vincitore
+/**
+ * @brief Elabora i pacchetti arrivati sul socket UNIX dello shard corrente da shard di altri worker.
+ */
+void drain_shard_ipc(void) {
+    Shard *sh = current_shard;
+    static __thread ShardPacket packet; // Troppo grande per lo stack di ogni chiamata
+    while (true) {
+        struct iovec iov = { &packet, sizeof(packet) };
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
 
-            // Invia messaggio di fine partita al perdente
-            if (loser_client && loser_client->fd != winner_client->fd) { 
-                send_to_client(loser_client->fd, "\nLa partita è terminata!\n"); // Invia messaggio di fine partita al perdente
-                send_to_client(loser_client->fd, board_str); // Invia il tabellone al perdente
-                send_to_client(loser_client->fd, "Hai perso.\n"); // Invia messaggio di sconfitta al perdente
+        ssize_t n = recvmsg(sh->ipc_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            
-            // --- Gestione Post-Vittoria ---
-            // Il vincitore diventa il nuovo proprietario della partita e attende un nuovo giocatore.
-            // La partita viene resettata per un nuovo round.
-            game->owner_fd = winner_client->fd; // Il vincitore diventa il proprietario della partita
-            game->opponent_fd = -1; // L'avversario precedente viene rimosso
-            game->state = GAME_WAITING_FOR_PLAYER; // Imposta lo stato della partita come in attesa di un nuovo giocatore
-            init_game(&game->tris_game); // Inizializza il tabellone per la nuova partita
-            game->last_result = IN_PROGRESS; // Resetta il risultato per la nuova partita
-
-            winner_client->game_id = game->id; // Associa il vincitore alla partita
-            winner_client->status = PLAYER_IN_GAME; // Resta in gioco, ora come proprietario
-            winner_client->player_symbol = X; // Il vincitore è X per la prossima partita
-            winner_client->is_current_turn = false; // Il turno verrà assegnato quando l'opponente si unisce
-            winner_client->wants_rematch = false; // Resetta
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recvmsg");
+            }
+            return;
+        }
 
-            // Messaggio per il vincitore
-            char winner_prompt[BUFFER_SIZE]; 
-            snprintf(winner_prompt, sizeof(winner_prompt), "Sei diventato il proprietario della partita %d e attendi un nuovo giocatore (X).\n", game->id);
-            send_to_client(winner_client->fd, winner_prompt); // Invia messaggio al vincitore
+        int fd = -1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        if (n < (ssize_t)offsetof(ShardPacket, pending) || packet.pending_len > INPUT_BUFFER_SIZE ||
+            packet.output_len > HANDOFF_OUTPUT_MAX ||
+            (size_t)n != offsetof(ShardPacket, pending) + packet.pending_len + packet.output_len) {
+            if (fd >= 0) close(fd); // Pacchetto malformato: scartato
+            continue;
+        }
+        packet.text[sizeof(packet.text) - 1] = '\0';
+        packet.username[sizeof(packet.username) - 1] = '\0';
 
-            // Rimuovi il perdente dal gioco
-            if (loser_client && loser_client->fd != winner_client->fd) {
-                send_to_client(loser_client->fd, "Sei stato rimosso dalla partita. Digita 'list' per vedere altre partite o 'create' per crearne una nuova.\n");
-                remove_client_from_game(loser_client->fd); // Rimuove il perdente dal gioco
+        if (packet.type == SHARD_MSG_HANDOFF && fd >= 0) {
+            Client *client = alloc_client();
+            if (!client || set_nonblocking(fd) < 0) {
+                free_client(client);
+                close(fd);
+                continue;
             }
-            
-            printf("Partita %d terminata. Vincitore FD %d. Partita resettata per un nuovo giro con FD %d proprietario.\n", game->id, winner_client->fd, winner_client->fd);
-            
-            //In caso di Pareggio Invia il messaggio di pareggio a entrambi i giocatori
-        } else if (result == DRAW) { 
-            
-            char msg_draw_board[BUFFER_SIZE * 2];
-            snprintf(msg_draw_board, sizeof(msg_draw_board), "\nLa partita è terminata in pareggio!\n%s", board_str);
-
-            send_to_client(game->owner_fd, msg_draw_board);
-            send_to_client(game->owner_fd, "Vuoi giocare un'altra partita? Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
-            // Invia il messaggio di pareggio all'avversario, se esiste
-            if (game->opponent_fd != -1) { 
-                send_to_client(game->opponent_fd, msg_draw_board);
-                send_to_client(game->opponent_fd, "Vuoi giocare un'altra partita? Digita 'rematch' per rigiocare o 'leave' per uscire.\n");
+            // Il client trasferito non è in partita: bastano fd, nome utente e giocatore registrato
+            client->fd = fd;
+            client->status = PLAYER_CONNECTED;
+            client->game_id = -1;
+            client->watch_game_id = -1;
+            client->player_symbol = EMPTY;
+            client->binary = packet.binary != 0;
+            memcpy(client->username, packet.username, sizeof(client->username));
+            client->account = packet.account;
+            memcpy(client->in_buf, packet.pending, packet.pending_len);
+            client->in_tail = packet.pending_len;
+            if (packet.output_len > 0) {
+                // L'output non ancora inviato dal worker di provenienza precede le risposte al comando
+                OutBuf *buf = alloc_outbuf(packet.output_len);
+                if (buf) {
+                    buf->len = packet.output_len;
+                    memcpy(buf->data, packet.pending + packet.pending_len, packet.output_len);
+                    if (!push_output_segment(client, buf->data, buf->len, buf)) {
+                        free_outbuf(buf);
+                    }
+                }
             }
-
-            game->state = GAME_ENDED; // Passa a uno stato di "ended" in cui si attende 'rematch' o 'leave'
-            game->last_result = DRAW; // Registra il pareggio
-            if(owner_client) owner_client->is_current_turn = false; // Resetta i turni
-            if(opponent_client) opponent_client->is_current_turn = false; // Resetta i turni
-
-            printf("Partita %d terminata. Risultato: PAREGGIO. In attesa di 'rematch' o 'leave'.\n", game->id);
-
-        } else { // IN_PROGRESS
-            // La partita continua, invia lo stato aggiornato
-            send_game_state_to_players(game);
-            printf("Partita %d in corso. Turno di %c.\n", game->id, (game->tris_game.turn == 0) ? 'X' : 'O');
+            adopt_client(client, packet.text);
+        } else if (fd >= 0) {
+            close(fd); // Tipo sconosciuto: il socket allegato non ha destinatario
         }
-    } else { // Mossa non valida
-        send_to_client(sd, "Mossa non valida. Controlla riga/colonna o se la cella è già occupata.\n");
     }
 }
 
 /**
- * @brief Gestisce il comando "rematch".
- * @param sd Il file descriptor del client che ha inviato il comando.
+ * @brief Raccoglie gli oggetti liberati da altri shard e pubblica l'occupazione dei pool.
+ * Uno shard rimasto senza client (es. dopo un'ondata di disconnessioni) restituisce al sistema le slab
+ * oltre POOL_KEEP_SLABS dei pool senza oggetti in uso, invece di tenerle mappate fino alla prossima ondata.
+ * Con client connessi i pool dei buffer si svuotano a ogni giro: restituirle allora le rimapperebbe subito.
+ * @param sh Lo shard corrente.
  */
-void handle_rematch_command(int sd) {
-    Client* current_client = find_client_by_fd(sd); // Trova il client corrente
-    // Controlla se il client è in una partita
-    if (!current_client || current_client->game_id == -1) { 
-        send_to_client(sd, "Non sei in una partita terminata per richiedere una rivincita.\n");
-        return;
+static void update_pool_metrics(Shard *sh) {
+    for (int p = 0; p < METRIC_POOL_COUNT; p++) {
+        SlabPool *pool = &sh->pools[p];
+        slab_pool_collect(pool);
+        if (sh->num_clients == 0 && slab_pool_reset(pool)) {
+            METRICS_ADD(sh->metrics->pool_resets, 1);
+        }
+        METRICS_SET(sh->metrics->pool_live[p], pool->live);
+        METRICS_SET(sh->metrics->pool_capacity[p], slab_pool_capacity(pool));
     }
+}
 
-    Game* game = find_game_by_id(current_client->game_id); // Trova la partita a cui il client appartiene
-    // Controlla se la partita esiste e se è in uno stato di pareggio
-    if (!game || game->state != GAME_ENDED || game->last_result != DRAW) {
-        send_to_client(sd, "Questa partita non è in stato di pareggio per una rivincita.\n");
-        return;
+/**
+ * @brief Ciclo principale del reactor di uno shard.
+ * Ogni evento viene consegnato direttamente al suo Client tramite la tabella indicizzata per fd.
+ * @param arg Puntatore allo Shard da eseguire.
+ */
+void *run_shard(void *arg) {
+    Shard *sh = arg;
+    struct epoll_event events[MAX_EVENTS]; // Eventi restituiti da epoll_wait()
+    current_shard = sh;
+    recover_games(); // Prima di servire client: le partite del journal tornano al loro posto
+    if (sh->io_uring) {
+        start_uring_shard();
     }
 
-    // Registra la richiesta di rivincita del client
-    current_client->wants_rematch = true; // Indica che il client vuole una rivincita
-    send_to_client(sd, "Richiesta di rivincita inviata. In attesa dell'altro giocatore...\n");
-    printf("Client FD %d ha richiesto rivincita per partita %d.\n", sd, game->id);
+    while (true) {
+        // Aspetta un'attività su uno dei socket, al più fino alla prossima scadenza della ruota dei timer
+        int timeout = timer_wheel_timeout_ms(&sh->timers, monotonic_ms());
+        if (sh->io_uring) {
+            // Una sola io_uring_enter invia le writev del giro precedente e attende gli eventi: le loro completion,
+            // pronte al ritorno perché i socket sono non bloccanti, non contano tra gli eventi attesi
+            int err = uring_wait(&sh->ring, (unsigned)sh->writes_inflight + 1, timeout);
+            if (uring_sq_pending(&sh->ring) == 0) {
+                sh->write_batch = 0; // Il kernel ha letto gli SQE: gli iovec delle writev si possono riusare
+            }
+            sh->now_ms = monotonic_ms();
+            if (err < 0) {
+                fprintf(stderr, "io_uring_enter: %s\n", strerror(-err));
+            }
+            timer_wheel_advance(&sh->timers, sh->now_ms);
+            handle_uring_events();
+        } else {
+            int nfds = epoll_wait(sh->epoll_fd, events, MAX_EVENTS, timeout);
+            sh->now_ms = monotonic_ms();
 
-    // Controlla se entrambi i giocatori vogliono la rivincita
-    Client* owner_client = find_client_by_fd(game->owner_fd);
-    Client* opponent_client = find_client_by_fd(game->opponent_fd);
+            // Controlla se c'è un errore nella epoll_wait
+            if (nfds < 0) {
+                if (errno != EINTR) {
+                    perror("epoll_wait");
+                }
+                continue;
+            }
 
-    if (owner_client && opponent_client && owner_client->wants_rematch && opponent_client->wants_rematch) {
-        // Entrambi i giocatori vogliono una rivincita!
-        init_game(&game->tris_game); // Reset della board
-        game->state = GAME_IN_PROGRESS; // Ritorna in corso
-        game->last_result = IN_PROGRESS; // Resetta risultato
+            // Prima i timer scaduti: i comandi di questo giro riarmano i timer a partire dall'istante attuale
+            timer_wheel_advance(&sh->timers, sh->now_ms);
 
-        // Resetta i turni e i simboli dei giocatori
-        if (game->tris_game.turn == 0) { // Se X (owner) aveva iniziato
-            game->tris_game.turn = 1; // O (opponent) inizia ora
-            owner_client->is_current_turn = false; // Resetta il turno del proprietario
-            opponent_client->is_current_turn = true; // O (avversario) inizia ora
-        } else { // Se O (opponent) aveva iniziato (o se fosse stato reimpostato a 0 dopo vittoria)
-            game->tris_game.turn = 0; // X (owner) inizia ora
-            owner_client->is_current_turn = true; // X (proprietario) inizia ora
-            opponent_client->is_current_turn = false; // Resetta il turno dell'avversario
+            for (int i = 0; i < nfds; i++) {
+                int fd = events[i].data.fd;
+                // Se c'è attività sul socket master, sono nuove connessioni
+                if (fd == listen_fd) {
+                    handle_new_connections(listen_fd);
+                    continue;
+                }
+                // Messaggi da altri shard dello stesso worker o da altri worker
+                if (fd == sh->wake_fd) {
+                    drain_shard_inbox();
+                    continue;
+                }
+                if (fd == sh->ipc_fd) {
+                    drain_shard_ipc();
+                    continue;
+                }
+                // Altrimenti, è attività su un socket client esistente (accesso diretto per fd)
+                Client *client = find_client_by_fd(fd);
+                if (!client) {
+                    if (sh->ipc_backlog > 0 && (events[i].events & EPOLLOUT)) {
+                        handle_ipc_writable(fd); // Socket UNIX verso un altro worker con pacchetti in attesa
+                    }
+                    continue; // Client già rimosso o trasferito durante questo giro di eventi
+                }
+                if ((events[i].events & EPOLLOUT) && client->out_count > 0 && !flush_client_output(client)) {
+                    remove_client(fd);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    handle_client_readable(client);
+                }
+            }
         }
-        
-        owner_client->wants_rematch = false; // Resetta lo stato di richiesta
-        opponent_client->wants_rematch = false; // Resetta lo stato di richiesta
 
-        send_to_client(owner_client->fd, "Entrambi avete richiesto una rivincita! La nuova partita inizia.\n");
-        send_to_client(opponent_client->fd, "Entrambi avete richiesto una rivincita! La nuova partita inizia.\n");
-        printf("Partita %d: Rivincita accettata. Nuova partita iniziata.\n", game->id);
+        // I record del giro vanno nel journal prima delle risposte che li confermano (group commit);
+        // anche i replay salvati nel giro vanno scritti prima che "replay <id>" li possa chiedere
+        commit_journal();
+        replay_store_commit(&current_shard->replays);
+        // Tutti i messaggi prodotti dagli handler di questo giro partono ora, una writev() per client
+        flush_dirty_clients();
 
-        send_game_state_to_players(game); // Invia il nuovo stato del tabellone e il turno
-        // Solo uno dei giocatori ha richiesto una rivincita
-    } else { 
-        // Notifica l'altro giocatore della richiesta di rivincita
-        Client* other_player = (current_client->fd == owner_client->fd) ? opponent_client : owner_client;
-        if (other_player && other_player->game_id == game->id) { // Assicurati che l'altro giocatore sia ancora nella stessa partita
-            send_to_client(other_player->fd, "L'altro giocatore ha richiesto una rivincita. Digita 'rematch' per accettare o 'leave' per uscire.\n");
-        }
+        // Indicatori dello shard: semplici store nella sua linea di cache, letti da "stats" e dalla porta delle statistiche
+        METRICS_SET(sh->metrics->clients, sh->num_clients);
+        METRICS_SET(sh->metrics->games, sh->num_games);
+        update_pool_metrics(sh);
+        metrics_tick(sh->metrics, sh->now_ms);
     }
+    return NULL;
 }
 
 /**
- * @brief Gestisce i dati in ingresso da un client.
- * @param sd Il file descriptor del client.
- * @param buffer Il buffer contenente i dati ricevuti.
- * @param valread Il numero di byte letti.
+ * @brief Inizializza uno shard: epoll (o anello io_uring), eventfd per i messaggi, socket UNIX e registrazione del listener.
+ * @param sh Lo shard da inizializzare.
+ * @param index Il suo indice globale.
  */
-void handle_client_data(int sd, char *buffer, int valread) {
-    buffer[valread] = '\0';
-    // Rimuovi il carattere newline finale se presente
-    buffer[strcspn(buffer, "\n")] = 0;
+static void init_shard(Shard *sh, int index) {
+    memset(sh, 0, sizeof(*sh));
+    sh->index = index;
+    sh->free_game_slot = -1;
+    sh->rng = ((uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16) ^ (uint32_t)(index + 1) * 2654435761u) | 1; // Mai 0 (xorshift)
+    sh->ipc_fd = ipc_recv_fds[index];
+    sh->ipc_outbox = calloc((size_t)num_shards, sizeof(IpcOutbox));
+    if (!sh->ipc_outbox) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    sh->now_ms = monotonic_ms();
+    timer_wheel_init(&sh->timers, sh->now_ms);
+    pthread_mutex_init(&sh->inbox_lock, NULL);
+    // Le slab vengono mappate al primo oggetto: uno shard senza traffico non occupa memoria
+    slab_pool_init(&sh->pools[METRIC_POOL_CLIENT], sizeof(Client), POOL_KEEP_SLABS);
+    slab_pool_init(&sh->pools[METRIC_POOL_GAME], sizeof(Game), POOL_KEEP_SLABS);
+    slab_pool_init(&sh->pools[METRIC_POOL_BUFFER_SMALL], OUTBUF_SMALL_SLOT, POOL_KEEP_SLABS);
+    slab_pool_init(&sh->pools[METRIC_POOL_BUFFER], sizeof(OutBuf) + OUTPUT_CHUNK_SIZE, POOL_KEEP_SLABS);
+    sh->journal.fd = -1;
+    // Il layout lega i file al numero di shard: gli ID delle partite registrate lo codificano
+    if (config.journal_dir && journal_open(&sh->journal, config.journal_dir, index, (uint32_t)num_shards, config.journal_sync) < 0) {
+        fprintf(stderr, "Shard %d: journal non disponibile in %s, le partite non sopravviveranno a un riavvio\n", index, config.journal_dir);
+    }
+    sh->metrics = &metrics.shards[index];
+    sh->replays.fd = -1;
+    // Anche gli ID dei replay codificano lo shard: stesso layout del journal
+    if (config.replay_dir && replay_store_open(&sh->replays, config.replay_dir, index, (uint32_t)num_shards, &replay_heads) < 0) {
+        fprintf(stderr, "Shard %d: archivio dei replay non disponibile in %s, i round conclusi non verranno salvati\n", index, config.replay_dir);
+    }
 
-    printf("Ricevuto da FD %d: '%s'\n", sd, buffer);
+    sh->epoll_fd = epoll_create1(0);
+    sh->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (sh->epoll_fd < 0 || sh->wake_fd < 0) {
+        perror("epoll_create1/eventfd");
+        exit(EXIT_FAILURE);
+    }
 
-    Client *current_client = find_client_by_fd(sd);
-    if (!current_client) {
-        send_to_client(sd, "Errore interno del server, client non trovato.\n");
-        return;
+    if (config.io_uring) {
+        // L'anello sostituisce l'epoll, che resta vuoto; fd interni e listener vengono armati dal thread dello shard.
+        // Un kernel senza le funzioni richieste (o con io_uring disabilitato) fa ripiegare lo shard su epoll.
+        sh->write_iov = malloc((size_t)URING_WRITE_BATCH * URING_WRITE_SEGMENTS * sizeof(struct iovec));
+        if (sh->write_iov && uring_init(&sh->ring, URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE) == 0) {
+            printf("Shard %d: eventi e scritture con io_uring\n", index);
+            sh->io_uring = true;
+            return;
+        }
+        fprintf(stderr, "Shard %d: io_uring non disponibile (%s), uso epoll\n", index, sh->write_iov ? sh->ring.failure : "malloc");
+        free(sh->write_iov);
+        sh->write_iov = NULL;
     }
 
-    if (strcmp(buffer, "list") == 0) { // Comando per elencare le partite disponibili
-        print_game_list(sd);
-    } else if (strcmp(buffer, "create") == 0) { // Comando per creare una nuova partita
-        handle_create_command(sd, current_client);
-    } else if (strncmp(buffer, "join ", 5) == 0) { // Comando per unirsi a una partita
-        handle_join_command(sd, current_client, buffer);
-    } else if (strcmp(buffer, "accept") == 0) { // Comando per accettare una richiesta di unione a una partita
-        handle_accept_command(sd, current_client);
-    } else if (strcmp(buffer, "reject") == 0) { // Comando per rifiutare una richiesta di unione a una partita
-        handle_reject_command(sd, current_client);
-    } else if (strcmp(buffer, "leave") == 0) { // Comando per lasciare una partita
-        handle_leave_command(sd, current_client);
-    } else if (strncmp(buffer, "move ", 5) == 0) { // Comando per effettuare una mossa
-        handle_move_command(sd, buffer); // Chiamata corretta con 2 argomenti
-    } else if (strcmp(buffer, "rematch") == 0) { // Comando per richiedere una rivincita
-        handle_rematch_command(sd); // Chiamata corretta con 1 argomento
-    } else if (strcmp(buffer, "quit") == 0) { // Comando per uscire dal server
-        send_to_client(sd, "Arrivederci!\n");
-        remove_client(sd); // Rimuovi il client completamente
-    } else {
-        send_to_client(sd, "Digita <create> per creare una stanza, <join> per unirti, <accept> per accettare una richiesta, <reject> per rifiutare una richiesta, <leave> per disconetterti dalla partita, <move> <riga> <colonna> per fare la tua mossa, <quit> per uscire dal gioco.\n"); // Potresti aggiungere un comando 'help'
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = sh->wake_fd;
+    if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, sh->wake_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.fd = sh->ipc_fd;
+    if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, sh->ipc_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
     }
-}
 
-// --- Funzione Main del Server ---
+    // Il listener è condiviso dagli shard del worker: EPOLLEXCLUSIVE evita di risvegliarli tutti per ogni connessione
+    ev.events = EPOLLIN | EPOLLET | (config.threads > 1 ? EPOLLEXCLUSIVE : 0);
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
 
-int main(int argc, char *argv[]) {
-    int master_socket, new_socket, activity, i, valread, sd; // File descriptor del socket master
+/**
+ * @brief Crea il socket in ascolto del worker.
+ * Con SO_REUSEPORT ogni worker ha il proprio listener sulla stessa porta e il kernel distribuisce le connessioni.
+ * @return Il socket in ascolto (non bloccante).
+ */
+static int create_listener(void) {
+    int master_socket; // File descriptor del socket master
     struct sockaddr_in address; // Struttura per l'indirizzo del server
-    int addrlen; // Lunghezza dell'indirizzo
-    char buffer[BUFFER_SIZE]; // Buffer per i dati ricevuti
-
-    // Inizializza tutti i client e giochi a 0 / -1
-    for (i = 0; i < MAX_CLIENTS; i++) {
-        clients[i].fd = 0;
-        clients[i].game_id = -1; // Nessuna partita
-    }
-    // Inizializza tutti i giochi a -1 (slot libero)
-    for (i = 0; i < MAX_GAMES; i++) {
-        games[i].id = -1; // Slot di gioco libero
-    }
 
     // Crea il socket master
-    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
 
-    // Imposta le opzioni del socket (riuso dell'indirizzo)
+    // Imposta le opzioni del socket (riuso dell'indirizzo e della porta tra i worker)
     int opt = 1;
-    if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0) {
+    if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 ||
+        setsockopt(master_socket, SOL_SOCKET, SO_REUSEPORT, (char *)&opt, sizeof(opt)) < 0) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
@@ -851,77 +5797,198 @@ int main(int argc, char *argv[]) {
     // Prepara la struttura dell'indirizzo
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
-    addrlen = sizeof(address);
+    address.sin_port = htons(config.port);
 
     // Binda il socket all'indirizzo e alla porta
     if (bind(master_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
-    printf("Server in ascolto sulla porta %d\n", PORT); 
 
-    // Metti il socket in modalità ascolto (max 3 connessioni in coda)
-    if (listen(master_socket, 3) < 0) {
+    // Metti il socket in modalità ascolto con la coda più lunga consentita dal sistema
+    if (listen(master_socket, SOMAXCONN) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
+    if (set_nonblocking(master_socket) < 0) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+    return master_socket;
+}
 
-    // Inizializza il set di file descriptor master
-    FD_ZERO(&master_fds);
-    FD_SET(master_socket, &master_fds);
-    max_sd = master_socket;
+/**
+ * @brief Esegue un worker: listener, shard e thread reactor. Non ritorna.
+ * @param index L'indice del worker.
+ */
+static void run_worker(int index) {
+    worker_index = index;
+    listen_fd = create_listener();
+    printf("Worker %d in ascolto sulla porta %d (shard %d-%d)\n", index, config.port,
+           index * config.threads, (index + 1) * config.threads - 1);
 
-    printf("In attesa di connessioni...\n");
+    // Crea gli shard: ognuno ha il proprio epoll e le proprie tabelle
+    shards = calloc((size_t)config.threads, sizeof(Shard));
+    if (!shards) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < config.threads; i++) {
+        init_shard(&shards[i], index * config.threads + i);
+    }
 
-    // Ciclo principale del server
-    while (true) {
-        fd_set read_fds = master_fds; // Copia il set master per select()
+    // Con più shard ogni reactor gira nel proprio thread, fissato a un core; il primo usa il thread principale
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int first_core = index * config.threads;
+    for (int i = 1; i < config.threads; i++) {
+        if (pthread_create(&shards[i].thread, NULL, run_shard, &shards[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        if (cores > 1) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET((first_core + i) % cores, &cpus);
+            pthread_setaffinity_np(shards[i].thread, sizeof(cpus), &cpus);
+        }
+    }
+    if (num_shards > 1 && cores > 1) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(first_core % cores, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    // Le metriche sono condivise: basta che un worker serva la porta delle statistiche
+    if (index == 0 && config.stats_port > 0) {
+        start_stats_server();
+    }
+    run_shard(&shards[0]);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Avvia (o riavvia) il processo worker con l'indice dato.
+ * @param index L'indice del worker.
+ * @return Il PID del worker.
+ */
+static pid_t spawn_worker(int index) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // Il worker termina insieme al supervisore
+        run_worker(index);
+    }
+    return pid;
+}
+
+// --- Funzione Main del Server ---
 
-        // Aspetta indefinitamente un'attività su uno dei socket
-        activity = select(max_sd + 1, &read_fds, NULL, NULL, NULL);
+int main(int argc, char *argv[]) {
+    load_config(); // Le tabelle di client e partite crescono su richiesta fino ai limiti configurati
+    if (argc > 1 && strcmp(argv[1], "export") == 0) {
+        // "server export": scrive su stdout tutti i replay salvati in TRIS_REPLAY_DIR, senza avviare il server
+        long exported = replay_export(config.replay_dir, stdout);
+        if (exported < 0) {
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "Esportati %ld replay.\n", exported);
+        return EXIT_SUCCESS;
+    }
+    signal(SIGPIPE, SIG_IGN); // Un client che chiude durante la writev() produce EPIPE, non la terminazione del processo
+    // Una write() per riga: anche su pipe o file le righe di shard e worker diversi non si spezzano a metà
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    num_shards = config.workers * config.threads;
+    max_clients_per_shard = (config.max_clients + num_shards - 1) / num_shards;
+    max_games_per_shard = (config.max_games + num_shards - 1) / num_shards;
+    if (max_games_per_shard > GAME_MAX_SLOTS / num_shards) {
+        max_games_per_shard = GAME_MAX_SLOTS / num_shards; // Limite imposto dai bit di slot nell'ID
+    }
 
-        // Controlla se c'è un errore nella select
-        if ((activity < 0) && (errno != EINTR)) {
-            printf("select error\n");
+    // Directory delle partite e socket UNIX degli shard vanno creati prima della fork, per essere ereditati
+    if (directory_create(&directory, num_shards, max_games_per_shard) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    // Giocatori registrati: condivisi da tutti i worker, salvati nel file TRIS_RATINGS_FILE se impostato
+    if (ratings_create(&ratings, config.ratings_file, (uint32_t)config.max_players) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    // Teste delle catene dei replay per giocatore: ogni shard pubblica le proprie, "replays player" le legge tutte.
+    // Gli indici dei giocatori valgono anche dopo un riavvio solo se la classifica è salvata su file.
+    if (config.replay_dir) {
+        if (replay_heads_create(&replay_heads, (uint32_t)num_shards, ratings.capacity) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        replay_heads.stable = config.ratings_file != NULL;
+    }
+    // Metriche: ogni shard scrive le proprie, "stats" e la porta delle statistiche le leggono tutte
+    if (metrics_create(&metrics, num_shards, monotonic_ms()) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    // Chiavi Zobrist e tabella delle trasposizioni della ricerca: ogni worker ne eredita una copia privata
+    if (search_init(SEARCH_TT_BITS) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    ai_set_search_limits(config.search_ms * 1000, config.search_threads);
+    ipc_recv_fds = calloc((size_t)num_shards, sizeof(int));
+    ipc_send_fds = calloc((size_t)num_shards, sizeof(int));
+    if (!ipc_recv_fds || !ipc_send_fds) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_shards; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) < 0) {
+            perror("socketpair");
+            exit(EXIT_FAILURE);
         }
+        ipc_recv_fds[i] = pair[0];
+        ipc_send_fds[i] = pair[1];
+    }
 
-        // Se c'è attività sul socket master, è una nuova connessione
-        if (FD_ISSET(master_socket, &read_fds)) {
-            if ((new_socket = accept(master_socket, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-                perror("accept");
-                exit(EXIT_FAILURE);
-            }
+    printf("Server in ascolto sulla porta %d (max %d client, %d partite, %d worker x %d shard)\n",
+           config.port, config.max_clients, config.max_games, config.workers, config.threads);
+    printf("In attesa di connessioni...\n");
+    fflush(stdout); // Evita che i worker ereditino e ristampino l'output ancora nel buffer
 
-            printf("Nuova connessione, socket fd è %d, ip è : %s, porta : %d\n", new_socket, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+    if (config.workers == 1) {
+        run_worker(0); // Modalità a processo singolo: nessun supervisore
+    }
 
-            // Aggiungi il nuovo socket al set di master_fds
-            FD_SET(new_socket, &master_fds); // Aggiungi il nuovo socket al set di file descriptor
-            // Aggiorna il massimo file descriptor
-            if (new_socket > max_sd) {
-                max_sd = new_socket;
+    // Modalità pre-fork: il processo principale supervisiona i worker e riavvia quelli che terminano.
+    // Le partite di un worker caduto spariscono dalla directory; gli altri worker continuano a giocare.
+    pid_t *pids = calloc((size_t)config.workers, sizeof(pid_t));
+    if (!pids) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < config.workers; i++) {
+        pids[i] = spawn_worker(i);
+    }
+    while (true) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-
-            initialize_client(new_socket); // Inizializza la struttura client
+            perror("wait");
+            break;
         }
-
-        // Altrimenti, è attività su un socket client esistente
-        for (i = 0; i < MAX_CLIENTS; i++) {
-            sd = clients[i].fd;
-            // Controlla se il socket è valido e ha attività
-            if (sd > 0 && FD_ISSET(sd, &read_fds)) { // Se il socket è valido e ha attività
-                // Leggi i dati dal client
-                if ((valread = read(sd, buffer, BUFFER_SIZE)) == 0) {
-                    // Client disconnesso
-                    printf("Host disconnesso, fd %d\n", sd);
-                    remove_client(sd); // Rimuovi il client
-                } else {
-                    // C'è del dato dal client
-                    handle_client_data(sd, buffer, valread);
-                }
+        for (int i = 0; i < config.workers; i++) {
+            if (pids[i] != pid) {
+                continue;
             }
+            fprintf(stderr, "Worker %d (PID %d) terminato (stato %d), riavvio.\n", i, (int)pid, status);
+            for (int s = i * config.threads; s < (i + 1) * config.threads; s++) {
+                directory_clear_shard(&directory, s);
+                metrics_reset_gauges(&metrics, s);
+            }
+            pids[i] = spawn_worker(i);
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS non è definito in modalità C99 stretta
+#include "slab_pool.h"
+#include <stdio.h>
+#include <sys/mman.h>
+
+struct SlabObject {
+    SlabObject *next;
+};
+
+// Intestazione all'inizio di ogni slab, in una linea di cache propria: gli oggetti partono dalla linea successiva
+struct SlabHeader {
+    SlabPool *pool;         // Pool proprietario, a cui tornano gli oggetti liberati da altri thread
+    SlabHeader *next;
+} __attribute__((aligned(SLAB_POOL_LINE)));
+
+void slab_pool_init(SlabPool *pool, size_t object_size, unsigned keep_slabs) {
+    size_t size = (object_size + SLAB_POOL_LINE - 1) & ~(size_t)(SLAB_POOL_LINE - 1);
+    if (size < sizeof(SlabObject)) {
+        size = SLAB_POOL_LINE;
+    }
+    size_t slab_size = SLAB_POOL_MIN_SLAB;
+    while ((slab_size - sizeof(SlabHeader)) / size < SLAB_POOL_MIN_OBJECTS) {
+        slab_size *= 2;
+    }
+    pool->object_size = size;
+    pool->slab_size = slab_size;
+    pool->slab_objects = (unsigned)((slab_size - sizeof(SlabHeader)) / size);
+    pool->keep_slabs = keep_slabs;
+    pool->slabs = NULL;
+    pool->slab_count = 0;
+    pool->free_list = NULL;
+    pool->live = 0;
+    pool->remote = NULL;
+}
+
+// Slab che contiene un oggetto: le slab sono allineate alla propria dimensione, uguale per i pool dello stesso tipo
+static SlabHeader *object_slab(const SlabPool *pool, void *object) {
+    return (SlabHeader *)((uintptr_t)object & ~(uintptr_t)(pool->slab_size - 1));
+}
+
+// Mette in testa alla free list gli oggetti di una slab, in modo che vengano allocati in ordine di indirizzo
+static void thread_slab_objects(SlabPool *pool, SlabHeader *slab) {
+    char *first = (char *)slab + sizeof(SlabHeader);
+    for (unsigned i = pool->slab_objects; i > 0; i--) {
+        SlabObject *object = (SlabObject *)(first + (size_t)(i - 1) * pool->object_size);
+        object->next = pool->free_list;
+        pool->free_list = object;
+    }
+}
+
+// Mappa una slab allineata alla propria dimensione: se ne mappa il doppio e si restituiscono le parti in eccesso
+static bool map_slab(SlabPool *pool) {
+    size_t span = pool->slab_size * 2;
+    char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        perror("mmap slab");
+        return false;
+    }
+    char *start = (char *)(((uintptr_t)raw + pool->slab_size - 1) & ~(uintptr_t)(pool->slab_size - 1));
+    if (start > raw) {
+        munmap(raw, (size_t)(start - raw));
+    }
+    if (start + pool->slab_size < raw + span) {
+        munmap(start + pool->slab_size, (size_t)(raw + span - (start + pool->slab_size)));
+    }
+
+    SlabHeader *slab = (SlabHeader *)start;
+    slab->pool = pool;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+    thread_slab_objects(pool, slab);
+    return true;
+}
+
+void slab_pool_collect(SlabPool *pool) {
+    if (!__atomic_load_n(&pool->remote, __ATOMIC_RELAXED)) {
+        return;
+    }
+    SlabObject *list = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+    while (list) {
+        SlabObject *next = list->next;
+        list->next = pool->free_list;
+        pool->free_list = list;
+        pool->live--;
+        list = next;
+    }
+}
+
+void *slab_pool_alloc(SlabPool *pool) {
+    if (!pool->free_list) {
+        slab_pool_collect(pool);
+        if (!pool->free_list && !map_slab(pool)) {
+            return NULL;
+        }
+    }
+    SlabObject *object = pool->free_list;
+    pool->free_list = object->next;
+    pool->live++;
+    return object;
+}
+
+void slab_pool_free(SlabPool *local, void *object) {
+    if (!object) {
+        return;
+    }
+    SlabPool *owner = object_slab(local, object)->pool;
+    SlabObject *node = object;
+    if (owner == local) {
+        node->next = local->free_list;
+        local->free_list = node;
+        local->live--;
+        return;
+    }
+    // Oggetto di un altro shard: lo si aggiunge alla sua lista remota, che raccoglierà al prossimo bisogno
+    SlabObject *head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+    do {
+        node->next = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote, &head, node, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+bool slab_pool_reset(SlabPool *pool) {
+    if (pool->slab_count <= pool->keep_slabs) {
+        return false;
+    }
+    slab_pool_collect(pool);
+    if (pool->live > 0) {
+        return false;
+    }
+    // Le slab conservate sono le prime della lista; le altre tornano al sistema insieme alla loro memoria
+    SlabHeader **link = &pool->slabs;
+    for (unsigned i = 0; i < pool->keep_slabs && *link; i++) {
+        link = &(*link)->next;
+    }
+    SlabHeader *slab = *link;
+    *link = NULL;
+    while (slab) {
+        SlabHeader *next = slab->next;
+        munmap(slab, pool->slab_size);
+        pool->slab_count--;
+        slab = next;
+    }
+    pool->free_list = NULL;
+    for (slab = pool->slabs; slab; slab = slab->next) {
+        thread_slab_objects(pool, slab);
+    }
+    return true;
+}
+
+uint64_t slab_pool_capacity(const SlabPool *pool) {
+    return (uint64_t)pool->slab_count * pool->slab_objects;
+}
@@ -0,0 +1,59 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_POOL_LINE 64                 // Linea di cache: allineamento e granularità degli oggetti
+#define SLAB_POOL_MIN_SLAB (64 * 1024)    // Dimensione minima di una slab (potenza di 2)
+#define SLAB_POOL_MIN_OBJECTS 16          // La slab cresce per raddoppio finché contiene almeno questi oggetti
+
+typedef struct SlabObject SlabObject;     // Oggetto libero: i primi byte collegano la free list
+typedef struct SlabHeader SlabHeader;
+
+// Pool di oggetti di dimensione fissa di uno shard, usato dal solo thread proprietario.
+// Gli oggetti vivono in slab mappate con mmap e allineate alla propria dimensione: dall'indirizzo di un oggetto
+// si risale alla slab, e quindi al pool che lo ha allocato, senza intestazioni per oggetto. Un oggetto liberato
+// da un altro thread (un client trasferito a un altro shard dello stesso worker) torna al pool proprietario
+// attraverso una lista separata, l'unico campo scritto da più thread.
+typedef struct SlabPool {
+    size_t object_size;       // Dimensione richiesta arrotondata alla linea di cache
+    size_t slab_size;         // Byte di una slab, intestazione compresa
+    unsigned slab_objects;    // Oggetti contenuti in una slab
+    unsigned keep_slabs;      // Slab conservate quando il pool si svuota
+
+    SlabHeader *slabs;        // Slab mappate (lista)
+    unsigned slab_count;
+    SlabObject *free_list;    // Oggetti liberi, in ordine LIFO: l'ultimo liberato è ancora nella cache
+    uint64_t live;            // Oggetti allocati e non ancora tornati alla free list (comprese le liberazioni remote da raccogliere)
+
+    // Oggetti liberati da altri thread, separati dai campi del proprietario da una linea di cache su ogni lato
+    // (i pool stanno in strutture allocate con calloc, senza garanzie di allineamento): pila a cui si aggiunge
+    // con una CAS e che il proprietario stacca per intero, quindi senza il problema ABA
+    char remote_pad[SLAB_POOL_LINE];
+    SlabObject *remote;
+    char remote_tail_pad[SLAB_POOL_LINE - sizeof(SlabObject *)];
+} SlabPool;
+
+// Prepara un pool vuoto per oggetti di object_size byte; nessuna slab viene mappata finché non serve
+void slab_pool_init(SlabPool *pool, size_t object_size, unsigned keep_slabs);
+
+// Alloca un oggetto allineato alla linea di cache, con contenuto indefinito; NULL se non si può mappare una slab
+void *slab_pool_alloc(SlabPool *pool);
+
+// Libera un oggetto allocato da un qualsiasi pool: local è il pool del thread chiamante per lo stesso tipo di
+// oggetto. Se l'oggetto appartiene a local torna subito nella sua free list, altrimenti nella lista remota del proprietario.
+void slab_pool_free(SlabPool *local, void *object);
+
+// Sposta nella free list gli oggetti liberati da altri thread
+void slab_pool_collect(SlabPool *pool);
+
+// Se il pool ha più di keep_slabs slab e nessun oggetto in uso, restituisce al sistema le slab in eccesso e
+// ricompone la free list in ordine di indirizzo. Restituisce true se lo svuotamento è avvenuto.
+bool slab_pool_reset(SlabPool *pool);
+
+// Oggetti che le slab mappate possono contenere
+uint64_t slab_pool_capacity(const SlabPool *pool);
+
+#endif // SLAB_POOL_H
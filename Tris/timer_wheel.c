@@ -0,0 +1,145 @@
+#include "timer_wheel.h"
+#include <limits.h>
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define MAX_DELAY_TICKS (((uint64_t)1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now_ms) {
+    wheel->tick = now_ms / TIMER_TICK_MS + 1; // Il tick in corso è già iniziato: si parte dal successivo
+    wheel->count = 0;
+    for (int level = 0; level < TIMER_LEVELS; ++level) {
+        wheel->occupied[level] = 0;
+        for (int slot = 0; slot < TIMER_SLOTS; ++slot) {
+            TimerNode *head = &wheel->slots[level][slot];
+            head->next = head->prev = head;
+        }
+    }
+}
+
+void timer_init(TimerNode *timer, TimerCallback callback) {
+    timer->next = timer->prev = NULL;
+    timer->callback = callback;
+}
+
+bool timer_pending(const TimerNode *timer) {
+    return timer->next != NULL;
+}
+
+// Il livello dipende dalla distanza della scadenza dal tick corrente, lo slot dai bit della scadenza a quel livello.
+static void insert_timer(TimerWheel *wheel, TimerNode *timer) {
+    uint64_t delta = timer->expires - wheel->tick;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (int)((timer->expires >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK);
+    TimerNode *head = &wheel->slots[level][slot];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    timer->level = (int8_t)level;
+    timer->slot = (uint8_t)slot;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+// Sposta la lista di uno slot in una testa temporanea, lasciando lo slot vuoto.
+static void take_slot(TimerWheel *wheel, int level, int slot, TimerNode *list) {
+    TimerNode *head = &wheel->slots[level][slot];
+    if (head->next == head) {
+        list->next = list->prev = list;
+        return;
+    }
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    head->next = head->prev = head;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+}
+
+// Ridistribuisce lo slot corrente del livello sui livelli inferiori; restituisce l'indice dello slot.
+static int cascade(TimerWheel *wheel, int level) {
+    int slot = (int)((wheel->tick >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK);
+    TimerNode list;
+    take_slot(wheel, level, slot, &list);
+    while (list.next != &list) {
+        TimerNode *timer = list.next;
+        list.next = timer->next;
+        timer->next->prev = &list;
+        insert_timer(wheel, timer);
+    }
+    return slot;
+}
+
+// Il tick corrente inizia dopo l'istante attuale e il ritardo è arrotondato per eccesso: un timer non scade mai in anticipo.
+void timer_arm(TimerWheel *wheel, TimerNode *timer, uint64_t delay_ms) {
+    timer_cancel(wheel, timer);
+    uint64_t ticks = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->expires = wheel->tick + (ticks > MAX_DELAY_TICKS ? MAX_DELAY_TICKS : ticks);
+    insert_timer(wheel, timer);
+    wheel->count++;
+}
+
+void timer_cancel(TimerWheel *wheel, TimerNode *timer) {
+    if (!timer->next) {
+        return;
+    }
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    TimerNode *head = &wheel->slots[timer->level][timer->slot];
+    if (head->next == head) {
+        wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+    }
+    timer->next = timer->prev = NULL;
+    wheel->count--;
+}
+
+// Ogni tick: a inizio giro del livello 0 si ridistribuiscono i livelli superiori, poi scadono i timer dello slot.
+// Il tick avanza prima delle callback, così un timer riarmato da una callback finisce in uno slot futuro.
+// Le callback possono cancellare altri timer, anche tra quelli scaduti nello stesso tick.
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms) {
+    uint64_t target = now_ms / TIMER_TICK_MS;
+    while (wheel->tick <= target) {
+        if (wheel->count == 0) {
+            wheel->tick = target + 1; // Ruota vuota: nessun tick da elaborare uno per uno
+            return;
+        }
+        int index = (int)(wheel->tick & SLOT_MASK);
+        if (index == 0) {
+            for (int level = 1; level < TIMER_LEVELS; ++level) {
+                if (cascade(wheel, level) != 0) {
+                    break; // I livelli ancora superiori scendono solo quando anche questo completa un giro
+                }
+            }
+        }
+        TimerNode expired;
+        take_slot(wheel, 0, index, &expired);
+        wheel->tick++;
+        while (expired.next != &expired) {
+            TimerNode *timer = expired.next;
+            expired.next = timer->next;
+            timer->next->prev = &expired;
+            timer->next = timer->prev = NULL;
+            wheel->count--;
+            timer->callback(timer);
+        }
+    }
+}
+
+// Il livello 0 contiene solo scadenze dei prossimi 64 tick: basta il primo slot occupato dopo quello corrente.
+// Se è vuoto, ci si risveglia al prossimo inizio giro, quando scendono i timer dei livelli superiori.
+int timer_wheel_timeout_ms(const TimerWheel *wheel, uint64_t now_ms) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+    int index = (int)(wheel->tick & SLOT_MASK);
+    uint64_t pending = wheel->occupied[0];
+    uint64_t rotated = index ? (pending >> index) | (pending << (TIMER_SLOTS - index)) : pending;
+    uint64_t ticks = rotated ? (uint64_t)__builtin_ctzll(rotated) : (uint64_t)((TIMER_SLOTS - index) & SLOT_MASK);
+    uint64_t due_ms = (wheel->tick + ticks) * TIMER_TICK_MS;
+    if (due_ms <= now_ms) {
+        return 0;
+    }
+    return due_ms - now_ms > INT_MAX ? INT_MAX : (int)(due_ms - now_ms);
+}
@@ -0,0 +1,61 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_TICK_MS 10        // Risoluzione della ruota
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS) // Slot per livello
+#define TIMER_LEVELS 4          // 64^4 tick = circa 46 ore: scadenze più lontane vengono limitate
+
+// Ricava la struttura che contiene un TimerNode (il timer è incorporato nell'oggetto che temporizza)
+#define TIMER_CONTAINER(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
+typedef struct TimerNode TimerNode;
+
+// Funzione chiamata alla scadenza: il timer è già staccato dalla ruota e può essere riarmato
+typedef void (*TimerCallback)(TimerNode *timer);
+
+// Timer incorporato nell'oggetto da temporizzare: nessuna allocazione per armarlo o cancellarlo
+struct TimerNode {
+    TimerNode *next;        // Lista doppiamente collegata dello slot (NULL se il timer non è armato)
+    TimerNode *prev;
+    uint64_t expires;       // Tick di scadenza
+    int8_t level;           // Livello e slot che contengono il timer, per aggiornare la mappa degli slot occupati
+    uint8_t slot;
+    TimerCallback callback;
+};
+
+// Ruota gerarchica: il livello 0 ha uno slot per tick, ogni livello successivo copre 64 slot del precedente.
+// Quando il livello 0 completa un giro, lo slot corrente del livello 1 viene ridistribuito sui livelli inferiori.
+typedef struct {
+    uint64_t tick;                              // Prossimo tick da elaborare
+    size_t count;                               // Timer armati
+    uint64_t occupied[TIMER_LEVELS];            // Bit i = slot i del livello non vuoto
+    TimerNode slots[TIMER_LEVELS][TIMER_SLOTS]; // Teste delle liste circolari
+} TimerWheel;
+
+// Inizializza la ruota all'istante now_ms (millisecondi di un orologio monotono)
+void timer_wheel_init(TimerWheel *wheel, uint64_t now_ms);
+
+// Prepara un timer non armato con la sua funzione di scadenza
+void timer_init(TimerNode *timer, TimerCallback callback);
+
+// Arma (o riarma) il timer perché scada fra delay_ms millisecondi: O(1)
+void timer_arm(TimerWheel *wheel, TimerNode *timer, uint64_t delay_ms);
+
+// Cancella il timer se armato: O(1)
+void timer_cancel(TimerWheel *wheel, TimerNode *timer);
+
+// Vero se il timer è armato
+bool timer_pending(const TimerNode *timer);
+
+// Esegue le callback dei timer scaduti fino all'istante now_ms
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms);
+
+// Millisecondi di attesa al più prima del prossimo timer (da usare come timeout di epoll_wait), -1 se la ruota è vuota
+int timer_wheel_timeout_ms(const TimerWheel *wheel, uint64_t now_ms);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,83 @@
+#include "tris_ai.h"
+#include "tris_search.h"
+#include "tris_ai_table.h" // Generato da tris_ai_gen.c
+
+// Percentuale di mosse casuali per livello nel tris classico (indice = BotLevel)
+static const uint8_t RANDOM_PERCENT[4] = { 0, 60, 25, 0 };
+
+// Profondità massima della ricerca per livello nelle varianti m,n,k (0 = fino allo scadere del tempo)
+static const uint8_t SEARCH_DEPTH[4] = { 0, 1, 2, 0 };
+
+// Limiti della ricerca, impostati all'avvio del server
+static SearchLimits search_limits = { 5000, 0, 1 };
+
+// Generatore xorshift32: basta per variare le partite, senza stato globale condiviso tra thread.
+static uint32_t next_random(uint32_t *rng) {
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+    return x;
+}
+
+// Sceglie una cella a caso tra quelle di una maschera non vuota.
+static int pick_cell(uint16_t mask, uint32_t *rng) {
+    int n = (int)(next_random(rng) % (uint32_t)__builtin_popcount(mask));
+    while (n-- > 0) {
+        mask &= (uint16_t)(mask - 1); // Scarta il bit più basso
+    }
+    return __builtin_ctz(mask);
+}
+
+// Indice della posizione nella tabella: due accessi alla tabella dei pesi in base 3.
+static uint16_t table_entry(const TrisGame *game) {
+    uint16_t xmask = (uint16_t)(game->marks[0][0] & 0x1FF);
+    uint16_t omask = (uint16_t)(game->marks[1][0] & 0x1FF);
+    return AI_TABLE[AI_BASE3[xmask] + 2 * AI_BASE3[omask]];
+}
+
+void ai_set_search_limits(int time_budget_us, int threads) {
+    search_limits.time_budget_us = time_budget_us;
+    search_limits.threads = threads;
+}
+
+int ai_choose_move(const TrisGame *game, BotLevel level, uint32_t *rng) {
+    if (!is_classic_game(game)) {
+        SearchLimits limits = search_limits;
+        limits.max_depth = SEARCH_DEPTH[level];
+        SearchResult result;
+        return search_best_move(game, &limits, &result);
+    }
+    uint16_t free_cells = (uint16_t)(~(game->marks[0][0] | game->marks[1][0]) & 0x1FF);
+    if (free_cells == 0)
+        return -1;
+
+    if (next_random(rng) % 100 < RANDOM_PERCENT[level])
+        return pick_cell(free_cells, rng);
+
+    uint16_t best = table_entry(game) & 0x1FF;
+    // Tra le mosse ottimali equivalenti se ne sceglie una a caso, per non ripetere sempre la stessa partita
+    return pick_cell(best ? best : free_cells, rng);
+}
+
+int ai_suggest_move(const TrisGame *game, int *outcome) {
+    *outcome = 0;
+    if (!is_classic_game(game)) {
+        SearchResult result;
+        int cell = search_best_move(game, &search_limits, &result);
+        if (result.score > SEARCH_SCORE_DECIDED) *outcome = 1;
+        if (result.score < -SEARCH_SCORE_DECIDED) *outcome = -1;
+        return cell;
+    }
+    uint16_t free_cells = (uint16_t)(~(game->marks[0][0] | game->marks[1][0]) & 0x1FF);
+    if (free_cells == 0)
+        return -1;
+    uint16_t best = table_entry(game) & 0x1FF;
+    *outcome = ai_position_value(game);
+    return __builtin_ctz(best ? best : free_cells); // Suggerimento stabile: la prima delle mosse ottimali
+}
+
+int ai_position_value(const TrisGame *game) {
+    return (int)((table_entry(game) >> 9) & 0x3) - 1;
+}
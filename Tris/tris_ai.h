@@ -0,0 +1,32 @@
+#ifndef TRIS_AI_H
+#define TRIS_AI_H
+
+#include <stdint.h>
+#include "tris_game.h"
+
+// Livelli del bot. Nel tris classico: probabilità di giocare una mossa casuale invece di una ottimale.
+// Nelle varianti m,n,k: profondità della ricerca alpha-beta.
+typedef enum {
+    BOT_NONE = 0,       // Nessun bot: avversario umano
+    BOT_EASY = 1,       // Facile: 60% di mosse casuali / ricerca a profondità 1
+    BOT_MEDIUM = 2,     // Medio: 25% di mosse casuali / ricerca a profondità 2
+    BOT_HARD = 3        // Difficile: sempre una mossa ottimale (imbattibile) / ricerca fino allo scadere del tempo
+} BotLevel;
+
+// Imposta tempo per mossa (microsecondi) e thread della ricerca usata nelle varianti m,n,k
+void ai_set_search_limits(int time_budget_us, int threads);
+
+// Sceglie la mossa del giocatore di turno: nel tris classico con un solo accesso alla tabella precalcolata,
+// nelle varianti m,n,k con la ricerca di tris_search. rng è lo stato del generatore pseudo-casuale del chiamante (diverso da 0).
+// Restituisce l'indice della cella (riga * colonne + colonna), -1 se non ci sono mosse.
+int ai_choose_move(const TrisGame *game, BotLevel level, uint32_t *rng);
+
+// Suggerisce la mossa migliore per il giocatore di turno e ne stima l'esito in *outcome:
+// 1 vittoria forzata, -1 sconfitta forzata, 0 pareggio (tris classico) o esito non ancora deciso.
+// Restituisce l'indice della cella, -1 se non ci sono mosse.
+int ai_suggest_move(const TrisGame *game, int *outcome);
+
+// Valore minimax di una posizione del tris classico per il giocatore di turno: 1 vittoria, 0 pareggio, -1 sconfitta (gioco perfetto)
+int ai_position_value(const TrisGame *game);
+
+#endif // TRIS_AI_H
@@ -0,0 +1,92 @@
+// Generatore della tabella del bot: risolve con minimax tutte le posizioni raggiungibili del tris
+// classico e scrive su stdout l'header tris_ai_table.h, incluso da tris_ai.c.
+// Uso: gcc tris_ai_gen.c -o tris_ai_gen && ./tris_ai_gen > tris_ai_table.h
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CELLS 9
+#define POSITIONS 19683 // 3^9: ogni posizione è indicizzata dal tabellone in base 3 (X = 1, O = 2)
+
+static const uint16_t LINES[8] = { 0x007, 0x038, 0x1C0, 0x049, 0x092, 0x124, 0x111, 0x054 };
+
+static uint16_t table[POSITIONS]; // Voce finale della tabella (0 = posizione non raggiungibile)
+static int8_t value_of[POSITIONS]; // Valore minimax per chi muove: -1 sconfitta, 0 pareggio, 1 vittoria
+static uint8_t solved[POSITIONS];
+static int pow3[CELLS];
+
+static int has_line(uint16_t mask) {
+    for (int i = 0; i < 8; ++i) {
+        if ((mask & LINES[i]) == LINES[i]) return 1;
+    }
+    return 0;
+}
+
+static int code_of(uint16_t xmask, uint16_t omask) {
+    int code = 0;
+    for (int i = 0; i < CELLS; ++i) {
+        if (xmask & (1u << i)) code += pow3[i];
+        if (omask & (1u << i)) code += 2 * pow3[i];
+    }
+    return code;
+}
+
+// Negamax sulla posizione: valore per chi muove e insieme delle mosse che lo ottengono
+static int solve(uint16_t xmask, uint16_t omask, int x_to_move) {
+    int code = code_of(xmask, omask);
+    if (solved[code]) return value_of[code];
+
+    uint16_t theirs = x_to_move ? omask : xmask;
+    int best = -2;
+    uint16_t best_moves = 0;
+    if (has_line(theirs)) {
+        best = -1; // L'avversario ha appena completato un tris
+    } else if ((xmask | omask) == 0x1FF) {
+        best = 0;  // Pareggio
+    } else {
+        for (int cell = 0; cell < CELLS; ++cell) {
+            uint16_t bit = (uint16_t)(1u << cell);
+            if ((xmask | omask) & bit) continue;
+            int v = x_to_move ? -solve(xmask | bit, omask, 0) : -solve(xmask, omask | bit, 1);
+            if (v > best) {
+                best = v;
+                best_moves = bit;
+            } else if (v == best) {
+                best_moves |= bit;
+            }
+        }
+    }
+    solved[code] = 1;
+    value_of[code] = (int8_t)best;
+    // bit 0-8: mosse ottimali, bit 9-10: valore + 1, bit 15: posizione raggiungibile
+    table[code] = (uint16_t)(0x8000 | ((best + 1) << 9) | best_moves);
+    return best;
+}
+
+int main(void) {
+    pow3[0] = 1;
+    for (int i = 1; i < CELLS; ++i) pow3[i] = pow3[i - 1] * 3;
+    solve(0, 0, 1);
+
+    int reachable = 0;
+    for (int i = 0; i < POSITIONS; ++i) reachable += solved[i];
+
+    printf("// File generato da tris_ai_gen.c: non modificare a mano.\n");
+    printf("// Posizioni raggiungibili: %d su %d.\n\n", reachable, POSITIONS);
+    printf("#ifndef TRIS_AI_TABLE_H\n#define TRIS_AI_TABLE_H\n\n");
+
+    printf("// Peso in base 3 di una maschera di 9 celle: indice = AI_BASE3[x] + 2 * AI_BASE3[o]\n");
+    printf("static const uint16_t AI_BASE3[512] = {");
+    for (int m = 0; m < 512; ++m) {
+        printf("%s%d", m == 0 ? "\n    " : m % 16 ? ", " : ",\n    ", code_of((uint16_t)m, 0));
+    }
+    printf("\n};\n\n");
+
+    printf("// Per ogni posizione: bit 0-8 mosse ottimali per chi muove, bit 9-10 valore + 1, bit 15 raggiungibile\n");
+    printf("static const uint16_t AI_TABLE[%d] = {", POSITIONS);
+    for (int i = 0; i < POSITIONS; ++i) {
+        printf("%s0x%04x", i == 0 ? "\n    " : i % 12 ? ", " : ",\n    ", table[i]);
+    }
+    printf("\n};\n\n#endif // TRIS_AI_TABLE_H\n");
+    return 0;
+}
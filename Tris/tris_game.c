@@ -1,81 +1,217 @@
 #include "tris_game.h"
+#include <stdio.h>
 #include <string.h>
 
+// Tabella delle vittorie: il bit m è 1 se la maschera di 9 celle m contiene almeno un tris
+// (riga, colonna o diagonale). 512 bit = 64 byte, sempre in cache.
+static const uint8_t WIN_TABLE[64] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xff, 0x80, 0xaa, 0xf0, 0xfa, 0x80, 0xaa, 0xf0, 0xff,
+    0x80, 0x80, 0xcc, 0xcc, 0x80, 0x80, 0xcc, 0xff, 0x80, 0xaa, 0xfc, 0xfe, 0x80, 0xaa, 0xfc, 0xff,
+    0x80, 0x80, 0xaa, 0xaa, 0xf0, 0xf0, 0xfa, 0xff, 0x80, 0xaa, 0xfa, 0xfa, 0xf0, 0xfa, 0xfa, 0xff,
+    0x80, 0x80, 0xee, 0xee, 0xf0, 0xf0, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
 // Inizializza una nuova partita svuotando il tabellone e impostando il turno iniziale al giocatore X (turno = 0).
 void init_game(TrisGame *game) {
-    memset(game, 0, sizeof(TrisGame));
+    init_game_variant(game, SIZE, SIZE, SIZE);
+}
+
+// Accetta tabelloni da MIN_BOARD_SIDE a MAX_BOARD_SIDE per lato, con k realizzabile su almeno una direzione.
+int init_game_variant(TrisGame *game, int rows, int cols, int k) {
+    if (rows < MIN_BOARD_SIDE || rows > MAX_BOARD_SIDE || cols < MIN_BOARD_SIDE || cols > MAX_BOARD_SIDE)
+        return -1;
+    if (k < MIN_BOARD_SIDE || (k > rows && k > cols))
+        return -1;
+
+    game->rows = (uint8_t)rows;
+    game->cols = (uint8_t)cols;
+    game->k = (uint8_t)k;
+    reset_game(game);
+    return 0;
+}
+
+// Svuota le bitboard; la variante resta quella scelta alla creazione.
+void reset_game(TrisGame *game) {
+    memset(game->marks, 0, sizeof(game->marks));
+    game->last_move = -1;
+    game->moves = 0;
+    game->turn = 0;
+}
+
+bool is_classic_game(const TrisGame *game) {
+    return game->rows == SIZE && game->cols == SIZE && game->k == SIZE;
 }
 
 
 // Tenta di effettuare una mossa sulla cella specificata. Restituisce 0 se la mossa è valida, -1 altrimenti.
 int make_move(TrisGame *game, int row, int col) {
-    if (row < 0 || row >= SIZE || col < 0 || col >= SIZE)
+    if (row < 0 || row >= game->rows || col < 0 || col >= game->cols)
         return -1;
-    if (game->board[row][col] != EMPTY)
+    return make_move_index(game, row * game->cols + col);
+}
+
+// Mossa sulla bitboard: la cella è libera se il suo bit non è in nessuna delle due maschere.
+int make_move_index(TrisGame *game, int cell) {
+    if (cell < 0 || cell >= game->rows * game->cols)
+        return -1;
+    int word = cell >> 6;
+    uint64_t bit = (uint64_t)1 << (cell & 63);
+    if ((game->marks[0][word] | game->marks[1][word]) & bit)
         return -1;
 
-    game->board[row][col] = (game->turn == 0) ? X : O;
-    game->turn = 1 - game->turn;
+    game->marks[game->turn][word] |= bit;
+    game->turn ^= 1;
+    game->last_move = (int16_t)cell;
+    game->moves++;
     return 0;
 }
 
+// Un solo accesso alla tabella per maschera.
+GameResult check_mask(uint16_t mask) {
+    return ((WIN_TABLE[mask >> 3] >> (mask & 7)) & 1) ? WIN : IN_PROGRESS;
+}
+
+// Conta le celle consecutive del giocatore a partire da (row, col), esclusa, nella direzione (dr, dc).
+static int count_direction(const TrisGame *game, const uint64_t *mask, int row, int col, int dr, int dc) {
+    int count = 0;
+    for (int i = 1; i < game->k; ++i) {
+        row += dr;
+        col += dc;
+        if (row < 0 || row >= game->rows || col < 0 || col >= game->cols)
+            break;
+        int cell = row * game->cols + col;
+        if (!((mask[cell >> 6] >> (cell & 63)) & 1))
+            break;
+        count++;
+    }
+    return count;
+}
+
 // Verifica lo stato della partita: vittoria, pareggio o in corso. Restituisce WIN, DRAW o IN_PROGRESS.
+// Solo chi ha appena mosso può aver completato una fila, e solo lungo le quattro direzioni
+// che passano per l'ultima mossa: il costo è O(k), indipendente dalla dimensione del tabellone.
 GameResult check_winner(TrisGame *game) {
-    Cell (*b)[SIZE] = game->board;
+    if (game->last_move < 0)
+        return IN_PROGRESS;
 
-    // Controllo righe e colonne
-    for (int i = 0; i < SIZE; ++i) {
-        if (b[i][0] != EMPTY && b[i][0] == b[i][1] && b[i][1] == b[i][2])
-            return WIN;
-        if (b[0][i] != EMPTY && b[0][i] == b[1][i] && b[1][i] == b[2][i])
+    const uint64_t *mask = game->marks[game->turn ^ 1];
+    if (is_classic_game(game)) {
+        if (check_mask((uint16_t)mask[0]) == WIN)
             return WIN;
+    } else {
+        static const int directions[4][2] = { {0, 1}, {1, 0}, {1, 1}, {1, -1} };
+        int row = game->last_move / game->cols;
+        int col = game->last_move % game->cols;
+        for (int d = 0; d < 4; ++d) {
+            int dr = directions[d][0], dc = directions[d][1];
+            if (1 + count_direction(game, mask, row, col, dr, dc) + count_direction(game, mask, row, col, -dr, -dc) >= game->k)
+                return WIN;
+        }
     }
 
-    // Controllo diagonali
-    if (b[0][0] != EMPTY && b[0][0] == b[1][1] && b[1][1] == b[2][2])
-        return WIN;
-    if (b[0][2] != EMPTY && b[0][2] == b[1][1] && b[1][1] == b[2][0])
-        return WIN;
+    // Pareggio: tutte le celle occupate
+    if (game->moves == game->rows * game->cols)
+        return DRAW;
 
-    // Verifica celle vuote rimaste
-    for (int i = 0; i < SIZE; ++i)
-        for (int j = 0; j < SIZE; ++j)
-            if (b[i][j] == EMPTY)
-                return IN_PROGRESS;
+    return IN_PROGRESS;
+}
 
-    return DRAW;
+// Legge una cella dalle due maschere.
+Cell get_cell(const TrisGame *game, int row, int col) {
+    int cell = row * game->cols + col;
+    uint64_t bit = (uint64_t)1 << (cell & 63);
+    if (game->marks[0][cell >> 6] & bit)
+        return X;
+    if (game->marks[1][cell >> 6] & bit)
+        return O;
+    return EMPTY;
 }
 
-// Stampa il tabellone di gioco nel buffer dato. I simboli usati sono: '.' = vuoto, 'X', 'O'
-void print_board(TrisGame *game, char *buffer) {
-    char *ptr = buffer;
+// Modello del tabellone testuale del tris classico, con tutte le celle vuote: un tabellone si ottiene
+// copiando il modello e scrivendo un byte per ogni cella occupata.
+static const char CLASSIC_TEMPLATE[] =
+    " . | . | . \n"
+    "---+---+---\n"
+    " . | . | . \n"
+    "---+---+---\n"
+    " . | . | . \n";
+
+// Posizione nel modello del simbolo di ogni cella del tris classico
+static const uint8_t CLASSIC_CELL_OFFSET[SIZE * SIZE] = { 1, 5, 9, 25, 29, 33, 49, 53, 57 };
+
+// Modello dell'ultima variante m,n,k renderizzata dal thread (le partite di uno shard sono quasi sempre
+// della stessa variante): riga di intestazione con gli indici delle colonne, poi una riga per riga del tabellone
+static __thread struct {
+    uint8_t rows, cols;     // Variante del modello (0 se non ancora costruito)
+    uint16_t len;           // Lunghezza del testo
+    char text[BOARD_TEXT_SIZE];
+} mnk_template;
 
-    for (int i = 0; i < SIZE; ++i) {
-        // Stampa una riga di celle con separatori verticali
-        for (int j = 0; j < SIZE; ++j) {
-            char c = (game->board[i][j] == EMPTY) ? '.' :
-                     (game->board[i][j] == X) ? 'X' : 'O';
+// Lunghezza di una riga del tabellone m,n,k: indice su 3 caratteri, 3 caratteri per cella, '\n'
+static int mnk_line_length(int cols) {
+    return 3 + 3 * cols + 1;
+}
+
+// Costruisce il modello di una variante m,n,k con le celle vuote
+static void build_mnk_template(int rows, int cols) {
+    char *ptr = mnk_template.text;
+    ptr += sprintf(ptr, "   ");
+    for (int j = 0; j < cols; ++j) {
+        ptr += sprintf(ptr, "%3d", j);
+    }
+    *ptr++ = '\n';
+    for (int i = 0; i < rows; ++i) {
+        ptr += sprintf(ptr, "%3d", i);
+        for (int j = 0; j < cols; ++j) {
             *ptr++ = ' ';
-            *ptr++ = c;
             *ptr++ = ' ';
-            if (j < SIZE - 1) {
-                *ptr++ = '|';  // separatore verticale
-            }
+            *ptr++ = '.';
         }
         *ptr++ = '\n';
+    }
+    mnk_template.rows = (uint8_t)rows;
+    mnk_template.cols = (uint8_t)cols;
+    mnk_template.len = (uint16_t)(ptr - mnk_template.text);
+}
+
+size_t board_text_length(const TrisGame *game) {
+    if (is_classic_game(game))
+        return sizeof(CLASSIC_TEMPLATE) - 1;
+    return (size_t)mnk_line_length(game->cols) * (size_t)(game->rows + 1);
+}
+
+// Copia il modello della variante e vi scrive i simboli delle celle occupate, percorrendo i bit delle due maschere:
+// il costo dipende dalle mosse giocate, non dalla dimensione del tabellone.
+size_t render_board(const TrisGame *game, char *buffer) {
+    static const char symbols[2] = { 'X', 'O' };
+    if (is_classic_game(game)) {
+        memcpy(buffer, CLASSIC_TEMPLATE, sizeof(CLASSIC_TEMPLATE) - 1);
+        for (int p = 0; p < 2; ++p) {
+            for (uint64_t bits = game->marks[p][0]; bits; bits &= bits - 1)
+                buffer[CLASSIC_CELL_OFFSET[__builtin_ctzll(bits)]] = symbols[p];
+        }
+        return sizeof(CLASSIC_TEMPLATE) - 1;
+    }
 
-        // Stampa la linea orizzontale tranne dopo l'ultima riga
-        if (i < SIZE - 1) {
-            for (int k = 0; k < SIZE; ++k) {
-                *ptr++ = '-';
-                *ptr++ = '-';
-                *ptr++ = '-';
-                if (k < SIZE - 1) {
-                    *ptr++ = '+';
-                }
+    if (mnk_template.rows != game->rows || mnk_template.cols != game->cols)
+        build_mnk_template(game->rows, game->cols);
+    memcpy(buffer, mnk_template.text, mnk_template.len);
+    int line = mnk_line_length(game->cols);
+    for (int p = 0; p < 2; ++p) {
+        for (int w = 0; w < BOARD_WORDS; ++w) {
+            for (uint64_t bits = game->marks[p][w]; bits; bits &= bits - 1) {
+                int cell = (w << 6) + __builtin_ctzll(bits);
+                int row = cell / game->cols, col = cell % game->cols;
+                buffer[line * (row + 1) + 5 + 3 * col] = symbols[p]; // Dopo l'indice di riga, terzo carattere della cella
             }
-            *ptr++ = '\n';
         }
     }
-    *ptr = '\0';
-}
\ No newline at end of file
+    return mnk_template.len;
+}
+
+// Stampa il tabellone di gioco nel buffer dato. I simboli usati sono: '.' = vuoto, 'X', 'O'.
+// Il tris classico usa la griglia con separatori; i tabelloni più grandi una griglia compatta
+// con gli indici di riga e di colonna, necessari per scegliere la mossa.
+void print_board(TrisGame *game, char *buffer) {
+    buffer[render_board(game, buffer)] = '\0';
+}
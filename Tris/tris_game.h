@@ -1,7 +1,16 @@
 #ifndef TRIS_GAME_H
 #define TRIS_GAME_H
 
-#define SIZE 3
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIZE 3                  // Lato del tris classico (3x3, 3 in fila)
+#define MIN_BOARD_SIDE 3        // Lato minimo di un tabellone m,n,k
+#define MAX_BOARD_SIDE 19       // Lato massimo di un tabellone m,n,k (goban 19x19)
+#define MAX_CELLS (MAX_BOARD_SIDE * MAX_BOARD_SIDE)
+#define BOARD_WORDS ((MAX_CELLS + 63) / 64) // Parole a 64 bit di una bitboard
+#define BOARD_TEXT_SIZE 4096    // Dimensione sufficiente per print_board del tabellone più grande
 
 // Stato di ogni cella del tabellone
 typedef enum { EMPTY, X, O } Cell;
@@ -9,22 +18,54 @@ typedef enum { EMPTY, X, O } Cell;
 // Stato della partita
 typedef enum { IN_PROGRESS, WIN, DRAW } GameResult;
 
-// Struttura dati che rappresenta lo stato di una partita di tris
+// Struttura dati che rappresenta una partita m,n,k (rows x cols, k in fila per vincere) come bitboard:
+// il bit (riga * cols + colonna) di marks[0] è la cella di X, quello di marks[1] la cella di O.
+// Il tris classico è la variante 3,3,3 e occupa i 9 bit bassi della prima parola.
 typedef struct {
-    Cell board[SIZE][SIZE]; // Griglia di gioco
+    uint8_t rows;           // Numero di righe (m)
+    uint8_t cols;           // Numero di colonne (n)
+    uint8_t k;              // Simboli in fila necessari per vincere
+    int16_t last_move;      // Indice dell'ultima cella giocata (-1 se nessuna)
+    uint16_t moves;         // Celle occupate
     int turn;               // 0 = turno X, 1 = turno O
+    uint64_t marks[2][BOARD_WORDS]; // Celle occupate da X (indice 0) e da O (indice 1)
 } TrisGame;
 
-// Inizializza la partita: svuota il tabellone e imposta il turno a X
+// Inizializza la partita come tris classico: svuota il tabellone e imposta il turno a X
 void init_game(TrisGame *game);
 
+// Inizializza una partita m,n,k; restituisce 0 se la variante è valida, -1 altrimenti
+int init_game_variant(TrisGame *game, int rows, int cols, int k);
+
+// Svuota il tabellone mantenendo la variante e imposta il turno a X
+void reset_game(TrisGame *game);
+
+// Vero se la partita è il tris classico 3x3
+bool is_classic_game(const TrisGame *game);
+
 // Esegue una mossa nella cella (row, col); restituisce 0 se valida, -1 altrimenti
 int make_move(TrisGame *game, int row, int col);
 
 // Verifica lo stato attuale della partita: vittoria, pareggio o in corso
 GameResult check_winner(TrisGame *game);
 
-// Scrive la rappresentazione testuale del tabellone nel buffer fornito
+// Scrive la rappresentazione testuale del tabellone nel buffer fornito (almeno BOARD_TEXT_SIZE byte)
 void print_board(TrisGame *game, char *buffer);
 
+// Lunghezza del testo scritto da render_board per la variante della partita
+size_t board_text_length(const TrisGame *game);
+
+// Scrive il tabellone testuale nel buffer (almeno board_text_length byte) partendo da un modello costante della
+// variante in cui si scrivono solo le celle occupate. Non aggiunge il terminatore; restituisce la lunghezza.
+size_t render_board(const TrisGame *game, char *buffer);
+
+// Restituisce il contenuto della cella (row, col)
+Cell get_cell(const TrisGame *game, int row, int col);
+
+// Esegue una mossa nella cella di indice (riga * cols + colonna); restituisce 0 se valida, -1 altrimenti
+int make_move_index(TrisGame *game, int cell);
+
+// Restituisce WIN se la maschera di celle del tris classico contiene un tris (tabella di 512 bit)
+GameResult check_mask(uint16_t mask);
+
 #endif // TRIS_GAME_H
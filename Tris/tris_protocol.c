@@ -0,0 +1,38 @@
+#include "tris_protocol.h"
+
+// Codifica il frame in big endian, indipendentemente dall'architettura.
+void proto_encode(const ProtoFrame *frame, uint8_t out[PROTO_FRAME_SIZE]) {
+    out[0] = frame->op;
+    out[1] = frame->code;
+    out[2] = (uint8_t)(frame->aux >> 8);
+    out[3] = (uint8_t)frame->aux;
+    out[4] = (uint8_t)(frame->arg >> 24);
+    out[5] = (uint8_t)(frame->arg >> 16);
+    out[6] = (uint8_t)(frame->arg >> 8);
+    out[7] = (uint8_t)frame->arg;
+}
+
+// Decodifica un frame ricevuto in big endian.
+void proto_decode(const uint8_t in[PROTO_FRAME_SIZE], ProtoFrame *frame) {
+    frame->op = in[0];
+    frame->code = in[1];
+    frame->aux = (uint16_t)((in[2] << 8) | in[3]);
+    frame->arg = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) | ((uint32_t)in[6] << 8) | (uint32_t)in[7];
+}
+
+// Ogni cella è una cifra in base 3 (EMPTY = 0, X = 1, O = 2): 3^9 = 19683 stati stanno in 16 bit.
+uint16_t proto_pack_board(const TrisGame *game) {
+    uint16_t packed = 0;
+    for (int i = SIZE * SIZE - 1; i >= 0; --i) {
+        packed = (uint16_t)(packed * 3 + get_cell(game, i / SIZE, i % SIZE));
+    }
+    return packed;
+}
+
+// Estrae le cifre in base 3 a partire dalla cella (0, 0).
+void proto_unpack_board(uint16_t packed, Cell board[SIZE][SIZE]) {
+    for (int i = 0; i < SIZE * SIZE; ++i) {
+        board[i / SIZE][i % SIZE] = (Cell)(packed % 3);
+        packed /= 3;
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef TRIS_PROTOCOL_H
+#define TRIS_PROTOCOL_H
+
+#include <stdint.h>
+#include "tris_game.h"
+
+// Protocollo binario, alternativo a quello testuale e negoziato con il comando testuale "binary".
+// Ogni messaggio, in entrambe le direzioni, è un frame di lunghezza fissa:
+//   byte 0    op    codice operativo
+//   byte 1    code  sottocodice (evento, errore, flag di stato, riga della mossa...)
+//   byte 2-3  aux   campo ausiliario a 16 bit (big endian)
+//   byte 4-7  arg   argomento a 32 bit (big endian), di norma l'ID della partita
+#define PROTO_FRAME_SIZE 8
+#define PROTO_VERSION 2 // 2: lista a pagine e con modifiche incrementali (LIST_END porta la versione della lista)
+
+// Frame decodificato
+typedef struct {
+    uint8_t op;
+    uint8_t code;
+    uint16_t aux;
+    uint32_t arg;
+} ProtoFrame;
+
+// Codici operativi: da client a server (< 0x80) e da server a client (>= 0x80)
+typedef enum {
+    PROTO_OP_LIST = 0x01,      // Elenca le partite: code = flag PROTO_LIST_*, aux = variante (0 = tutte), arg = pagina o versione nota
+    PROTO_OP_CREATE = 0x02,    // Crea una partita: aux = variante PROTO_VARIANT (0 = tris classico), code = livello del bot (0 = nessuno)
+    PROTO_OP_JOIN = 0x03,      // Unisciti alla partita arg
+    PROTO_OP_ACCEPT = 0x04,    // Accetta l'avversario in attesa
+    PROTO_OP_REJECT = 0x05,    // Rifiuta l'avversario in attesa
+    PROTO_OP_LEAVE = 0x06,     // Lascia la partita
+    PROTO_OP_MOVE = 0x07,      // Mossa: code = riga, aux = colonna
+    PROTO_OP_REMATCH = 0x08,   // Richiedi la rivincita
+    PROTO_OP_QUIT = 0x09,      // Disconnettiti
+    PROTO_OP_HINT = 0x0A,      // Chiedi un suggerimento sulla mossa (solo nel proprio turno)
+    PROTO_OP_QUEUE = 0x0B,     // Entra in coda di matchmaking: aux = variante PROTO_VARIANT (0 = tris classico)
+    PROTO_OP_WATCH = 0x0C,     // Segui come spettatore la partita arg
+    PROTO_OP_UNWATCH = 0x0D,   // Smetti di seguire la partita
+    PROTO_OP_RESUME = 0x0E,    // Rientra nella partita dopo una disconnessione o un riavvio: codice di rientro in code (bit 48-55), aux (bit 32-47) e arg (bit 0-31)
+    PROTO_OP_REPLAY = 0x0F,    // Chiedi il replay arg: risponde PROTO_OP_REPLAY_DATA seguito dal record
+    PROTO_OP_REPLAYS = 0x10,   // Elenca i replay della partita arg (code = 0) o del giocatore della connessione (code = PROTO_REPLAYS_PLAYER): frame PROTO_OP_REPLAY_ENTRY chiusi da PROTO_OP_LIST_END (aux = voci)
+    PROTO_OP_RATING = 0x11,    // Chiedi punteggio e posizione del giocatore registrato (il nome si sceglie con "login" prima di "binary")
+
+    PROTO_OP_HELLO = 0x80,     // Conferma del passaggio al protocollo binario: code = versione
+    PROTO_OP_EVENT = 0x81,     // Evento: code = ProtoEvent, arg = ID partita
+    PROTO_OP_ERROR = 0x82,     // Errore: code = ProtoError
+    PROTO_OP_STATE = 0x83,     // Tabellone: code = flag PROTO_STATE_*, aux = tabellone compatto o ultima mossa, arg = ID partita
+    PROTO_OP_GAME = 0x84,      // Voce della lista: code = stato della partita (PROTO_GAME_REMOVED nelle modifiche), aux = variante, arg = ID partita
+    PROTO_OP_LIST_END = 0x85,  // Fine della lista: code = flag PROTO_LIST_MORE/PROTO_LIST_DELTA, aux = voci inviate, arg = versione della lista
+    PROTO_OP_HINT_REPLY = 0x86, // Suggerimento: code = PROTO_HINT_*, aux = indice della cella (riga * colonne + colonna), arg = ID partita
+    PROTO_OP_CELL = 0x87,      // Istantanea per uno spettatore di una variante m,n,k: code = simbolo (1 = X, 2 = O), aux = indice della cella, arg = ID partita
+    PROTO_OP_TOKEN = 0x88,     // Codice di rientro del tuo posto nella partita appena creata o iniziata: code, aux e arg come in PROTO_OP_RESUME
+    PROTO_OP_REPLAY_DATA = 0x89, // Replay arg: seguono aux byte del record così come è salvato (ReplayHeader little-endian e mosse, multiplo di 8 byte)
+    PROTO_OP_REPLAY_ENTRY = 0x8A, // Voce dei replay di una partita: code = esito (ReplayResult), aux = mosse, arg = ID del replay
+    PROTO_OP_RATING_INFO = 0x8B // Punteggio Elo in aux e posizione in classifica in arg: code = 0 in risposta a PROTO_OP_RATING, 1 dopo una partita valutata
+} ProtoOp;
+
+// Eventi (PROTO_OP_EVENT)
+typedef enum {
+    PROTO_EV_GAME_CREATED = 1,     // Partita creata, aux = simbolo del giocatore
+    PROTO_EV_JOIN_SENT,            // Richiesta di unione inviata al proprietario
+    PROTO_EV_JOIN_REQUEST,         // Un giocatore vuole unirsi alla tua partita
+    PROTO_EV_GAME_STARTED,         // La partita è iniziata (accettazione)
+    PROTO_EV_JOIN_REJECTED,        // La tua richiesta è stata rifiutata
+    PROTO_EV_PLAYER_REJECTED,      // Hai rifiutato il giocatore in attesa
+    PROTO_EV_LEFT,                 // Hai lasciato la partita
+    PROTO_EV_OPPONENT_LEFT,        // L'avversario ha lasciato, la partita torna in attesa
+    PROTO_EV_OWNER_LEFT,           // Il proprietario ha lasciato, la partita è chiusa
+    PROTO_EV_WIN,                  // Hai vinto
+    PROTO_EV_LOSE,                 // Hai perso
+    PROTO_EV_DRAW,                 // Pareggio: 'rematch' o 'leave'
+    PROTO_EV_NEW_OWNER,            // Sei il nuovo proprietario, in attesa di un avversario
+    PROTO_EV_REMOVED,              // Sei stato rimosso dalla partita
+    PROTO_EV_REMATCH_SENT,         // Richiesta di rivincita inviata
+    PROTO_EV_REMATCH_REQUESTED,    // L'avversario chiede la rivincita
+    PROTO_EV_REMATCH_STARTED,      // La rivincita è iniziata
+    PROTO_EV_GAME_AVAILABLE,       // Non più inviato (le nuove partite si seguono con PROTO_LIST_SINCE): valore riservato
+    PROTO_EV_BYE,                  // Disconnessione confermata
+    PROTO_EV_TURN_TIMEOUT,         // Non hai mosso in tempo: hai lasciato la partita
+    PROTO_EV_JOIN_EXPIRED,         // La richiesta di unione è scaduta senza risposta
+    PROTO_EV_IDLE_TIMEOUT,         // Disconnessione per inattività
+    PROTO_EV_QUEUED,               // Sei in coda, in attesa di un avversario
+    PROTO_EV_QUEUE_LEFT,           // Sei uscito dalla coda
+    PROTO_EV_MATCH_FOUND,          // Avversario trovato: la partita arg è iniziata senza accettazione
+    PROTO_EV_WATCHING,             // Stai seguendo la partita arg: seguono l'istantanea e gli aggiornamenti STATE
+    PROTO_EV_UNWATCHED,            // Non segui più la partita
+    PROTO_EV_WATCH_ENDED,          // La partita seguita è stata chiusa
+    PROTO_EV_RESUMED,              // Sei rientrato nella partita arg: segue il tabellone
+    PROTO_EV_PLAYER_RESUMED,       // L'avversario è rientrato nella partita
+    PROTO_EV_PLAYER_DETACHED,      // La connessione dell'avversario è caduta: il suo posto resta tenuto fino al rientro
+    PROTO_EV_SESSION_REPLACED,     // Il tuo posto è stato ripreso con il tuo codice da un'altra connessione
+    PROTO_EV_REPLAY_SAVED          // Il round appena terminato è stato salvato: arg = ID del replay
+} ProtoEvent;
+
+// Errori (PROTO_OP_ERROR)
+typedef enum {
+    PROTO_ERR_INTERNAL = 1,        // Errore interno del server
+    PROTO_ERR_UNKNOWN_COMMAND,     // Codice operativo sconosciuto
+    PROTO_ERR_ALREADY_IN_GAME,     // Sei già in una partita
+    PROTO_ERR_MAX_GAMES,           // Numero massimo di partite raggiunto
+    PROTO_ERR_GAME_NOT_FOUND,      // Partita non trovata
+    PROTO_ERR_GAME_UNAVAILABLE,    // Partita in corso, terminata o con avversario
+    PROTO_ERR_OWN_GAME,            // Non puoi unirti alla tua partita
+    PROTO_ERR_NOT_OWNER,           // Comando riservato al proprietario
+    PROTO_ERR_NO_PENDING_PLAYER,   // Nessun giocatore in attesa
+    PROTO_ERR_NOT_IN_GAME,         // Non sei in una partita
+    PROTO_ERR_GAME_NOT_RUNNING,    // La partita non è in corso
+    PROTO_ERR_GAME_ENDED,          // La partita è terminata
+    PROTO_ERR_NOT_YOUR_TURN,       // Non è il tuo turno
+    PROTO_ERR_INVALID_MOVE,        // Mossa non valida
+    PROTO_ERR_NO_REMATCH,          // La partita non è in pareggio
+    PROTO_ERR_INVALID_VARIANT,     // Variante m,n,k non valida
+    PROTO_ERR_QUEUED,              // Sei in coda di matchmaking
+    PROTO_ERR_NOT_WATCHING,        // Non stai seguendo nessuna partita
+    PROTO_ERR_RESUME_DENIED,       // Codice di rientro non valido o partita non più disponibile
+    PROTO_ERR_REPLAY_NOT_FOUND,    // Replay inesistente, archivio disattivato o in un altro shard mentre sei in partita
+    PROTO_ERR_NOT_LOGGED_IN,       // Comando riservato ai giocatori registrati con "login"
+    PROTO_ERR_INPUT_OVERFLOW       // Troppi comandi inviati in anticipo durante un trasferimento: la connessione viene chiusa
+} ProtoError;
+
+// Flag di PROTO_OP_STATE
+#define PROTO_STATE_TURN_O    0x01 // Il prossimo a muovere è O
+#define PROTO_STATE_YOUR_TURN 0x02 // Il prossimo a muovere è il destinatario
+#define PROTO_STATE_WIN       0x04 // Tabellone finale di una vittoria
+#define PROTO_STATE_DRAW      0x08 // Tabellone finale di un pareggio
+#define PROTO_STATE_LAST_MOVE 0x10 // Variante m,n,k: aux è l'indice (riga * colonne + colonna) dell'ultima mossa,
+                                   // 0xFFFF se il tabellone è vuoto; il client ricostruisce il tabellone dalle mosse
+
+// Flag di PROTO_OP_LIST (richiesta)
+#define PROTO_LIST_WAITING 0x01 // Solo partite in attesa di un giocatore
+#define PROTO_LIST_SINCE   0x02 // arg è la versione già nota: si ricevono solo le modifiche successive
+
+// Flag di PROTO_OP_LIST_END
+#define PROTO_LIST_MORE  0x01 // Ci sono altre pagine dopo questa
+#define PROTO_LIST_DELTA 0x02 // Le voci sono modifiche da applicare alla lista nota, non una pagina completa
+#define PROTO_GAME_REMOVED 0xFF // Stato di una voce rimossa (o non più in attesa, con PROTO_LIST_WAITING) nelle modifiche
+
+// Sottocodice di PROTO_OP_REPLAYS
+#define PROTO_REPLAYS_PLAYER 0x01 // Replay del giocatore registrato della connessione invece che di una partita
+
+// Esito previsto di PROTO_OP_HINT_REPLY
+#define PROTO_HINT_OPEN 0 // Pareggio con il gioco perfetto (tris classico) o esito non ancora deciso
+#define PROTO_HINT_WIN  1 // Vittoria forzata
+#define PROTO_HINT_LOSS 2 // Sconfitta contro un gioco perfetto
+
+// Variante m,n,k impacchettata in 15 bit: righe (5 bit), colonne (5 bit), simboli in fila (5 bit)
+#define PROTO_VARIANT(rows, cols, k) ((uint16_t)(((rows) << 10) | ((cols) << 5) | (k)))
+#define PROTO_VARIANT_ROWS(v) (((v) >> 10) & 0x1F)
+#define PROTO_VARIANT_COLS(v) (((v) >> 5) & 0x1F)
+#define PROTO_VARIANT_K(v) ((v) & 0x1F)
+
+// Scrive il frame nei PROTO_FRAME_SIZE byte di out
+void proto_encode(const ProtoFrame *frame, uint8_t out[PROTO_FRAME_SIZE]);
+
+// Legge un frame dai PROTO_FRAME_SIZE byte di in
+void proto_decode(const uint8_t in[PROTO_FRAME_SIZE], ProtoFrame *frame);
+
+// Impacchetta il tabellone del tris classico in base 3 (cella riga*3+colonna = cifra di peso 3^(riga*3+colonna)): 9 celle in 16 bit
+uint16_t proto_pack_board(const TrisGame *game);
+
+// Ricostruisce il tabellone classico da un valore prodotto da proto_pack_board
+void proto_unpack_board(uint16_t packed, Cell board[SIZE][SIZE]);
+
+#endif // TRIS_PROTOCOL_H
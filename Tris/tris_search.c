@@ -0,0 +1,512 @@
+#define _GNU_SOURCE // clock_gettime e CLOCK_MONOTONIC non sono definiti in modalità C99 stretta
+#include "tris_search.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_WINDOWS (4 * MAX_CELLS)            // Finestre di k celle: una per direzione e cella di partenza
+#define MAX_CELL_WINDOWS (4 * MAX_BOARD_SIDE)  // Finestre che contengono una stessa cella
+#define MAX_NEIGHBOURS 24                      // Celle entro distanza 2 da una cella
+#define TIME_CHECK_NODES 1024                  // Nodi tra due letture dell'orologio (potenza di 2)
+#define SCORE_INFINITE (SEARCH_SCORE_WIN + 1)
+#define ORDER_TT_MOVE (1 << 30)                // Priorità della mossa suggerita dalla tabella delle trasposizioni
+#define ORDER_KILLER (1 << 28)                 // Priorità delle mosse killer (tagli allo stesso ply in rami fratelli)
+#define HISTORY_MAX (1 << 20)
+
+// Tipo di valore memorizzato nella tabella delle trasposizioni
+enum { TT_EXACT = 1, TT_LOWER, TT_UPPER };
+
+// Voce della tabella delle trasposizioni, senza lock: check = chiave ^ data.
+// Una voce scritta a metà da due thread non supera il controllo e viene ignorata.
+// data: valore (32 bit), profondità (8 bit), tipo (8 bit), mossa + 1 (16 bit).
+typedef struct {
+    uint64_t check;
+    uint64_t data;
+} TTEntry;
+
+static uint64_t zobrist[2][MAX_CELLS]; // Chiave di ogni simbolo in ogni cella
+static uint64_t zobrist_turn;          // Chiave del turno di O
+static TTEntry *tt;                    // Tabella condivisa da tutte le ricerche del processo
+static uint64_t tt_mask;
+
+// Dati di una ricerca in sola lettura per i thread, tranne il flag di arresto
+typedef struct {
+    int rows, cols, k, cells;
+    int max_depth;
+    bool has_deadline;
+    struct timespec deadline;
+    int stop;                                              // Diventa 1 allo scadere del tempo o alla fine del thread principale
+    int armed;                                             // Diventa 1 quando il thread principale ha una mossa (profondità 1)
+    uint64_t variant_key;                                  // Distingue le stesse celle su varianti diverse
+    int weight[MAX_BOARD_SIDE + 1];                        // Valore di una finestra con c simboli di un solo giocatore
+    uint16_t cell_windows[MAX_CELLS][MAX_CELL_WINDOWS];    // Finestre che contengono ogni cella
+    uint8_t cell_window_count[MAX_CELLS];
+    int16_t neighbours[MAX_CELLS][MAX_NEIGHBOURS];         // Celle vicine, candidate dopo una mossa
+    uint8_t neighbour_count[MAX_CELLS];
+} SearchContext;
+
+// Stato di un thread di ricerca: ha una propria copia del tabellone, aggiornata in modo incrementale
+typedef struct {
+    SearchContext *ctx;
+    int id;                                 // 0 = thread principale
+    pthread_t thread;
+    bool started;
+    uint8_t board[MAX_CELLS];               // 0 vuota, 1 X, 2 O
+    uint8_t counts[2][MAX_WINDOWS];         // Simboli di X e di O in ogni finestra
+    uint8_t near[MAX_CELLS];                // Simboli vicini a ogni cella
+    int turn;
+    int moves;
+    int eval;                               // Valutazione statica dal punto di vista di X
+    uint64_t hash;
+    int history[2][MAX_CELLS];              // Euristica della storia: celle che hanno prodotto tagli
+    int16_t killers[SEARCH_MAX_PLY][2];
+    uint32_t rng;                           // Rumore nell'ordinamento dei thread ausiliari
+    uint64_t nodes;
+    int root_cell, root_score;              // Mossa migliore dell'iterazione in corso
+    int best_cell, best_score, depth;       // Esito dell'ultima iterazione completata
+} SearchThread;
+
+// splitmix64: chiavi Zobrist riproducibili
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint32_t next_random(uint32_t *rng) {
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+    return x;
+}
+
+int search_init(int tt_bits) {
+    if (tt) {
+        return 0;
+    }
+    uint64_t seed = 0x7472697353454152ULL;
+    for (int p = 0; p < 2; ++p) {
+        for (int c = 0; c < MAX_CELLS; ++c) {
+            zobrist[p][c] = splitmix64(&seed);
+        }
+    }
+    zobrist_turn = splitmix64(&seed);
+
+    tt = calloc((size_t)1 << tt_bits, sizeof(TTEntry));
+    if (!tt) {
+        perror("calloc");
+        return -1;
+    }
+    tt_mask = ((uint64_t)1 << tt_bits) - 1;
+    return 0;
+}
+
+// --- Tabella delle trasposizioni ---
+
+// I valori di vittoria dipendono dalla distanza dalla radice: in tabella si salvano relativi al nodo.
+static int score_to_tt(int score, int ply) {
+    if (score > SEARCH_SCORE_DECIDED) return score + ply;
+    if (score < -SEARCH_SCORE_DECIDED) return score - ply;
+    return score;
+}
+
+static int score_from_tt(int score, int ply) {
+    if (score > SEARCH_SCORE_DECIDED) return score - ply;
+    if (score < -SEARCH_SCORE_DECIDED) return score + ply;
+    return score;
+}
+
+static bool tt_probe(uint64_t key, uint64_t *data) {
+    if (!tt) {
+        return false;
+    }
+    TTEntry *e = &tt[key & tt_mask];
+    uint64_t check = __atomic_load_n(&e->check, __ATOMIC_RELAXED);
+    *data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+    return (check ^ *data) == key;
+}
+
+// Sostituisce sempre, salvo una voce più profonda della stessa posizione.
+static void tt_store(uint64_t key, int depth, int flag, int score, int cell) {
+    if (!tt) {
+        return;
+    }
+    TTEntry *e = &tt[key & tt_mask];
+    uint64_t old;
+    if (tt_probe(key, &old) && (int)((old >> 32) & 0xFF) > depth) {
+        return;
+    }
+    uint64_t data = (uint64_t)(uint32_t)score | ((uint64_t)depth << 32) | ((uint64_t)flag << 40) | ((uint64_t)(cell + 1) << 48);
+    __atomic_store_n(&e->check, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->data, data, __ATOMIC_RELAXED);
+}
+
+// --- Tabellone incrementale ---
+
+// Una finestra con simboli di entrambi i giocatori non vale più nulla.
+static int window_value(const SearchContext *ctx, int cx, int co) {
+    if (cx && co) return 0;
+    return ctx->weight[cx] - ctx->weight[co];
+}
+
+// Aggiunge un simbolo del giocatore p: aggiorna finestre, valutazione e vicinato.
+// Restituisce true se una finestra diventa completa (k in fila).
+static bool place(SearchThread *t, int cell, int p) {
+    const SearchContext *ctx = t->ctx;
+    bool win = false;
+    for (int i = 0; i < ctx->cell_window_count[cell]; ++i) {
+        int w = ctx->cell_windows[cell][i];
+        t->eval -= window_value(ctx, t->counts[0][w], t->counts[1][w]);
+        if (++t->counts[p][w] == ctx->k) win = true;
+        t->eval += window_value(ctx, t->counts[0][w], t->counts[1][w]);
+    }
+    for (int i = 0; i < ctx->neighbour_count[cell]; ++i) {
+        t->near[ctx->neighbours[cell][i]]++;
+    }
+    t->board[cell] = (uint8_t)(p + 1);
+    return win;
+}
+
+static void unplace(SearchThread *t, int cell, int p) {
+    const SearchContext *ctx = t->ctx;
+    for (int i = 0; i < ctx->cell_window_count[cell]; ++i) {
+        int w = ctx->cell_windows[cell][i];
+        t->eval -= window_value(ctx, t->counts[0][w], t->counts[1][w]);
+        t->counts[p][w]--;
+        t->eval += window_value(ctx, t->counts[0][w], t->counts[1][w]);
+    }
+    for (int i = 0; i < ctx->neighbour_count[cell]; ++i) {
+        t->near[ctx->neighbours[cell][i]]--;
+    }
+    t->board[cell] = 0;
+}
+
+static bool play(SearchThread *t, int cell) {
+    bool win = place(t, cell, t->turn);
+    t->hash ^= zobrist[t->turn][cell] ^ zobrist_turn;
+    t->turn ^= 1;
+    t->moves++;
+    return win;
+}
+
+static void undo(SearchThread *t, int cell) {
+    t->turn ^= 1;
+    t->moves--;
+    t->hash ^= zobrist[t->turn][cell] ^ zobrist_turn;
+    unplace(t, cell, t->turn);
+}
+
+// --- Ricerca ---
+
+// Tutti i thread leggono l'orologio, ma solo dopo che il thread principale ha completato la profondità 1:
+// con più thread che core il principale può restare fermo proprio allo scadere del tempo.
+static void check_time(SearchThread *t) {
+    SearchContext *ctx = t->ctx;
+    if (!ctx->has_deadline || !__atomic_load_n(&ctx->armed, __ATOMIC_RELAXED)) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > ctx->deadline.tv_sec || (now.tv_sec == ctx->deadline.tv_sec && now.tv_nsec >= ctx->deadline.tv_nsec)) {
+        __atomic_store_n(&ctx->stop, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Priorità statica di una cella: finestre che completa per sé (attacco) e che chiude all'avversario (difesa).
+static int order_score(const SearchThread *t, int cell) {
+    const SearchContext *ctx = t->ctx;
+    int own = t->turn, opp = t->turn ^ 1;
+    int score = 0;
+    for (int i = 0; i < ctx->cell_window_count[cell]; ++i) {
+        int w = ctx->cell_windows[cell][i];
+        if (t->counts[opp][w] == 0) score += 2 * ctx->weight[t->counts[own][w] + 1];
+        if (t->counts[own][w] == 0) score += ctx->weight[t->counts[opp][w] + 1];
+    }
+    return score;
+}
+
+// Candidate: le celle libere vicine ad almeno un simbolo; se non ce ne sono, tutte le celle libere.
+static int generate_moves(SearchThread *t, int ply, int tt_cell, int *moves, int *scores) {
+    const SearchContext *ctx = t->ctx;
+    int n = 0;
+    for (int pass = 0; pass < 2 && n == 0; ++pass) {
+        for (int c = 0; c < ctx->cells; ++c) {
+            if (t->board[c] || (pass == 0 && !t->near[c])) continue;
+            int score;
+            if (c == tt_cell) {
+                score = ORDER_TT_MOVE;
+            } else if (ply < SEARCH_MAX_PLY && (c == t->killers[ply][0] || c == t->killers[ply][1])) {
+                score = ORDER_KILLER;
+            } else {
+                score = order_score(t, c) + t->history[t->turn][c];
+                if (t->id != 0) score += (int)(next_random(&t->rng) & 0xF); // Thread ausiliari: ordine leggermente diverso
+            }
+            moves[n] = c;
+            scores[n] = score;
+            n++;
+        }
+    }
+    return n;
+}
+
+// Negamax con potatura alpha-beta e finestra nulla (PVS) sulle mosse successive alla prima.
+static int negamax(SearchThread *t, int depth, int ply, int alpha, int beta) {
+    SearchContext *ctx = t->ctx;
+    if ((++t->nodes & (TIME_CHECK_NODES - 1)) == 0) {
+        check_time(t);
+    }
+    if (__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (t->moves == ctx->cells) {
+        return 0; // Pareggio
+    }
+    if (depth == 0 || ply >= SEARCH_MAX_PLY) {
+        return t->turn ? -t->eval : t->eval;
+    }
+
+    int alpha_orig = alpha;
+    int tt_cell = -1;
+    uint64_t data;
+    if (tt_probe(t->hash, &data)) {
+        tt_cell = (int)(data >> 48) - 1;
+        int tt_depth = (int)((data >> 32) & 0xFF);
+        int flag = (int)((data >> 40) & 0xFF);
+        int score = score_from_tt((int)(int32_t)(uint32_t)data, ply);
+        if (ply > 0 && tt_depth >= depth) { // Alla radice serve comunque la mossa
+            if (flag == TT_EXACT) return score;
+            if (flag == TT_LOWER && score > alpha) alpha = score;
+            if (flag == TT_UPPER && score < beta) beta = score;
+            if (alpha >= beta) return score;
+        }
+    }
+
+    int moves[MAX_CELLS], scores[MAX_CELLS];
+    int n = generate_moves(t, ply, tt_cell, moves, scores);
+    int best = -SCORE_INFINITE, best_cell = -1;
+    for (int i = 0; i < n; ++i) {
+        // Selezione della mossa con priorità maggiore fra le rimanenti: spesso basta la prima
+        int top = i;
+        for (int j = i + 1; j < n; ++j) {
+            if (scores[j] > scores[top]) top = j;
+        }
+        int cell = moves[top], tmp = scores[top];
+        moves[top] = moves[i];
+        scores[top] = scores[i];
+        moves[i] = cell;
+        scores[i] = tmp;
+
+        int score;
+        if (play(t, cell)) {
+            score = SEARCH_SCORE_WIN - (ply + 1);
+        } else if (i == 0) {
+            score = -negamax(t, depth - 1, ply + 1, -beta, -alpha);
+        } else {
+            score = -negamax(t, depth - 1, ply + 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta) {
+                score = -negamax(t, depth - 1, ply + 1, -beta, -alpha);
+            }
+        }
+        undo(t, cell);
+        if (__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+
+        if (score > best) {
+            best = score;
+            best_cell = cell;
+            if (ply == 0) {
+                t->root_cell = cell;
+                t->root_score = score;
+            }
+        }
+        if (score > alpha) alpha = score;
+        if (alpha >= beta) {
+            if (cell != t->killers[ply][0]) {
+                t->killers[ply][1] = t->killers[ply][0];
+                t->killers[ply][0] = (int16_t)cell;
+            }
+            if (t->history[t->turn][cell] < HISTORY_MAX) {
+                t->history[t->turn][cell] += depth * depth;
+            }
+            break;
+        }
+    }
+
+    int flag = best <= alpha_orig ? TT_UPPER : best >= beta ? TT_LOWER : TT_EXACT;
+    tt_store(t->hash, depth, flag, score_to_tt(best, ply), best_cell);
+    return best;
+}
+
+// Approfondimento iterativo: ogni iterazione riempie la tabella e migliora l'ordinamento della successiva.
+// I thread ausiliari partono a profondità alternate, così esplorano rami diversi nello stesso momento.
+static void iterative_deepening(SearchThread *t) {
+    SearchContext *ctx = t->ctx;
+    for (int depth = 1 + (t->id & 1); depth <= ctx->max_depth; ++depth) {
+        t->root_cell = -1;
+        int score = negamax(t, depth, 0, -SCORE_INFINITE, SCORE_INFINITE);
+        if (__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED) || t->root_cell < 0) {
+            break;
+        }
+        t->best_cell = t->root_cell;
+        t->best_score = score;
+        t->depth = depth;
+        if (t->id == 0) {
+            __atomic_store_n(&ctx->armed, 1, __ATOMIC_RELAXED);
+        }
+        if (score > SEARCH_SCORE_DECIDED || score < -SEARCH_SCORE_DECIDED) {
+            break; // Esito dimostrato: cercare più a fondo non lo cambia
+        }
+    }
+}
+
+static void *helper_main(void *arg) {
+    iterative_deepening(arg);
+    return NULL;
+}
+
+// Precalcola le finestre di k celle, i vicinati e i pesi della variante.
+static void build_context(SearchContext *ctx, const TrisGame *game, const SearchLimits *limits) {
+    static const int directions[4][2] = { {0, 1}, {1, 0}, {1, 1}, {1, -1} };
+    ctx->rows = game->rows;
+    ctx->cols = game->cols;
+    ctx->k = game->k;
+    ctx->cells = game->rows * game->cols;
+    ctx->stop = 0;
+    ctx->armed = 0;
+    ctx->variant_key = ((uint64_t)game->rows << 16 | (uint64_t)game->cols << 8 | game->k) * 0x9E3779B97F4A7C15ULL;
+
+    int remaining = ctx->cells - game->moves;
+    ctx->max_depth = (limits->max_depth > 0 && limits->max_depth < SEARCH_MAX_PLY) ? limits->max_depth : SEARCH_MAX_PLY;
+    if (ctx->max_depth > remaining) ctx->max_depth = remaining;
+
+    ctx->has_deadline = limits->time_budget_us > 0;
+    if (ctx->has_deadline) {
+        clock_gettime(CLOCK_MONOTONIC, &ctx->deadline);
+        long nsec = ctx->deadline.tv_nsec + (long)(limits->time_budget_us % 1000000) * 1000;
+        ctx->deadline.tv_sec += limits->time_budget_us / 1000000 + nsec / 1000000000;
+        ctx->deadline.tv_nsec = nsec % 1000000000;
+    }
+
+    // Peso secondo i simboli mancanti per completare la finestra: ogni simbolo in più lo quadruplica.
+    // Il massimo (2^16 per finestra) tiene la somma ben sotto SEARCH_SCORE_DECIDED.
+    ctx->weight[0] = 0;
+    for (int c = 1; c <= ctx->k; ++c) {
+        int missing = ctx->k - c < 8 ? ctx->k - c : 8;
+        ctx->weight[c] = 1 << (2 * (8 - missing));
+    }
+
+    memset(ctx->cell_window_count, 0, sizeof(ctx->cell_window_count));
+    for (int d = 0; d < 4; ++d) {
+        int dr = directions[d][0], dc = directions[d][1];
+        for (int r = 0; r < ctx->rows; ++r) {
+            for (int c = 0; c < ctx->cols; ++c) {
+                int er = r + (ctx->k - 1) * dr, ec = c + (ctx->k - 1) * dc;
+                if (er >= ctx->rows || ec < 0 || ec >= ctx->cols) continue;
+                uint16_t w = (uint16_t)(d * ctx->cells + r * ctx->cols + c);
+                for (int i = 0; i < ctx->k; ++i) {
+                    int cell = (r + i * dr) * ctx->cols + c + i * dc;
+                    ctx->cell_windows[cell][ctx->cell_window_count[cell]++] = w;
+                }
+            }
+        }
+    }
+
+    // Sui tabelloni piccoli si considerano le celle entro distanza 2, sugli altri solo quelle adiacenti
+    int radius = ctx->cells <= 49 ? 2 : 1;
+    for (int cell = 0; cell < ctx->cells; ++cell) {
+        int r = cell / ctx->cols, c = cell % ctx->cols, n = 0;
+        for (int dr = -radius; dr <= radius; ++dr) {
+            for (int dc = -radius; dc <= radius; ++dc) {
+                int nr = r + dr, nc = c + dc;
+                if ((dr || dc) && nr >= 0 && nr < ctx->rows && nc >= 0 && nc < ctx->cols) {
+                    ctx->neighbours[cell][n++] = (int16_t)(nr * ctx->cols + nc);
+                }
+            }
+        }
+        ctx->neighbour_count[cell] = (uint8_t)n;
+    }
+}
+
+// Copia la posizione della partita nello stato del thread.
+static void setup_thread(SearchThread *t, SearchContext *ctx, const TrisGame *game, int id) {
+    memset(t, 0, sizeof(*t));
+    t->ctx = ctx;
+    t->id = id;
+    t->rng = 0x9E3779B9u * (uint32_t)(id + 1);
+    t->turn = game->turn;
+    t->moves = game->moves;
+    t->hash = ctx->variant_key ^ (game->turn ? zobrist_turn : 0);
+    t->best_cell = -1;
+    for (int i = 0; i < SEARCH_MAX_PLY; ++i) {
+        t->killers[i][0] = t->killers[i][1] = -1;
+    }
+    for (int cell = 0; cell < ctx->cells; ++cell) {
+        Cell value = get_cell(game, cell / ctx->cols, cell % ctx->cols);
+        if (value != EMPTY) {
+            int p = value == X ? 0 : 1;
+            place(t, cell, p);
+            t->hash ^= zobrist[p][cell];
+        }
+    }
+}
+
+// Lazy SMP: tutti i thread cercano la stessa radice e condividono solo la tabella delle trasposizioni.
+// Il risultato è quello del thread principale, che trova la tabella già riempita dagli altri.
+int search_best_move(const TrisGame *game, const SearchLimits *limits, SearchResult *result) {
+    SearchResult local;
+    if (!result) result = &local;
+    memset(result, 0, sizeof(*result));
+    result->cell = -1;
+
+    int cells = game->rows * game->cols;
+    if (game->moves >= cells) {
+        return -1;
+    }
+    if (game->moves == 0) {
+        // Apertura: il centro è sempre tra le mosse migliori, non serve cercare
+        result->cell = (game->rows / 2) * game->cols + game->cols / 2;
+        return result->cell;
+    }
+
+    int threads = limits->threads < 1 ? 1 : limits->threads > SEARCH_MAX_THREADS ? SEARCH_MAX_THREADS : limits->threads;
+    SearchContext *ctx = malloc(sizeof(SearchContext));
+    SearchThread *workers = malloc((size_t)threads * sizeof(SearchThread));
+    if (!ctx || !workers) {
+        perror("malloc");
+        free(ctx);
+        free(workers);
+        return -1;
+    }
+    build_context(ctx, game, limits);
+    for (int i = 0; i < threads; ++i) {
+        setup_thread(&workers[i], ctx, game, i);
+    }
+
+    for (int i = 1; i < threads; ++i) {
+        workers[i].started = pthread_create(&workers[i].thread, NULL, helper_main, &workers[i]) == 0;
+    }
+    iterative_deepening(&workers[0]);
+    __atomic_store_n(&ctx->stop, 1, __ATOMIC_RELAXED);
+    for (int i = 1; i < threads; ++i) {
+        if (workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    result->cell = workers[0].best_cell;
+    result->score = workers[0].best_score;
+    result->depth = workers[0].depth;
+    for (int i = 0; i < threads; ++i) {
+        result->nodes += workers[i].nodes;
+    }
+    free(workers);
+    free(ctx);
+    return result->cell;
+}
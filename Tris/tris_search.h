@@ -0,0 +1,35 @@
+#ifndef TRIS_SEARCH_H
+#define TRIS_SEARCH_H
+
+#include <stdint.h>
+#include "tris_game.h"
+
+#define SEARCH_MAX_PLY 64                         // Profondità massima dell'approfondimento iterativo
+#define SEARCH_MAX_THREADS 16                     // Thread massimi di una ricerca parallela (lazy SMP)
+#define SEARCH_SCORE_WIN 1000000000               // Valore di una vittoria immediata (diminuisce con la distanza)
+#define SEARCH_SCORE_DECIDED (SEARCH_SCORE_WIN - SEARCH_MAX_PLY) // Oltre questa soglia la partita è decisa
+
+// Limiti di una ricerca
+typedef struct {
+    int time_budget_us;     // Tempo massimo per la mossa, in microsecondi (0 = nessun limite)
+    int max_depth;          // Profondità massima (0 = SEARCH_MAX_PLY)
+    int threads;            // Thread che cercano in parallelo condividendo la tabella delle trasposizioni (1 = solo il chiamante)
+} SearchLimits;
+
+// Esito di una ricerca
+typedef struct {
+    int cell;               // Mossa migliore come indice (riga * cols + colonna), -1 se non ci sono mosse
+    int score;              // Valutazione per il giocatore di turno (oltre SEARCH_SCORE_DECIDED: vittoria forzata)
+    int depth;              // Ultima profondità completata dal thread principale
+    uint64_t nodes;         // Nodi visitati da tutti i thread
+} SearchResult;
+
+// Genera le chiavi Zobrist e alloca la tabella delle trasposizioni (2^tt_bits voci), condivisa da tutti i thread del processo.
+// Va chiamata una volta prima di qualsiasi ricerca; restituisce 0 se riuscita, -1 altrimenti.
+int search_init(int tt_bits);
+
+// Cerca la mossa migliore per il giocatore di turno con alpha-beta ad approfondimento iterativo entro i limiti dati.
+// La partita non viene modificata. Restituisce la cella scelta (-1 se non ci sono mosse o la partita è già decisa).
+int search_best_move(const TrisGame *game, const SearchLimits *limits, SearchResult *result);
+
+#endif // TRIS_SEARCH_H
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE // syscall() e MAP_POPULATE non sono definiti in modalità C99 stretta
+#include "uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Parti dell'ABI più recenti degli header del kernel dell'immagine (Ubuntu 22.04, 5.15): i valori sono stabili
+#ifndef IORING_ACCEPT_MULTISHOT
+#define IORING_ACCEPT_MULTISHOT (1U << 0) // sqe->ioprio di IORING_OP_ACCEPT (5.19)
+#endif
+#ifndef IORING_RECV_MULTISHOT
+#define IORING_RECV_MULTISHOT (1U << 1)   // sqe->ioprio di IORING_OP_RECV (6.0)
+#endif
+#ifndef IORING_ASYNC_CANCEL_ALL
+#define IORING_ASYNC_CANCEL_ALL (1U << 0) // Annulla tutte le operazioni che corrispondono alla chiave (5.19)
+#endif
+#ifndef IORING_ASYNC_CANCEL_FD
+#define IORING_ASYNC_CANCEL_FD (1U << 1)  // La chiave è il fd invece di user_data (5.19)
+#endif
+#define URING_REGISTER_PBUF_RING 22   // IORING_REGISTER_PBUF_RING (5.19)
+#define URING_REGISTER_SYNC_CANCEL 24 // IORING_REGISTER_SYNC_CANCEL (6.0)
+#define URING_BUF_RING_TAIL 14        // Offset della coda nell'anello dei buffer (sovrapposta al campo resv della prima voce)
+
+// Voce dell'anello dei buffer forniti (struct io_uring_buf)
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t bid;
+    uint16_t resv;          // Nella prima voce è la coda dell'anello: non va mai scritto
+} UringBuf;
+
+// Registrazione dell'anello dei buffer (struct io_uring_buf_reg)
+typedef struct {
+    uint64_t ring_addr;
+    uint32_t ring_entries;
+    uint16_t bgid;
+    uint16_t flags;
+    uint64_t resv[3];
+} UringBufReg;
+
+// Annullamento sincrono (struct io_uring_sync_cancel_reg)
+typedef struct {
+    uint64_t addr;
+    int32_t fd;
+    uint32_t flags;
+    struct __kernel_timespec timeout; // {-1, -1} = attende quanto serve
+    uint64_t pad[4];
+} UringSyncCancel;
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * @brief Verifica sul kernel in uso le funzioni che il server richiede e che io_uring_setup non dichiara:
+ * una recv multishot su una coppia di socket deve consegnare il dato in un buffer fornito restando attiva,
+ * e l'annullamento sincrono per fd deve fermarla. La accept multishot è precedente alla recv multishot.
+ * @return true se l'anello è utilizzabile.
+ */
+static bool probe_features(Uring *ring) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+        ring->failure = "socketpair";
+        return false;
+    }
+    bool ok = false;
+    UringEvent event;
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    uring_prep_recv_multishot(sqe, sv[0], 1);
+    ring->failure = "recv multishot";
+    if (uring_submit(ring) == 0 && write(sv[1], "x", 1) == 1 && uring_wait(ring, 1, 1000) == 0 &&
+        uring_next_event(ring, &event) && event.user_data == 1 && event.res == 1 &&
+        (event.flags & IORING_CQE_F_BUFFER) && (event.flags & IORING_CQE_F_MORE) && uring_buffer(ring, event.flags)[0] == 'x') {
+        uring_recycle_buffer(ring, event.flags);
+        ring->failure = "annullamento sincrono";
+        ok = uring_cancel_fd(ring, sv[0]) == 0;
+    }
+    close(sv[0]);
+    close(sv[1]);
+    uring_harvest(ring);
+    while (uring_next_event(ring, &event)) {
+        uring_recycle_buffer(ring, event.flags); // Completion dell'annullamento (o della prova non riuscita)
+    }
+    if (ok) {
+        ring->failure = NULL;
+    }
+    return ok;
+}
+
+int uring_init(Uring *ring, unsigned sq_entries, unsigned buf_count, uint32_t buf_size) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = sq_entries * 4; // Le recv multishot producono più completion che submission
+    ring->fd = sys_setup(sq_entries, &params);
+    if (ring->fd < 0) {
+        ring->failure = "io_uring_setup";
+        return -1;
+    }
+    // Completion mai perse, SQE letti durante io_uring_enter (gli iovec possono essere riusati dopo), attesa con timeout
+    unsigned required = IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        ring->failure = "funzioni di io_uring_setup";
+        uring_destroy(ring);
+        return -1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_map_size > ring->sq_map_size) {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        ring->failure = "mmap della coda di submission";
+        uring_destroy(ring);
+        return -1;
+    }
+    if (single_mmap) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            ring->failure = "mmap della coda di completion";
+            uring_destroy(ring);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ring->failure = "mmap degli SQE";
+        uring_destroy(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_local_tail = *ring->sq_tail;
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < ring->sq_entries; i++) {
+        array[i] = i; // Indirezione fissa: il posto i della coda è sempre l'SQE i
+    }
+    char *cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->event_cap = params.cq_entries;
+    ring->events = malloc(ring->event_cap * sizeof(UringEvent));
+    ring->buf_count = buf_count;
+    ring->buf_size = buf_size;
+    ring->buf_ring_size = buf_count * sizeof(UringBuf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buffers = mmap(NULL, (size_t)buf_count * buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!ring->events || ring->buf_ring == MAP_FAILED || ring->buffers == MAP_FAILED) {
+        if (ring->buf_ring == MAP_FAILED) ring->buf_ring = NULL;
+        if (ring->buffers == MAP_FAILED) ring->buffers = NULL;
+        ring->failure = "memoria dei buffer";
+        uring_destroy(ring);
+        return -1;
+    }
+
+    UringBufReg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (sys_register(ring->fd, URING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        ring->failure = "anello dei buffer forniti";
+        uring_destroy(ring);
+        return -1;
+    }
+    for (unsigned i = 0; i < buf_count; i++) {
+        uring_recycle_buffer(ring, IORING_CQE_F_BUFFER | (i << IORING_CQE_BUFFER_SHIFT));
+    }
+
+    if (!probe_features(ring)) {
+        uring_destroy(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void uring_destroy(Uring *ring) {
+    if (ring->fd >= 0) {
+        close(ring->fd); // Chiude l'istanza: il kernel annulla le operazioni ancora in corso
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->buf_ring) {
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+    if (ring->buffers) {
+        munmap(ring->buffers, (size_t)ring->buf_count * ring->buf_size);
+    }
+    free(ring->events);
+    const char *failure = ring->failure;
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    ring->failure = failure;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    ring->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Pubblica al kernel gli SQE preparati.
+ * @return Il numero di SQE che il kernel non ha ancora letto.
+ */
+static unsigned publish_sqes(Uring *ring) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    return ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int uring_submit(Uring *ring) {
+    unsigned to_submit;
+    while ((to_submit = publish_sqes(ring)) > 0) {
+        int ret = sys_enter(ring->fd, to_submit, 0, 0, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            return -errno;
+        }
+        if (ret == 0) {
+            return -EAGAIN; // Il kernel non ha letto nulla: si riprova al prossimo invio
+        }
+    }
+    return 0;
+}
+
+unsigned uring_sq_pending(const Uring *ring) {
+    return ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int uring_wait(Uring *ring, unsigned wait_nr, int timeout_ms) {
+    unsigned to_submit = publish_sqes(ring);
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    // Una sola chiamata di sistema invia le scritture del giro precedente e attende gli eventi del successivo
+    int ret = sys_enter(ring->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    int err = ret < 0 ? errno : 0;
+    uring_harvest(ring);
+    // Scadenza del timeout, segnale, o coda di completion da svuotare prima di inviare altro: non sono errori
+    if (err == ETIME || err == EINTR || err == EBUSY || err == EAGAIN) {
+        return 0;
+    }
+    return -err;
+}
+
+void uring_harvest(Uring *ring) {
+    // Gli eventi già elaborati lasciano il posto a quelli nuovi
+    if (ring->event_pos > 0) {
+        memmove(ring->events, ring->events + ring->event_pos, (ring->event_count - ring->event_pos) * sizeof(UringEvent));
+        ring->event_count -= ring->event_pos;
+        ring->event_pos = 0;
+    }
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && ring->event_count < ring->event_cap) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        UringEvent *event = &ring->events[ring->event_count++];
+        event->user_data = cqe->user_data;
+        event->res = cqe->res;
+        event->flags = cqe->flags;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+bool uring_next_event(Uring *ring, UringEvent *event) {
+    while (ring->event_pos < ring->event_count) {
+        *event = ring->events[ring->event_pos++];
+        if (event->user_data != URING_EVENT_NONE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int uring_cancel_fd(Uring *ring, int fd) {
+    UringSyncCancel cancel;
+    memset(&cancel, 0, sizeof(cancel));
+    cancel.fd = fd;
+    cancel.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    cancel.timeout.tv_sec = -1;
+    cancel.timeout.tv_nsec = -1;
+    int ret;
+    do {
+        ret = sys_register(ring->fd, URING_REGISTER_SYNC_CANCEL, &cancel, 1);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 && errno != ENOENT) {
+        return -errno; // ENOENT: nessuna operazione in corso sul fd
+    }
+    return 0;
+}
+
+const char *uring_buffer(const Uring *ring, uint32_t cqe_flags) {
+    return ring->buffers + (size_t)(cqe_flags >> IORING_CQE_BUFFER_SHIFT) * ring->buf_size;
+}
+
+void uring_recycle_buffer(Uring *ring, uint32_t cqe_flags) {
+    if (!(cqe_flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+    uint16_t bid = (uint16_t)(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+    UringBuf *entry = (UringBuf *)ring->buf_ring + (ring->buf_tail & (ring->buf_count - 1));
+    entry->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)bid * ring->buf_size);
+    entry->len = ring->buf_size;
+    entry->bid = bid;
+    ring->buf_tail++;
+    __atomic_store_n((uint16_t *)((char *)ring->buf_ring + URING_BUF_RING_TAIL), ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = (uint32_t)flags;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT; // Senza indirizzo del client: una multishot non ha dove scriverlo
+    sqe->user_data = user_data;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT; // Il buffer lo sceglie il kernel dall'anello quando arrivano i dati
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t user_data) {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, uint32_t poll_mask, bool multishot, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,104 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Completion copiata dalla coda del kernel: viene elaborata dopo aver liberato il posto nell'anello
+typedef struct {
+    uint64_t user_data;     // Valore dell'SQE che l'ha prodotta (URING_EVENT_NONE = già consumata)
+    int32_t res;            // Risultato dell'operazione (byte, fd accettato o -errno)
+    uint32_t flags;         // IORING_CQE_F_*: buffer scelto dal kernel e operazione multishot ancora attiva
+} UringEvent;
+
+#define URING_EVENT_NONE 0  // user_data riservato: evento consumato (o SQE di cui non interessa la completion)
+
+// Anello io_uring di uno shard, usato da un solo thread: code di submission e completion mappate dal kernel,
+// anello di buffer forniti per le recv multishot e completion raccolte ma non ancora elaborate
+typedef struct {
+    int fd;                 // File descriptor dell'istanza io_uring (-1 se non inizializzata)
+    const char *failure;    // Passo che ha reso l'anello inutilizzabile, per il messaggio di ripiego su epoll
+
+    // Coda di submission
+    void *sq_map;
+    size_t sq_map_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned sq_local_tail; // Coda locale: gli SQE fino a qui sono preparati, quelli dopo *sq_tail non ancora pubblicati
+
+    // Coda di completion (nella stessa mappatura della submission se il kernel lo consente)
+    void *cq_map;
+    size_t cq_map_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Anello dei buffer forniti al kernel: ogni recv multishot ne riempie uno per completion
+    void *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;          // buf_count buffer contigui di buf_size byte
+    unsigned buf_count;     // Potenza di 2
+    uint32_t buf_size;
+    uint16_t buf_tail;      // Coda locale dell'anello, pubblicata al kernel a ogni buffer restituito
+
+    // Completion raccolte: elaborate in ordine da uring_next_event, consultabili per annullare quelle di un fd
+    UringEvent *events;
+    unsigned event_count;
+    unsigned event_pos;     // Prossimo evento da elaborare
+    unsigned event_cap;     // Pari alla dimensione della coda di completion
+} Uring;
+
+#define URING_BUFFER_GROUP 0 // Gruppo dei buffer forniti (uno solo per anello)
+
+// Crea l'anello con sq_entries posti di submission e buf_count buffer forniti di buf_size byte, poi verifica
+// sul kernel in uso le funzioni richieste (recv multishot con buffer forniti, annullamento sincrono).
+// Restituisce 0 se riuscito; -1 altrimenti, con failure impostato e nessuna risorsa rimasta allocata.
+int uring_init(Uring *ring, unsigned sq_entries, unsigned buf_count, uint32_t buf_size);
+
+// Libera l'anello e i buffer
+void uring_destroy(Uring *ring);
+
+// Posto libero per un SQE, azzerato; NULL se la coda è piena (il chiamante invia con uring_submit e riprova)
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+// Passa al kernel gli SQE preparati senza attendere. Restituisce 0 se il kernel li ha letti tutti, -errno altrimenti.
+int uring_submit(Uring *ring);
+
+// SQE preparati che il kernel non ha ancora letto: a 0 la memoria a cui puntano (es. gli iovec) può essere riusata
+unsigned uring_sq_pending(const Uring *ring);
+
+// Passa al kernel gli SQE preparati e attende almeno wait_nr completion (in tutto, comprese quelle già
+// disponibili) o lo scadere di timeout_ms (-1 = nessun limite), poi le raccoglie. Restituisce 0 o -errno.
+int uring_wait(Uring *ring, unsigned wait_nr, int timeout_ms);
+
+// Copia in coda agli eventi raccolti le completion disponibili, liberando i loro posti nell'anello
+void uring_harvest(Uring *ring);
+
+// Prossimo evento raccolto e non consumato: false se non ce ne sono altri
+bool uring_next_event(Uring *ring, UringEvent *event);
+
+// Annulla in modo sincrono tutte le operazioni in corso su fd: al ritorno il kernel non usa più il fd né la
+// memoria delle sue operazioni, e le loro ultime completion sono nella coda (vanno raccolte con uring_harvest).
+// Restituisce 0 o -errno.
+int uring_cancel_fd(Uring *ring, int fd);
+
+// Dati del buffer fornito indicato da una completion con IORING_CQE_F_BUFFER
+const char *uring_buffer(const Uring *ring, uint32_t cqe_flags);
+
+// Restituisce al kernel il buffer indicato da una completion, se ne ha uno
+void uring_recycle_buffer(Uring *ring, uint32_t cqe_flags);
+
+// Preparazione degli SQE usati dal server
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags, uint64_t user_data);
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+void uring_prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t user_data);
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, uint32_t poll_mask, bool multishot, uint64_t user_data);
+
+#endif // URING_H